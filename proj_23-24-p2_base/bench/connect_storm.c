@@ -0,0 +1,184 @@
+// Registration benchmark of the server: launches many clients at once, each with an empty .jobs file, against the
+// server with session threads and with two event loops, and times until every client connected and quit. The time
+// includes starting the client processes. Clients still running at the deadline lost their session. Run from the
+// directory server/ems and client/client are built in.
+// Usage: bench/connect_storm [clients] [deadline_s]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/constants.h"
+
+static char server_path[64];
+static char jobs_path[64];
+static volatile sig_atomic_t deadline_passed;
+
+static void on_deadline(int signal) {
+  (void)signal;
+  deadline_passed = 1;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// Gets the path of a request or response pipe of a client.
+static void pipe_path(char *path, size_t size, const char *kind, size_t client) {
+  snprintf(path, size, "/tmp/ems-storm-%d-%s-%zu", getpid(), kind, client);
+}
+
+/// Starts the server and waits for its pipe to appear, dropping what it prints.
+/// @param loops Event loops given to -e, NULL for session threads.
+/// @return Pid of the server, -1 on failure.
+static pid_t start_server(const char *loops) {
+  unlink(server_path);
+  pid_t pid = fork();
+  if (pid == -1) return -1;
+
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd != -1) dup2(null_fd, STDOUT_FILENO);
+    if (loops != NULL) {
+      execl("server/ems", "ems", "-e", loops, server_path, "0", (char *)NULL);
+    } else {
+      execl("server/ems", "ems", server_path, "0", (char *)NULL);
+    }
+    perror("Error starting server/ems");
+    _exit(1);
+  }
+
+  struct timespec pause = {0, 10 * 1000 * 1000};
+  for (int i = 0; i < 500; i++) {
+    if (access(server_path, F_OK) == 0) return pid;
+    nanosleep(&pause, NULL);
+  }
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  return -1;
+}
+
+/// Launches the clients against a fresh server and waits for them, printing how many connected and how fast.
+/// @param clients Buffer for the pid of each client.
+/// @return 0 if every client connected, 1 otherwise.
+static int run(const char *loops, pid_t *clients, size_t num_clients, unsigned int deadline_s) {
+  pid_t server = start_server(loops);
+  if (server == -1) {
+    fprintf(stderr, "Failed to start the server\n");
+    return 1;
+  }
+
+  deadline_passed = 0;
+  alarm(deadline_s);
+  double start = now();
+
+  size_t launched = 0;
+  for (; launched < num_clients && !deadline_passed; launched++) {
+    char req_path[64], resp_path[64];
+    pipe_path(req_path, sizeof(req_path), "req", launched);
+    pipe_path(resp_path, sizeof(resp_path), "resp", launched);
+
+    clients[launched] = fork();
+    if (clients[launched] == -1) {
+      perror("Error launching a client");
+      break;
+    }
+    if (clients[launched] == 0) {
+      int null_fd = open("/dev/null", O_WRONLY);
+      if (null_fd != -1) {
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+      }
+      execl("client/client", "client", req_path, resp_path, server_path, jobs_path, (char *)NULL);
+      _exit(1);
+    }
+  }
+
+  // Clients are reaped as they finish, those left at the deadline are killed
+  size_t connected = 0, running = launched;
+  double end = start;
+  while (running > 0) {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid == -1 && errno == EINTR && deadline_passed) {
+      for (size_t i = 0; i < launched; i++) {
+        if (clients[i] != 0) kill(clients[i], SIGKILL);
+      }
+      continue;
+    }
+    if (pid == -1) break;
+
+    for (size_t i = 0; i < launched; i++) {
+      if (clients[i] != pid) continue;
+      clients[i] = 0;
+      running--;
+      if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        connected++;
+        end = now();
+      }
+      break;
+    }
+  }
+  alarm(0);
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  unlink(server_path);
+  for (size_t i = 0; i < launched; i++) {
+    char path[64];
+    pipe_path(path, sizeof(path), "req", i);
+    unlink(path);
+    pipe_path(path, sizeof(path), "resp", i);
+    unlink(path);
+  }
+
+  double elapsed = end - start;
+  printf("  %-15s %2d  %zu/%zu connected in %.2f s, %.0f sessions/s\n",
+         loops != NULL ? "event loops" : "session threads", loops != NULL ? atoi(loops) : MAX_SESSION_COUNT, connected,
+         num_clients, elapsed, elapsed > 0 ? (double)connected / elapsed : 0.0);
+  fflush(stdout);
+  return connected != num_clients;
+}
+
+int main(int argc, char *argv[]) {
+  size_t num_clients = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+  unsigned long deadline_s = argc > 2 ? strtoul(argv[2], NULL, 10) : 120;
+  if (num_clients == 0 || num_clients > 100000 || deadline_s == 0 || deadline_s > 3600) {
+    fprintf(stderr, "Usage: %s [clients] [deadline_s]\n", argv[0]);
+    return 1;
+  }
+
+  snprintf(server_path, sizeof(server_path), "/tmp/ems-storm-%d", getpid());
+  snprintf(jobs_path, sizeof(jobs_path), "/tmp/ems-storm-%d.jobs", getpid());
+  int jobs_fd = open(jobs_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  pid_t *clients = malloc(num_clients * sizeof(pid_t));
+  if (jobs_fd == -1 || clients == NULL) {
+    fprintf(stderr, "Failed to set up the clients\n");
+    return 1;
+  }
+  close(jobs_fd);
+
+  struct sigaction action = {.sa_handler = on_deadline};
+  sigaction(SIGALRM, &action, NULL);
+
+  printf("%zu clients with an empty .jobs file launched at once, %ld cores online\n", num_clients,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  fflush(stdout);
+
+  int failed = run(NULL, clients, num_clients, (unsigned int)deadline_s);
+  failed |= run("2", clients, num_clients, (unsigned int)deadline_s);
+
+  unlink(jobs_path);
+  char out_path[64];
+  snprintf(out_path, sizeof(out_path), "/tmp/ems-storm-%d.out", getpid());
+  unlink(out_path);
+  free(clients);
+  return failed;
+}
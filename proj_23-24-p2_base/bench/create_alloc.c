@@ -0,0 +1,99 @@
+// Allocation benchmark of event creation: counts the heap allocations the EMS state makes, and the growth of the
+// resident set, while creating many small events, deleting them all and creating them again. The allocation
+// functions are wrapped at link time, so only the calls of the EMS sources are counted, not those of libc.
+// Usage: bench/create_alloc [events] [rows] [cols]
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server/operations.h"
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+static atomic_size_t num_allocations;
+
+void* __wrap_malloc(size_t size) {
+  atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
+  return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+  atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
+  return __real_realloc(pointer, size);
+}
+
+/// Gets the resident set of the process in KiB, 0 if it cannot be read.
+static size_t resident_kib(void) {
+  FILE* file = fopen("/proc/self/statm", "r");
+  size_t size, resident = 0;
+  if (file != NULL) {
+    if (fscanf(file, "%zu %zu", &size, &resident) != 2) resident = 0;
+    fclose(file);
+  }
+  return resident * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// Runs one phase and prints the allocations it made, the growth of the resident set and its time.
+/// @param name Name of the phase.
+/// @param create Whether the phase creates the events, otherwise it deletes them.
+/// @return 0 if every operation succeeded, 1 otherwise.
+static int run_phase(const char* name, int create, unsigned int num_events, size_t rows, size_t cols) {
+  size_t allocations = atomic_load(&num_allocations);
+  size_t resident = resident_kib();
+  double start = now();
+
+  for (unsigned int event_id = 1; event_id <= num_events; event_id++) {
+    if ((create ? ems_create(event_id, rows, cols) : ems_delete(event_id)) != 0) return 1;
+  }
+
+  double elapsed = now() - start;
+  allocations = atomic_load(&num_allocations) - allocations;
+  printf("  %-10s %8zu allocations (%.3f per event)  %+7ld KiB resident  %6.1f ns per event\n", name, allocations,
+         (double)allocations / num_events, (long)resident_kib() - (long)resident, elapsed / num_events * 1e9);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  unsigned long num_events = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+  size_t rows = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+  size_t cols = argc > 3 ? strtoul(argv[3], NULL, 10) : 10;
+  if (num_events == 0 || num_events > 0xffffffffu || rows == 0 || cols == 0) {
+    fprintf(stderr, "Usage: %s [events] [rows] [cols]\n", argv[0]);
+    return 1;
+  }
+
+  // The access delay still calls nanosleep, so the timer slack is cut to keep it from sleeping 50us per lookup
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+  struct EmsConfig config = {.delay_us = 0, .reserve_mode = RESERVE_MODE_MUTEX};
+  if (ems_init(&config) != 0) {
+    fprintf(stderr, "Failed to initialize EMS\n");
+    return 1;
+  }
+
+  printf("%lu events of %zux%zu, no access delay\n", num_events, rows, cols);
+  int failed = run_phase("create", 1, (unsigned int)num_events, rows, cols) ||
+               run_phase("delete", 0, (unsigned int)num_events, rows, cols) ||
+               run_phase("re-create", 1, (unsigned int)num_events, rows, cols);
+
+  if (failed) fprintf(stderr, "Benchmark failed\n");
+  ems_terminate();
+  return failed;
+}
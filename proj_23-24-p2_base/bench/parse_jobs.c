@@ -0,0 +1,158 @@
+// Benchmark of the .jobs parser: writes a synthetic job file of CREATE, RESERVE and SHOW commands and comments,
+// then parses it from its mapping and through a pipe, reporting MB/s. A file written to a path given on the command
+// line is kept, so it can be fed to the client as well.
+// Usage: bench/parse_jobs [commands] [path]
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client/parser.h"
+#include "common/constants.h"
+
+/// Writes a synthetic job file, with a fifth of CREATEs, two fifths of RESERVEs of two seats, a fifth of SHOWs and a
+/// fifth of comments.
+/// @return 0 if the file was written successfully, 1 otherwise.
+static int generate(const char *path, size_t num_commands) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    perror("Error creating the job file");
+    return 1;
+  }
+
+  unsigned int seed = 1;
+  for (size_t i = 0; i < num_commands; i++) {
+    unsigned int event_id = (unsigned int)rand_r(&seed) % 1000 + 1;
+
+    switch (rand_r(&seed) % 5) {
+      case 0:
+        fprintf(file, "CREATE %u %d %d\n", event_id, rand_r(&seed) % 100 + 1, rand_r(&seed) % 100 + 1);
+        break;
+      case 1:
+      case 2:
+        fprintf(file, "RESERVE %u [(%d,%d) (%d,%d)]\n", event_id, rand_r(&seed) % 100 + 1, rand_r(&seed) % 100 + 1,
+                rand_r(&seed) % 100 + 1, rand_r(&seed) % 100 + 1);
+        break;
+      case 3:
+        fprintf(file, "SHOW %u\n", event_id);
+        break;
+      default:
+        fprintf(file, "# comment %zu\n", i);
+        break;
+    }
+  }
+
+  return fclose(file) != 0;
+}
+
+/// Parses every command of a job file.
+/// @param fd File descriptor to parse, a regular file is mapped and anything else is read into a buffer.
+/// @return Number of commands parsed, 0 if the file could not be set up.
+static size_t parse(int fd) {
+  struct JobsFile jobs;
+  if (jobs_open(&jobs, fd) != 0) return 0;
+
+  size_t num_commands = 0;
+  unsigned int event_id;
+  size_t num_rows, num_cols, xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+
+  for (enum Command command = get_next(&jobs); command != EOC; command = get_next(&jobs)) {
+    // The generator only writes these commands and comments
+    if (command == CMD_CREATE) {
+      parse_create(&jobs, &event_id, &num_rows, &num_cols);
+    } else if (command == CMD_RESERVE) {
+      parse_reserve(&jobs, MAX_RESERVATION_SIZE, &event_id, xs, ys);
+    } else if (command == CMD_SHOW) {
+      parse_show(&jobs, &event_id);
+    }
+    num_commands++;
+  }
+
+  jobs_close(&jobs);
+  return num_commands;
+}
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+/// Parses a job file and prints the throughput.
+/// @param through_pipe Whether the file is fed through a pipe instead of mapped.
+/// @return 0 if the file was parsed successfully, 1 otherwise.
+static int measure(const char *path, off_t size, int through_pipe) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    perror("Error opening the job file");
+    return 1;
+  }
+
+  // A child copies the file into the pipe, which costs the parser the reads a pipe or terminal would
+  pid_t pid = -1;
+  if (through_pipe) {
+    int fds[2];
+    fflush(stdout);
+    if (pipe(fds) == -1 || (pid = fork()) == -1) {
+      perror("Error starting the pipe");
+      return 1;
+    }
+
+    if (pid == 0) {
+      close(fds[0]);
+      char buffer[JOBS_BUFFER_SIZE];
+      ssize_t bytes_read;
+      while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (write(fds[1], buffer, (size_t)bytes_read) != bytes_read) _exit(1);
+      }
+      _exit(bytes_read != 0);
+    }
+
+    close(fds[1]);
+    close(fd);
+    fd = fds[0];
+  }
+
+  double start = now();
+  size_t num_commands = parse(fd);
+  double seconds = now() - start;
+  close(fd);
+  if (pid != -1) waitpid(pid, NULL, 0);
+
+  if (num_commands == 0) {
+    fprintf(stderr, "Error parsing the job file\n");
+    return 1;
+  }
+
+  printf("  %-8s %zu commands in %.3f s, %.1f MB/s\n", through_pipe ? "pipe" : "mapping", num_commands, seconds,
+         (double)size / seconds / 1e6);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  size_t num_commands = argc > 1 ? strtoul(argv[1], NULL, 10) : 1200000;
+  const char *path = argc > 2 ? argv[2] : "/tmp/ems-bench.jobs";
+
+  if (num_commands == 0) {
+    fprintf(stderr, "Usage: %s [commands] [path]\n", argv[0]);
+    return 1;
+  }
+
+  if (generate(path, num_commands) != 0) return 1;
+
+  int fd = open(path, O_RDONLY);
+  off_t size = fd == -1 ? -1 : lseek(fd, 0, SEEK_END);
+  if (fd != -1) close(fd);
+  if (size <= 0) {
+    fprintf(stderr, "Error reading the size of the job file\n");
+    return 1;
+  }
+
+  printf("%s: %.1f MB, %zu commands\n", path, (double)size / 1e6, num_commands);
+  int failed = measure(path, size, 0) || measure(path, size, 1);
+  if (argc <= 2) unlink(path);
+  return failed;
+}
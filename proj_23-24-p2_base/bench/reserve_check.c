@@ -0,0 +1,140 @@
+// Microbenchmark of the conflict check of a reservation: the grid scan ems_reserve used to make under the event
+// mutex against the occupancy bitmap it claims seats in now, and the whole ems_reserve and ems_cancel round trip.
+// Usage: bench/reserve_check [rows] [cols] [seats]
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <time.h>
+
+#include "server/operations.h"
+
+#define SCAN_ITERATIONS 50        // Requests checked with the grid scan, which takes milliseconds each
+#define BITMAP_ITERATIONS 200000  // Requests checked with the bitmap
+#define EMS_ITERATIONS 20000      // Reservations made and cancelled through ems_reserve and ems_cancel
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+/// Checks a request the way ems_reserve did before the bitmap, scanning every seat of the event for the requested
+/// ones under the event mutex.
+/// @return 1 if a requested seat is taken, 0 otherwise.
+static int check_scan(pthread_mutex_t* mutex, const unsigned int* data, size_t rows, size_t cols, size_t num_seats,
+                      const size_t* xs, const size_t* ys) {
+  int taken = 0;
+  pthread_mutex_lock(mutex);
+
+  for (size_t i = 0; i < rows * cols && !taken; i++) {
+    for (size_t j = 0; j < num_seats; j++) {
+      if ((xs[j] - 1) * cols + ys[j] - 1 != i) continue;
+      taken = data[i] != 0;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(mutex);
+  return taken;
+}
+
+/// Checks a request the way ems_reserve does now, claiming each seat in the bitmap and releasing the claims again.
+/// @return 1 if a requested seat is taken, 0 otherwise.
+static int check_bitmap(pthread_mutex_t* mutex, uint64_t* bitmap, size_t cols, size_t num_seats, const size_t* xs,
+                        const size_t* ys) {
+  size_t claimed = 0;
+  pthread_mutex_lock(mutex);
+
+  for (; claimed < num_seats; claimed++) {
+    size_t index = (xs[claimed] - 1) * cols + ys[claimed] - 1;
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    if (bitmap[index / 64] & bit) break;
+    bitmap[index / 64] |= bit;
+  }
+
+  int taken = claimed < num_seats;
+  while (claimed-- > 0) {
+    size_t index = (xs[claimed] - 1) * cols + ys[claimed] - 1;
+    bitmap[index / 64] &= ~((uint64_t)1 << (index % 64));
+  }
+
+  pthread_mutex_unlock(mutex);
+  return taken;
+}
+
+int main(int argc, char* argv[]) {
+  size_t rows = argc > 1 ? strtoul(argv[1], NULL, 10) : 317;
+  size_t cols = argc > 2 ? strtoul(argv[2], NULL, 10) : 317;
+  size_t num_seats = argc > 3 ? strtoul(argv[3], NULL, 10) : 256;
+  if (rows == 0 || cols == 0 || num_seats == 0 || num_seats > rows * cols) {
+    fprintf(stderr, "Usage: %s [rows] [cols] [seats], with at most rows * cols seats\n", argv[0]);
+    return 1;
+  }
+
+  // Distinct seats, so every request passes its check and pays for all of it
+  size_t* xs = malloc(num_seats * sizeof(size_t));
+  size_t* ys = malloc(num_seats * sizeof(size_t));
+  size_t* order = malloc(rows * cols * sizeof(size_t));
+  unsigned int* data = calloc(rows * cols, sizeof(unsigned int));
+  uint64_t* bitmap = calloc((rows * cols + 63) / 64, sizeof(uint64_t));
+  if (xs == NULL || ys == NULL || order == NULL || data == NULL || bitmap == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    return 1;
+  }
+
+  unsigned int seed = 1;
+  for (size_t i = 0; i < rows * cols; i++) order[i] = i;
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t j = i + (size_t)rand_r(&seed) % (rows * cols - i);
+    size_t seat = order[j];
+    order[j] = order[i];
+    xs[i] = seat / cols + 1;
+    ys[i] = seat % cols + 1;
+  }
+
+  pthread_mutex_t mutex;
+  pthread_mutex_init(&mutex, NULL);
+  volatile int taken = 0;
+
+  double start = now();
+  for (int i = 0; i < SCAN_ITERATIONS; i++) taken |= check_scan(&mutex, data, rows, cols, num_seats, xs, ys);
+  double scan = (now() - start) / SCAN_ITERATIONS;
+
+  start = now();
+  for (int i = 0; i < BITMAP_ITERATIONS; i++) taken |= check_bitmap(&mutex, bitmap, cols, num_seats, xs, ys);
+  double check = (now() - start) / BITMAP_ITERATIONS;
+
+  printf("%zux%zu venue, %zu seats per request\n", rows, cols, num_seats);
+  printf("  grid scan       %10.3f us per request\n", scan * 1e6);
+  printf("  bitmap          %10.3f us per request (%.0fx)\n", check * 1e6, scan / check);
+
+  // The same request reserved and cancelled again through the EMS state, without the access delay. Its nanosleep
+  // still runs, so the timer slack is cut to keep it from sleeping 50us per call
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+  struct EmsConfig config = {.delay_us = 0, .reserve_mode = RESERVE_MODE_MUTEX};
+  if (ems_init(&config) != 0 || ems_create(1, rows, cols) != 0) {
+    fprintf(stderr, "Failed to initialize EMS\n");
+    return 1;
+  }
+
+  start = now();
+  for (unsigned int i = 1; i <= EMS_ITERATIONS; i++) {
+    if (ems_reserve(1, num_seats, xs, ys) != 0 || ems_cancel(1, i) != 0) {
+      fprintf(stderr, "Reservation %u failed\n", i);
+      return 1;
+    }
+  }
+  printf("  ems_reserve     %10.3f us per request, with its ems_cancel\n", (now() - start) / EMS_ITERATIONS * 1e6);
+
+  ems_terminate();
+  pthread_mutex_destroy(&mutex);
+  free(xs);
+  free(ys);
+  free(order);
+  free(data);
+  free(bitmap);
+  return taken;
+}
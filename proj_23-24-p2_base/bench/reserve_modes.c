@@ -0,0 +1,110 @@
+// Throughput benchmark of the reserve modes: session threads making 4-seat reservations in one large event, straight
+// in the EMS state, with the event mutex and with atomic claims on the occupancy bitmap. Each mode runs in its own
+// process, without the access delay. On a single core it only measures the cost of each path, not contention.
+// Usage: bench/reserve_modes [sessions] [reservations per session]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server/operations.h"
+
+#define BENCH_ROWS 1000  // Rows of the event
+#define BENCH_COLS 1000  // Columns of the event, a multiple of BENCH_SEATS so no reservation spans two rows
+#define BENCH_SEATS 4    // Seats of each reservation
+#define MAX_BENCH_SESSIONS 64
+
+static size_t num_sessions;
+static size_t num_reservations;
+
+/// Makes the reservations of a session. Sessions interleave over the seats of the event and never pick the same
+/// ones, so no reservation fails.
+static void* session_function(void* arg) {
+  size_t session = (size_t)arg;
+
+  for (size_t i = 0; i < num_reservations; i++) {
+    size_t first = (i * num_sessions + session) * BENCH_SEATS;
+    size_t xs[BENCH_SEATS], ys[BENCH_SEATS];
+    for (size_t j = 0; j < BENCH_SEATS; j++) {
+      xs[j] = (first + j) / BENCH_COLS + 1;
+      ys[j] = (first + j) % BENCH_COLS + 1;
+    }
+
+    if (ems_reserve(1, BENCH_SEATS, xs, ys) != 0) {
+      fprintf(stderr, "Reservation from seat (%zu,%zu) failed\n", xs[0], ys[0]);
+      exit(1);
+    }
+  }
+
+  return NULL;
+}
+
+/// Runs one mode and prints its throughput.
+/// @return 0 if the mode ran successfully, 1 otherwise.
+static int run(enum ReserveMode mode) {
+  struct EmsConfig config = {.delay_us = 0, .reserve_mode = mode};
+  if (ems_init(&config) != 0 || ems_create(1, BENCH_ROWS, BENCH_COLS) != 0) {
+    fprintf(stderr, "Failed to initialize EMS\n");
+    return 1;
+  }
+
+  struct timespec start, end;
+  pthread_t threads[MAX_BENCH_SESSIONS];
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t i = 0; i < num_sessions; i++) {
+    if (pthread_create(&threads[i], NULL, session_function, (void*)i) != 0) {
+      fprintf(stderr, "Error creating session thread\n");
+      return 1;
+    }
+  }
+  for (size_t i = 0; i < num_sessions; i++) pthread_join(threads[i], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+  printf("  %-6s %10.3f Mops/s\n", mode == RESERVE_MODE_MUTEX ? "mutex" : "cas",
+         (double)(num_sessions * num_reservations) / seconds / 1e6);
+  fflush(stdout);
+
+  ems_terminate();
+  return 0;
+}
+
+/// Runs a mode in a child process, so each one starts from a fresh EMS state.
+/// @return 0 if the mode ran successfully, 1 otherwise.
+static int run_isolated(enum ReserveMode mode) {
+  pid_t pid = fork();
+  if (pid == -1) return 1;
+  if (pid == 0) exit(run(mode));
+
+  int status;
+  return waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int main(int argc, char* argv[]) {
+  num_sessions = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+  num_reservations = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+
+  if (num_sessions == 0 || num_sessions > MAX_BENCH_SESSIONS ||
+      num_sessions * num_reservations > (size_t)BENCH_ROWS * BENCH_COLS / BENCH_SEATS) {
+    fprintf(stderr, "Usage: %s [sessions] [reservations per session]\n", argv[0]);
+    fprintf(stderr, "With 1 to %d sessions and at most %d reservations in all\n", MAX_BENCH_SESSIONS,
+            BENCH_ROWS * BENCH_COLS / BENCH_SEATS);
+    return 1;
+  }
+
+  // The access delay still calls nanosleep, so the timer slack inherited by every thread is cut to keep it from
+  // sleeping 50us per request
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+  printf("%zu sessions, %zu reservations of %d seats each, one event of %dx%d, %ld cores online\n", num_sessions,
+         num_reservations, BENCH_SEATS, BENCH_ROWS, BENCH_COLS, sysconf(_SC_NPROCESSORS_ONLN));
+  fflush(stdout);
+
+  return run_isolated(RESERVE_MODE_MUTEX) || run_isolated(RESERVE_MODE_CAS);
+}
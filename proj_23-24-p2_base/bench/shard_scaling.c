@@ -0,0 +1,135 @@
+// Scaling benchmark of the execution modes: session threads reserving seats straight in the EMS state, with the
+// event mutex or atomic claims, against the same sessions handing their reservations to 1, 2, 4, ... shards.
+// Each configuration runs in its own process, without the access delay. Run it on a machine with at least as many
+// cores as the largest shard count for the scaling curve, on fewer cores it only measures the handoff cost.
+// Usage: bench/shard_scaling [sessions] [reservations per session] [max shards]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server/operations.h"
+#include "server/shard.h"
+
+#define BENCH_EVENTS 128  // Events the reservations are spread over
+#define BENCH_ROWS 256    // Rows of each event
+#define BENCH_COLS 256    // Columns of each event
+#define MAX_BENCH_SESSIONS 64
+
+static size_t num_sessions;
+static size_t num_reservations;
+static int sharded;
+
+/// Makes the reservations of a session, one seat each. Sessions interleave over the events and never pick the same
+/// seat, so no reservation fails.
+static void* session_function(void* arg) {
+  size_t session = (size_t)arg;
+
+  for (size_t i = 0; i < num_reservations; i++) {
+    size_t k = i * num_sessions + session;
+    unsigned int event_id = (unsigned int)(k % BENCH_EVENTS) + 1;
+    size_t seat = k / BENCH_EVENTS;
+    size_t x = seat / BENCH_COLS + 1;
+    size_t y = seat % BENCH_COLS + 1;
+
+    int result = sharded ? shard_reserve(session, event_id, 1, &x, &y) : ems_reserve(event_id, 1, &x, &y);
+    if (result != 0) {
+      fprintf(stderr, "Reservation of seat (%zu,%zu) in event %u failed\n", x, y, event_id);
+      exit(1);
+    }
+  }
+
+  return NULL;
+}
+
+/// Runs one configuration and prints its throughput.
+/// @param mode Reserve mode, RESERVE_MODE_OWNER to go through the shards.
+/// @param num_shards Number of shards, only used with RESERVE_MODE_OWNER.
+/// @return 0 if the configuration ran successfully, 1 otherwise.
+static int run(enum ReserveMode mode, size_t num_shards) {
+  struct EmsConfig config = {.delay_us = 0, .reserve_mode = mode};
+  sharded = mode == RESERVE_MODE_OWNER;
+
+  if (ems_init(&config) != 0) {
+    fprintf(stderr, "Failed to initialize EMS\n");
+    return 1;
+  }
+  if (shard_init(sharded ? num_shards : 0, num_sessions) != 0) {
+    fprintf(stderr, "Failed to start the shards\n");
+    return 1;
+  }
+
+  for (unsigned int event_id = 1; event_id <= BENCH_EVENTS; event_id++) {
+    int result = sharded ? shard_create(0, event_id, BENCH_ROWS, BENCH_COLS)
+                         : ems_create(event_id, BENCH_ROWS, BENCH_COLS);
+    if (result != 0) return 1;
+  }
+
+  struct timespec start, end;
+  pthread_t threads[MAX_BENCH_SESSIONS];
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t i = 0; i < num_sessions; i++) {
+    if (pthread_create(&threads[i], NULL, session_function, (void*)i) != 0) {
+      fprintf(stderr, "Error creating session thread\n");
+      return 1;
+    }
+  }
+  for (size_t i = 0; i < num_sessions; i++) pthread_join(threads[i], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+  const char* name = mode == RESERVE_MODE_MUTEX ? "direct, mutex" : mode == RESERVE_MODE_CAS ? "direct, cas" : "owner";
+  printf("  %-14s shards %2zu  %12.0f ops/s\n", name, sharded ? num_shards : 0,
+         (double)(num_sessions * num_reservations) / seconds);
+  fflush(stdout);
+
+  shard_terminate();
+  ems_terminate();
+  return 0;
+}
+
+/// Runs a configuration in a child process, so each one starts from a fresh EMS state.
+/// @return 0 if the configuration ran successfully, 1 otherwise.
+static int run_isolated(enum ReserveMode mode, size_t num_shards) {
+  pid_t pid = fork();
+  if (pid == -1) return 1;
+  if (pid == 0) exit(run(mode, num_shards));
+
+  int status;
+  return waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int main(int argc, char* argv[]) {
+  num_sessions = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+  num_reservations = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+  size_t max_shards = argc > 3 ? strtoul(argv[3], NULL, 10) : 32;
+
+  if (num_sessions == 0 || num_sessions > MAX_BENCH_SESSIONS ||
+      num_sessions * num_reservations > (size_t)BENCH_EVENTS * BENCH_ROWS * BENCH_COLS) {
+    fprintf(stderr, "Usage: %s [sessions] [reservations per session] [max shards]\n", argv[0]);
+    fprintf(stderr, "With 1 to %d sessions and at most %d reservations in all\n", MAX_BENCH_SESSIONS,
+            BENCH_EVENTS * BENCH_ROWS * BENCH_COLS);
+    return 1;
+  }
+
+  // The access delay still calls nanosleep, so the timer slack inherited by every thread is cut to keep it from
+  // sleeping 50us per request
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+  printf("%zu sessions, %zu single-seat reservations each, %d events of %dx%d, %ld cores online\n", num_sessions,
+         num_reservations, BENCH_EVENTS, BENCH_ROWS, BENCH_COLS, sysconf(_SC_NPROCESSORS_ONLN));
+  fflush(stdout);
+
+  int failed = run_isolated(RESERVE_MODE_MUTEX, 0) || run_isolated(RESERVE_MODE_CAS, 0);
+  for (size_t num_shards = 1; num_shards <= max_shards && !failed; num_shards *= 2) {
+    failed = run_isolated(RESERVE_MODE_OWNER, num_shards);
+  }
+
+  return failed;
+}
@@ -0,0 +1,77 @@
+// Benchmark of the SHOW encodings: builds a large event with scattered reservations and times SHOWs of it answered
+// with the raw seat map and with the run-length encoding, straight in the EMS state, printing the bytes of each
+// response. Responses are queued in memory rather than written, so only building them is timed.
+// Usage: bench/show_encoding [shows] [rows] [cols] [reserved seats]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/constants.h"
+#include "server/operations.h"
+#include "server/reply.h"
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// Times SHOWs with the given encodings accepted and prints the bytes and time of each.
+/// @return 0 if every SHOW succeeded, 1 otherwise.
+static int time_shows(const char* name, unsigned char encodings, size_t num_shows) {
+  size_t bytes = 0;
+  double start = now();
+
+  for (size_t i = 0; i < num_shows; i++) {
+    struct Reply reply = {.fd = -1, .queued = 1};
+    if (ems_show(&reply, 1, encodings) != 0) return 1;
+    bytes = reply_pending(&reply);
+    reply_free(&reply);
+  }
+
+  double elapsed = now() - start;
+  printf("  %-4s %9zu bytes per response  %8.3f ms per SHOW\n", name, bytes, elapsed / (double)num_shows * 1e3);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  size_t num_shows = argc > 1 ? strtoul(argv[1], NULL, 10) : 50;
+  size_t rows = argc > 2 ? strtoul(argv[2], NULL, 10) : 500;
+  size_t cols = argc > 3 ? strtoul(argv[3], NULL, 10) : 500;
+  size_t num_reserved = argc > 4 ? strtoul(argv[4], NULL, 10) : 800;
+  if (num_shows == 0 || rows == 0 || cols == 0 || num_reserved > rows * cols / 2) {
+    fprintf(stderr, "Usage: %s [shows] [rows] [cols] [reserved seats]\n", argv[0]);
+    fprintf(stderr, "With at most half the seats reserved\n");
+    return 1;
+  }
+
+  // The access delay still calls nanosleep, so the timer slack is cut to keep it from sleeping 50us per lookup
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+  struct EmsConfig config = {.delay_us = 0, .reserve_mode = RESERVE_MODE_MUTEX};
+  if (ems_init(&config) != 0 || ems_create(1, rows, cols) != 0) {
+    fprintf(stderr, "Failed to initialize EMS\n");
+    return 1;
+  }
+
+  // Single seats picked by a fixed generator, so every run shows the same event, a reservation each
+  unsigned long long state = 1;
+  for (size_t reserved = 0; reserved < num_reserved;) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    size_t seat = (size_t)(state >> 33) % (rows * cols);
+    size_t x = seat / cols + 1, y = seat % cols + 1;
+    if (ems_reserve(1, 1, &x, &y) == 0) reserved++;
+  }
+
+  printf("%zu SHOWs of a %zux%zu event with %zu reserved seats, no access delay\n", num_shows, rows, cols,
+         num_reserved);
+  int failed = time_shows("raw", 1u << SHOW_ENCODING_RAW, num_shows) ||
+               time_shows("rle", 1u << SHOW_ENCODING_RAW | 1u << SHOW_ENCODING_RLE, num_shows);
+
+  if (failed) fprintf(stderr, "Benchmark failed\n");
+  ems_terminate();
+  return failed;
+}
@@ -0,0 +1,135 @@
+// Startup benchmark of recovery: builds a state of many small events with a write-ahead log and a checkpoint, then
+// times ems_init restoring it from the mapped checkpoint and from a replay of the whole log. Each startup runs in its
+// own process, with the files in the page cache.
+// Usage: bench/startup_restore [events] [directory]
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/constants.h"
+#include "server/operations.h"
+#include "server/reply.h"
+
+#define BENCH_ROWS 8          // Rows of each event
+#define BENCH_COLS 8          // Columns of each event
+#define RESERVATION_EVERY 16  // Events with a reservation, one in this many
+
+static size_t num_events;
+static char wal_path[4096];
+static char checkpoint_path[4096];
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// Gets the size of a file in megabytes, 0 if it is missing.
+static double file_mb(const char* path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? (double)st.st_size / (1024.0 * 1024.0) : 0.0;
+}
+
+/// Creates the events and their reservations, logged without syncing, and writes the checkpoint on terminate.
+/// @return 0 if the state was built successfully, 1 otherwise.
+static int build(void) {
+  struct EmsConfig config = {.reserve_mode = RESERVE_MODE_MUTEX,
+                             .wal_path = wal_path,
+                             .wal_sync = WAL_SYNC_NONE,
+                             .checkpoint_path = checkpoint_path};
+  if (ems_init(&config) != 0) return 1;
+
+  double start = now();
+  for (unsigned int event_id = 1; event_id <= num_events; event_id++) {
+    if (ems_create(event_id, BENCH_ROWS, BENCH_COLS) != 0) return 1;
+
+    size_t x = (event_id / RESERVATION_EVERY) % BENCH_ROWS + 1, y = 1;
+    if (event_id % RESERVATION_EVERY == 0 && ems_reserve(event_id, 1, &x, &y) != 0) return 1;
+  }
+  double built = now();
+
+  // The checkpoint written on terminate covers the whole log
+  if (ems_terminate() != 0) return 1;
+  double terminated = now();
+
+  char label[64];
+  snprintf(label, sizeof(label), "building %zu events", num_events);
+  printf("  %-36s %6.2f s\n", label, built - start);
+  snprintf(label, sizeof(label), "writing the checkpoint (%.0f MB)", file_mb(checkpoint_path));
+  printf("  %-36s %6.2f s\n", label, terminated - built);
+  return 0;
+}
+
+/// Times the startup from the checkpoint, or from the log alone, and the first SHOW after it.
+/// @return 0 if the state was restored successfully, 1 otherwise.
+static int restore(int from_checkpoint) {
+  struct EmsConfig config = {.reserve_mode = RESERVE_MODE_MUTEX,
+                             .wal_path = wal_path,
+                             .wal_sync = WAL_SYNC_NONE,
+                             .checkpoint_path = from_checkpoint ? checkpoint_path : NULL};
+
+  double start = now();
+  if (ems_init(&config) != 0) return 1;
+  double started = now();
+
+  struct Reply reply = {.fd = open("/dev/null", O_WRONLY)};
+  if (reply.fd == -1 || ems_show(&reply, (unsigned int)num_events, 1u << SHOW_ENCODING_RAW) != 0) return 1;
+  double shown = now();
+  close(reply.fd);
+
+  char label[64];
+  if (from_checkpoint) {
+    snprintf(label, sizeof(label), "ems_init from the checkpoint");
+  } else {
+    snprintf(label, sizeof(label), "ems_init replaying the log (%.0f MB)", file_mb(wal_path));
+  }
+  printf("  %-36s %6.2f s, first SHOW %.2f ms\n", label, started - start, (shown - started) * 1e3);
+  fflush(stdout);
+
+  // The state is not terminated, which would write a new checkpoint
+  return 0;
+}
+
+/// Runs a step in a child process, so each startup begins from a fresh EMS state.
+/// @return 0 if the step ran successfully, 1 otherwise.
+static int run_isolated(int step) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) return 1;
+  if (pid == 0) exit(step == 0 ? build() : restore(step == 1));
+
+  int status;
+  return waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int main(int argc, char* argv[]) {
+  num_events = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  const char* directory = argc > 2 ? argv[2] : ".";
+
+  if (num_events == 0 || num_events > 0xffffffffu) {
+    fprintf(stderr, "Usage: %s [events] [directory]\n", argv[0]);
+    return 1;
+  }
+
+  snprintf(wal_path, sizeof(wal_path), "%s/startup_restore-%d.wal", directory, getpid());
+  snprintf(checkpoint_path, sizeof(checkpoint_path), "%s/startup_restore-%d.ckpt", directory, getpid());
+
+  // The access delay still calls nanosleep, so the timer slack is cut to keep it from sleeping 50us per lookup
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+  printf("%zu events of %dx%d, a reservation in every %dth, files in %s, %ld cores online\n", num_events,
+         BENCH_ROWS, BENCH_COLS, RESERVATION_EVERY, directory, sysconf(_SC_NPROCESSORS_ONLN));
+
+  int failed = run_isolated(0) || run_isolated(1) || run_isolated(2);
+  if (failed) fprintf(stderr, "Benchmark failed\n");
+
+  unlink(wal_path);
+  unlink(checkpoint_path);
+  return failed;
+}
@@ -0,0 +1,291 @@
+// Syscall benchmark of the protocol: runs server/ems and client/client of a build under ptrace, on .jobs files of
+// one kind of command repeated, and counts the syscalls each process makes per command. A run of the same file
+// without the repeated commands is subtracted, so starting and stopping are not counted. The I/O column only
+// counts the read and write family, the rest also has the futexes, waits and the sleeps of the access delay.
+// Usage: bench/syscall_count [commands] [build directory] [fifo|socket|shm ...]
+
+#define _GNU_SOURCE  // __WALL, PTRACE_GET_SYSCALL_INFO
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_TRACEES 1024  // Threads of the server and the client traced at once at most
+#define EVENT_ROWS 100    // Rows of the event the commands use, enough seats for 10000 single-seat reservations
+#define EVENT_COLS 100
+
+/// Syscalls made by one process.
+struct Counts {
+  double total;
+  double io;  // Of the read and write family
+};
+
+/// A thread being traced, and the process it belongs to.
+struct Tracee {
+  pid_t tid;
+  int client;  // Whether it is a thread of the client, otherwise of the server
+};
+
+static struct Tracee tracees[MAX_TRACEES];
+static size_t num_tracees;
+
+static const char *build_dir;
+static char work_dir[64];
+
+/// Checks whether a syscall moves bytes through a file descriptor.
+static int is_io(long nr) {
+  return nr == SYS_read || nr == SYS_write || nr == SYS_readv || nr == SYS_writev || nr == SYS_pread64 ||
+         nr == SYS_pwrite64 || nr == SYS_recvfrom || nr == SYS_sendto || nr == SYS_recvmsg || nr == SYS_sendmsg;
+}
+
+/// Finds a traced thread.
+/// @return Entry of the thread, NULL if it is not traced yet.
+static struct Tracee *find_tracee(pid_t tid) {
+  for (size_t i = 0; i < num_tracees; i++) {
+    if (tracees[i].tid == tid) return &tracees[i];
+  }
+  return NULL;
+}
+
+/// Forks a process stopped under ptrace, tracing its syscalls and every thread it starts, and runs a program in it.
+/// @param argv Program, relative to the build directory, and its arguments.
+/// @return Pid of the process, -1 on failure.
+static pid_t spawn_traced(char *const argv[]) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s", build_dir, argv[0]);
+
+  pid_t pid = fork();
+  if (pid == -1) return -1;
+  if (pid == 0) {
+    // What the programs print of every request is dropped, their errors are not
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1 || chdir(work_dir) == -1 ||
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1) {
+      _exit(1);
+    }
+    raise(SIGSTOP);
+    execv(path, argv);
+    _exit(1);
+  }
+
+  int status;
+  long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL;
+  if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status) ||
+      ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)options) == -1 || ptrace(PTRACE_SYSCALL, pid, NULL, NULL) == -1) {
+    kill(pid, SIGKILL);
+    return -1;
+  }
+  return pid;
+}
+
+/// Runs the server and a client on a .jobs file, counting the syscalls of each.
+/// @param server_argv Arguments of the server.
+/// @param client_argv Arguments of the client, started once the server is up and waiting.
+/// @param server Set to the syscalls of the server.
+/// @param client Set to the syscalls of the client.
+/// @return 0 if both ran successfully, 1 otherwise.
+static int trace_run(char *const server_argv[], char *const client_argv[], const char *server_path,
+                     struct Counts *server, struct Counts *client) {
+  *server = *client = (struct Counts){0};
+  num_tracees = 0;
+
+  pid_t server_pid = spawn_traced(server_argv);
+  if (server_pid == -1) return 1;
+  tracees[num_tracees++] = (struct Tracee){server_pid, 0};
+
+  pid_t client_pid = -1;
+  int failed = 0, idle = 0;
+  while (num_tracees > 0) {
+    // Until the client starts, the server is polled, so it is only started once the server waits for it
+    int status;
+    pid_t tid = waitpid(-1, &status, __WALL | (client_pid == -1 ? WNOHANG : 0));
+    if (tid == 0) {
+      struct timespec pause = {0, 1000 * 1000};
+      if (++idle >= 50 && access(server_path, F_OK) == 0) {
+        client_pid = spawn_traced(client_argv);
+        if (client_pid == -1) {
+          kill(server_pid, SIGKILL);
+          failed = 1;
+          continue;
+        }
+        tracees[num_tracees++] = (struct Tracee){client_pid, 1};
+      } else if (idle >= 5000) {
+        fprintf(stderr, "The server did not start\n");
+        kill(server_pid, SIGKILL);
+        failed = 1;
+      }
+      nanosleep(&pause, NULL);
+      continue;
+    }
+    if (tid == -1) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    idle = 0;
+
+    struct Tracee *tracee = find_tracee(tid);
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (tracee != NULL) *tracee = tracees[--num_tracees];
+      if (tid == client_pid) {
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        kill(server_pid, SIGTERM);
+      }
+      continue;
+    }
+
+    int signal = WSTOPSIG(status);
+    int event = status >> 16;
+    if (tracee == NULL) {
+      // A new thread starts with a SIGSTOP, and its process is the one that cloned it, which is told apart by pid
+      if (num_tracees == MAX_TRACEES) {
+        fprintf(stderr, "Too many threads to trace\n");
+        kill(server_pid, SIGKILL);
+        if (client_pid != -1) kill(client_pid, SIGKILL);
+        return 1;
+      }
+      char status_path[64], line[256];
+      snprintf(status_path, sizeof(status_path), "/proc/%d/status", tid);
+      FILE *file = fopen(status_path, "r");
+      pid_t tgid = -1;
+      while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "Tgid: %d", &tgid) == 1) break;
+      }
+      if (file != NULL) fclose(file);
+
+      tracee = &tracees[num_tracees++];
+      *tracee = (struct Tracee){tid, tgid == client_pid};
+      if (signal == SIGSTOP) signal = 0;
+    }
+
+    if (signal == (SIGTRAP | 0x80)) {
+      struct __ptrace_syscall_info info;
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, (void *)sizeof(info), &info) > 0 &&
+          info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        struct Counts *counts = tracee->client ? client : server;
+        counts->total++;
+        if (is_io((long)info.entry.nr)) counts->io++;
+      }
+      signal = 0;
+    } else if (signal == SIGTRAP && event != 0) {
+      signal = 0;  // Clone and exec events
+    }
+
+    ptrace(PTRACE_SYSCALL, tid, NULL, (void *)(long)signal);
+  }
+
+  return failed || client_pid == -1;
+}
+
+/// Writes a .jobs file of a setup command, followed by a command repeated.
+/// @param kind Command repeated, as it is named in the .jobs file.
+/// @param count Number of times it is repeated.
+/// @return 0 if the file was written successfully, 1 otherwise.
+static int write_jobs(const char *path, const char *kind, size_t count) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) return 1;
+
+  fprintf(file, "CREATE 1 %d %d\n", EVENT_ROWS, EVENT_COLS);
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(kind, "CREATE") == 0) {
+      fprintf(file, "CREATE %zu 2 2\n", i + 2);
+    } else if (strcmp(kind, "RESERVE") == 0) {
+      fprintf(file, "RESERVE 1 [(%zu,%zu)]\n", i / EVENT_COLS + 1, i % EVENT_COLS + 1);
+    } else if (strcmp(kind, "SHOW") == 0) {
+      fprintf(file, "SHOW 1\n");
+    } else {
+      fprintf(file, "LIST\n");
+    }
+  }
+
+  return fclose(file) != 0;
+}
+
+/// Counts the syscalls of one .jobs file against a fresh server.
+/// @return 0 if the file ran successfully, 1 otherwise.
+static int count_jobs(const char *transport, const char *kind, size_t count, struct Counts *server,
+                      struct Counts *client) {
+  char jobs_path[128], out_path[128], server_path[128], req_path[128], resp_path[128];
+  snprintf(jobs_path, sizeof(jobs_path), "%s/%s-%zu.jobs", work_dir, kind, count);
+  snprintf(out_path, sizeof(out_path), "%s/%s-%zu.out", work_dir, kind, count);
+  snprintf(server_path, sizeof(server_path), "%s/server", work_dir);
+  snprintf(req_path, sizeof(req_path), "%s/req", work_dir);
+  snprintf(resp_path, sizeof(resp_path), "%s/resp", work_dir);
+  if (write_jobs(jobs_path, kind, count) != 0) return 1;
+
+  char *server_argv[] = {"server/ems", "-t", (char *)transport, server_path, "0", NULL};
+  char *client_argv[] = {"client/client", "-t", (char *)transport, req_path, resp_path, server_path, jobs_path, NULL};
+  int failed = trace_run(server_argv, client_argv, server_path, server, client);
+
+  unlink(jobs_path);
+  unlink(out_path);
+  unlink(server_path);
+  unlink(req_path);
+  unlink(resp_path);
+  return failed;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+  build_dir = argc > 2 ? argv[2] : ".";
+  if (count == 0 || count > EVENT_ROWS * EVENT_COLS) {
+    fprintf(stderr, "Usage: %s [commands] [build directory] [fifo|socket|shm ...]\n", argv[0]);
+    fprintf(stderr, "With 1 to %d commands\n", EVENT_ROWS * EVENT_COLS);
+    return 1;
+  }
+
+  char *build_path = realpath(build_dir, NULL);
+  if (build_path == NULL) {
+    perror("Error finding the build directory");
+    return 1;
+  }
+  build_dir = build_path;
+
+  snprintf(work_dir, sizeof(work_dir), "/tmp/ems-syscalls-%d", getpid());
+  if (mkdir(work_dir, 0700) == -1) {
+    perror("Error creating the work directory");
+    return 1;
+  }
+
+  // The access delay still calls nanosleep, and the server inherits the timer slack, so it is cut to keep the
+  // server from sleeping 50us per request
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+  const char *default_transports[] = {"fifo", "socket", "shm"};
+  const char **transports = argc > 3 ? (const char **)argv + 3 : default_transports;
+  size_t num_transports = argc > 3 ? (size_t)argc - 3 : 3;
+  const char *kinds[] = {"CREATE", "RESERVE", "SHOW", "LIST"};
+
+  printf("Syscalls per command of %s, %zu commands, session threads\n", build_dir, count);
+  int failed = 0;
+  for (size_t i = 0; i < num_transports && !failed; i++) {
+    printf("%-8s client total  client I/O  server total  server I/O\n", transports[i]);
+
+    struct Counts base_server, base_client;
+    failed = count_jobs(transports[i], "CREATE", 0, &base_server, &base_client);
+    for (size_t j = 0; j < sizeof(kinds) / sizeof(kinds[0]) && !failed; j++) {
+      struct Counts server, client;
+      failed = count_jobs(transports[i], kinds[j], count, &server, &client);
+      if (failed) break;
+
+      double n = (double)count;
+      printf("  %-7s %12.2f %11.2f %13.2f %11.2f\n", kinds[j], (client.total - base_client.total) / n,
+             (client.io - base_client.io) / n, (server.total - base_server.total) / n,
+             (server.io - base_server.io) / n);
+      fflush(stdout);
+    }
+  }
+
+  if (failed) fprintf(stderr, "Benchmark failed\n");
+  rmdir(work_dir);
+  free(build_path);
+  return failed;
+}
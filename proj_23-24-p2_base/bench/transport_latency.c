@@ -0,0 +1,166 @@
+// Latency benchmark of the transports: starts the server with each transport, with session threads and with one
+// event loop but for shared memory, and times round trips of one session through the client API. The small request
+// is a SHOW of an unchanged 1x1 event, answered with an empty update, the large one a LIST of enough events to span
+// several socket messages. Run from the directory server/ems is built in.
+// Usage: bench/transport_latency [small round trips] [large round trips] [events listed]
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client/api.h"
+
+static char server_path[64];
+static char req_path[64];
+static char resp_path[64];
+static int report_fd;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/// Starts the server and waits for its pipe or socket to appear.
+/// @param transport_name Transport given to -t.
+/// @param loops Event loops given to -e, NULL for session threads.
+/// @return Pid of the server, -1 on failure.
+static pid_t start_server(const char *transport_name, const char *loops) {
+  unlink(server_path);
+  pid_t pid = fork();
+  if (pid == -1) return -1;
+
+  if (pid == 0) {
+    if (loops != NULL) {
+      execl("server/ems", "ems", "-t", transport_name, "-e", loops, server_path, "0", (char *)NULL);
+    } else {
+      execl("server/ems", "ems", "-t", transport_name, server_path, "0", (char *)NULL);
+    }
+    perror("Error starting server/ems");
+    _exit(1);
+  }
+
+  struct timespec pause = {0, 10 * 1000 * 1000};
+  for (int i = 0; i < 500; i++) {
+    if (access(server_path, F_OK) == 0) return pid;
+    nanosleep(&pause, NULL);
+  }
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  return -1;
+}
+
+/// Times round trips of one kind and prints their mean and percentiles.
+/// @param name Name of the request.
+/// @param large Whether the request is the LIST, otherwise the SHOW.
+/// @param samples Buffer for the latency of each round trip.
+/// @param count Number of round trips.
+/// @param out_fd File descriptor the responses are printed to.
+/// @return 0 if every round trip succeeded, 1 otherwise.
+static int time_round_trips(const char *name, int large, double *samples, size_t count, int out_fd) {
+  double total = 0;
+  for (size_t i = 0; i < count; i++) {
+    double start = now();
+    if ((large ? ems_list_events(out_fd) : ems_show(out_fd, 1)) != 0) return 1;
+    samples[i] = now() - start;
+    total += samples[i];
+  }
+
+  qsort(samples, count, sizeof(double), compare_doubles);
+  dprintf(report_fd, "  %-6s mean %8.1f us  p50 %8.1f us  p99 %8.1f us\n", name, total / (double)count * 1e6,
+          samples[count / 2] * 1e6, samples[count * 99 / 100] * 1e6);
+  return 0;
+}
+
+/// Runs one transport and mode against a fresh server.
+/// @return 0 if the configuration ran successfully, 1 otherwise.
+static int run(const char *transport_name, int transport, const char *loops, size_t small_count, size_t large_count,
+               unsigned int num_events, double *samples) {
+  pid_t server = start_server(transport_name, loops);
+  if (server == -1) {
+    fprintf(stderr, "Failed to start the server\n");
+    return 1;
+  }
+
+  int out_fd = open("/dev/null", O_WRONLY);
+  int failed = out_fd == -1 || ems_setup(req_path, resp_path, server_path, transport) != 0;
+  for (unsigned int event_id = 1; event_id <= num_events && !failed; event_id++) {
+    failed = ems_create(event_id, 1, 1) != 0;
+  }
+
+  if (!failed) {
+    dprintf(report_fd, "%s, %s%s\n", transport_name, loops != NULL ? "event loops " : "session threads",
+            loops != NULL ? loops : "");
+    failed = ems_show(out_fd, 1) != 0 || time_round_trips("SHOW", 0, samples, small_count, out_fd) != 0 ||
+             time_round_trips("LIST", 1, samples, large_count, out_fd) != 0;
+  }
+  failed |= ems_quit() != 0;
+
+  if (out_fd != -1) close(out_fd);
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  unlink(server_path);
+  unlink(req_path);
+  unlink(resp_path);
+  return failed;
+}
+
+int main(int argc, char *argv[]) {
+  size_t small_count = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+  size_t large_count = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000;
+  unsigned long num_events = argc > 3 ? strtoul(argv[3], NULL, 10) : 20000;
+  if (small_count == 0 || large_count == 0 || num_events == 0 || num_events > 1000000) {
+    fprintf(stderr, "Usage: %s [small round trips] [large round trips] [events listed]\n", argv[0]);
+    return 1;
+  }
+
+  snprintf(server_path, sizeof(server_path), "/tmp/ems-bench-%d", getpid());
+  snprintf(req_path, sizeof(req_path), "/tmp/ems-bench-req-%d", getpid());
+  snprintf(resp_path, sizeof(resp_path), "/tmp/ems-bench-resp-%d", getpid());
+
+  // The client API reports every request on stdout, only the timings are printed
+  report_fd = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (report_fd == -1 || null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1) {
+    perror("Error redirecting stdout");
+    return 1;
+  }
+  close(null_fd);
+
+  // The access delay still calls nanosleep, and the server inherits the timer slack, so it is cut to keep the
+  // server from sleeping 50us per request
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+  double *samples = malloc((small_count > large_count ? small_count : large_count) * sizeof(double));
+  if (samples == NULL) return 1;
+
+  dprintf(report_fd, "One session, %zu SHOWs of a 1x1 event, %zu LISTs of %lu events (%lu bytes), %ld cores online\n",
+          small_count, large_count, num_events, num_events * sizeof(unsigned int), sysconf(_SC_NPROCESSORS_ONLN));
+
+  const char *transport_names[] = {"fifo", "socket", "shm"};
+  const int transports[] = {TRANSPORT_FIFO, TRANSPORT_SOCKET, TRANSPORT_SHM};
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]) && !failed; i++) {
+    // Shared-memory sessions need a thread each, so they have no event-loop mode
+    failed = run(transport_names[i], transports[i], NULL, small_count, large_count, (unsigned int)num_events,
+                 samples) ||
+             (transports[i] != TRANSPORT_SHM &&
+              run(transport_names[i], transports[i], "1", small_count, large_count, (unsigned int)num_events,
+                  samples));
+  }
+
+  free(samples);
+  if (failed) fprintf(stderr, "Benchmark failed\n");
+  return failed;
+}
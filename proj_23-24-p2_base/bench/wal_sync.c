@@ -0,0 +1,132 @@
+// Durability benchmark of the write-ahead log: session threads reserving seats straight in the EMS state, each
+// waiting for its change to be acknowledged, with no log and with every sync policy, for 1, 8 and 32 sessions.
+// Each configuration runs in its own process with a fresh log in the given directory, which should be on the disk
+// the server logs to, since the sync cost is that disk's.
+// Usage: bench/wal_sync [reservations per session] [directory] [interval_us]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server/operations.h"
+
+#define BENCH_ROWS 512  // Rows of the event, enough seats for 32 sessions of 4096 reservations
+#define BENCH_COLS 256
+#define MAX_BENCH_SESSIONS 32
+
+static const size_t session_counts[] = {1, 8, 32};
+
+static size_t num_sessions;
+static size_t num_reservations;
+
+/// Makes the reservations of a session, one seat each. Sessions interleave over the seats, so no reservation fails.
+static void* session_function(void* arg) {
+  size_t session = (size_t)arg;
+
+  for (size_t i = 0; i < num_reservations; i++) {
+    size_t seat = i * num_sessions + session;
+    size_t x = seat / BENCH_COLS + 1;
+    size_t y = seat % BENCH_COLS + 1;
+
+    if (ems_reserve(1, 1, &x, &y) != 0) {
+      fprintf(stderr, "Reservation of seat (%zu,%zu) failed\n", x, y);
+      exit(1);
+    }
+  }
+
+  return NULL;
+}
+
+/// Runs one configuration and prints its throughput.
+/// @param name Name of the configuration.
+/// @param config Configuration of the EMS state, its log removed first.
+/// @return 0 if the configuration ran successfully, 1 otherwise.
+static int run(const char* name, const struct EmsConfig* config) {
+  if (config->wal_path != NULL) unlink(config->wal_path);
+  if (ems_init(config) != 0) {
+    fprintf(stderr, "Failed to initialize EMS\n");
+    return 1;
+  }
+  if (ems_create(1, BENCH_ROWS, BENCH_COLS) != 0) return 1;
+
+  struct timespec start, end;
+  pthread_t threads[MAX_BENCH_SESSIONS];
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (size_t i = 0; i < num_sessions; i++) {
+    if (pthread_create(&threads[i], NULL, session_function, (void*)i) != 0) {
+      fprintf(stderr, "Error creating session thread\n");
+      return 1;
+    }
+  }
+  for (size_t i = 0; i < num_sessions; i++) pthread_join(threads[i], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+  size_t total = num_sessions * num_reservations;
+
+  printf("  %-10s sessions %2zu  %10.0f ops/s  %8.1f us/op per session\n", name, num_sessions,
+         (double)total / seconds, seconds * 1e6 / (double)num_reservations);
+  fflush(stdout);
+
+  ems_terminate();
+  if (config->wal_path != NULL) unlink(config->wal_path);
+  return 0;
+}
+
+/// Runs a configuration in a child process, so each one starts from a fresh EMS state.
+/// @return 0 if the configuration ran successfully, 1 otherwise.
+static int run_isolated(const char* name, const struct EmsConfig* config) {
+  pid_t pid = fork();
+  if (pid == -1) return 1;
+  if (pid == 0) exit(run(name, config));
+
+  int status;
+  return waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int main(int argc, char* argv[]) {
+  num_reservations = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+  const char* directory = argc > 2 ? argv[2] : ".";
+  unsigned int interval_us = argc > 3 ? (unsigned int)strtoul(argv[3], NULL, 10) : 1000;
+
+  if (num_reservations == 0 || MAX_BENCH_SESSIONS * num_reservations > (size_t)BENCH_ROWS * BENCH_COLS) {
+    fprintf(stderr, "Usage: %s [reservations per session] [directory] [interval_us]\n", argv[0]);
+    fprintf(stderr, "With at most %d reservations per session\n", BENCH_ROWS * BENCH_COLS / MAX_BENCH_SESSIONS);
+    return 1;
+  }
+
+  char wal_path[4096];
+  snprintf(wal_path, sizeof(wal_path), "%s/wal_sync-%d.wal", directory, getpid());
+
+  // The access delay still calls nanosleep, so the timer slack inherited by every thread is cut to keep it from
+  // sleeping 50us per request
+  prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+  printf("%zu single-seat reservations per session, log in %s, interval %u us\n", num_reservations, directory,
+         interval_us);
+  fflush(stdout);
+
+  struct EmsConfig configs[] = {
+      {.reserve_mode = RESERVE_MODE_MUTEX},
+      {.reserve_mode = RESERVE_MODE_MUTEX, .wal_path = wal_path, .wal_sync = WAL_SYNC_NONE},
+      {.reserve_mode = RESERVE_MODE_MUTEX, .wal_path = wal_path, .wal_sync = WAL_SYNC_INTERVAL,
+       .wal_interval_us = interval_us},
+      {.reserve_mode = RESERVE_MODE_MUTEX, .wal_path = wal_path, .wal_sync = WAL_SYNC_EVERY},
+  };
+  const char* names[] = {"no log", "none", "interval", "every"};
+
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(session_counts) / sizeof(session_counts[0]) && !failed; i++) {
+    num_sessions = session_counts[i];
+    for (size_t j = 0; j < sizeof(configs) / sizeof(configs[0]) && !failed; j++) {
+      failed = run_isolated(names[j], &configs[j]);
+    }
+  }
+
+  return failed;
+}
@@ -1,9 +1,84 @@
 #include "api.h"
 
-int req_pipe, resp_pipe, server_pipe;
-const char *pipe1_path, *pipe2_path;
-int session_id;
-
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "common/io.h"
+#include "common/ring.h"
+
+// Each thread has a session of its own, so every variable below is per thread
+_Thread_local int req_pipe, resp_pipe, server_pipe;
+_Thread_local const char *pipe1_path, *pipe2_path;
+_Thread_local int session_id;
+_Thread_local int session_transport;  // TRANSPORT_*, with TRANSPORT_SOCKET req_pipe and resp_pipe are the same socket
+
+// Segment of the session with TRANSPORT_SHM
+static _Thread_local struct RingPair rings;
+static _Thread_local char ring_name[MAX_PIPE_NAME];
+static unsigned int next_ring = 0;  // Sessions of the process, each segment named after its own
+
+// Last message received from the socket, whose rest is read by the next responses
+static _Thread_local char message[MAX_SOCKET_MESSAGE];
+static _Thread_local size_t message_size = 0;
+static _Thread_local size_t message_offset = 0;
+
+#define GRID_CACHE_SIZE 64  // Events whose seats are kept locally for SHOW_SINCE
+#define LIST_CHUNK_IDS 1024  // Event ids of a LIST response read at a time
+
+/// Local copy of the seats of an event, updated from SHOW_SINCE responses.
+struct EventGrid {
+  unsigned int id;
+  size_t serial;        // Serial of the instance of the event copied
+  size_t version;       // Version of the event copied
+  size_t rows, cols;
+  unsigned int *seats;  // NULL if the entry is unused
+};
+
+static _Thread_local struct EventGrid grids[GRID_CACHE_SIZE];
+static _Thread_local size_t next_grid = 0;  // Entry replaced when the cache is full
+
+#define PIPELINE_WINDOW_SIZE (32 * 1024)  // Request bytes in flight at most, less than a pipe, socket or ring holds
+
+/// A request sent and waiting for its response.
+struct PendingRequest {
+  unsigned int id;
+  char op_code;
+  const char *name;       // Of the function that sent it, for error messages
+  size_t size;            // Bytes of the request, counted against PIPELINE_WINDOW_SIZE
+  int (*read)(const struct PendingRequest *, struct EmsCompletion *);  // Reads the response after the request id
+  int out_fd;             // Where SHOW and LIST_EVENTS print their response
+  unsigned int event_id;  // Event whose local copy SHOW updates
+  size_t num_seats;       // Seats asked for by RESERVE_BEST
+  size_t *row, *col;      // Where RESERVE_BEST stores the seats chosen, if not NULL
+  size_t num_commands;    // Commands of a BATCH, whose ids are the ones before its own
+  char *op_codes;         // OP_CODEs of the commands of a BATCH
+};
+
+// Requests in flight, oldest first, see ems_pipeline
+static _Thread_local struct PendingRequest pending[MAX_PIPELINE_DEPTH];
+static _Thread_local size_t pending_head = 0;
+static _Thread_local size_t pending_count = 0;
+static _Thread_local size_t pending_bytes = 0;
+static _Thread_local size_t pipeline_depth = 1;
+static _Thread_local void (*completion_handler)(const struct EmsCompletion *completion) = NULL;
+static _Thread_local unsigned int next_request_id = 1;
+
+// Commands gathered into the next BATCH request, see ems_batch
+static _Thread_local int batching = 0;
+static _Thread_local char batch_data[MAX_BATCH_SIZE];
+static _Thread_local size_t batch_size = 0;
+static _Thread_local char batch_op_codes[MAX_BATCH_COMMANDS];
+static _Thread_local size_t batch_count = 0;
+
+// OP_CODEs of the commands of each BATCH in flight, by the entry of the request in pending, and the statuses of
+// those of the one being completed
+static _Thread_local char batched_op_codes[MAX_PIPELINE_DEPTH][MAX_BATCH_COMMANDS];
+static _Thread_local unsigned char batch_statuses[MAX_BATCH_COMMANDS];
+
+// Where SHOW and LIST_EVENTS render their output before it is written
+static _Thread_local struct Output output;
 
 /// Gets the index of a seat.
 /// @note This function assumes that the seat exists.
@@ -13,10 +88,178 @@ int session_id;
 /// @return Index of the seat.
 static size_t seat_index(size_t num_cols, size_t row, size_t col) { return (row - 1) * num_cols + col - 1; }
 
-int ems_setup(char const *req_pipe_path, char const *resp_pipe_path, char const *server_pipe_path) {
+#define MAX_REQUEST_FIELDS 5  // Fields of a request after its header, as many as TRANSACTION has
+
+/// Sends a request as a single frame: the size of the request, then its OP_CODE, session id, request id and fields.
+/// @note The frame is written with one call, or published at once with TRANSPORT_SHM, so the server wakes up a
+/// single time for it.
+/// @param fields Fields of the request, in order.
+/// @param num_fields Number of fields, at most MAX_REQUEST_FIELDS.
+/// @return 0 if the frame was written successfully, 1 otherwise.
+static int send_frame(char op_code, unsigned int request_id, struct iovec *fields, int num_fields) {
+  unsigned int size = sizeof(char) + sizeof(int) + sizeof(unsigned int);
+  for (int i = 0; i < num_fields; i++) size += (unsigned int)fields[i].iov_len;
+
+  char header[sizeof(unsigned int) + sizeof(char) + sizeof(int) + sizeof(unsigned int)];
+  memcpy(header, &size, sizeof(unsigned int));
+  memcpy(header + sizeof(unsigned int), &op_code, sizeof(char));
+  memcpy(header + sizeof(unsigned int) + sizeof(char), &session_id, sizeof(int));
+  memcpy(header + sizeof(unsigned int) + sizeof(char) + sizeof(int), &request_id, sizeof(unsigned int));
+
+  struct iovec parts[1 + MAX_REQUEST_FIELDS] = {{header, sizeof(header)}};
+  for (int i = 0; i < num_fields; i++) parts[1 + i] = fields[i];
+
+  if (session_transport != TRANSPORT_SHM) return writev_all(req_pipe, parts, 1 + num_fields);
+
+  if (rings.mapping == NULL) return 1;
+  for (int i = 0; i < 1 + num_fields; i++) {
+    if (ring_write(&rings.requests, parts[i].iov_base, parts[i].iov_len)) return 1;
+  }
+  ring_flush(&rings.requests);
+  return 0;
+}
+
+/// Reads part of a response.
+/// @note A socket message is cut short unless it is received whole, so each one is received into message with a
+/// single call, as the server never sends one longer than MAX_SOCKET_MESSAGE, and its rest is kept for the reads
+/// that follow.
+/// @param buffer Buffer to read into.
+/// @param size Number of bytes to read.
+/// @return 0 if the bytes were read successfully, 1 on error or if the server closed the session.
+static int read_response(void *buffer, size_t size) {
+  if (session_transport == TRANSPORT_SHM) {
+    if (rings.mapping == NULL) return 1;  // Like the closed pipes, once the session ended
+
+    char *current = buffer;
+    while (size > 0) {
+      size_t bytes_read = ring_read(&rings.responses, current, size);
+      if (bytes_read == 0) return 1;
+      current += bytes_read;
+      size -= bytes_read;
+    }
+    return 0;
+  }
+
+  if (session_transport != TRANSPORT_SOCKET) return read_all(resp_pipe, buffer, size);
+
+  char *current = buffer;
+  while (size > 0) {
+    if (message_offset == message_size) {
+      // With MSG_TRUNC the length of the whole message is returned, so one cut short is told apart
+      ssize_t bytes_read = recv(resp_pipe, message, sizeof(message), MSG_TRUNC);
+      if (bytes_read <= 0) return 1;
+      if ((size_t)bytes_read > sizeof(message)) {
+        fprintf(stderr, "Response message larger than %d bytes\n", MAX_SOCKET_MESSAGE);
+        return 1;
+      }
+      message_size = (size_t)bytes_read;
+      message_offset = 0;
+    }
+
+    size_t available = message_size - message_offset;
+    size_t taken = size < available ? size : available;
+    memcpy(current, message + message_offset, taken);
+    message_offset += taken;
+    current += taken;
+    size -= taken;
+  }
+
+  return 0;
+}
+
+/// Connects to the server socket.
+/// @return 0 if the connection was established successfully, 1 otherwise.
+static int connect_socket(char const *server_socket_path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(server_socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Server socket path too long\n");
+    return 1;
+  }
+  strcpy(address.sun_path, server_socket_path);
+
+  if ((req_pipe = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) {
+    fprintf(stderr, "Error creating socket\n");
+    return 1;
+  }
+
+  if (connect(req_pipe, (struct sockaddr *)&address, sizeof(address)) == -1) {
+    fprintf(stderr, "Error connecting to server socket\n");
+    close(req_pipe);
+    return 1;
+  }
+
+  resp_pipe = req_pipe;
+  printf("Connecting to server...\n");
+  printf("\n");
+  return 0;
+}
+
+/// Creates the segment of the session and registers it through the server pipe.
+/// @return 0 if the segment was registered successfully, 1 otherwise.
+static int register_rings(char const *server_pipe_path) {
+  unsigned int ring = __atomic_fetch_add(&next_ring, 1, __ATOMIC_RELAXED);
+  snprintf(ring_name, sizeof(ring_name), "/ems-%d-%u", getpid(), ring);
+  if (ring_pair_create(ring_name, &rings)) {
+    fprintf(stderr, "Error creating shared memory\n");
+    return 1;
+  }
+
+  // The name of the segment goes in place of the request pipe, and there is no response pipe
+  char buffer[81];
+  memset(buffer, '\0', sizeof(buffer));
+  buffer[0] = '1';
+  memcpy(buffer + 1, ring_name, strlen(ring_name));
+
+  if ((server_pipe = open(server_pipe_path, O_WRONLY)) == -1 || write(server_pipe, buffer, sizeof(buffer)) == -1) {
+    fprintf(stderr, "Error sending request to the server\n");
+    if (server_pipe != -1) close(server_pipe);
+    ring_pair_close(&rings);
+    shm_unlink(ring_name);
+    return 1;
+  }
+  close(server_pipe);
+
+  printf("Connecting to server...\n");
+  printf("\n");
+  return 0;
+}
+
+int ems_setup(char const *req_pipe_path, char const *resp_pipe_path, char const *server_pipe_path, int transport) {
+
+  session_transport = transport;
+  if (transport == TRANSPORT_SHM) {
+    if (register_rings(server_pipe_path)) return 1;
+
+    if (read_response(&session_id, sizeof(int))) {
+      fprintf(stderr, "Error reading session_id from shared memory\n");
+      ring_pair_close(&rings);
+      shm_unlink(ring_name);
+      return 1;
+    }
+
+    printf("Connection established with session ID = %d.\n", session_id);
+    printf("\n");
+    return 0;
+  }
+
+  if (transport == TRANSPORT_SOCKET) {
+    if (connect_socket(server_pipe_path)) return 1;
+
+    // The connection is the session, no pipes are registered
+    if (read_response(&session_id, sizeof(int))) {
+      fprintf(stderr, "Error reading session_id from the server socket\n");
+      close(req_pipe);
+      return 1;
+    }
+
+    printf("Connection established with session ID = %d.\n", session_id);
+    printf("\n");
+    return 0;
+  }
 
   pipe1_path = req_pipe_path;
   pipe2_path = resp_pipe_path;
+  req_pipe = resp_pipe = -1;  // Nothing for ems_quit to close until the pipes are open
   unlink(req_pipe_path);
   unlink(resp_pipe_path);
 
@@ -79,7 +322,7 @@ int ems_setup(char const *req_pipe_path, char const *resp_pipe_path, char const
   }
 
   // Reads the session_id from the response pipe
-  if (read(resp_pipe, &session_id, sizeof(int)) == -1) {
+  if (read_response(&session_id, sizeof(int))) {
     fprintf(stderr, "Error reading session_id from the response pipe\n");
     close(server_pipe);
     ems_quit();
@@ -96,125 +339,528 @@ int ems_setup(char const *req_pipe_path, char const *resp_pipe_path, char const
 }
 
 
+/// Closes the pipes, socket or segment of the session.
+static void close_session(void) {
+  if (session_transport == TRANSPORT_SHM) {
+    if (rings.mapping != NULL) {
+      ring_pair_close(&rings);
+      rings.mapping = NULL;
+      shm_unlink(ring_name);  // In case the server never mapped it
+    }
+    return;
+  }
+
+  if (req_pipe == -1) return;  // Requests in flight fail one by one once the session ended
+
+  close(req_pipe);
+  req_pipe = -1;
+  message_size = message_offset = 0;
+  if (session_transport == TRANSPORT_SOCKET) return;
+
+  // The server pipe was closed by ems_setup, and its descriptor may already belong to another session's pipe
+  if (resp_pipe != -1) close(resp_pipe);
+  resp_pipe = -1;
+  unlink(pipe1_path);
+  unlink(pipe2_path);
+}
+
 // Terminates session
 int ems_quit(void) {
   //TODO: close pipes
 
-  char op_code = '2';
-
   // Sends request to terminate session
-  if(write(req_pipe, &op_code, sizeof(char)) == -1 || (write(req_pipe, &session_id, sizeof(int)) == -1)){
+  if (send_frame('2', next_request_id++, NULL, 0)) {
     fprintf(stderr, "Error writing to request pipe (ems_quit)\n");
-    close(req_pipe);
-    close(resp_pipe);
-    close(server_pipe);
-    unlink(pipe1_path);
-    unlink(pipe2_path);
+    close_session();
     return 1;
   }
 
   printf("REQUEST FOR EMS_QUIT SENT!\n");
 
-  close(req_pipe);
-  close(resp_pipe);
-  close(server_pipe);
-  unlink(pipe1_path);
-  unlink(pipe2_path);
-
+  close_session();
   return 0;
 }
 
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
-  //TODO: send create request to the server (through the request pipe) and wait for the response (through the response pipe)
-  char op_code = '3';
+/// Reports the outcome of each command of a BATCH, in order.
+/// @param statuses Status of each command, NULL if the BATCH failed and every command with it.
+static void report_batch(const struct PendingRequest *request, const unsigned char *statuses) {
+  if (completion_handler == NULL) return;
 
-  //Sends requests
+  for (size_t i = 0; i < request->num_commands; i++) {
+    struct EmsCompletion completion = {.request_id = request->id - (unsigned int)(request->num_commands - i),
+                                       .op_code = request->op_codes[i],
+                                       .status = statuses != NULL ? statuses[i] : 1};
+    completion_handler(&completion);
+  }
+}
 
-  if (write(req_pipe, &op_code, sizeof(char)) == -1 ||
-      write(req_pipe, &session_id, sizeof(int)) == -1 ||
-      write(req_pipe, &event_id, sizeof(unsigned int)) == -1 ||
-      write(req_pipe, &num_rows, sizeof(size_t)) == -1 ||
-      write(req_pipe, &num_cols, sizeof(size_t)) == -1) {
-    fprintf(stderr, "Error writing to request pipe (ems_create)\n");
+/// Reads the response to the oldest request in flight and reports its outcome.
+/// @return Status of the request, see struct EmsCompletion.
+static int complete_oldest(void) {
+  struct PendingRequest request = pending[pending_head];
+  pending_head = (pending_head + 1) % MAX_PIPELINE_DEPTH;
+  pending_count--;
+  pending_bytes -= request.size;
+
+  struct EmsCompletion completion = {
+      .request_id = request.id, .op_code = request.op_code, .num_seats = request.num_seats};
+  unsigned int response_id;
+  if (read_response(&response_id, sizeof(unsigned int))) {
+    fprintf(stderr, "Error reading from response pipe (%s)\n", request.name);
     ems_quit();
-    return 1;
+    completion.status = 1;
+  } else if (response_id != request.id) {
+    fprintf(stderr, "Response to request %u received while waiting for request %u (%s)\n", response_id, request.id,
+            request.name);
+    ems_quit();
+    completion.status = 1;
+  } else {
+    completion.status = request.read(&request, &completion);
   }
 
-  printf("REQUEST FOR EMS_CREATE SENT!\n");
+  // The commands of a BATCH are reported instead of the request carrying them
+  if (request.op_code == 'C') {
+    report_batch(&request, completion.status == 0 ? batch_statuses : NULL);
+  } else if (completion_handler != NULL) {
+    completion_handler(&completion);
+  }
+  return completion.status;
+}
+
+/// Reads responses, oldest first, until few enough requests are in flight.
+/// @param max_in_flight Most requests left in flight.
+/// @param size Bytes of a request about to be sent, which must fit in the window along with them.
+/// @return Status of the last request completed, 0 if none was.
+static int settle(size_t max_in_flight, size_t size) {
+  int status = 0;
+  while (pending_count > max_in_flight || (pending_count > 0 && pending_bytes + size > PIPELINE_WINDOW_SIZE)) {
+    status = complete_oldest();
+  }
+  return status;
+}
+
+/// Starts a request once there is room for it in the pipeline.
+/// @param size Bytes of the fields of the request, see send_request.
+/// @param read Function reading its response after the request id.
+/// @return Entry of the request, to send with send_request and end_request.
+static struct PendingRequest *begin_request(char op_code, const char *name, size_t size,
+                                            int (*read)(const struct PendingRequest *, struct EmsCompletion *)) {
+  size += sizeof(unsigned int) + sizeof(char) + sizeof(int) + sizeof(unsigned int);
+  settle(pipeline_depth - 1, size);
+
+  struct PendingRequest *request = &pending[(pending_head + pending_count) % MAX_PIPELINE_DEPTH];
+  *request = (struct PendingRequest){
+      .id = next_request_id++, .op_code = op_code, .name = name, .size = size, .read = read, .out_fd = -1};
+  return request;
+}
+
+/// Sends a started request with its fields, see send_frame.
+/// @return 0 if the request was written successfully, 1 otherwise.
+static int send_request(const struct PendingRequest *request, struct iovec *fields, int num_fields) {
+  return send_frame(request->op_code, request->id, fields, num_fields);
+}
+
+/// Puts a request that was sent in flight.
+/// @return Status of the request without a completion handler, which waits for its response, 0 with one.
+static int end_request(struct PendingRequest *request) {
+  pending_count++;
+  pending_bytes += request->size;
+
+  int status = settle(pipeline_depth - 1, 0);
+  return completion_handler != NULL ? 0 : status;
+}
+
+/// Ends the session once a request could not be written, after the responses to those sent before it.
+/// @return 1, the status of the request, which is reported like any other.
+static int fail_request(const struct PendingRequest *request) {
+  fprintf(stderr, "Error writing to request pipe (%s)\n", request->name);
+  struct EmsCompletion completion = {
+      .request_id = request->id, .op_code = request->op_code, .status = 1, .num_seats = request->num_seats};
+
+  settle(0, 0);
+  ems_quit();
+  if (request->op_code == 'C') {
+    report_batch(request, NULL);
+  } else if (completion_handler != NULL) {
+    completion_handler(&completion);
+  }
+  return 1;
+}
+
+/// Reads a response that is only a return status.
+/// @return Status of the request.
+static int read_status(const struct PendingRequest *request, struct EmsCompletion *completion) {
+  (void)completion;
 
-  // Receives response
   int return_status;
-  if(read(resp_pipe, &return_status, sizeof(int)) == -1){
-    fprintf(stderr, "Error reading from response pipe (ems_create)\n");
+  if (read_response(&return_status, sizeof(int))) {
+    fprintf(stderr, "Error reading from response pipe (%s)\n", request->name);
     ems_quit();
     return 1;
   }
 
-  if(return_status == 1){
-    fprintf(stderr, "EMS_CREATE FAILED (ems_show)\n");
+  if (return_status == 1) {
+    fprintf(stderr, "Request failed (%s)\n", request->name);
     return 1;
   }
-  // Returns 0 on success
+
   return 0;
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
-  //TODO: send reserve request to the server (through the request pipe) and wait for the response (through the response pipe)
-  char op_code = '4';
-
-  // Sends requests
-  if (write(req_pipe, &op_code, sizeof(char)) == -1 ||
-      write(req_pipe, &session_id, sizeof(int)) == -1 ||
-      write(req_pipe, &event_id, sizeof(unsigned int)) == -1 ||
-      write(req_pipe, &num_seats, sizeof(size_t)) == -1 ||
-      write(req_pipe, xs, sizeof(size_t) * num_seats) == -1 ||
-      write(req_pipe, ys, sizeof(size_t) * num_seats) == -1) {
-    fprintf(stderr, "Error writing to request pipe (ems_reserve)\n");
+/// Reads the response to BATCH, the status of each of its commands.
+/// @return 0 if the statuses were read, whatever they are, 1 otherwise.
+static int read_batch(const struct PendingRequest *request, struct EmsCompletion *completion) {
+  (void)completion;
+
+  if (read_response(batch_statuses, request->num_commands)) {
+    fprintf(stderr, "Error reading from response pipe (%s)\n", request->name);
     ems_quit();
     return 1;
   }
 
+  for (size_t i = 0; i < request->num_commands; i++) {
+    if (batch_statuses[i] != 0) fprintf(stderr, "Request failed (%s, command %zu)\n", request->name, i + 1);
+  }
+  return 0;
+}
+
+/// Sends the commands gathered by ems_batch as one BATCH request.
+/// @return 0 if there were none or they were sent successfully, 1 otherwise.
+static int flush_batch(void) {
+  if (batch_count == 0) return 0;
+
+  size_t num_commands = batch_count;
+  struct PendingRequest *request = begin_request('C', "ems_batch", sizeof(size_t) + batch_size, read_batch);
+  request->num_commands = num_commands;
+  request->op_codes = batched_op_codes[request - pending];
+  memcpy(request->op_codes, batch_op_codes, num_commands);
+
+  struct iovec fields[] = {{&num_commands, sizeof(size_t)}, {batch_data, batch_size}};
+  int failed = send_request(request, fields, 2);
+  batch_count = 0;
+  batch_size = 0;
+  if (failed) return fail_request(request);
+
+  printf("REQUEST FOR EMS_BATCH SENT!\n");
+  return end_request(request);
+}
+
+/// Adds a command to the next BATCH request, sending the batch first if the command does not fit in it.
+/// @return 0 if the command was added, 1 if it is larger than any batch and must be sent on its own.
+static int batch_command(char op_code, const struct iovec *fields, int num_fields) {
+  size_t size = sizeof(char);
+  for (int i = 0; i < num_fields; i++) size += fields[i].iov_len;
+
+  if (size > MAX_BATCH_SIZE || batch_count == MAX_BATCH_COMMANDS || batch_size + size > MAX_BATCH_SIZE) {
+    flush_batch();
+    if (size > MAX_BATCH_SIZE) return 1;
+  }
+
+  batch_data[batch_size++] = op_code;
+  for (int i = 0; i < num_fields; i++) {
+    memcpy(batch_data + batch_size, fields[i].iov_base, fields[i].iov_len);
+    batch_size += fields[i].iov_len;
+  }
+
+  // Takes the id the command would have been sent with, so the ids of a BATCH are the ones before its own
+  batch_op_codes[batch_count++] = op_code;
+  next_request_id++;
+  return 0;
+}
+
+int ems_pipeline(size_t depth, void (*on_complete)(const struct EmsCompletion *completion)) {
+  if (depth == 0 || depth > MAX_PIPELINE_DEPTH || on_complete == NULL) return 1;
+
+  flush_batch();
+  settle(0, 0);
+  pipeline_depth = depth;
+  completion_handler = on_complete;
+  return 0;
+}
+
+int ems_batch(int enabled) {
+  if (enabled && completion_handler == NULL) return 1;
+
+  flush_batch();
+  batching = enabled;
+  return 0;
+}
+
+void ems_drain(void) {
+  flush_batch();
+  settle(0, 0);
+}
+
+int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  struct iovec fields[] = {
+      {&event_id, sizeof(unsigned int)}, {&num_rows, sizeof(size_t)}, {&num_cols, sizeof(size_t)}};
+  if (batching && batch_command('3', fields, 3) == 0) return 0;
+
+  struct PendingRequest *request =
+      begin_request('3', "ems_create", sizeof(unsigned int) + 2 * sizeof(size_t), read_status);
+  if (send_request(request, fields, 3)) return fail_request(request);
+
+  printf("REQUEST FOR EMS_CREATE SENT!\n");
+  return end_request(request);
+}
+
+int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  struct iovec fields[] = {
+      {&event_id, sizeof(unsigned int)},
+      {&num_seats, sizeof(size_t)},
+      {xs, sizeof(size_t) * num_seats},
+      {ys, sizeof(size_t) * num_seats}};
+  if (batching && batch_command('4', fields, 4) == 0) return 0;
+
+  struct PendingRequest *request = begin_request(
+      '4', "ems_reserve", sizeof(unsigned int) + sizeof(size_t) + 2 * num_seats * sizeof(size_t), read_status);
+  if (send_request(request, fields, 4)) return fail_request(request);
+
   printf("REQUEST FOR EMS_RESERVE SENT!\n");
+  return end_request(request);
+}
 
-  // Receives response
-  int return_status;
-  if (read(resp_pipe, &return_status, sizeof(int)) == -1) {
-    fprintf(stderr, "Error reading from response pipe (ems_reserve)\n");
+/// Reads the response to RESERVE_BEST: its status, then the seats chosen by the server.
+static int read_reserve_best(const struct PendingRequest *request, struct EmsCompletion *completion) {
+  if (read_status(request, completion)) return 1;
+
+  if (read_response(&completion->row, sizeof(size_t)) || read_response(&completion->col, sizeof(size_t))) {
+    fprintf(stderr, "Error reading seats from response pipe (ems_reserve_best)\n");
     ems_quit();
     return 1;
   }
 
-  if(return_status == 1){
-    fprintf(stderr, "EMS_RESERVE FAILED (ems_reserve)\n");
-    return 1;
+  if (request->row != NULL) *request->row = completion->row;
+  if (request->col != NULL) *request->col = completion->col;
+  return 0;
+}
+
+int ems_reserve_best(unsigned int event_id, size_t num_seats, size_t min_row, size_t max_row, size_t* row,
+                     size_t* col) {
+  flush_batch();  // Sent after the commands batched before it
+
+  struct PendingRequest *request =
+      begin_request('A', "ems_reserve_best", sizeof(unsigned int) + 3 * sizeof(size_t), read_reserve_best);
+  request->num_seats = num_seats;
+  request->row = row;
+  request->col = col;
+
+  struct iovec fields[] = {
+      {&event_id, sizeof(unsigned int)},
+      {&num_seats, sizeof(size_t)},
+      {&min_row, sizeof(size_t)},
+      {&max_row, sizeof(size_t)}};
+  if (send_request(request, fields, 4)) return fail_request(request);
+
+  printf("REQUEST FOR EMS_RESERVE_BEST SENT!\n");
+  return end_request(request);
+}
+
+int ems_transaction(size_t num_events, unsigned int* event_ids, size_t* num_seats, size_t* xs, size_t* ys) {
+  size_t total_seats = 0;
+  for (size_t i = 0; i < num_events; i++) total_seats += num_seats[i];
+
+  size_t size = sizeof(size_t) + num_events * (sizeof(unsigned int) + sizeof(size_t)) + 2 * total_seats * sizeof(size_t);
+  struct iovec fields[] = {
+      {&num_events, sizeof(size_t)},
+      {event_ids, sizeof(unsigned int) * num_events},
+      {num_seats, sizeof(size_t) * num_events},
+      {xs, sizeof(size_t) * total_seats},
+      {ys, sizeof(size_t) * total_seats}};
+  if (batching && batch_command('9', fields, 5) == 0) return 0;
+
+  struct PendingRequest *request = begin_request('9', "ems_transaction", size, read_status);
+  if (send_request(request, fields, 5)) return fail_request(request);
+
+  printf("REQUEST FOR EMS_TRANSACTION SENT!\n");
+  return end_request(request);
+}
+
+int ems_cancel(unsigned int event_id, unsigned int reservation_id) {
+  struct iovec fields[] = {{&event_id, sizeof(unsigned int)}, {&reservation_id, sizeof(unsigned int)}};
+  if (batching && batch_command('B', fields, 2) == 0) return 0;
+
+  struct PendingRequest *request = begin_request('B', "ems_cancel", 2 * sizeof(unsigned int), read_status);
+  if (send_request(request, fields, 2)) return fail_request(request);
+
+  printf("REQUEST FOR EMS_CANCEL SENT!\n");
+  return end_request(request);
+}
+
+int ems_delete(unsigned int event_id) {
+  struct iovec fields[] = {{&event_id, sizeof(unsigned int)}};
+  if (batching && batch_command('7', fields, 1) == 0) return 0;
+
+  struct PendingRequest *request = begin_request('7', "ems_delete", sizeof(unsigned int), read_status);
+  if (send_request(request, fields, 1)) return fail_request(request);
+
+  printf("REQUEST FOR EMS_DELETE SENT!\n");
+  return end_request(request);
+}
+
+/// Expands an encoded seat map.
+/// @param encoding SHOW_ENCODING_* of the seat map.
+/// @param payload Encoded seat map.
+/// @param payload_size Size of the encoded seat map.
+/// @param num_rows Number of rows.
+/// @param num_cols Number of columns.
+/// @param seats Array of size num_rows * num_cols to expand the seat map to.
+/// @return 0 if the seat map was expanded successfully, 1 otherwise.
+static int decode_seat_map(unsigned char encoding, const char *payload, size_t payload_size, size_t num_rows,
+                           size_t num_cols, unsigned int *seats) {
+  if (encoding == SHOW_ENCODING_RAW) {
+    if (payload_size != sizeof(unsigned int) * num_rows * num_cols) return 1;
+    memcpy(seats, payload, payload_size);
+    return 0;
+  }
+
+  if (encoding != SHOW_ENCODING_RLE) return 1;
+
+  // Runs never cross a row
+  const char *end = payload + payload_size;
+  for (size_t i = 1; i <= num_rows; i++) {
+    size_t j = 1;
+    while (j <= num_cols) {
+      unsigned int length, seat;
+      if (end - payload < (ptrdiff_t)(2 * sizeof(unsigned int))) return 1;
+      memcpy(&length, payload, sizeof(unsigned int));
+      memcpy(&seat, payload + sizeof(unsigned int), sizeof(unsigned int));
+      payload += 2 * sizeof(unsigned int);
+
+      if (length == 0 || length > num_cols - j + 1) return 1;
+      for (unsigned int k = 0; k < length; k++, j++) {
+        seats[seat_index(num_cols, i, j)] = seat;
+      }
+    }
   }
 
-  // Returns 0 on success
   return 0;
 }
 
-int ems_show(int out_fd, unsigned int event_id) {
-
-  char op_code = '5';
+/// Prints a seat map to the output file, a row at a time into the output buffer.
+/// @return 0 if the seat map was printed successfully, 1 otherwise.
+static int print_seat_map(int out_fd, const unsigned int *seats, size_t num_rows, size_t num_cols) {
+  output_start(&output, out_fd);
+  for (size_t i = 1; i <= num_rows; i++) {
+    for (size_t j = 1; j <= num_cols; j++) {
+      output_uint(&output, seats[seat_index(num_cols, i, j)]);
+      output_char(&output, j < num_cols ? ' ' : '\n');
+    }
+  }
 
-  // Sends request
-  if (write(req_pipe, &op_code, sizeof(char)) == -1 ||
-      write(req_pipe, &session_id, sizeof(int)) == -1 ||
-      write(req_pipe, &event_id, sizeof(unsigned int)) == -1) {
-    fprintf(stderr, "Error writing to request pipe (ems_show)\n");
-    ems_quit();
+  if (output_flush(&output)) {
+    fprintf(stderr, "Error writing seat layout to output file (ems_show)\n");
     return 1;
   }
+  return 0;
+}
 
-  printf("REQUEST FOR EMS_SHOW SENT!\n");
+/// Finds the local copy of an event.
+/// @return Local copy of the event, NULL if there is none.
+static struct EventGrid *find_grid(unsigned int event_id) {
+  for (size_t i = 0; i < GRID_CACHE_SIZE; i++) {
+    if (grids[i].seats != NULL && grids[i].id == event_id) return &grids[i];
+  }
+  return NULL;
+}
 
-  int ret_value;
+/// Drops the local copy of an event, if there is one.
+static void drop_grid(unsigned int event_id) {
+  struct EventGrid *grid = find_grid(event_id);
+  if (grid != NULL) {
+    free(grid->seats);
+    grid->seats = NULL;
+  }
+}
+
+/// Reads a whole seat map from the response pipe into the local copy of an event.
+/// @note The copy replaces the previous one of the event or, failing that, the oldest one in the cache.
+/// @return Local copy of the event, NULL on failure.
+static struct EventGrid *read_full_grid(unsigned int event_id) {
   size_t num_rows;
   size_t num_cols;
+  unsigned char encoding;
+  size_t payload_size;
+
+  // Reads num_rows, num_cols and the encoding of the seat map from response pipe
+  if (read_response(&num_rows, sizeof(size_t)) || read_response(&num_cols, sizeof(size_t)) ||
+      read_response(&encoding, sizeof(unsigned char)) || read_response(&payload_size, sizeof(size_t))) {
+    fprintf(stderr, "Error reading num_rows or num_cols from request pipe (ems_show)\n");
+    return NULL;
+  }
+
+  char *payload = malloc(payload_size);
+  unsigned int *seats = malloc(num_rows * num_cols * sizeof(unsigned int));
+  // Reads room layout from response pipe
+  if (payload == NULL || seats == NULL || read_response(payload, payload_size) ||
+      decode_seat_map(encoding, payload, payload_size, num_rows, num_cols, seats)) {
+    fprintf(stderr, "Error reading seats layout from request pipe (ems_show)\n");
+    free(payload);
+    free(seats);
+    return NULL;
+  }
+  free(payload);
 
+  struct EventGrid *grid = find_grid(event_id);
+  if (grid == NULL) {
+    grid = &grids[next_grid];
+    next_grid = (next_grid + 1) % GRID_CACHE_SIZE;
+  }
+  free(grid->seats);
+
+  grid->id = event_id;
+  grid->rows = num_rows;
+  grid->cols = num_cols;
+  grid->seats = seats;
+  return grid;
+}
+
+/// Reads the seats changed since the local copy of an event from the response pipe and applies them to it.
+/// @return 0 if the changes were applied successfully, 1 otherwise.
+static int read_delta_grid(struct EventGrid *grid) {
+  size_t num_changed;
+  if (read_response(&num_changed, sizeof(size_t)) || num_changed > grid->rows * grid->cols) {
+    fprintf(stderr, "Error reading changed seats from request pipe (ems_show)\n");
+    return 1;
+  }
+
+  size_t *indices = malloc(num_changed * sizeof(size_t));
+  unsigned int *seats = malloc(num_changed * sizeof(unsigned int));
+  if (indices == NULL || seats == NULL || read_response(indices, num_changed * sizeof(size_t)) ||
+      read_response(seats, num_changed * sizeof(unsigned int))) {
+    fprintf(stderr, "Error reading changed seats from request pipe (ems_show)\n");
+    free(indices);
+    free(seats);
+    return 1;
+  }
+
+  // Changes are in order, so a seat changed twice ends with its latest reservation id
+  int ret = 0;
+  for (size_t i = 0; i < num_changed; i++) {
+    if (indices[i] >= grid->rows * grid->cols) {
+      ret = 1;
+      break;
+    }
+    grid->seats[indices[i]] = seats[i];
+  }
+
+  free(indices);
+  free(seats);
+  return ret;
+}
+
+/// Reads the response to SHOW and prints the updated local copy of the event.
+/// @note The local copy is looked up again, as responses to other SHOWs of the event may have updated it since the
+/// request was sent. Each of them carries every seat changed since the version it was sent with, up to its own.
+static int read_show(const struct PendingRequest *request, struct EmsCompletion *completion) {
+  (void)completion;
+  unsigned int event_id = request->event_id;
+  size_t serial, since;
+  int ret_value;
+  unsigned char kind;
 
   // Reads return value from response pipe
-  if( read(resp_pipe, &ret_value, sizeof(int)) == -1 ){
+  if( read_response(&ret_value, sizeof(int)) ){
     fprintf(stderr, "Error reading return value from request pipe (ems_show)\n");
     ems_quit();
     return 1;
@@ -222,75 +868,78 @@ int ems_show(int out_fd, unsigned int event_id) {
 
    if(ret_value == 1){
       fprintf(stderr, "EMS_SHOW FAILED (ems_show)\n");
+      drop_grid(event_id);
       ems_quit();
       return 1;
-   } else {
+   }
 
-      // Reads num_rows and num_cols from response pipe
-      if(read(resp_pipe, &num_rows , sizeof(size_t)) == -1 || read(resp_pipe, &num_cols , sizeof(size_t)) == -1) {
-        fprintf(stderr, "Error reading num_rows or num_cols from request pipe (ems_show)\n");
-        ems_quit();
-        return 1;
-      }
+   if (read_response(&serial, sizeof(size_t)) || read_response(&since, sizeof(size_t)) ||
+       read_response(&kind, sizeof(unsigned char))) {
+     fprintf(stderr, "Error reading event version from request pipe (ems_show)\n");
+     ems_quit();
+     return 1;
+   }
 
-      unsigned int seats[num_rows*num_cols];
-      // Reads room layout from response pipe
-      if(read(resp_pipe, &seats, sizeof(unsigned int)* num_rows * num_cols) == -1){
-        fprintf(stderr, "Error reading seats layout from request pipe (ems_show)\n");
-        ems_quit();
-        return 1;
-      }
+   struct EventGrid *grid = find_grid(event_id);
+   if (kind == SHOW_SINCE_FULL) {
+     grid = read_full_grid(event_id);
+   } else if (grid == NULL || kind != SHOW_SINCE_DELTA || read_delta_grid(grid)) {
+     grid = NULL;
+   }
 
-      // Prints the layout of the room to the output file
-      for (size_t i = 1; i <= num_rows; i++) {
-        for (size_t j = 1; j <= num_cols; j++) {
-
-          char seat_str[2];
-          sprintf(seat_str, "%u", seats[seat_index(num_cols, i, j)]);
-
-          if (write(out_fd, seat_str, 1) == -1) {
-            fprintf(stderr, "Error writing seat to output file (ems_show)\n");
-            ems_quit();
-            return 1;
-          }
-
-          if(j < num_cols){
-            if (write(out_fd, " ", sizeof(char)) == -1) {
-              fprintf(stderr, "Error writing space in seat layout to output file (ems_show)\n");
-              ems_quit();
-              return 1;
-            }
-          }
-        }
+   if (grid == NULL) {
+     drop_grid(event_id);
+     ems_quit();
+     return 1;
+   }
 
-        if (write(out_fd, "\n", sizeof(char)) == -1) {
-          fprintf(stderr, "Error writing newline in seat layout to output file (ems_show)\n");
-          ems_quit();
-          return 1;
-        }
-     }
+   grid->serial = serial;
+   grid->version = since;
+
+   // Prints the layout of the room to the output file
+   if (print_seat_map(request->out_fd, grid->seats, grid->rows, grid->cols)) {
+     fprintf(stderr, "Error printing seats layout (ems_show)\n");
+     ems_quit();
+     return 1;
    }
 
    // Returns 0 on success
   return 0;
 }
 
-int ems_list_events(int out_fd) {
-  //TODO: send list request to the server (through the request pipe) and wait for the response (through the response pipe)
-
-  char op_code = '6';
+int ems_show(int out_fd, unsigned int event_id) {
+  flush_batch();  // Sent after the commands batched before it
+
+  unsigned char encodings = (1u << SHOW_ENCODING_RAW) | (1u << SHOW_ENCODING_RLE);
+  struct EventGrid *grid = find_grid(event_id);
+  size_t serial = grid != NULL ? grid->serial : 0;
+  size_t since = grid != NULL ? grid->version : 0;
+
+  struct PendingRequest *request = begin_request(
+      '8', "ems_show", sizeof(unsigned int) + sizeof(unsigned char) + 2 * sizeof(size_t), read_show);
+  request->out_fd = out_fd;
+  request->event_id = event_id;
+
+  // Sends request with the version of the local copy of the event, if there is one
+  struct iovec fields[] = {
+      {&event_id, sizeof(unsigned int)},
+      {&encodings, sizeof(unsigned char)},
+      {&serial, sizeof(size_t)},
+      {&since, sizeof(size_t)}};
+  if (send_request(request, fields, 4)) return fail_request(request);
 
-  // Sends request
-  if((write(req_pipe, &op_code, sizeof(char)) == -1) || write(req_pipe, &session_id, sizeof(int)) == -1){
-      ems_quit();
-      return 1;
-  }
+  printf("REQUEST FOR EMS_SHOW SENT!\n");
+  return end_request(request);
+}
 
-  printf("REQUEST FOR EMS_LIST_EVENTS SENT!\n");
+/// Reads the response to LIST_EVENTS and prints the events.
+static int read_list_events(const struct PendingRequest *request, struct EmsCompletion *completion) {
+  (void)completion;
+  int out_fd = request->out_fd;
 
   int ret_value;
   // Reads return value from response pipe
-  if( read(resp_pipe, &ret_value, sizeof(int)) == -1 ){
+  if( read_response(&ret_value, sizeof(int)) ){
       fprintf(stderr, "Error reading return value from request pipe (ems_show)\n");
       ems_quit();
       return 1;
@@ -302,9 +951,7 @@ int ems_list_events(int out_fd) {
 
   } else if(ret_value == 2){
 
-      char no_events[] = "No Events\n";
-
-      if(write(out_fd, &no_events, sizeof(no_events)) == -1){
+      if (print_str(out_fd, "No Events\n")) {
         fprintf(stderr,"Error writing 'No Events' to out file descriptor\n");
         return 1;
       }
@@ -315,45 +962,49 @@ int ems_list_events(int out_fd) {
 
       size_t num_events;
 
-      if( read(resp_pipe, &num_events, sizeof(size_t)) == -1 ){
+      if( read_response(&num_events, sizeof(size_t)) ){
         fprintf(stderr, "Error reading num_events from request pipe (ems_list_events)\n");
         ems_quit();
         return 1;
       }
 
-      unsigned int ids[num_events];
+      // Read a chunk at a time, so the stack use does not depend on a length read from the server
+      unsigned int ids[LIST_CHUNK_IDS];
+      output_start(&output, out_fd);
 
-      if( read(resp_pipe, &ids, sizeof(unsigned int)*num_events) == -1 ){
-        fprintf(stderr, "Error reading num_events from request pipe (ems_list_events)\n");
-        ems_quit();
-        return 1;
-      }
-
-      for(size_t i = 0; i < num_events; i++ ){
-
-        char buff[] = "Event: ";
-
-        if (write(out_fd, &buff, strlen(buff)) == -1) {
-          fprintf(stderr,"Error writing 'No Events' to out file descriptor\n");
-          return 1;
-        }
-
-        char event_id_str[2];
-        sprintf(event_id_str, "%u", ids[i]);
-
-        if(write(out_fd, event_id_str, 1) == -1) {
-          fprintf(stderr, "Error writing event ID to out file descriptor\n");
+      for (size_t read_ids = 0; read_ids < num_events;) {
+        size_t count = num_events - read_ids < LIST_CHUNK_IDS ? num_events - read_ids : LIST_CHUNK_IDS;
+        if( read_response(ids, sizeof(unsigned int)*count) ){
+          fprintf(stderr, "Error reading num_events from request pipe (ems_list_events)\n");
+          ems_quit();
           return 1;
         }
 
-        char new_line[] = "\n";
-        if(write(out_fd, new_line, 1) == -1) {
-          fprintf(stderr, "Error writing event ID to out file descriptor\n");
-          return 1;
+        for (size_t i = 0; i < count; i++) {
+          output_str(&output, "Event: ");
+          output_uint(&output, ids[i]);
+          output_char(&output, '\n');
         }
+        read_ids += count;
+      }
 
+      if (output_flush(&output)) {
+        fprintf(stderr, "Error writing event IDs to out file descriptor\n");
+        return 1;
       }
 
       return 0;
   }
 }
+
+int ems_list_events(int out_fd) {
+  flush_batch();  // Sent after the commands batched before it
+
+  struct PendingRequest *request = begin_request('6', "ems_list_events", 0, read_list_events);
+  request->out_fd = out_fd;
+
+  if (send_request(request, NULL, 0)) return fail_request(request);
+
+  printf("REQUEST FOR EMS_LIST_EVENTS SENT!\n");
+  return end_request(request);
+}
@@ -10,11 +10,44 @@
 #include "common/constants.h"
 
 /// Connects to an EMS server.
+/// @note The session belongs to the calling thread, which the functions below then send their requests over. Other
+/// threads may each set up a session of their own, with pipes of their own.
 /// @param req_pipe_path Path to the name pipe to be created for requests.
 /// @param resp_pipe_path Path to the name pipe to be created for responses.
-/// @param server_pipe_path Path to the name pipe where the server is listening.
+/// @param server_pipe_path Path to the name pipe where the server is listening, or to its socket.
+/// @param transport TRANSPORT_FIFO to register the named pipes, TRANSPORT_SOCKET to connect to the server socket
+/// instead, TRANSPORT_SHM to register a shared-memory segment. The named pipes are only used by TRANSPORT_FIFO.
 /// @return 0 if the connection was established successfully, 1 otherwise.
-int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path);
+int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path, int transport);
+
+/// Outcome of a request, see ems_pipeline.
+struct EmsCompletion {
+  unsigned int request_id;  // Id the request was sent with, echoed by the server in its response
+  char op_code;             // OP_CODE of the request
+  int status;               // What the function sending the request returns without pipelining
+  size_t num_seats;         // Seats asked for by RESERVE_BEST
+  size_t row, col;          // Seats chosen by RESERVE_BEST
+};
+
+/// Lets the functions below return once their request is sent, without waiting for its response.
+/// @note Responses are read in the order their requests were sent, once more than depth requests are in flight or
+/// the next request would not fit in the pipes along with them. The outcome of each request, failing to send it
+/// included, is then passed to on_complete, and the function that sent it returns 0.
+/// @param depth Most requests in flight, from 1, which still waits for each response, to MAX_PIPELINE_DEPTH.
+/// @param on_complete Function to pass the outcome of each request to.
+/// @return 0 if the pipeline was set up successfully, 1 otherwise.
+int ems_pipeline(size_t depth, void (*on_complete)(const struct EmsCompletion* completion));
+
+/// Gathers the commands of ems_create, ems_reserve, ems_transaction, ems_cancel and ems_delete into BATCH
+/// requests, each executed by the server in one go and answered with the status of every command.
+/// @note A batch is sent once it is full, before any other request, and by ems_drain. Each command is reported to
+/// the completion handler of ems_pipeline on its own, and the function that gathered it returns 0.
+/// @param enabled Whether to gather commands, 0 sends the ones gathered so far.
+/// @return 0 if batching was set up successfully, 1 if there is no completion handler to report commands to.
+int ems_batch(int enabled);
+
+/// Waits for the responses to every request in flight, see ems_pipeline, sending the commands gathered first.
+void ems_drain(void);
 
 /// Disconnects from an EMS server.
 /// @return 0 in case of success, 1 otherwise.
@@ -35,6 +68,37 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 /// @return 0 if the reservation was created successfully, 1 otherwise.
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys);
 
+/// Creates a reservation for the first run of adjacent free seats in a row of the given event.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of adjacent seats to reserve.
+/// @param min_row First row the seats may be in, 0 for the first row of the event.
+/// @param max_row Last row the seats may be in, 0 for the last row of the event.
+/// @param row Pointer to the variable to store the row of the seats in, or NULL.
+/// @param col Pointer to the variable to store the column of the first seat in, or NULL.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+int ems_reserve_best(unsigned int event_id, size_t num_seats, size_t min_row, size_t max_row, size_t* row,
+                     size_t* col);
+
+/// Creates reservations in several events as a single transaction, either every reservation is created or none.
+/// @param num_events Number of events, at most MAX_TRANSACTION_EVENTS.
+/// @param event_ids Array of ids of the events to create a reservation for.
+/// @param num_seats Array of numbers of seats to reserve in each event.
+/// @param xs Array of rows of the seats to reserve, those of each event following those of the previous one.
+/// @param ys Array of columns of the seats to reserve, in the same order as xs.
+/// @return 0 if the reservations were created successfully, 1 otherwise.
+int ems_transaction(size_t num_events, unsigned int* event_ids, size_t* num_seats, size_t* xs, size_t* ys);
+
+/// Cancels a reservation of the given event, freeing its seats.
+/// @param event_id Id of the event of the reservation.
+/// @param reservation_id Id of the reservation to cancel, as shown by ems_show.
+/// @return 0 if the reservation was cancelled successfully, 1 otherwise.
+int ems_cancel(unsigned int event_id, unsigned int reservation_id);
+
+/// Deletes the given event.
+/// @param event_id Id of the event to be deleted.
+/// @return 0 if the event was deleted successfully, 1 otherwise.
+int ems_delete(unsigned int event_id);
+
 /// Prints the given event to the given file.
 /// @param out_fd File descriptor to print the event to.
 /// @param event_id Id of the event to print.
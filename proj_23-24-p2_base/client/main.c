@@ -1,99 +1,190 @@
+#include <dirent.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "api.h"
 #include "common/constants.h"
 #include "parser.h"
 
-int main(int argc, char* argv[]) {
+/// Prints how the client is run.
+static void print_usage(const char* name) {
+  fprintf(stderr,
+          "Usage: %s [-t fifo|socket|shm] [-p depth] [-b] [-j sessions] <request pipe path> <response pipe path> "
+          "<server pipe path> <.jobs file or directory path>\n",
+          name);
+}
 
-  if (argc < 5) {
-    fprintf(stderr, "Usage: %s <request pipe path> <response pipe path> <server pipe path> <.jobs file path>\n",
-            argv[0]);
-    return 1;
+/// Reports the outcome of a request, in the order the requests were sent.
+static void report(const struct EmsCompletion* completion) {
+  if (completion->status == 0) {
+    if (completion->op_code == 'A') {
+      printf("Reserved %zu seats in row %zu from column %zu\n", completion->num_seats, completion->row,
+             completion->col);
+    }
+    return;
   }
 
-  printf("Client is now running...\n");
-
-  if (ems_setup(argv[1], argv[2], argv[3])) {
-    fprintf(stderr, "Failed to set up EMS\n");
-    unlink(argv[1]);   // deletes the request and response pipes
-    unlink(argv[2]);
-    return 1;
+  switch (completion->op_code) {
+    case '3':
+      fprintf(stderr, "Failed to create event\n");
+      break;
+    case '4':
+    case '9':
+    case 'A':
+      fprintf(stderr, "Failed to reserve seats\n");
+      break;
+    case '6':
+      fprintf(stderr, "Failed to list events\n");
+      break;
+    case '7':
+      fprintf(stderr, "Failed to delete event\n");
+      break;
+    case '8':
+      fprintf(stderr, "Failed to show event\n");
+      break;
+    case 'B':
+      fprintf(stderr, "Failed to cancel reservation\n");
+      break;
+    default:
+      break;
   }
+}
 
-  const char* dot = strrchr(argv[4], '.');
-  if (dot == NULL || dot == argv[4] || strlen(dot) != 5 || strcmp(dot, ".jobs") ||
-      strlen(argv[4]) > MAX_JOB_FILE_NAME_SIZE) {
-    fprintf(stderr, "The provided .jobs file path is not valid. Path: %s\n", argv[1]);
+/// Runs the commands of a .jobs file over the session of the calling thread, printing their output to a .out file.
+/// @param path Path of the .jobs file, the .out file is put next to it.
+/// @param num_commands Pointer to the variable to add the number of commands run to.
+/// @return 0 if the file was run, 1 if it or its .out file could not be opened.
+static int run_jobs(const char* path, size_t* num_commands) {
+  const char* dot = strrchr(path, '.');
+  if (dot == NULL || dot == path || strlen(dot) != 5 || strcmp(dot, ".jobs") ||
+      strlen(path) >= MAX_JOB_FILE_NAME_SIZE) {
+    fprintf(stderr, "The provided .jobs file path is not valid. Path: %s\n", path);
     return 1;
   }
 
   char out_path[MAX_JOB_FILE_NAME_SIZE];
-  strcpy(out_path, argv[4]);
+  strcpy(out_path, path);
   strcpy(strrchr(out_path, '.'), ".out");
 
-  int in_fd = open(argv[4], O_RDONLY);
+  int in_fd = open(path, O_RDONLY);
   if (in_fd == -1) {
-    fprintf(stderr, "Failed to open input file. Path: %s\n", argv[4]);
+    fprintf(stderr, "Failed to open input file. Path: %s\n", path);
     return 1;
   }
 
   int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
   if (out_fd == -1) {
     fprintf(stderr, "Failed to open output file. Path: %s\n", out_path);
+    close(in_fd);
+    return 1;
+  }
+
+  struct JobsFile jobs;
+  if (jobs_open(&jobs, in_fd)) {
+    fprintf(stderr, "Failed to read input file. Path: %s\n", path);
+    close(in_fd);
+    close(out_fd);
     return 1;
   }
 
   while (1) {
-    unsigned int event_id;
-    size_t num_rows, num_columns, num_coords;
+    unsigned int event_id, reservation_id;
+    size_t num_rows, num_columns, num_coords, min_row, max_row;
     unsigned int delay = 0;
     size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+    unsigned int event_ids[MAX_TRANSACTION_EVENTS];
+    size_t num_events, event_coords[MAX_TRANSACTION_EVENTS];
+
+    enum Command command = get_next(&jobs);
+    if (command != CMD_EMPTY && command != CMD_INVALID && command != EOC) (*num_commands)++;
 
-    switch (get_next(in_fd)) {
+    switch (command) {
       case CMD_CREATE:
-        if (parse_create(in_fd, &event_id, &num_rows, &num_columns) != 0) {
+        if (parse_create(&jobs, &event_id, &num_rows, &num_columns) != 0) {
           fprintf(stderr, "Invalid command. See HELP for usage\n");
           continue;
         }
 
-        if (ems_create(event_id, num_rows, num_columns)) fprintf(stderr, "Failed to create event\n");
+        ems_create(event_id, num_rows, num_columns);
         break;
 
       case CMD_RESERVE:
-        num_coords = parse_reserve(in_fd, MAX_RESERVATION_SIZE, &event_id, xs, ys);
+        num_coords = parse_reserve(&jobs, MAX_RESERVATION_SIZE, &event_id, xs, ys);
 
         if (num_coords == 0) {
           fprintf(stderr, "Invalid command. See HELP for usage\n");
           continue;
         }
 
-        if (ems_reserve(event_id, num_coords, xs, ys)) fprintf(stderr, "Failed to reserve seats\n");
+        ems_reserve(event_id, num_coords, xs, ys);
+        break;
+
+      case CMD_RESERVE_BEST:
+        if (parse_reserve_best(&jobs, &event_id, &num_coords, &min_row, &max_row) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        ems_reserve_best(event_id, num_coords, min_row, max_row, NULL, NULL);
+        break;
+
+      case CMD_TRANSACTION:
+        num_events = parse_transaction(&jobs, MAX_TRANSACTION_EVENTS, MAX_RESERVATION_SIZE, event_ids, event_coords,
+                                       xs, ys);
+
+        if (num_events == 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        ems_transaction(num_events, event_ids, event_coords, xs, ys);
         break;
 
       case CMD_SHOW:
-        if (parse_show(in_fd, &event_id) != 0) {
+        if (parse_show(&jobs, &event_id) != 0) {
           fprintf(stderr, "Invalid command. See HELP for usage\n");
           continue;
         }
 
-        if (ems_show(out_fd, event_id)) fprintf(stderr, "Failed to show event\n");
+        ems_show(out_fd, event_id);
+        break;
+
+      case CMD_CANCEL:
+        if (parse_cancel(&jobs, &event_id, &reservation_id) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        ems_cancel(event_id, reservation_id);
+        break;
+
+      case CMD_DELETE:
+        if (parse_delete(&jobs, &event_id) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        ems_delete(event_id);
         break;
 
       case CMD_LIST_EVENTS:
-        if (ems_list_events(out_fd)) fprintf(stderr, "Failed to list events\n");
+        ems_list_events(out_fd);
         break;
 
       case CMD_WAIT:
-        if (parse_wait(in_fd, &delay, NULL) == -1) {
+        if (parse_wait(&jobs, &delay, NULL) == -1) {
             fprintf(stderr, "Invalid command. See HELP for usage\n");
             continue;
         }
 
         if (delay > 0) {
+            ems_drain();  // Requests before the wait are answered before it
             printf("Waiting...\n");
             printf("%u\n", delay);
             sleep(delay);
@@ -109,7 +200,11 @@ int main(int argc, char* argv[]) {
             "Available commands:\n"
             "  CREATE <event_id> <num_rows> <num_columns>\n"
             "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+            "  RESERVE_BEST <event_id> <num_seats> [<min_row> <max_row>]\n"
+            "  TRANSACTION <event_id> [(<x1>,<y1>) ...] <event_id> [(<x1>,<y1>) ...] ...\n"
             "  SHOW <event_id>\n"
+            "  CANCEL <event_id> <reservation_id>\n"
+            "  DELETE <event_id>\n"
             "  LIST\n"
             "  WAIT <delay_ms>\n"
             "  HELP\n");
@@ -120,10 +215,247 @@ int main(int argc, char* argv[]) {
         break;
 
       case EOC:
+        ems_drain();
+        jobs_close(&jobs);
         close(in_fd);
         close(out_fd);
-        ems_quit();
         return 0;
     }
   }
-}
\ No newline at end of file
+}
+
+/// Options every session of the client is set up with.
+struct Options {
+  int transport;
+  size_t depth;
+  int batch;
+};
+
+/// Connects the calling thread to the server, see ems_setup.
+/// @return 0 if the session was set up successfully, 1 otherwise.
+static int start_session(const struct Options* options, const char* req_pipe_path, const char* resp_pipe_path,
+                         const char* server_pipe_path) {
+  if (ems_setup(req_pipe_path, resp_pipe_path, server_pipe_path, options->transport)) {
+    fprintf(stderr, "Failed to set up EMS\n");
+    if (options->transport == TRANSPORT_FIFO) {
+      unlink(req_pipe_path);   // deletes the request and response pipes
+      unlink(resp_pipe_path);
+    }
+    return 1;
+  }
+
+  // Requests are reported by report whether or not they are pipelined, or batched
+  ems_pipeline(options->depth, report);
+  ems_batch(options->batch);
+  return 0;
+}
+
+/// The .jobs files of a directory, each taken by the first session free to run it.
+struct JobQueue {
+  char** paths;  // Sorted by name
+  size_t count;
+  size_t next;          // First file no session took yet
+  size_t files_run;     // Files run so far, and the commands in them
+  size_t commands_run;
+  pthread_mutex_t mutex;
+};
+
+/// A thread of the pool, running files from the queue over pipes of its own.
+struct Worker {
+  pthread_t thread;
+  char req_pipe_path[MAX_PIPE_NAME];
+  char resp_pipe_path[MAX_PIPE_NAME];
+  const char* server_pipe_path;
+  const struct Options* options;
+  struct JobQueue* queue;
+};
+
+/// Runs files from the queue until it is empty.
+static void* worker_function(void* arg) {
+  struct Worker* worker = arg;
+  struct JobQueue* queue = worker->queue;
+
+  while (1) {
+    pthread_mutex_lock(&queue->mutex);
+    const char* path = queue->next < queue->count ? queue->paths[queue->next++] : NULL;
+    pthread_mutex_unlock(&queue->mutex);
+    if (path == NULL) break;
+
+    // Each file gets a session of its own, as when run on its own, since a failed SHOW ends the session
+    size_t num_commands = 0;
+    int failed = start_session(worker->options, worker->req_pipe_path, worker->resp_pipe_path,
+                               worker->server_pipe_path);
+    if (!failed) {
+      failed = run_jobs(path, &num_commands);
+      ems_quit();
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+    if (!failed) queue->files_run++;
+    queue->commands_run += num_commands;
+    pthread_mutex_unlock(&queue->mutex);
+  }
+
+  return NULL;
+}
+
+/// Orders the paths of .jobs files by name, for qsort.
+static int compare_paths(const void* a, const void* b) { return strcmp(*(char* const*)a, *(char* const*)b); }
+
+/// Finds the .jobs files of a directory.
+/// @param queue Queue to put the paths of the files in, sorted.
+/// @return 0 if the directory was read successfully, 1 otherwise.
+static int find_jobs(const char* dir_path, struct JobQueue* queue) {
+  DIR* dir = opendir(dir_path);
+  if (dir == NULL) {
+    fprintf(stderr, "Failed to open jobs directory. Path: %s\n", dir_path);
+    return 1;
+  }
+
+  size_t capacity = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    size_t length = strlen(entry->d_name);
+    if (length <= 5 || strcmp(entry->d_name + length - 5, ".jobs") != 0) continue;
+
+    char path[MAX_JOB_FILE_NAME_SIZE];
+    struct stat st;
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name) >= sizeof(path)) {
+      fprintf(stderr, "The provided .jobs file path is not valid. Path: %s/%s\n", dir_path, entry->d_name);
+      continue;
+    }
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+    if (queue->count == capacity) {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      char** paths = realloc(queue->paths, capacity * sizeof(char*));
+      if (paths == NULL) break;
+      queue->paths = paths;
+    }
+    if ((queue->paths[queue->count] = strdup(path)) == NULL) break;
+    queue->count++;
+  }
+
+  int failed = entry != NULL;
+  if (failed) fprintf(stderr, "Error allocating memory for .jobs file paths\n");
+  closedir(dir);
+
+  if (queue->count > 0) qsort(queue->paths, queue->count, sizeof(char*), compare_paths);
+  return failed;
+}
+
+/// Runs the .jobs files of a directory concurrently, on a pool of threads each with a session open at a time.
+/// @note Each file gets the same .out as when run on its own, as long as the files do not use the same events.
+/// @param num_sessions Threads of the pool, each with its own pipes, named after the given ones followed by its number.
+/// @return 0 if every file was run, 1 otherwise.
+static int run_directory(const struct Options* options, const char* req_pipe_path, const char* resp_pipe_path,
+                         const char* server_pipe_path, const char* dir_path, size_t num_sessions) {
+  struct JobQueue queue = {.paths = NULL};
+  if (find_jobs(dir_path, &queue) != 0 || queue.count == 0) {
+    if (queue.count == 0) fprintf(stderr, "No .jobs files found. Path: %s\n", dir_path);
+    for (size_t i = 0; i < queue.count; i++) free(queue.paths[i]);
+    free(queue.paths);
+    return 1;
+  }
+
+  if (num_sessions > queue.count) num_sessions = queue.count;
+  struct Worker* workers = calloc(num_sessions, sizeof(struct Worker));
+  if (workers == NULL || pthread_mutex_init(&queue.mutex, NULL) != 0) {
+    fprintf(stderr, "Error allocating memory for sessions\n");
+    for (size_t i = 0; i < queue.count; i++) free(queue.paths[i]);
+    free(queue.paths);
+    free(workers);
+    return 1;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  size_t started = 0;
+  for (size_t i = 0; i < num_sessions; i++) {
+    struct Worker* worker = &workers[started];
+    *worker = (struct Worker){.server_pipe_path = server_pipe_path, .options = options, .queue = &queue};
+
+    if ((size_t)snprintf(worker->req_pipe_path, MAX_PIPE_NAME, "%s.%zu", req_pipe_path, i + 1) >= MAX_PIPE_NAME ||
+        (size_t)snprintf(worker->resp_pipe_path, MAX_PIPE_NAME, "%s.%zu", resp_pipe_path, i + 1) >= MAX_PIPE_NAME) {
+      fprintf(stderr, "Pipe paths too long for session %zu\n", i + 1);
+      continue;
+    }
+    if (pthread_create(&worker->thread, NULL, worker_function, worker) != 0) {
+      fprintf(stderr, "Error starting session %zu\n", i + 1);
+      continue;
+    }
+    started++;
+  }
+
+  for (size_t i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("Ran %zu of %zu .jobs files, %zu commands, over %zu sessions in %.3f s: %.1f files/s, %.1f commands/s\n",
+         queue.files_run, queue.count, queue.commands_run, started, elapsed, (double)queue.files_run / elapsed,
+         (double)queue.commands_run / elapsed);
+
+  int failed = queue.files_run != queue.count;
+  pthread_mutex_destroy(&queue.mutex);
+  for (size_t i = 0; i < queue.count; i++) free(queue.paths[i]);
+  free(queue.paths);
+  free(workers);
+  return failed;
+}
+
+int main(int argc, char* argv[]) {
+  struct Options options = {.transport = TRANSPORT_FIFO, .depth = 1, .batch = 0};
+  size_t num_sessions = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:p:bj:")) != -1) {
+    if (opt == 't' && strcmp(optarg, "fifo") == 0) {
+      options.transport = TRANSPORT_FIFO;
+    } else if (opt == 't' && strcmp(optarg, "socket") == 0) {
+      options.transport = TRANSPORT_SOCKET;
+    } else if (opt == 't' && strcmp(optarg, "shm") == 0) {
+      options.transport = TRANSPORT_SHM;
+    } else if (opt == 'p') {
+      char* end;
+      options.depth = strtoul(optarg, &end, 10);
+      if (*optarg == '\0' || *end != '\0' || options.depth == 0 || options.depth > MAX_PIPELINE_DEPTH) {
+        fprintf(stderr, "Invalid pipeline depth: %s\n", optarg);
+        return 1;
+      }
+    } else if (opt == 'b') {
+      options.batch = 1;
+    } else if (opt == 'j') {
+      char* end;
+      num_sessions = strtoul(optarg, &end, 10);
+      if (*optarg == '\0' || *end != '\0' || num_sessions == 0 || num_sessions > MAX_CLIENT_SESSIONS) {
+        fprintf(stderr, "Invalid number of sessions: %s\n", optarg);
+        return 1;
+      }
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (argc - optind < 4) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  argv += optind - 1;  // Positional arguments from argv[1] on
+
+  printf("Client is now running...\n");
+
+  // A directory has its .jobs files run by a pool of sessions
+  struct stat st;
+  if (stat(argv[4], &st) == 0 && S_ISDIR(st.st_mode)) {
+    return run_directory(&options, argv[1], argv[2], argv[3], argv[4], num_sessions);
+  }
+
+  if (start_session(&options, argv[1], argv[2], argv[3])) return 1;
+
+  size_t num_commands = 0;
+  int failed = run_jobs(argv[4], &num_commands);
+  ems_quit();
+  return failed;
+}
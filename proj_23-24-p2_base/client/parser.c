@@ -1,115 +1,249 @@
 #include "parser.h"
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "common/constants.h"
-#include "common/io.h"
 
-static void cleanup(int fd) {
-  char ch;
-  while (read(fd, &ch, 1) == 1 && ch != '\n')
-    ;
+int jobs_open(struct JobsFile *file, int fd) {
+  *file = (struct JobsFile){.fd = fd};
+
+  // A regular file is mapped whole, so parsing it makes no system call at all
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      posix_madvise(mapping, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+      file->mapping = mapping;
+      file->mapping_size = (size_t)st.st_size;
+      file->pos = mapping;
+      file->end = file->pos + st.st_size;
+      return 0;
+    }
+  }
+
+  file->buffer = malloc(JOBS_BUFFER_SIZE);
+  if (file->buffer == NULL) return 1;
+  file->pos = file->buffer;
+  file->end = file->buffer;
+  return 0;
+}
+
+void jobs_close(struct JobsFile *file) {
+  if (file->mapping != NULL) munmap(file->mapping, file->mapping_size);
+  free(file->buffer);
+  *file = (struct JobsFile){.fd = -1};
+}
+
+/// Reads the next characters of a file into its buffer, once those before were all parsed.
+/// @return 1 if there are characters to parse, 0 at the end of the file or on error.
+static int refill(struct JobsFile *file) {
+  if (file->buffer == NULL) return 0;
+
+  ssize_t bytes_read = read(file->fd, file->buffer, JOBS_BUFFER_SIZE);
+  if (bytes_read <= 0) return 0;
+
+  file->pos = file->buffer;
+  file->end = file->buffer + bytes_read;
+  return 1;
+}
+
+/// Takes characters from a file, as read would.
+/// @param buf Buffer to copy the characters to.
+/// @param count Number of characters to take.
+/// @return Number of characters taken, less than count only at the end of the file.
+static size_t read_chars(struct JobsFile *file, char *buf, size_t count) {
+  size_t taken = 0;
+  while (taken < count) {
+    if (file->pos == file->end && !refill(file)) break;
+
+    size_t available = (size_t)(file->end - file->pos);
+    size_t part = count - taken < available ? count - taken : available;
+    memcpy(buf + taken, file->pos, part);
+    file->pos += part;
+    taken += part;
+  }
+  return taken;
 }
 
-enum Command get_next(int fd) {
+/// Skips the rest of the line.
+static void cleanup(struct JobsFile *file) {
+  do {
+    const char *newline = memchr(file->pos, '\n', (size_t)(file->end - file->pos));
+    if (newline != NULL) {
+      file->pos = newline + 1;
+      return;
+    }
+    file->pos = file->end;
+  } while (refill(file));
+}
+
+/// Parses an unsigned integer, scanning its digits straight out of the mapping or buffer.
+/// @param value Pointer to the variable to store the value in, 0 if there are no digits.
+/// @param next Pointer to the variable to store the character after the digits in, '\0' at the end of the file.
+/// @return 0 if the integer was parsed successfully, 1 if it does not fit in an unsigned int.
+static int scan_uint(struct JobsFile *file, unsigned int *value, char *next) {
+  uint64_t result = 0;  // Stops growing past UINT_MAX, so it never wraps around
+
+  while (1) {
+    const char *pos = file->pos;
+    while (pos < file->end && (unsigned char)(*pos - '0') < 10) {
+      result = result * 10 + (uint64_t)(*pos - '0');
+      if (result > UINT_MAX) result = (uint64_t)UINT_MAX + 1;
+      pos++;
+    }
+    file->pos = pos;
+
+    if (pos < file->end) {
+      *next = *file->pos++;
+      break;
+    }
+    if (!refill(file)) {
+      *next = '\0';
+      break;
+    }
+  }
+
+  if (result > UINT_MAX) return 1;
+  *value = (unsigned int)result;
+  return 0;
+}
+
+enum Command get_next(struct JobsFile *file) {
   char buf[16];
-  if (read(fd, buf, 1) != 1) {
+  if (read_chars(file, buf, 1) != 1) {
     return EOC;
   }
 
   switch (buf[0]) {
     case 'C':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
-        cleanup(fd);
+      if (read_chars(file, buf + 1, 6) != 6) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
-      return CMD_CREATE;
+      if (strncmp(buf, "CREATE ", 7) == 0) {
+        return CMD_CREATE;
+      }
+
+      if (strncmp(buf, "CANCEL ", 7) == 0) {
+        return CMD_CANCEL;
+      }
+
+      cleanup(file);
+      return CMD_INVALID;
 
     case 'R':
-      if (read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
-        cleanup(fd);
+      if (read_chars(file, buf + 1, 7) != 7 || strncmp(buf, "RESERVE", 7) != 0 || (buf[7] != ' ' && buf[7] != '_')) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
-      return CMD_RESERVE;
+      if (buf[7] == ' ') {
+        return CMD_RESERVE;
+      }
+
+      if (read_chars(file, buf + 8, 5) != 5 || strncmp(buf, "RESERVE_BEST ", 13) != 0) {
+        cleanup(file);
+        return CMD_INVALID;
+      }
+
+      return CMD_RESERVE_BEST;
+
+    case 'T':
+      if (read_chars(file, buf + 1, 11) != 11 || strncmp(buf, "TRANSACTION ", 12) != 0) {
+        cleanup(file);
+        return CMD_INVALID;
+      }
+
+      return CMD_TRANSACTION;
 
     case 'S':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
-        cleanup(fd);
+      if (read_chars(file, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_SHOW;
 
+    case 'D':
+      if (read_chars(file, buf + 1, 6) != 6 || strncmp(buf, "DELETE ", 7) != 0) {
+        cleanup(file);
+        return CMD_INVALID;
+      }
+
+      return CMD_DELETE;
+
     case 'L':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
-        cleanup(fd);
+      if (read_chars(file, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
-        cleanup(fd);
+      if (read_chars(file, buf + 4, 1) != 0 && buf[4] != '\n') {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_LIST_EVENTS;
 
     case 'W':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
-        cleanup(fd);
+      if (read_chars(file, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_WAIT;
 
     case 'H':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
-        cleanup(fd);
+      if (read_chars(file, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
-        cleanup(fd);
+      if (read_chars(file, buf + 4, 1) != 0 && buf[4] != '\n') {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_HELP;
 
     case '#':
-      cleanup(fd);
+      cleanup(file);
       return CMD_EMPTY;
 
     case '\n':
       return CMD_EMPTY;
 
     default:
-      cleanup(fd);
+      cleanup(file);
       return CMD_INVALID;
   }
 }
 
-int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_cols) {
+int parse_create(struct JobsFile *file, unsigned int *event_id, size_t *num_rows, size_t *num_cols) {
   char ch;
 
-  if (parse_uint(fd, event_id, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
+  if (scan_uint(file, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(file);
     return 1;
   }
 
   unsigned int u_num_rows;
-  if (parse_uint(fd, &u_num_rows, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
+  if (scan_uint(file, &u_num_rows, &ch) != 0 || ch != ' ') {
+    cleanup(file);
     return 1;
   }
   *num_rows = (size_t)u_num_rows;
 
   unsigned int u_num_cols;
-  if (parse_uint(fd, &u_num_cols, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (scan_uint(file, &u_num_cols, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
     return 1;
   }
   *num_cols = (size_t)u_num_cols;
@@ -117,44 +251,45 @@ int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_c
   return 0;
 }
 
-size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys) {
+/// Parses a list of coordinates between square brackets.
+/// @param file File to read from.
+/// @param max Maximum number of coordinates to read, plus one.
+/// @param xs Pointer to the array to store the X coordinates in.
+/// @param ys Pointer to the array to store the Y coordinates in.
+/// @return Number of coordinates read. 0 on failure, after cleaning up the line.
+static size_t parse_coords(struct JobsFile *file, size_t max, size_t *xs, size_t *ys) {
   char ch;
 
-  if (parse_uint(fd, event_id, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
-    return 0;
-  }
-
-  if (read(fd, &ch, 1) != 1 || ch != '[') {
-    cleanup(fd);
+  if (read_chars(file, &ch, 1) != 1 || ch != '[') {
+    cleanup(file);
     return 0;
   }
 
   size_t num_coords = 0;
   while (num_coords < max) {
-    if (read(fd, &ch, 1) != 1 || ch != '(') {
-      cleanup(fd);
+    if (read_chars(file, &ch, 1) != 1 || ch != '(') {
+      cleanup(file);
       return 0;
     }
 
     unsigned int x;
-    if (parse_uint(fd, &x, &ch) != 0 || ch != ',') {
-      cleanup(fd);
+    if (scan_uint(file, &x, &ch) != 0 || ch != ',') {
+      cleanup(file);
       return 0;
     }
     xs[num_coords] = (size_t)x;
 
     unsigned int y;
-    if (parse_uint(fd, &y, &ch) != 0 || ch != ')') {
-      cleanup(fd);
+    if (scan_uint(file, &y, &ch) != 0 || ch != ')') {
+      cleanup(file);
       return 0;
     }
     ys[num_coords] = (size_t)y;
 
     num_coords++;
 
-    if (read(fd, &ch, 1) != 1 || (ch != ' ' && ch != ']')) {
-      cleanup(fd);
+    if (read_chars(file, &ch, 1) != 1 || (ch != ' ' && ch != ']')) {
+      cleanup(file);
       return 0;
     }
 
@@ -164,45 +299,165 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
   }
 
   if (num_coords == max) {
-    cleanup(fd);
+    cleanup(file);
+    return 0;
+  }
+
+  return num_coords;
+}
+
+size_t parse_reserve(struct JobsFile *file, size_t max, unsigned int *event_id, size_t *xs, size_t *ys) {
+  char ch;
+
+  if (scan_uint(file, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(file);
+    return 0;
+  }
+
+  size_t num_coords = parse_coords(file, max, xs, ys);
+  if (num_coords == 0) {
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (read_chars(file, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
     return 0;
   }
 
   return num_coords;
 }
 
-int parse_show(int fd, unsigned int *event_id) {
+int parse_reserve_best(struct JobsFile *file, unsigned int *event_id, size_t *num_seats, size_t *min_row,
+                       size_t *max_row) {
+  char ch;
+
+  if (scan_uint(file, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(file);
+    return 1;
+  }
+
+  unsigned int u_num_seats;
+  if (scan_uint(file, &u_num_seats, &ch) != 0 || (ch != ' ' && ch != '\n' && ch != '\0')) {
+    cleanup(file);
+    return 1;
+  }
+  *num_seats = (size_t)u_num_seats;
+  *min_row = 0;
+  *max_row = 0;
+
+  if (ch != ' ') {
+    return 0;
+  }
+
+  unsigned int u_min_row;
+  if (scan_uint(file, &u_min_row, &ch) != 0 || ch != ' ') {
+    cleanup(file);
+    return 1;
+  }
+  *min_row = (size_t)u_min_row;
+
+  unsigned int u_max_row;
+  if (scan_uint(file, &u_max_row, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
+    return 1;
+  }
+  *max_row = (size_t)u_max_row;
+
+  return 0;
+}
+
+size_t parse_transaction(struct JobsFile *file, size_t max_events, size_t max_coords, unsigned int *event_ids,
+                         size_t *num_coords, size_t *xs, size_t *ys) {
+  char ch = ' ';
+  size_t num_events = 0;
+  size_t total_coords = 0;
+
+  // Each event is followed by a space before the next one or by the end of the line
+  while (ch == ' ') {
+    if (num_events == max_events) {
+      cleanup(file);
+      return 0;
+    }
+
+    if (scan_uint(file, &event_ids[num_events], &ch) != 0 || ch != ' ') {
+      cleanup(file);
+      return 0;
+    }
+
+    num_coords[num_events] = parse_coords(file, max_coords - total_coords, xs + total_coords, ys + total_coords);
+    if (num_coords[num_events] == 0) {
+      return 0;
+    }
+    total_coords += num_coords[num_events];
+    num_events++;
+
+    if (read_chars(file, &ch, 1) != 1) {
+      ch = '\0';
+    }
+  }
+
+  if (ch != '\n' && ch != '\0') {
+    cleanup(file);
+    return 0;
+  }
+
+  return num_events;
+}
+
+int parse_show(struct JobsFile *file, unsigned int *event_id) {
+  char ch;
+
+  if (scan_uint(file, event_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
+    return 1;
+  }
+
+  return 0;
+}
+
+int parse_cancel(struct JobsFile *file, unsigned int *event_id, unsigned int *reservation_id) {
+  char ch;
+
+  if (scan_uint(file, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(file);
+    return 1;
+  }
+
+  if (scan_uint(file, reservation_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
+    return 1;
+  }
+
+  return 0;
+}
+
+int parse_delete(struct JobsFile *file, unsigned int *event_id) {
   char ch;
 
-  if (parse_uint(fd, event_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (scan_uint(file, event_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
     return 1;
   }
 
   return 0;
 }
 
-int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
+int parse_wait(struct JobsFile *file, unsigned int *delay, unsigned int *thread_id) {
   char ch;
 
-  if (parse_uint(fd, delay, &ch) != 0) {
-    cleanup(fd);
+  if (scan_uint(file, delay, &ch) != 0) {
+    cleanup(file);
     return -1;
   }
 
   if (ch == ' ') {
     if (thread_id == NULL) {
-      cleanup(fd);
+      cleanup(file);
       return 0;
     }
 
-    if (parse_uint(fd, thread_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-      cleanup(fd);
+    if (scan_uint(file, thread_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+      cleanup(file);
       return -1;
     }
 
@@ -210,7 +465,7 @@ int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
   } else if (ch == '\n' || ch == '\0') {
     return 0;
   } else {
-    cleanup(fd);
+    cleanup(file);
     return -1;
   }
 }
@@ -3,10 +3,35 @@
 
 #include <stddef.h>
 
+#define JOBS_BUFFER_SIZE (64 * 1024)  // Bytes read at a time from a .jobs file that cannot be mapped
+
+/// A .jobs file being parsed, mapped whole when it is a regular file and read a buffer at a time otherwise.
+struct JobsFile {
+  int fd;
+  const char *pos;  // Next character to parse
+  const char *end;  // End of the characters mapped or read so far
+  char *buffer;     // JOBS_BUFFER_SIZE bytes, NULL while the file is mapped
+  void *mapping;    // Whole file, NULL if it is read through buffer
+  size_t mapping_size;
+};
+
+/// Starts parsing a .jobs file.
+/// @param file File to set up.
+/// @param fd File descriptor to read from, left open by jobs_close.
+/// @return 0 if the file was set up successfully, 1 otherwise.
+int jobs_open(struct JobsFile *file, int fd);
+
+/// Stops parsing a .jobs file, releasing its mapping or buffer.
+void jobs_close(struct JobsFile *file);
+
 enum Command {
   CMD_CREATE,
   CMD_RESERVE,
+  CMD_RESERVE_BEST,
+  CMD_TRANSACTION,
   CMD_SHOW,
+  CMD_CANCEL,
+  CMD_DELETE,
   CMD_LIST_EVENTS,
   CMD_WAIT,
   CMD_HELP,
@@ -16,38 +41,73 @@ enum Command {
 };
 
 /// Reads a line and returns the corresponding command.
-/// @param fd File descriptor to read from.
+/// @param file File to read from.
 /// @return The command read.
-enum Command get_next(int fd);
+enum Command get_next(struct JobsFile *file);
 
 /// Parses a CREATE command.
-/// @param fd File descriptor to read from.
+/// @param file File to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @param num_rows Pointer to the variable to store the number of rows in.
 /// @param num_cols Pointer to the variable to store the number of columns in.
 /// @return 0 if the command was parsed successfully, 1 otherwise.
-int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_cols);
+int parse_create(struct JobsFile *file, unsigned int *event_id, size_t *num_rows, size_t *num_cols);
 
 /// Parses a RESERVE command.
-/// @param fd File descriptor to read from.
+/// @param file File to read from.
 /// @param max Maximum number of coordinates to read.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @param xs Pointer to the array to store the X coordinates in.
 /// @param ys Pointer to the array to store the Y coordinates in.
 /// @return Number of coordinates read. 0 on failure.
-size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys);
+size_t parse_reserve(struct JobsFile *file, size_t max, unsigned int *event_id, size_t *xs, size_t *ys);
+
+/// Parses a RESERVE_BEST command.
+/// @param file File to read from.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @param num_seats Pointer to the variable to store the number of seats in.
+/// @param min_row Pointer to the variable to store the first row in. Set to 0 if not specified.
+/// @param max_row Pointer to the variable to store the last row in. Set to 0 if not specified.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_reserve_best(struct JobsFile *file, unsigned int *event_id, size_t *num_seats, size_t *min_row,
+                       size_t *max_row);
+
+/// Parses a TRANSACTION command.
+/// @param file File to read from.
+/// @param max_events Maximum number of events to read.
+/// @param max_coords Maximum number of coordinates to read across all events.
+/// @param event_ids Pointer to the array to store the event IDs in.
+/// @param num_coords Pointer to the array to store the number of coordinates of each event in.
+/// @param xs Pointer to the array to store the X coordinates in, those of each event following the previous ones.
+/// @param ys Pointer to the array to store the Y coordinates in.
+/// @return Number of events read. 0 on failure.
+size_t parse_transaction(struct JobsFile *file, size_t max_events, size_t max_coords, unsigned int *event_ids,
+                         size_t *num_coords, size_t *xs, size_t *ys);
 
 /// Parses a SHOW command.
-/// @param fd File descriptor to read from.
+/// @param file File to read from.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_show(struct JobsFile *file, unsigned int *event_id);
+
+/// Parses a CANCEL command.
+/// @param file File to read from.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @param reservation_id Pointer to the variable to store the reservation ID in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_cancel(struct JobsFile *file, unsigned int *event_id, unsigned int *reservation_id);
+
+/// Parses a DELETE command.
+/// @param file File to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @return 0 if the command was parsed successfully, 1 otherwise.
-int parse_show(int fd, unsigned int *event_id);
+int parse_delete(struct JobsFile *file, unsigned int *event_id);
 
 /// Parses a WAIT command.
-/// @param fd File descriptor to read from.
+/// @param file File to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
 /// @param thread_id Pointer to the variable to store the thread ID in. May not be set.
 /// @return 0 if no thread was specified, 1 if a thread was specified, -1 on error.
-int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id);
+int parse_wait(struct JobsFile *file, unsigned int *delay, unsigned int *thread_id);
 
 #endif  // CLIENT_PARSER_H
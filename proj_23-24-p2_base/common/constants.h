@@ -1,6 +1,32 @@
 #define MAX_RESERVATION_SIZE 256
 #define STATE_ACCESS_DELAY_US 500000  // 500ms
+#define WAL_INTERVAL_US 1000  // 1ms between write-ahead log syncs
+#define CHECKPOINT_INTERVAL_S 60  // 1min between checkpoints
 #define MAX_JOB_FILE_NAME_SIZE 256
 #define MAX_PIPE_NAME 40
 #define MAX_SESSION_COUNT 8
+#define MAX_PENDING_SESSIONS 64  // Clients registered and waiting for a free session thread
+#define MAX_TRANSACTION_EVENTS 16
+#define MAX_SHARD_COUNT 256
+#define MAX_LOOP_COUNT 64
+#define MAX_PIPELINE_DEPTH 256  // Requests a client keeps in flight at most, see ems_pipeline
+#define MAX_BATCH_COMMANDS 256  // Commands a BATCH request carries at most, see ems_batch
+#define MAX_BATCH_SIZE (16 * 1024)  // Bytes of the commands of a BATCH request at most
+#define MAX_CLIENT_SESSIONS 64  // Sessions a client runs the .jobs files of a directory over at most
+#define MAX_SOCKET_MESSAGE (32 * 1024)  // Bytes of a socket message at most, longer responses span several
 
+
+// SHOW seat map encodings. A SHOW request carries a bitmask of the encodings the client accepts and the
+// response names the one the server chose.
+#define SHOW_ENCODING_RAW 0  // One unsigned int per seat
+#define SHOW_ENCODING_RLE 1  // Per row, runs of (unsigned int length, unsigned int reservation id)
+
+// SHOW_SINCE updates. A SHOW_SINCE request carries the serial and version of the event the client has and the
+// response sends either the seats changed since that version or the whole seat map.
+#define SHOW_SINCE_FULL 0   // Seat map as in a SHOW response
+#define SHOW_SINCE_DELTA 1  // Number of changed seats, then their size_t indices and unsigned int reservation ids
+
+// Transports, chosen with -t on both the server and the client.
+#define TRANSPORT_FIFO 0    // Pipes of the client, registered through the server pipe
+#define TRANSPORT_SOCKET 1  // AF_UNIX SOCK_SEQPACKET connection accepted on the server socket
+#define TRANSPORT_SHM 2     // Rings in a shared-memory segment of the client, registered through the server pipe
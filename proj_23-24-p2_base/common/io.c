@@ -1,78 +1,145 @@
 #include "io.h"
 
-#include <limits.h>
-#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-int parse_uint(int fd, unsigned int *value, char *next) {
-  char buf[16];
-
-  int i = 0;
-  while (1) {
-    ssize_t read_bytes = read(fd, buf + i, 1);
-    if (read_bytes == -1) {
-      return 1;
-    } else if (read_bytes == 0) {
-      *next = '\0';
-      break;
-    }
+// Decimal digits of 0 to 99, two characters each
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+size_t format_uint(char *buffer, unsigned int value) {
+  char digits[10];
+  size_t i = sizeof(digits);
+
+  // Two digits per division, from the last ones
+  while (value >= 100) {
+    const char *pair = digit_pairs + 2 * (value % 100);
+    value /= 100;
+    digits[--i] = pair[1];
+    digits[--i] = pair[0];
+  }
 
-    *next = buf[i];
+  if (value >= 10) {
+    digits[--i] = digit_pairs[2 * value + 1];
+    digits[--i] = digit_pairs[2 * value];
+  } else {
+    digits[--i] = (char)('0' + value);
+  }
 
-    if (buf[i] > '9' || buf[i] < '0') {
-      buf[i] = '\0';
-      break;
-    }
+  memcpy(buffer, digits + i, sizeof(digits) - i);
+  return sizeof(digits) - i;
+}
 
-    i++;
-  }
+int print_uint(int fd, unsigned int value) {
+  char buffer[10];
+  return write_all(fd, buffer, format_uint(buffer, value));
+}
 
-  unsigned long ul = strtoul(buf, NULL, 10);
+int print_str(int fd, const char *str) {
+  size_t len = strlen(str);
+  while (len > 0) {
+    ssize_t written = write(fd, str, len);
+    if (written == -1) {
+      return 1;
+    }
 
-  if (ul > UINT_MAX) {
-    return 1;
+    str += (size_t)written;
+    len -= (size_t)written;
   }
 
-  *value = (unsigned int)ul;
-
   return 0;
 }
 
-int print_uint(int fd, unsigned int value) {
-  char buffer[16];
-  size_t i = 16;
+int write_all(int fd, const void *buffer, size_t size) {
+  const char *current = buffer;
+  while (size > 0) {
+    ssize_t written = write(fd, current, size);
+    if (written == -1) {
+      return 1;
+    }
 
-  for (; value > 0; value /= 10) {
-    buffer[--i] = '0' + (char)(value % 10);
+    current += (size_t)written;
+    size -= (size_t)written;
   }
 
-  if (i == 16) {
-    buffer[--i] = '0';
-  }
+  return 0;
+}
 
-  while (i < 16) {
-    ssize_t written = write(fd, buffer + i, 16 - i);
+int writev_all(int fd, struct iovec *parts, int count) {
+  while (count > 0) {
+    ssize_t written = writev(fd, parts, count);
     if (written == -1) {
       return 1;
     }
 
-    i += (size_t)written;
+    size_t left = (size_t)written;
+    while (count > 0 && left >= parts->iov_len) {
+      left -= parts->iov_len;
+      parts++;
+      count--;
+    }
+
+    if (count > 0) {
+      parts->iov_base = (char *)parts->iov_base + left;
+      parts->iov_len -= left;
+    }
   }
 
   return 0;
 }
 
-int print_str(int fd, const char *str) {
+void output_start(struct Output *out, int fd) {
+  out->fd = fd;
+  out->failed = 0;
+  out->size = 0;
+}
+
+/// Writes what an output gathered, leaving its buffer empty.
+static void drain(struct Output *out) {
+  if (!out->failed && write_all(out->fd, out->buffer, out->size) != 0) out->failed = 1;
+  out->size = 0;
+}
+
+void output_uint(struct Output *out, unsigned int value) {
+  if (OUTPUT_BUFFER_SIZE - out->size < 10) drain(out);
+  out->size += format_uint(out->buffer + out->size, value);
+}
+
+void output_str(struct Output *out, const char *str) {
   size_t len = strlen(str);
   while (len > 0) {
-    ssize_t written = write(fd, str, len);
-    if (written == -1) {
+    if (out->size == OUTPUT_BUFFER_SIZE) drain(out);
+
+    size_t part = OUTPUT_BUFFER_SIZE - out->size < len ? OUTPUT_BUFFER_SIZE - out->size : len;
+    memcpy(out->buffer + out->size, str, part);
+    out->size += part;
+    str += part;
+    len -= part;
+  }
+}
+
+void output_char(struct Output *out, char c) {
+  if (out->size == OUTPUT_BUFFER_SIZE) drain(out);
+  out->buffer[out->size++] = c;
+}
+
+int output_flush(struct Output *out) {
+  if (out->size > 0) drain(out);
+  return out->failed;
+}
+
+int read_all(int fd, void *buffer, size_t size) {
+  char *current = buffer;
+  while (size > 0) {
+    ssize_t bytes_read = read(fd, current, size);
+    if (bytes_read <= 0) {
       return 1;
     }
 
-    str += (size_t)written;
-    len -= (size_t)written;
+    current += (size_t)bytes_read;
+    size -= (size_t)bytes_read;
   }
 
   return 0;
@@ -1,12 +1,18 @@
 #ifndef COMMON_IO_H
 #define COMMON_IO_H
 
-/// Parses an unsigned integer from the given file descriptor.
-/// @param fd The file descriptor to read from.
-/// @param value Pointer to the variable to store the value in.
-/// @param next Pointer to the variable to store the next character in.
-/// @return 0 if the integer was read successfully, 1 otherwise.
-int parse_uint(int fd, unsigned int *value, char *next);
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)  // Bytes gathered by an Output before they are written
+
+/// Output to a file descriptor, gathered in a buffer and written a large chunk at a time.
+struct Output {
+  int fd;
+  int failed;   // Set once a write failed, what follows is dropped
+  size_t size;  // Bytes in buffer not written yet
+  char buffer[OUTPUT_BUFFER_SIZE];
+};
 
 /// Prints an unsigned integer to the given file descriptor.
 /// @param fd The file descriptor to write to.
@@ -20,4 +26,50 @@ int print_uint(int fd, unsigned int value);
 /// @return 0 if the string was written successfully, 1 otherwise.
 int print_str(int fd, const char *str);
 
+/// Writes a buffer to the given file descriptor, retrying on partial writes.
+/// @param fd The file descriptor to write to.
+/// @param buffer The buffer to write.
+/// @param size The number of bytes to write.
+/// @return 0 if the buffer was written successfully, 1 otherwise.
+int write_all(int fd, const void *buffer, size_t size);
+
+/// Writes several buffers to the given file descriptor at once, retrying on partial writes.
+/// @param fd The file descriptor to write to.
+/// @param parts The buffers to write, changed to skip what was written.
+/// @param count The number of buffers.
+/// @return 0 if the buffers were written successfully, 1 otherwise.
+int writev_all(int fd, struct iovec *parts, int count);
+
+/// Formats an unsigned integer in decimal.
+/// @param buffer Buffer to write the digits to, at least 10 bytes.
+/// @param value The value to format.
+/// @return The number of digits written.
+size_t format_uint(char *buffer, unsigned int value);
+
+/// Starts gathering output for the given file descriptor, dropping anything gathered before.
+/// @param out The output to reuse.
+/// @param fd The file descriptor to write to.
+void output_start(struct Output *out, int fd);
+
+/// Adds an unsigned integer to an output, in decimal.
+void output_uint(struct Output *out, unsigned int value);
+
+/// Adds a string to an output.
+void output_str(struct Output *out, const char *str);
+
+/// Adds a character to an output.
+void output_char(struct Output *out, char c);
+
+/// Writes what an output gathered to its file descriptor.
+/// @param out The output to flush.
+/// @return 0 if everything added since output_start was written successfully, 1 otherwise.
+int output_flush(struct Output *out);
+
+/// Reads exactly size bytes from the given file descriptor, retrying on partial reads.
+/// @param fd The file descriptor to read from.
+/// @param buffer The buffer to read into.
+/// @param size The number of bytes to read.
+/// @return 0 if the buffer was filled successfully, 1 on error or end of file.
+int read_all(int fd, void *buffer, size_t size);
+
 #endif  // COMMON_IO_H
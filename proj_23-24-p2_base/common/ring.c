@@ -0,0 +1,259 @@
+#define _GNU_SOURCE  // syscall, MAP_ANONYMOUS
+#include "ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE_SIZE 64
+#define RING_SPINS 64              // Checks a waiting process makes, yielding in between, before it sleeps
+#define RING_WAIT_NS 100000000     // 100ms between checks that the peer process is still there
+#define RING_CONTROL_SIZE 4096     // Bytes before the rings in the segment, a multiple of the page size
+
+// Counters of a ring, shared by its reader and its writer
+struct RingControl {
+  _Alignas(CACHE_LINE_SIZE) uint32_t head;  // Bytes read, free-running
+  uint32_t writer_sleeping;                 // Set while the writer may sleep on head
+  pid_t reader;                             // Process reading the ring, 0 until it mapped the segment
+  _Alignas(CACHE_LINE_SIZE) uint32_t tail;  // Bytes published, free-running
+  uint32_t reader_sleeping;                 // Set while the reader may sleep on tail
+  pid_t writer;                             // Process writing the ring, 0 until it mapped the segment
+  _Alignas(CACHE_LINE_SIZE) uint32_t closed;
+};
+
+// Checks made before sleeping, none on a single processor where the peer cannot run while this process spins
+static int spins = -1;
+
+static void futex_wait(uint32_t *word, uint32_t value) {
+  struct timespec timeout = {0, RING_WAIT_NS};
+  syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word) { syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0); }
+
+/// Checks whether the session of a ring went away.
+/// @param peer Location of the process at the other end of the ring, NULL if it is not checked.
+/// @param name Name of the segment, NULL if it is not checked.
+static int ended(struct RingControl *control, const pid_t *peer, const char *name) {
+  if (__atomic_load_n(&control->closed, __ATOMIC_ACQUIRE)) return 1;
+  if (peer == NULL) return 0;
+
+  pid_t pid = __atomic_load_n(peer, __ATOMIC_SEQ_CST);
+  if (pid != 0) return kill(pid, 0) == -1 && errno == ESRCH;
+  if (name == NULL) return 0;
+
+  // The server removes the name once it stored its pid, or once it failed to map the segment
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd != -1) close(fd);
+  return fd == -1 && errno == ENOENT && __atomic_load_n(peer, __ATOMIC_SEQ_CST) == 0;
+}
+
+/// Ends the session of a ring whose counters are more than RING_SIZE apart, which only a broken or hostile peer
+/// leaves them, so no copy runs past the two mappings of the ring.
+static void corrupt(struct RingControl *control) {
+  fprintf(stderr, "Ring counters out of range, ending the session\n");
+  __atomic_store_n(&control->closed, 1, __ATOMIC_RELEASE);
+  futex_wake(&control->head);
+  futex_wake(&control->tail);
+}
+
+/// Waits until a counter of a ring moves from a value.
+/// @note Spins first on several processors, since the peer usually answers within a few of its time slices.
+/// @param sleeping Flag of the waiting side, so the other side knows to wake it.
+/// @param peer Location of the process at the other end of the ring.
+/// @param name Name of the segment, NULL if it is not checked.
+/// @return 0 once the counter moved, 1 if the session ended or the peer process is gone.
+static int wait_for(struct RingControl *control, uint32_t *counter, uint32_t value, uint32_t *sleeping,
+                    const pid_t *peer, const char *name) {
+  for (int i = 0; i < __atomic_load_n(&spins, __ATOMIC_RELAXED); i++) {
+    if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) != value) return 0;
+    sched_yield();
+  }
+
+  // The peer stores the counter and then loads the flag, both sequentially consistent, so either it sees the flag
+  // and wakes this process or this process sees the new counter before it sleeps
+  int moved = 0;
+  while (!moved) {
+    __atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(counter, __ATOMIC_SEQ_CST) == value) futex_wait(counter, value);
+    moved = __atomic_load_n(counter, __ATOMIC_ACQUIRE) != value;
+    if (!moved && ended(control, peer, name)) break;
+    pthread_testcancel();  // The futex is no cancellation point of its own
+  }
+
+  __atomic_store_n(sleeping, 0, __ATOMIC_RELAXED);
+  return !moved;
+}
+
+/// Maps a segment, each ring twice in a row.
+/// @return 0 if the segment was mapped successfully, 1 otherwise.
+static int map_pair(int fd, struct RingPair *pair) {
+  if (__atomic_load_n(&spins, __ATOMIC_RELAXED) == -1) {
+    __atomic_store_n(&spins, sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPINS : 0, __ATOMIC_RELAXED);
+  }
+
+  // Reserves the whole range first, so the mappings of a ring are sure to be adjacent
+  pair->mapping_size = RING_CONTROL_SIZE + 4 * (size_t)RING_SIZE;
+  char *base = mmap(NULL, pair->mapping_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) return 1;
+  pair->mapping = base;
+
+  int failed = mmap(base, RING_CONTROL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED;
+  for (size_t i = 0; i < 4 && !failed; i++) {
+    off_t offset = RING_CONTROL_SIZE + (off_t)(i / 2) * RING_SIZE;
+    char *at = base + RING_CONTROL_SIZE + i * RING_SIZE;
+    failed = mmap(at, RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED;
+  }
+  if (failed) {
+    munmap(base, pair->mapping_size);
+    return 1;
+  }
+
+  struct RingControl *controls = (struct RingControl *)base;
+  pair->requests = (struct Ring){.control = &controls[0], .data = base + RING_CONTROL_SIZE};
+  pair->responses = (struct Ring){.control = &controls[1], .data = base + RING_CONTROL_SIZE + 2 * RING_SIZE};
+  return 0;
+}
+
+int ring_pair_create(const char *name, struct RingPair *pair) {
+  _Static_assert(2 * sizeof(struct RingControl) <= RING_CONTROL_SIZE, "ring counters must fit before the rings");
+
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1) return 1;
+
+  // A new segment is all zeros, so the rings start empty and open
+  if (ftruncate(fd, RING_CONTROL_SIZE + 2 * RING_SIZE) == -1 || map_pair(fd, pair) != 0) {
+    close(fd);
+    shm_unlink(name);
+    return 1;
+  }
+  close(fd);
+
+  pair->requests.control->writer = getpid();
+  pair->responses.control->reader = getpid();
+  pair->requests.name = name;
+  pair->responses.name = name;
+  return 0;
+}
+
+int ring_pair_open(const char *name, struct RingPair *pair) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1) {
+    shm_unlink(name);
+    return 1;
+  }
+
+  int failed = map_pair(fd, pair);
+  close(fd);
+  if (failed) {
+    shm_unlink(name);
+    return 1;
+  }
+
+  // The pids are stored before the name is removed, so the client never takes a joined session for a failed one
+  __atomic_store_n(&pair->requests.control->reader, getpid(), __ATOMIC_SEQ_CST);
+  __atomic_store_n(&pair->responses.control->writer, getpid(), __ATOMIC_SEQ_CST);
+  pair->responses.written = __atomic_load_n(&pair->responses.control->tail, __ATOMIC_RELAXED);
+  shm_unlink(name);
+  return 0;
+}
+
+void ring_pair_close(struct RingPair *pair) {
+  ring_flush(&pair->requests);
+  ring_flush(&pair->responses);
+
+  struct Ring *rings[] = {&pair->requests, &pair->responses};
+  for (size_t i = 0; i < 2; i++) {
+    struct RingControl *control = rings[i]->control;
+    __atomic_store_n(&control->closed, 1, __ATOMIC_RELEASE);
+    futex_wake(&control->head);
+    futex_wake(&control->tail);
+  }
+
+  munmap(pair->mapping, pair->mapping_size);
+}
+
+size_t ring_read(struct Ring *ring, void *buffer, size_t size) {
+  struct RingControl *control = ring->control;
+  uint32_t head = __atomic_load_n(&control->head, __ATOMIC_RELAXED);
+  uint32_t tail = __atomic_load_n(&control->tail, __ATOMIC_ACQUIRE);
+
+  while (tail == head) {
+    if (wait_for(control, &control->tail, tail, &control->reader_sleeping, &control->writer, ring->name)) return 0;
+    tail = __atomic_load_n(&control->tail, __ATOMIC_ACQUIRE);
+  }
+
+  uint32_t available = tail - head;
+  if (available > RING_SIZE) {
+    corrupt(control);
+    return 0;
+  }
+
+  size_t taken = size < available ? size : available;
+  memcpy(buffer, ring->data + head % RING_SIZE, taken);
+
+  __atomic_store_n(&control->head, head + (uint32_t)taken, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&control->writer_sleeping, __ATOMIC_SEQ_CST)) futex_wake(&control->head);
+  return taken;
+}
+
+int ring_write(struct Ring *ring, const void *data, size_t size) {
+  struct RingControl *control = ring->control;
+  const char *current = data;
+
+  while (size > 0) {
+    uint32_t head = __atomic_load_n(&control->head, __ATOMIC_ACQUIRE);
+    uint32_t used = ring->written - head;
+    if (used > RING_SIZE) {
+      corrupt(control);
+      return 1;
+    }
+    size_t room = RING_SIZE - used;
+
+    if (room == 0) {
+      // The reader can only make room once it sees what fills the ring
+      ring_flush(ring);
+      if (wait_for(control, &control->head, head, &control->writer_sleeping, &control->reader, ring->name)) return 1;
+      continue;
+    }
+
+    size_t taken = size < room ? size : room;
+    memcpy(ring->data + ring->written % RING_SIZE, current, taken);
+    ring->written += (uint32_t)taken;
+    current += taken;
+    size -= taken;
+  }
+
+  return ended(control, NULL, NULL);
+}
+
+void *ring_claim(struct Ring *ring, size_t size) {
+  uint32_t head = __atomic_load_n(&ring->control->head, __ATOMIC_ACQUIRE);
+  uint32_t used = ring->written - head;
+
+  // Counters out of range are left for ring_write to end the session on
+  if (used > RING_SIZE || RING_SIZE - used < size) return NULL;
+  return ring->data + ring->written % RING_SIZE;
+}
+
+void ring_publish(struct Ring *ring, size_t size) {
+  ring->written += (uint32_t)size;
+  ring_flush(ring);
+}
+
+void ring_flush(struct Ring *ring) {
+  struct RingControl *control = ring->control;
+  if (__atomic_load_n(&control->tail, __ATOMIC_RELAXED) == ring->written) return;
+
+  __atomic_store_n(&control->tail, ring->written, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&control->reader_sleeping, __ATOMIC_SEQ_CST)) futex_wake(&control->tail);
+}
@@ -0,0 +1,78 @@
+#ifndef COMMON_RING_H
+#define COMMON_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_SIZE (64 * 1024)  // Bytes of each ring, a power of two and a multiple of the page size
+
+// Shared-memory transport: a session is a segment holding a ring of requests, written by the client, and a ring of
+// responses, written by the server. Each ring is mapped twice in a row, so any run of up to RING_SIZE bytes from
+// any position is contiguous. Its reader and writer only sleep on a futex once it is empty or full.
+
+struct RingControl;
+
+/// A ring as mapped by one of the two processes of its session.
+struct Ring {
+  struct RingControl *control;  // In the segment
+  char *data;                   // RING_SIZE bytes, mapped twice in a row
+  uint32_t written;             // Bytes written by this process so far, published or not
+  const char *name;             // Name of the segment while the peer may not have mapped it, NULL otherwise
+};
+
+/// The two rings of a session, see ring_pair_create.
+struct RingPair {
+  struct Ring requests;
+  struct Ring responses;
+  void *mapping;
+  size_t mapping_size;
+};
+
+/// Creates the segment of a new session and maps it.
+/// @note Until the server maps the segment, waits on its rings end once its name is removed.
+/// @param name Name of the segment, as for shm_open. Must outlive the pair.
+/// @param pair Pair to map the rings of the session to.
+/// @return 0 if the segment was created successfully, 1 otherwise.
+int ring_pair_create(const char *name, struct RingPair *pair);
+
+/// Maps the segment a client created and removes its name.
+/// @note The name is removed even if the segment cannot be mapped, which ends the session for the client.
+/// @param name Name of the segment, as for shm_open.
+/// @param pair Pair to map the rings of the session to.
+/// @return 0 if the segment was mapped successfully, 1 otherwise.
+int ring_pair_open(const char *name, struct RingPair *pair);
+
+/// Ends the session for both processes and unmaps its segment.
+/// @note The peer still reads what was published before, and then sees the end of the session.
+void ring_pair_close(struct RingPair *pair);
+
+/// Reads the bytes published in a ring, waiting for at least one.
+/// @param ring Ring the calling process reads.
+/// @param buffer Buffer to read into.
+/// @param size Size of the buffer.
+/// @return Number of bytes read, 0 once the session ended, the peer process is gone or the counters of the ring are
+/// out of range, which ends the session.
+size_t ring_read(struct Ring *ring, void *buffer, size_t size);
+
+/// Writes bytes to a ring without publishing them, waiting for room if it is full.
+/// @note The bytes are only seen by the reader after ring_flush, unless they fill the ring first.
+/// @param ring Ring the calling process writes.
+/// @param data Bytes to write.
+/// @param size Number of bytes to write.
+/// @return 0 if the bytes were written successfully, 1 if the session ended, the peer process is gone or the counters
+/// of the ring are out of range, which ends the session.
+int ring_write(struct Ring *ring, const void *data, size_t size);
+
+/// Gets room for bytes in a ring without waiting, so they can be written in place.
+/// @param ring Ring the calling process writes.
+/// @param size Number of bytes to write, see ring_publish.
+/// @return Contiguous room for the bytes, NULL if the ring does not have it now.
+void *ring_claim(struct Ring *ring, size_t size);
+
+/// Publishes bytes written in the room got with ring_claim, along with any written before.
+void ring_publish(struct Ring *ring, size_t size);
+
+/// Publishes the bytes written to a ring, waking its reader if it sleeps.
+void ring_flush(struct Ring *ring);
+
+#endif  // COMMON_RING_H
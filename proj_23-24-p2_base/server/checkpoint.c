@@ -0,0 +1,185 @@
+#include "checkpoint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/io.h"
+
+#define CHECKPOINT_MAGIC "EMSCKPT1"
+#define CHECKPOINT_BUFFER_SIZE (1u << 20)  // Bytes gathered before each write
+
+/// Writes out the buffered bytes of a checkpoint.
+/// @return 0 if the bytes were written successfully, 1 otherwise.
+static int flush_buffer(struct CheckpointWriter* writer) {
+  if (write_all(writer->fd, writer->buffer, writer->size) != 0) return 1;
+  writer->size = 0;
+  return 0;
+}
+
+/// Appends bytes to a checkpoint, going around the buffer when they would not fit in it.
+/// @return 0 if the bytes were appended successfully, 1 otherwise.
+static int put_bytes(struct CheckpointWriter* writer, const void* bytes, size_t size) {
+  if (writer->size + size > CHECKPOINT_BUFFER_SIZE && flush_buffer(writer) != 0) return 1;
+
+  if (size > CHECKPOINT_BUFFER_SIZE) {
+    if (write_all(writer->fd, bytes, size) != 0) return 1;
+  } else {
+    memcpy(writer->buffer + writer->size, bytes, size);
+    writer->size += size;
+  }
+
+  writer->offset += size;
+  return 0;
+}
+
+/// Releases everything held by a writer, closing its file.
+static void release_writer(struct CheckpointWriter* writer) {
+  if (writer->fd != -1) close(writer->fd);
+  free(writer->path);
+  free(writer->temp_path);
+  free(writer->buffer);
+  free(writer->events);
+  writer->fd = -1;
+  writer->path = NULL;
+  writer->temp_path = NULL;
+  writer->buffer = NULL;
+  writer->events = NULL;
+}
+
+int checkpoint_begin(struct CheckpointWriter* writer, const char* path) {
+  size_t length = strlen(path);
+  *writer = (struct CheckpointWriter){.fd = -1};
+
+  writer->path = malloc(length + 1);
+  writer->temp_path = malloc(length + sizeof(".tmp"));
+  writer->buffer = malloc(CHECKPOINT_BUFFER_SIZE);
+  if (writer->path == NULL || writer->temp_path == NULL || writer->buffer == NULL) {
+    fprintf(stderr, "Error allocating memory for checkpoint\n");
+    release_writer(writer);
+    return 1;
+  }
+  memcpy(writer->path, path, length + 1);
+  memcpy(writer->temp_path, path, length);
+  memcpy(writer->temp_path + length, ".tmp", sizeof(".tmp"));
+
+  writer->fd = open(writer->temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (writer->fd == -1) {
+    fprintf(stderr, "Error opening checkpoint\n");
+    release_writer(writer);
+    return 1;
+  }
+
+  // The header is only filled in by checkpoint_commit
+  struct CheckpointHeader header = {0};
+  if (put_bytes(writer, &header, sizeof(header)) != 0) {
+    checkpoint_abort(writer);
+    return 1;
+  }
+  return 0;
+}
+
+int checkpoint_add(struct CheckpointWriter* writer, const struct CheckpointEvent* event, const void* block, size_t size) {
+  if (writer->num_events == writer->capacity) {
+    size_t capacity = writer->capacity == 0 ? 1024 : writer->capacity * 2;
+    struct CheckpointEvent* grown = realloc(writer->events, capacity * sizeof(struct CheckpointEvent));
+    if (grown == NULL) {
+      fprintf(stderr, "Error allocating memory for checkpoint\n");
+      return 1;
+    }
+    writer->events = grown;
+    writer->capacity = capacity;
+  }
+
+  static const char padding[CHECKPOINT_ALIGNMENT] = {0};
+  size_t pad = (size_t)(-writer->offset & (CHECKPOINT_ALIGNMENT - 1));
+  if (put_bytes(writer, padding, pad) != 0) return 1;
+
+  struct CheckpointEvent* entry = &writer->events[writer->num_events];
+  *entry = *event;
+  entry->block_offset = writer->offset;
+  if (put_bytes(writer, block, size) != 0) return 1;
+
+  writer->num_events++;
+  return 0;
+}
+
+int checkpoint_commit(struct CheckpointWriter* writer, uint64_t wal_lsn, uint64_t next_serial) {
+  struct CheckpointHeader header = {.wal_lsn = wal_lsn,
+                                    .next_serial = next_serial,
+                                    .num_events = writer->num_events,
+                                    .table_offset = writer->offset};
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+
+  // Only a complete file ever takes the place of the previous checkpoint
+  if (put_bytes(writer, writer->events, writer->num_events * sizeof(struct CheckpointEvent)) != 0 ||
+      flush_buffer(writer) != 0 || pwrite(writer->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      fdatasync(writer->fd) != 0 || rename(writer->temp_path, writer->path) != 0) {
+    fprintf(stderr, "Error writing checkpoint\n");
+    checkpoint_abort(writer);
+    return 1;
+  }
+
+  release_writer(writer);
+  return 0;
+}
+
+void checkpoint_abort(struct CheckpointWriter* writer) {
+  if (writer->temp_path != NULL) unlink(writer->temp_path);
+  release_writer(writer);
+}
+
+int checkpoint_map(const char* path, struct Checkpoint* checkpoint, size_t (*block_size)(size_t, size_t)) {
+  *checkpoint = (struct Checkpoint){0};
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return errno == ENOENT ? 0 : 1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct CheckpointHeader)) {
+    fprintf(stderr, "Invalid checkpoint\n");
+    close(fd);
+    return 1;
+  }
+
+  // Pages are only read when first touched, and copied only when first written
+  size_t size = (size_t)st.st_size;
+  char* image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    fprintf(stderr, "Error mapping checkpoint\n");
+    return 1;
+  }
+
+  const struct CheckpointHeader* header = (const struct CheckpointHeader*)image;
+  int valid = memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) == 0 &&
+              header->table_offset <= size && header->table_offset % sizeof(uint64_t) == 0 &&
+              (size - header->table_offset) / sizeof(struct CheckpointEvent) == header->num_events &&
+              (size - header->table_offset) % sizeof(struct CheckpointEvent) == 0;
+
+  const struct CheckpointEvent* events = (const struct CheckpointEvent*)(image + (valid ? header->table_offset : 0));
+  // Each seat takes at least an unsigned int of its block, which bounds rows times cols before block_size uses it
+  for (size_t i = 0; valid && i < header->num_events; i++) {
+    valid = events[i].block_offset % CHECKPOINT_ALIGNMENT == 0 && events[i].rows > 0 && events[i].cols > 0 &&
+            events[i].rows <= header->table_offset / sizeof(unsigned int) / events[i].cols &&
+            events[i].block_offset <= header->table_offset &&
+            block_size(events[i].rows, events[i].cols) <= header->table_offset - events[i].block_offset;
+  }
+
+  if (!valid) {
+    fprintf(stderr, "Invalid checkpoint\n");
+    munmap(image, size);
+    return 1;
+  }
+
+  checkpoint->image = image;
+  checkpoint->size = size;
+  checkpoint->header = header;
+  checkpoint->events = events;
+  return 0;
+}
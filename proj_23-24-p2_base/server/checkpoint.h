@@ -0,0 +1,82 @@
+#ifndef SERVER_CHECKPOINT_H
+#define SERVER_CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHECKPOINT_ALIGNMENT 64  // Alignment of every seat block in the file, a cache line
+
+// Header at the start of a checkpoint, followed by the seat blocks and then the event table
+struct CheckpointHeader {
+  char magic[8];
+  uint64_t wal_lsn;       // Write-ahead log offset the checkpoint covers, replay resumes there
+  uint64_t next_serial;   // Serial of the next event created
+  uint64_t num_events;    // Number of entries of the event table
+  uint64_t table_offset;  // Offset of the event table, which ends the file
+};
+
+// Entry of the event table, in creation order
+struct CheckpointEvent {
+  uint64_t block_offset;  // Offset of the seat block, aligned to CHECKPOINT_ALIGNMENT
+  uint64_t serial;
+  uint64_t changes;
+  uint64_t rows;
+  uint64_t cols;
+  uint32_t id;
+  uint32_t reservations;
+};
+
+// Checkpoint being written to a temporary file, renamed over the previous one once complete
+struct CheckpointWriter {
+  int fd;
+  char* path;                      // Path of the checkpoint
+  char* temp_path;                 // Path of the file being written
+  char* buffer;                    // Bytes not yet written to fd
+  size_t size;                     // Number of bytes in buffer
+  uint64_t offset;                 // Offset in the file of the end of buffer
+  struct CheckpointEvent* events;  // Event table
+  size_t num_events;
+  size_t capacity;  // Capacity of events
+};
+
+// Checkpoint mapped copy-on-write, so its seat blocks can be changed in place without touching the file
+struct Checkpoint {
+  char* image;  // Mapping of the whole file, NULL if there is no checkpoint
+  size_t size;  // Size of image
+  const struct CheckpointHeader* header;
+  const struct CheckpointEvent* events;
+};
+
+/// Starts writing a checkpoint.
+/// @param writer Writer to be initialized.
+/// @param path Path of the checkpoint, only replaced by checkpoint_commit.
+/// @return 0 if the checkpoint was started successfully, 1 otherwise.
+int checkpoint_begin(struct CheckpointWriter* writer, const char* path);
+
+/// Adds an event to a checkpoint.
+/// @param writer Writer of the checkpoint.
+/// @param event Entry of the event, its block_offset is set by the writer.
+/// @param block Seat block of the event.
+/// @param size Size of the seat block.
+/// @return 0 if the event was added successfully, 1 otherwise.
+int checkpoint_add(struct CheckpointWriter* writer, const struct CheckpointEvent* event, const void* block, size_t size);
+
+/// Finishes a checkpoint, syncs it and atomically replaces the previous one.
+/// @param writer Writer of the checkpoint, released in any case.
+/// @param wal_lsn Write-ahead log offset the checkpoint covers.
+/// @param next_serial Serial of the next event created.
+/// @return 0 if the checkpoint was written successfully, 1 otherwise with the previous one left in place.
+int checkpoint_commit(struct CheckpointWriter* writer, uint64_t wal_lsn, uint64_t next_serial);
+
+/// Abandons a checkpoint, removing its temporary file.
+/// @param writer Writer of the checkpoint, released.
+void checkpoint_abort(struct CheckpointWriter* writer);
+
+/// Maps a checkpoint and validates its layout, without reading its seat blocks.
+/// @param path Path of the checkpoint. A missing checkpoint leaves image NULL.
+/// @param checkpoint Checkpoint to be filled in.
+/// @param block_size Function computing the size of the seat block of an event with the given rows and columns.
+/// @return 0 if the checkpoint was mapped successfully or is missing, 1 otherwise.
+int checkpoint_map(const char* path, struct Checkpoint* checkpoint, size_t (*block_size)(size_t, size_t));
+
+#endif  // SERVER_CHECKPOINT_H
@@ -0,0 +1,148 @@
+#include "epoch.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CACHE_LINE_SIZE 64
+
+// Per-thread announcement of the epoch the thread entered its critical section in, 0 when outside.
+struct EpochRecord {
+  _Alignas(CACHE_LINE_SIZE) unsigned long epoch;
+  unsigned int depth;  // Nesting depth, only accessed by the owner thread
+  struct EpochRecord* next;
+};
+
+struct Retired {
+  void* ptr;
+  void (*free_fn)(void*, void*);
+  void* context;
+  unsigned long epoch;  // Global epoch when the node was retired
+  struct Retired* next;
+};
+
+static unsigned long global_epoch = 1;
+static struct EpochRecord* records = NULL;  // Records of every thread that ever entered a critical section
+
+static struct Retired* retired = NULL;
+static pthread_mutex_t retired_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local struct EpochRecord* local_record = NULL;
+
+/// Gets the record of the calling thread, registering it on first use.
+/// @return Pointer to the record, NULL on failure.
+static struct EpochRecord* get_record(void) {
+  if (local_record != NULL) return local_record;
+
+  struct EpochRecord* record = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct EpochRecord));
+  if (record == NULL) return NULL;
+
+  record->epoch = 0;
+  record->depth = 0;
+  record->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&records, &record->next, record, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+
+  local_record = record;
+  return record;
+}
+
+void epoch_enter(void) {
+  struct EpochRecord* record = get_record();
+  if (record == NULL) {
+    fprintf(stderr, "Error registering thread for epoch reclamation\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (record->depth++ > 0) return;
+
+  __atomic_store_n(&record->epoch, __atomic_load_n(&global_epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  // The announcement must be visible before any node is read
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void) {
+  struct EpochRecord* record = local_record;
+  if (--record->depth > 0) return;
+
+  __atomic_store_n(&record->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/// Advances the global epoch if every thread inside a critical section has observed the current one.
+/// @return The global epoch after the attempt.
+static unsigned long try_advance(void) {
+  unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+
+  for (struct EpochRecord* record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record; record = record->next) {
+    unsigned long announced = __atomic_load_n(&record->epoch, __ATOMIC_SEQ_CST);
+    if (announced != 0 && announced != epoch) return epoch;
+  }
+
+  __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+}
+
+void epoch_retire(void* ptr, void (*free_fn)(void*, void*), void* context) {
+  struct Retired* node = malloc(sizeof(struct Retired));
+  if (node == NULL) {
+    fprintf(stderr, "Error allocating memory for retired node\n");
+    exit(EXIT_FAILURE);
+  }
+
+  node->ptr = ptr;
+  node->free_fn = free_fn;
+  node->context = context;
+  node->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+
+  pthread_mutex_lock(&retired_mutex);
+  node->next = retired;
+  retired = node;
+
+  // Critical sections entered two epochs after a node was retired cannot have reached it
+  unsigned long epoch = try_advance();
+  struct Retired** current = &retired;
+  while (*current) {
+    struct Retired* temp = *current;
+    if (temp->epoch + 2 <= epoch) {
+      *current = temp->next;
+      temp->free_fn(temp->context, temp->ptr);
+      free(temp);
+    } else {
+      current = &temp->next;
+    }
+  }
+
+  pthread_mutex_unlock(&retired_mutex);
+}
+
+void epoch_synchronize(void) {
+  unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+
+  // Sections entered once the global epoch moved past epoch announce a later one, so only older sections block
+  while (1) {
+    try_advance();
+
+    int waiting = 0;
+    for (struct EpochRecord* record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record; record = record->next) {
+      unsigned long announced = __atomic_load_n(&record->epoch, __ATOMIC_SEQ_CST);
+      if (announced != 0 && announced <= epoch) waiting = 1;
+    }
+
+    if (!waiting) return;
+    sched_yield();
+  }
+}
+
+void epoch_drain(void) {
+  pthread_mutex_lock(&retired_mutex);
+
+  while (retired) {
+    struct Retired* temp = retired;
+    retired = retired->next;
+    temp->free_fn(temp->context, temp->ptr);
+    free(temp);
+  }
+
+  pthread_mutex_unlock(&retired_mutex);
+}
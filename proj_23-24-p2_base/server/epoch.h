@@ -0,0 +1,27 @@
+#ifndef SERVER_EPOCH_H
+#define SERVER_EPOCH_H
+
+/// Enters a read-side critical section.
+/// @note Nodes reachable when the section is entered are not freed before it is exited, even if they are
+/// removed meanwhile. Only the calling thread's own record is written. Sections may be nested.
+void epoch_enter(void);
+
+/// Exits a read-side critical section.
+void epoch_exit(void);
+
+/// Frees a removed node once no critical section that could still reference it remains.
+/// @note The node must already be unreachable for new critical sections.
+/// @param ptr Node to be freed.
+/// @param free_fn Function that frees the node, called with context and ptr.
+/// @param context First argument of free_fn.
+void epoch_retire(void* ptr, void (*free_fn)(void*, void*), void* context);
+
+/// Waits until every critical section in progress when called has been exited.
+/// @note Must not be called inside a critical section.
+void epoch_synchronize(void);
+
+/// Frees every retired node immediately.
+/// @note Only safe when no thread is inside a critical section.
+void epoch_drain(void);
+
+#endif  // SERVER_EPOCH_H
@@ -2,73 +2,500 @@
 
 #include <pthread.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+
+#include "epoch.h"
+
+#define INDEX_LEVEL_MASK ((uintptr_t)(RESERVATION_INDEX_LEVELS - 1))  // Bits of reservation_index holding its levels
+
+/// Gets the hash bucket of an event id (Fibonacci hashing).
+/// @param event_id Event id.
+/// @return Index of the bucket.
+static size_t bucket_index(unsigned int event_id) {
+  return (size_t)((event_id * 2654435761u) >> (32 - EVENT_TABLE_BITS));
+}
+
+/// Gets the offset of the taken bitmap inside the seat block of an event.
+static size_t taken_offset(size_t num_seats) {
+  return (num_seats * sizeof(unsigned int) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+/// Gets the lock serializing changes to a hash bucket.
+/// @param list Event list.
+/// @param bucket Index of the bucket.
+/// @return Pointer to the lock.
+static pthread_mutex_t* bucket_lock(struct EventList* list, size_t bucket) {
+  return &list->stripes[bucket & (EVENT_TABLE_STRIPES - 1)];
+}
 
 struct EventList* create_list() {
   struct EventList* list = (struct EventList*)malloc(sizeof(struct EventList));
   if (!list) return NULL;
-  if (pthread_rwlock_init(&list->rwl, NULL) != 0) {
+  if (pthread_mutex_init(&list->write_mutex, NULL) != 0) {
+    free(list);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < EVENT_TABLE_STRIPES; i++) {
+    if (pthread_mutex_init(&list->stripes[i], NULL) != 0) {
+      while (i-- > 0) pthread_mutex_destroy(&list->stripes[i]);
+      pthread_mutex_destroy(&list->write_mutex);
+      free(list);
+      return NULL;
+    }
+  }
+
+  if (slab_init(&list->event_slab, sizeof(struct Event)) != 0 || slab_init(&list->node_slab, sizeof(struct ListNode)) != 0 ||
+      seat_pool_init(&list->seat_pool) != 0) {
+    for (size_t i = 0; i < EVENT_TABLE_STRIPES; i++) pthread_mutex_destroy(&list->stripes[i]);
+    pthread_mutex_destroy(&list->write_mutex);
     free(list);
     return NULL;
   }
+
+  for (size_t i = 0; i < EVENT_TABLE_BUCKETS; i++) {
+    list->buckets[i] = NULL;
+  }
+
   list->head = NULL;
   list->tail = NULL;
+  list->version = 0;
+  list->next_serial = 1;
+  list->image = NULL;
+  list->image_size = 0;
   return list;
 }
 
-int append_to_list(struct EventList* list, struct Event* event) {
-  if (!list) return 1;
+/// Gets the offset of the journal inside the seat block of an event.
+static size_t journal_offset(size_t num_seats) {
+  return taken_offset(num_seats) + (num_seats + 63) / 64 * sizeof(uint64_t);
+}
+
+/// Gets the capacity of the journal of an event, a delta longer than the seat map is never useful.
+static size_t journal_size(size_t num_seats) { return num_seats < EVENT_JOURNAL_SIZE ? num_seats : EVENT_JOURNAL_SIZE; }
+
+/// Gets the number of leaves of the free-run tree of an event, the number of rows rounded up to a power of two.
+static size_t free_run_leaves(size_t num_rows) {
+  size_t leaves = 1;
+  while (leaves < num_rows) leaves *= 2;
+  return leaves;
+}
+
+/// Gets the offset of the free-run tree inside the seat block of an event.
+static size_t free_runs_offset(size_t num_seats) {
+  return journal_offset(num_seats) + journal_size(num_seats) * sizeof(size_t);
+}
+
+/// Gets the offset of the dirty-row bitmap inside the seat block of an event.
+static size_t dirty_rows_offset(size_t num_rows, size_t num_cols) {
+  return free_runs_offset(num_rows * num_cols) + 2 * free_run_leaves(num_rows) * sizeof(size_t);
+}
+
+// The seat block is data followed by the taken bitmap, the journal, the free-run tree and the dirty-row bitmap
+size_t seat_block_size(size_t num_rows, size_t num_cols) {
+  return dirty_rows_offset(num_rows, num_cols) + (num_rows + 63) / 64 * sizeof(uint64_t);
+}
+
+/// Allocates an event whose seat structures live in a given block, with no reservation or change yet.
+/// @return Newly allocated event, NULL on failure.
+static struct Event* alloc_event(struct EventList* list, unsigned int event_id, size_t num_rows, size_t num_cols,
+                                 char* block) {
+  struct Event* event = slab_alloc(&list->event_slab);
+  if (event == NULL) return NULL;
+
+  event->id = event_id;
+  event->rows = num_rows;
+  event->cols = num_cols;
+  event->reservations = 0;
+  event->version = 0;
+  event->writers = 0;
+  event->deleted = 0;
+  event->changes = 0;
+  event->reservation_index = NULL;
+  event->unindexed = 0;
+  event->journal_size = journal_size(num_rows * num_cols);
+  if (pthread_mutex_init(&event->mutex, NULL) != 0) {
+    slab_free(&list->event_slab, event);
+    return NULL;
+  }
+
+  event->data = (unsigned int*)block;
+  event->taken = (uint64_t*)(block + taken_offset(num_rows * num_cols));
+  event->journal = (size_t*)(block + journal_offset(num_rows * num_cols));
+  event->free_runs = (size_t*)(block + free_runs_offset(num_rows * num_cols));
+  event->free_run_leaves = free_run_leaves(num_rows);
+  event->dirty_rows = (uint64_t*)(block + dirty_rows_offset(num_rows, num_cols));
+  return event;
+}
+
+struct Event* create_event(struct EventList* list, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  // The seat structures share one block, so a reservation touches a single allocation
+  char* block = seat_alloc(&list->seat_pool, seat_block_size(num_rows, num_cols));
+  if (block == NULL) return NULL;
+
+  struct Event* event = alloc_event(list, event_id, num_rows, num_cols, block);
+  if (event == NULL) {
+    seat_free(&list->seat_pool, block, seat_block_size(num_rows, num_cols));
+    return NULL;
+  }
+  event->serial = __atomic_fetch_add(&list->next_serial, 1, __ATOMIC_RELAXED);
+
+  // Every row starts as a single free run, the padding leaves stay empty
+  for (size_t i = 0; i < num_rows; i++) event->free_runs[event->free_run_leaves + i] = num_cols;
+  for (size_t i = event->free_run_leaves - 1; i > 0; i--) {
+    size_t left = event->free_runs[2 * i], right = event->free_runs[2 * i + 1];
+    event->free_runs[i] = left > right ? left : right;
+  }
+  return event;
+}
+
+struct Event* restore_event(struct EventList* list, unsigned int event_id, size_t num_rows, size_t num_cols,
+                            char* block) {
+  return alloc_event(list, event_id, num_rows, num_cols, block);
+}
+
+/// Gets the size of a node of the reservation index.
+static size_t index_node_size(void) { return ((size_t)1 << RESERVATION_INDEX_BITS) * sizeof(void*); }
+
+/// Splits the tagged root of a reservation index into its node and number of levels.
+/// @param tagged Value of Event::reservation_index.
+/// @param levels Pointer to the variable to store the number of levels in.
+/// @return Root node, NULL if the index is empty.
+static void** index_root(void* tagged, unsigned int* levels) {
+  *levels = (unsigned int)((uintptr_t)tagged & INDEX_LEVEL_MASK) + 1;
+  return (void**)((uintptr_t)tagged & ~INDEX_LEVEL_MASK);
+}
+
+/// Frees a subtree of the reservation index with the seat lists it holds.
+/// @param node Node of the subtree, NULL if it was never created.
+/// @param level Number of levels below the node.
+static void free_index_node(struct EventList* list, void** node, unsigned int level) {
+  if (node == NULL) return;
+  for (size_t i = 0; i < (size_t)1 << RESERVATION_INDEX_BITS; i++) {
+    if (level == 0) {
+      free_reservation_seats(list, node[i]);
+    } else {
+      free_index_node(list, node[i], level - 1);
+    }
+  }
+  seat_free(&list->seat_pool, node, index_node_size());
+}
+
+/// Gets the slot of a reservation in the reservation index of an event.
+/// @note Small ids only pay for the levels they need, the root is replaced by a taller one once an id no longer
+/// fits, keeping the old root as its first child.
+/// @param list Event list the event belongs to, used to create missing nodes. NULL to never create them.
+/// @return Pointer to the slot, NULL if a node is missing and could not be created.
+static void** index_slot(struct EventList* list, struct Event* event, unsigned int reservation_id) {
+  unsigned int levels;
+  void* tagged = __atomic_load_n(&event->reservation_index, __ATOMIC_ACQUIRE);
+  void** node = index_root(tagged, &levels);
+
+  while (node == NULL || (levels < RESERVATION_INDEX_LEVELS &&
+                          ((size_t)reservation_id >> (levels * RESERVATION_INDEX_BITS)) != 0)) {
+    if (list == NULL) return NULL;
+
+    // An empty index starts with as many levels as the id needs
+    unsigned int grown_levels = levels + 1;
+    if (node == NULL) {
+      grown_levels = 1;
+      while (grown_levels < RESERVATION_INDEX_LEVELS &&
+             ((size_t)reservation_id >> (grown_levels * RESERVATION_INDEX_BITS)) != 0) {
+        grown_levels++;
+      }
+    }
+
+    void** created = seat_alloc(&list->seat_pool, index_node_size());
+    if (created == NULL) return NULL;
+    created[0] = node;
+
+    // Racing growers keep the first root published and retry against it
+    void* grown = (void*)((uintptr_t)created | (grown_levels - 1));
+    if (!__atomic_compare_exchange_n(&event->reservation_index, &tagged, grown, 0, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+      seat_free(&list->seat_pool, created, index_node_size());
+    }
+
+    tagged = __atomic_load_n(&event->reservation_index, __ATOMIC_ACQUIRE);
+    node = index_root(tagged, &levels);
+  }
+
+  for (unsigned int level = levels; level-- > 0;) {
+    size_t shift = level * RESERVATION_INDEX_BITS;
+    void** slot = &node[(reservation_id >> shift) & (((size_t)1 << RESERVATION_INDEX_BITS) - 1)];
+    if (level == 0) return slot;
+
+    node = __atomic_load_n((void***)slot, __ATOMIC_ACQUIRE);
+    if (node == NULL) {
+      if (list == NULL) return NULL;
+
+      // Racing creators of the same node keep the first one published
+      void** created = seat_alloc(&list->seat_pool, index_node_size());
+      if (created == NULL) return NULL;
+      if (__atomic_compare_exchange_n((void***)slot, &node, created, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        node = created;
+      } else {
+        seat_free(&list->seat_pool, created, index_node_size());
+      }
+    }
+  }
+
+  return NULL;
+}
+
+struct ReservationSeats* create_reservation_seats(struct EventList* list, size_t num_seats) {
+  struct ReservationSeats* seats =
+      seat_alloc(&list->seat_pool, sizeof(struct ReservationSeats) + num_seats * sizeof(size_t));
+  if (seats != NULL) seats->num_seats = num_seats;
+  return seats;
+}
+
+void free_reservation_seats(struct EventList* list, struct ReservationSeats* seats) {
+  if (seats == NULL) return;
+  seat_free(&list->seat_pool, seats, sizeof(struct ReservationSeats) + seats->num_seats * sizeof(size_t));
+}
+
+int index_reservation(struct EventList* list, struct Event* event, unsigned int reservation_id,
+                      struct ReservationSeats* seats) {
+  void** slot = index_slot(list, event, reservation_id);
+  if (slot == NULL) return 1;
+
+  __atomic_store_n((struct ReservationSeats**)slot, seats, __ATOMIC_RELEASE);
+  return 0;
+}
+
+struct ReservationSeats* unindex_reservation(struct Event* event, unsigned int reservation_id) {
+  void** slot = index_slot(NULL, event, reservation_id);
+  if (slot == NULL) return NULL;
 
-  struct ListNode* new_node = (struct ListNode*)malloc(sizeof(struct ListNode));
+  return __atomic_exchange_n((struct ReservationSeats**)slot, NULL, __ATOMIC_ACQ_REL);
+}
+
+int index_restored_reservations(struct EventList* list, struct Event* event) {
+  if (__atomic_load_n(&event->unindexed, __ATOMIC_ACQUIRE) == 0) return 0;
+
+  pthread_mutex_lock(&event->mutex);
+  unsigned int restored = event->unindexed;
+  if (restored == 0) {
+    pthread_mutex_unlock(&event->mutex);
+    return 0;
+  }
+
+  // Reservations made since the restore have later ids and are indexed by whoever made them
+  size_t num_seats = event->rows * event->cols;
+  struct ReservationSeats** found = calloc((size_t)restored + 1, sizeof(struct ReservationSeats*));
+  size_t* counts = calloc((size_t)restored + 1, sizeof(size_t));
+  int result = found == NULL || counts == NULL;
+
+  for (size_t i = 0; result == 0 && i < num_seats; i++) {
+    unsigned int reservation_id = __atomic_load_n(&event->data[i], __ATOMIC_RELAXED);
+    if (reservation_id != 0 && reservation_id <= restored) counts[reservation_id]++;
+  }
+
+  for (unsigned int id = 1; result == 0 && id <= restored; id++) {
+    // Reservations replayed from the write-ahead log after the restore are indexed already
+    void** slot = counts[id] == 0 ? NULL : index_slot(NULL, event, id);
+    if (counts[id] == 0 || (slot != NULL && __atomic_load_n(slot, __ATOMIC_ACQUIRE) != NULL)) continue;
+
+    found[id] = create_reservation_seats(list, counts[id]);
+    result = found[id] == NULL;
+    if (result == 0) found[id]->num_seats = 0;
+  }
+
+  for (size_t i = 0; result == 0 && i < num_seats; i++) {
+    unsigned int reservation_id = __atomic_load_n(&event->data[i], __ATOMIC_RELAXED);
+    if (reservation_id != 0 && reservation_id <= restored && found[reservation_id] != NULL) {
+      found[reservation_id]->seats[found[reservation_id]->num_seats++] = i;
+    }
+  }
+
+  for (unsigned int id = 1; result == 0 && id <= restored; id++) {
+    if (found[id] == NULL) continue;
+    result = index_reservation(list, event, id, found[id]);
+    if (result == 0) found[id] = NULL;
+  }
+
+  if (found != NULL) {
+    for (unsigned int id = 1; id <= restored; id++) free_reservation_seats(list, found[id]);
+  }
+  free(found);
+  free(counts);
+
+  if (result == 0) __atomic_store_n(&event->unindexed, 0, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&event->mutex);
+  return result;
+}
+
+void destroy_event(struct EventList* list, struct Event* event) {
+  if (!event) return;
+  unsigned int levels;
+  void** root = index_root(event->reservation_index, &levels);
+  free_index_node(list, root, levels - 1);
+  pthread_mutex_destroy(&event->mutex);
+
+  // Restored seat blocks belong to the checkpoint image
+  char* block = (char*)event->data;
+  if (block < list->image || block >= list->image + list->image_size) {
+    seat_free(&list->seat_pool, event->data, seat_block_size(event->rows, event->cols));
+  }
+  slab_free(&list->event_slab, event);
+}
+
+/// Links a new node for an event into its hash bucket and at the end of the creation order.
+/// @note The lock of the bucket must be held, unless no other thread uses the list yet.
+/// @return 0 if the node was linked successfully, 1 otherwise.
+static int link_node(struct EventList* list, size_t bucket, struct Event* event) {
+  struct ListNode* new_node = slab_alloc(&list->node_slab);
   if (!new_node) return 1;
 
+  new_node->id = event->id;
   new_node->event = event;
   new_node->next = NULL;
+  new_node->bucket_next = list->buckets[bucket];
 
+  // The node is fully initialized before it becomes reachable
+  __atomic_store_n(&list->buckets[bucket], new_node, __ATOMIC_RELEASE);
+
+  pthread_mutex_lock(&list->write_mutex);
+
+  new_node->prev = list->tail;
   if (list->head == NULL) {
-    list->head = new_node;
-    list->tail = new_node;
+    __atomic_store_n(&list->head, new_node, __ATOMIC_RELEASE);
   } else {
-    list->tail->next = new_node;
-    list->tail = new_node;
+    __atomic_store_n(&list->tail->next, new_node, __ATOMIC_RELEASE);
   }
+  list->tail = new_node;
+  __atomic_add_fetch(&list->version, 1, __ATOMIC_RELEASE);
 
+  pthread_mutex_unlock(&list->write_mutex);
   return 0;
 }
 
-static void free_event(struct Event* event) {
-  if (!event) return;
-  free(event->data);
-  free(event);
+int append_to_list(struct EventList* list, struct Event* event) {
+  if (!list) return 1;
+
+  size_t bucket = bucket_index(event->id);
+  pthread_mutex_t* lock = bucket_lock(list, bucket);
+
+  if (pthread_mutex_lock(lock) != 0) return 1;
+
+  for (struct ListNode* current = list->buckets[bucket]; current; current = current->bucket_next) {
+    if (current->id == event->id) {
+      pthread_mutex_unlock(lock);
+      return 2;
+    }
+  }
+
+  int result = link_node(list, bucket, event);
+  pthread_mutex_unlock(lock);
+
+  return result;
+}
+
+int restore_to_list(struct EventList* list, struct Event* event) {
+  if (!list) return 1;
+  return link_node(list, bucket_index(event->id), event);
+}
+
+/// Frees a node and its event, used as the epoch_retire callback.
+/// @param context Event list the node belongs to.
+/// @param ptr Node to be freed.
+static void free_node(void* context, void* ptr) {
+  struct EventList* list = (struct EventList*)context;
+  struct ListNode* node = (struct ListNode*)ptr;
+  destroy_event(list, node->event);
+  slab_free(&list->node_slab, node);
+}
+
+int remove_from_list(struct EventList* list, unsigned int event_id) {
+  if (!list) return 1;
+
+  size_t bucket = bucket_index(event_id);
+  pthread_mutex_t* lock = bucket_lock(list, bucket);
+
+  if (pthread_mutex_lock(lock) != 0) return 1;
+
+  struct ListNode** link = &list->buckets[bucket];
+  while (*link && (*link)->id != event_id) {
+    link = &(*link)->bucket_next;
+  }
+
+  struct ListNode* node = *link;
+  if (node == NULL) {
+    pthread_mutex_unlock(lock);
+    return 1;
+  }
+
+  // Readers already on the node keep following its own links, which are left untouched
+  __atomic_store_n(link, node->bucket_next, __ATOMIC_RELEASE);
+
+  pthread_mutex_lock(&list->write_mutex);
+
+  if (node->prev == NULL) {
+    __atomic_store_n(&list->head, node->next, __ATOMIC_RELEASE);
+  } else {
+    __atomic_store_n(&node->prev->next, node->next, __ATOMIC_RELEASE);
+  }
+
+  if (node->next == NULL) {
+    list->tail = node->prev;
+  } else {
+    node->next->prev = node->prev;
+  }
+  __atomic_add_fetch(&list->version, 1, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&list->write_mutex);
+  pthread_mutex_unlock(lock);
+
+  pthread_mutex_lock(&node->event->mutex);
+  node->event->deleted = 1;
+  pthread_mutex_unlock(&node->event->mutex);
+
+  epoch_retire(node, free_node, list);
+  return 0;
 }
 
 void free_list(struct EventList* list) {
   if (!list) return;
 
-  struct ListNode* current = list->head;
-  while (current) {
-    struct ListNode* temp = current;
-    current = current->next;
+  for (struct ListNode* current = list->head; current; current = current->next) {
+    pthread_mutex_destroy(&current->event->mutex);
+  }
+
+  seat_pool_destroy(&list->seat_pool);
+  if (list->image != NULL) munmap(list->image, list->image_size);
+  slab_destroy(&list->node_slab);
+  slab_destroy(&list->event_slab);
 
-    free_event(temp->event);
-    free(temp);
+  for (size_t i = 0; i < EVENT_TABLE_STRIPES; i++) {
+    pthread_mutex_destroy(&list->stripes[i]);
   }
+  pthread_mutex_destroy(&list->write_mutex);
 
   free(list);
 }
 
-struct Event* get_event(struct EventList* list, unsigned int event_id, struct ListNode* from, struct ListNode* to) {
-  if (!list || !from || !to) return NULL;
-  struct ListNode* current = from;
+struct Event* get_event(struct EventList* list, unsigned int event_id) {
+  if (!list) return NULL;
 
-  while (1) {
-    if (current->event->id == event_id) {
-      return current->event;
-    }
+  struct ListNode* current = __atomic_load_n(&list->buckets[bucket_index(event_id)], __ATOMIC_ACQUIRE);
 
-    if (current == to) {
-      return NULL;
+  while (current) {
+    if (current->id == event_id) {
+      return current->event;
     }
 
-    current = current->next;
+    current = __atomic_load_n(&current->bucket_next, __ATOMIC_ACQUIRE);
   }
+
+  return NULL;
 }
+
+unsigned long list_version(struct EventList* list) { return __atomic_load_n(&list->version, __ATOMIC_ACQUIRE); }
+
+struct ListNode* list_first(struct EventList* list) {
+  if (!list) return NULL;
+  return __atomic_load_n(&list->head, __ATOMIC_ACQUIRE);
+}
+
+struct ListNode* list_next(struct ListNode* node) { return __atomic_load_n(&node->next, __ATOMIC_ACQUIRE); }
@@ -3,6 +3,22 @@
 
 #include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "slab.h"
+
+#define EVENT_TABLE_BITS 16
+#define EVENT_TABLE_BUCKETS (1u << EVENT_TABLE_BITS)  // Number of hash buckets (power of two)
+#define EVENT_TABLE_STRIPES 256                       // Number of bucket locks (power of two)
+#define EVENT_JOURNAL_SIZE 1024                       // Maximum number of seat changes kept per event
+#define RESERVATION_INDEX_BITS 4                      // Bits of the reservation id resolved per index level
+#define RESERVATION_INDEX_LEVELS 8                    // Most levels of the reservation index, covering 32-bit ids
+
+// Seats of a reservation, as indices into Event::data
+struct ReservationSeats {
+  size_t num_seats;
+  size_t seats[];
+};
 
 struct Event {
   unsigned int id;            /// Event id
@@ -12,42 +28,176 @@ struct Event {
   size_t rows;  /// Number of rows.
 
   unsigned int* data;     /// Array of size rows * cols with the reservations for each seat.
+  uint64_t* taken;        /// Occupancy bitmap of data, one bit per seat.
+  unsigned int version;   /// Number of completed changes to data.
+  unsigned int writers;   /// Number of changes to data in progress.
+
+  size_t serial;        /// Number unique to this event, even across deletes and re-creates of the same id.
+  size_t changes;       /// Number of seats changed so far, the version a delta SHOW starts from.
+  size_t* journal;      /// Ring with the index of the last journal_size changed seats, entry i % journal_size.
+  size_t journal_size;  /// Capacity of journal, at most EVENT_JOURNAL_SIZE.
+
+  size_t* free_runs;       /// Max segment tree of the longest run of free seats per row, leaf of row i at
+                           /// free_run_leaves + i. Protected by mutex, rows in dirty_rows may be stale.
+  size_t free_run_leaves;  /// Number of leaves of free_runs, a power of two.
+  uint64_t* dirty_rows;    /// Bitmap of the rows changed since their leaf in free_runs was computed.
+
+  void* reservation_index;  /// Radix tree from reservation id to its ReservationSeats, nodes created on demand.
+                            /// Tagged with its number of levels minus one, grown as reservation ids get larger.
+  unsigned int unindexed;   /// Reservations up to this id were restored from a checkpoint and are not yet in
+                            /// reservation_index, see index_restored_reservations.
+
+  int deleted;            /// Set once the event is removed from the list, protected by mutex.
   pthread_mutex_t mutex;  // Mutex to protect the event
 };
 
+// Nodes are published with release stores and read with acquire loads, so readers need no lock. Writers
+// serialize on the locks of EventList. Removed nodes are freed through epoch_retire.
 struct ListNode {
+  unsigned int id;               // Id of the event, so bucket scans never touch the event itself
+  struct ListNode* bucket_next;  // Next node in the same hash bucket
   struct Event* event;
-  struct ListNode* next;
+  struct ListNode* next;  // Next node in creation order
+  struct ListNode* prev;  // Previous node in creation order, only used by writers
 };
 
-// Linked list structure
+// Linked list structure, indexed by a hash table on the event id
 struct EventList {
-  struct ListNode* head;  // Head of the list
-  struct ListNode* tail;  // Tail of the list
-  pthread_rwlock_t rwl;   // Mutex to protect the list
+  struct ListNode* head;         // Head of the list
+  struct ListNode* tail;         // Tail of the list, only used by writers
+  pthread_mutex_t write_mutex;  // Mutex to serialize changes to the creation order
+  unsigned long version;        // Bumped after every append and removal
+  size_t next_serial;           // Serial of the next event created
+
+  struct ListNode* buckets[EVENT_TABLE_BUCKETS];  // Hash chains
+  pthread_mutex_t stripes[EVENT_TABLE_STRIPES];   // Bucket i is changed under stripes[i % EVENT_TABLE_STRIPES]
+
+  struct Slab event_slab;     // Storage of every Event
+  struct Slab node_slab;      // Storage of every ListNode
+  struct SeatPool seat_pool;  // Storage of the data and taken arrays of every Event
+
+  char* image;        // Checkpoint the list was restored from, holding the seat blocks of restored events
+  size_t image_size;  // Size of image, unmapped by free_list
 };
 
 /// Creates a new event list.
 /// @return Newly created event list, NULL on failure
 struct EventList* create_list();
 
-/// Appends a new node to the list.
+/// Creates a new event, with every seat free, using the storage of the list.
+/// @param list Event list the event will be appended to.
+/// @param event_id Id of the event.
+/// @param num_rows Number of rows of the event.
+/// @param num_cols Number of columns of the event.
+/// @return Newly created event, NULL on failure.
+struct Event* create_event(struct EventList* list, unsigned int event_id, size_t num_rows, size_t num_cols);
+
+/// Gets the size of the seat block of an event, which starts at Event::data and holds every seat structure.
+/// @param num_rows Number of rows of the event.
+/// @param num_cols Number of columns of the event.
+/// @return Size of the block in bytes.
+size_t seat_block_size(size_t num_rows, size_t num_cols);
+
+/// Creates an event around a seat block restored from a checkpoint, using the block in place.
+/// @note The block must lie inside the image of the list, and is never returned to the seat pool.
+/// @param list Event list the event will be appended to.
+/// @param event_id Id of the event.
+/// @param num_rows Number of rows of the event.
+/// @param num_cols Number of columns of the event.
+/// @param block Seat block of the event.
+/// @return Newly created event, NULL on failure.
+struct Event* restore_event(struct EventList* list, unsigned int event_id, size_t num_rows, size_t num_cols,
+                            char* block);
+
+/// Frees an event that was never appended to the list.
+/// @param list Event list the event was created with.
+/// @param event Event to be freed.
+void destroy_event(struct EventList* list, struct Event* event);
+
+/// Creates an empty seat list for a reservation, using the storage of the list.
+/// @param list Event list the event of the reservation belongs to.
+/// @param num_seats Number of seats of the reservation.
+/// @return Newly created seat list with num_seats set, NULL on failure.
+struct ReservationSeats* create_reservation_seats(struct EventList* list, size_t num_seats);
+
+/// Frees a seat list created with create_reservation_seats.
+void free_reservation_seats(struct EventList* list, struct ReservationSeats* seats);
+
+/// Adds the seats of a reservation to the reservation index of an event.
+/// @note Safe to call concurrently for different reservations of the same event.
+/// @param list Event list the event belongs to.
+/// @param event Event of the reservation.
+/// @param reservation_id Id of the reservation.
+/// @param seats Seat list of the reservation, owned by the index on success.
+/// @return 0 if the reservation was indexed, 1 otherwise.
+int index_reservation(struct EventList* list, struct Event* event, unsigned int reservation_id,
+                      struct ReservationSeats* seats);
+
+/// Removes a reservation from the reservation index of an event.
+/// @note Concurrent calls for the same reservation return its seats to exactly one caller.
+/// @param event Event of the reservation.
+/// @param reservation_id Id of the reservation.
+/// @return Seat list of the reservation, owned by the caller, NULL if it is not indexed.
+struct ReservationSeats* unindex_reservation(struct Event* event, unsigned int reservation_id);
+
+/// Indexes the reservations of an event restored from a checkpoint, found by scanning its seats.
+/// @note Does nothing once the event is indexed. Holds the event mutex while scanning, so the seats of restored
+/// reservations must only be cleared after calling it.
+/// @param list Event list the event belongs to.
+/// @param event Event to be indexed.
+/// @return 0 if every restored reservation is indexed, 1 otherwise.
+int index_restored_reservations(struct EventList* list, struct Event* event);
+
+/// Appends a new node to the list, unless an event with the same id already exists.
+/// @note Only the bucket the event hashes to is locked while checking and inserting.
 /// @param list Event list to be modified.
 /// @param data Event to be stored in the new node.
-/// @return 0 if the node was appended successfully, 1 otherwise.
+/// @return 0 if the node was appended successfully, 2 if the event already exists, 1 otherwise.
 int append_to_list(struct EventList* list, struct Event* data);
 
-/// Removes a node from the list.
+/// Appends a new node to the list without checking for an event with the same id.
+/// @note Only for restoring a checkpoint, which holds each id once, before any other thread uses the list.
+/// Skipping the check keeps the cost of each append independent of the length of the hash chains.
 /// @param list Event list to be modified.
+/// @param event Event to be stored in the new node.
+/// @return 0 if the node was appended successfully, 1 otherwise.
+int restore_to_list(struct EventList* list, struct Event* event);
+
+/// Removes the node of an event from the list and retires it.
+/// @note The node and its event are freed once no epoch critical section can still reference them.
+/// @param list Event list to be modified.
+/// @param event_id Id of the event to be removed.
 /// @return 0 if the node was removed successfully, 1 otherwise.
+int remove_from_list(struct EventList* list, unsigned int event_id);
+
+/// Frees the list and every event still in it.
+/// @note No other thread may be using the list. The storage of the events is released in bulk.
+/// @param list Event list to be freed.
 void free_list(struct EventList* list);
 
 /// Retrieves an event in the list.
+/// @note Must be called inside an epoch critical section, which must not be exited while the event is used.
 /// @param list Event list to be searched
 /// @param event_id Event id.
-/// @param from First node to be searched.
-/// @param to Last node to be searched.
 /// @return Pointer to the event if found, NULL otherwise.
-struct Event* get_event(struct EventList* list, unsigned int event_id, struct ListNode* from, struct ListNode* to);
+struct Event* get_event(struct EventList* list, unsigned int event_id);
+
+/// Gets the version of the list.
+/// @note Every node appended before the version was bumped is reachable once the version is read.
+/// @param list Event list.
+/// @return Number of appends and removals so far.
+unsigned long list_version(struct EventList* list);
+
+/// Gets the first node of the list, in creation order.
+/// @note Must be called inside an epoch critical section. Follow the list with list_next.
+/// @param list Event list to be traversed.
+/// @return Pointer to the first node, NULL if the list is empty.
+struct ListNode* list_first(struct EventList* list);
+
+/// Gets the next node of the list, in creation order.
+/// @note Must be called inside the same epoch critical section as list_first.
+/// @param node Current node.
+/// @return Pointer to the next node, NULL at the end of the list.
+struct ListNode* list_next(struct ListNode* node);
 
 #endif  // SERVER_EVENT_LIST_H
@@ -3,16 +3,25 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "common/constants.h"
-#include "common/io.h"
+#include "common/ring.h"
 #include "operations.h"
+#include "reactor.h"
+#include "reply.h"
+#include "request.h"
+#include "shard.h"
 
-int server_pipe;
+int server_pipe;  // Server socket with -t socket
+int transport = TRANSPORT_FIFO;
 sigset_t blocked_signals;
 int sigusr1_flag = 0;
 
@@ -21,24 +30,42 @@ void handle_function(){
   printf("SIGUSR1 received\n");
 }
 
+volatile sig_atomic_t sigterm_flag = 0;
+
+void handle_sigterm(int sig){
+  (void)sig;
+  sigterm_flag = 1;
+}
+
 typedef struct{
   int client_session_id;
 }thread_args;
 
 typedef struct{
-  char *req_pipe_path, *resp_pipe_path;
+  int socket;  // Connected socket of the client, -1 if it registered its pipes instead
+  char req_pipe_path[MAX_PIPE_NAME + 1];
+  char resp_pipe_path[MAX_PIPE_NAME + 1];
 } Client;
 
-Client clients[MAX_SESSION_COUNT];
-int client_count = 0;
+// Clients registered and not yet taken by a thread, served in the order they connected
+Client clients[MAX_PENDING_SESSIONS];
+size_t client_head = 0;  // Oldest client
+size_t client_count = 0;
 pthread_mutex_t clients_mutex;
 pthread_cond_t clients_cond;
+sem_t free_clients;  // Free slots of clients, the server pipe is not read while there are none
+
+// Releases clients_mutex when a thread is cancelled while waiting for a client
+void unlock_clients(void* arg){
+  (void)arg;
+  pthread_mutex_unlock(&clients_mutex);
+}
 
 void*thread_function(void* args){
 
   thread_args *t_args = (thread_args*)args;
-  int active_client;
   int client_session_id = t_args->client_session_id;
+  size_t session = (size_t)(client_session_id - 1);
 
   // Blocks thread from receiving
   pthread_sigmask(SIG_BLOCK, &blocked_signals, NULL);
@@ -46,7 +73,13 @@ void*thread_function(void* args){
   // Loop that keeps thread always active
   while(1) {
 
+    Client client;
+
+    // Requests disable cancellation, and a session that ended left it that way
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
     pthread_mutex_lock(&clients_mutex);
+    pthread_cleanup_push(unlock_clients, NULL);
 
     while(client_count == 0 ){
       printf("Consumer %d is waiting...\n", client_session_id);
@@ -54,28 +87,44 @@ void*thread_function(void* args){
     }
 
     // If we get a conditional signal and the client count is greater than 0 that means we have a new active client
-    active_client = 1;
-    char* req_pipe_path = clients[client_count-1].req_pipe_path;
-    char* resp_pipe_path = clients[client_count-1].resp_pipe_path;
-
+    client = clients[client_head];
+    client_head = (client_head + 1) % MAX_PENDING_SESSIONS;
     client_count--;
-    pthread_mutex_unlock(&clients_mutex);
+    pthread_cleanup_pop(1);
+    sem_post(&free_clients);
     printf("Consumer %d is awake.\n", client_session_id);
 
-    int req_pipe = open(req_pipe_path, O_RDONLY);
-    if (req_pipe == -1) {
-      perror("Error opening Client's request pipe for reading");
-    }
+    // A connected socket carries both requests and responses
+    int req_pipe = client.socket;
+    int resp_pipe = client.socket;
+    struct RingPair rings;
+    struct Reply reply = {0};
+
+    if (transport == TRANSPORT_SHM) {
+      // The client names its segment in place of its request pipe
+      // A segment that cannot be mapped loses its name anyway, which tells the client its session failed
+      if (ring_pair_open(client.req_pipe_path, &rings) != 0) {
+        perror("Error mapping Client's shared memory");
+        continue;
+      }
+      reply.ring = &rings.responses;
+    } else {
+      if (client.socket == -1 && (req_pipe = open(client.req_pipe_path, O_RDONLY)) == -1) {
+        perror("Error opening Client's request pipe for reading");
+        continue;
+      }
 
-    // Opens Client's response pipe for writing
-    int resp_pipe = open(resp_pipe_path, O_WRONLY);
-    if (resp_pipe == -1) {
-      perror("Error opening Client's response pipe for writing");
-      close(req_pipe);
+      // Opens Client's response pipe for writing
+      if (client.socket == -1 && (resp_pipe = open(client.resp_pipe_path, O_WRONLY)) == -1) {
+        perror("Error opening Client's response pipe for writing");
+        close(req_pipe);
+        continue;
+      }
+      reply.fd = resp_pipe;
     }
 
-    // Sends the session_id back to Client via resp_pipe
-    if (write(resp_pipe, &client_session_id, sizeof(int)) == -1) {
+    // Sends the session_id back to Client
+    if (reply_write(&reply, &client_session_id, sizeof(int)) != 0) {
       fprintf(stderr, "Failed to write session_id to response pipe\n");
     }
 
@@ -83,232 +132,323 @@ void*thread_function(void* args){
 
     printf("A Client connected to the server with session ID: %d!\n", client_session_id);
 
+    // Requests are decoded from whatever the pipe holds, so one split across reads is still executed whole
+    struct RequestBuffer requests = {0};
     while (1) {
-
-
-      if (!active_client) {
-        break;
-      }
-
-      char op_code;
+      // The thread may only be cancelled while waiting for a request, never halfway through one
+      pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
       ssize_t bytes_read;
-      bytes_read = read(req_pipe, &op_code, sizeof(char));
-
-      if (bytes_read == -1) {
-        // fprintf(stderr, "Error reading OP_CODE from request pipe\n");
-        perror("Error reading OP_CODE from request pipe");
-        close(req_pipe);
-        close(resp_pipe);
+      if (transport == TRANSPORT_SHM) {
+        bytes_read = request_read_ring(&requests, &rings.requests);
+      } else if (client.socket != -1) {
+        bytes_read = request_receive(&requests, req_pipe);
+      } else {
+        bytes_read = request_read(&requests, req_pipe);
       }
+      pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-      // Switch case to execute commands based on OP_CODE
-      switch (op_code) {
-        case '2': {
-          int session_id;
-
-          if (read(req_pipe, &session_id, sizeof(int)) == -1) {
-            fprintf(stderr, "Error reading from request pipe (ems_quit)\n");
-          }
+      if (bytes_read == -1 && errno == EINTR) continue;
+      if (bytes_read == -1) perror("Error reading OP_CODE from request pipe");
 
-          printf("REQUEST FOR EMS_QUIT RECEIVED\n");
+      // The client closed its end, or quit
+      if (bytes_read <= 0 || request_execute(&requests, session, &reply) != 0) break;
+    }
 
-          close(req_pipe);
-          close(resp_pipe);
+    request_free(&requests);
+    if (transport == TRANSPORT_SHM) {
+      ring_pair_close(&rings);
+    } else {
+      close(req_pipe);
+      if (client.socket == -1) close(resp_pipe);
+    }
+  }
+}
 
-          active_client = 0;
 
-          printf("Client with session ID %d disconnected from server!\n", session_id);
 
-          break;
+int main(int argc, char* argv[]) {
+  struct EmsConfig config = {.delay_us = STATE_ACCESS_DELAY_US,
+                             .reserve_mode = RESERVE_MODE_MUTEX,
+                             .wal_path = NULL,
+                             .wal_sync = WAL_SYNC_INTERVAL,
+                             .wal_interval_us = WAL_INTERVAL_US,
+                             .checkpoint_path = NULL,
+                             .checkpoint_interval_s = CHECKPOINT_INTERVAL_S};
+  size_t num_shards = 0;
+  size_t num_loops = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:w:s:i:c:p:n:e:t:")) != -1) {
+    switch (opt) {
+      case 'r':
+        if (strcmp(optarg, "mutex") == 0) {
+          config.reserve_mode = RESERVE_MODE_MUTEX;
+        } else if (strcmp(optarg, "cas") == 0) {
+          config.reserve_mode = RESERVE_MODE_CAS;
+        } else {
+          fprintf(stderr, "Invalid reservation mode: %s\n", optarg);
+          return 1;
         }
-        case '3': {
-          int session_id;
-          unsigned int event_id;
-          size_t num_rows;
-          size_t num_cols;
-
-          if (read(req_pipe, &session_id, sizeof(int)) == -1 || read(req_pipe, &event_id, sizeof(unsigned int)) == -1 ||
-              read(req_pipe, &num_rows, sizeof(size_t)) == -1 || read(req_pipe, &num_cols, sizeof(size_t)) == -1) {
-            fprintf(stderr, "Error reading from request pipe (ems_create)\n");
-          }
-
-          printf("REQUEST FOR EMS_CREATE RECEIVED\n");
-
-          int return_status = ems_create(event_id, num_rows, num_cols);
+        break;
 
-          if (write(resp_pipe, &return_status, sizeof(int)) == -1) {
-            fprintf(stderr, "Error writing return status to response pipe (ems_create)\n");
-          }
+      case 'w':
+        config.wal_path = optarg;
+        break;
 
-          break;
+      case 's':
+        if (strcmp(optarg, "none") == 0) {
+          config.wal_sync = WAL_SYNC_NONE;
+        } else if (strcmp(optarg, "interval") == 0) {
+          config.wal_sync = WAL_SYNC_INTERVAL;
+        } else if (strcmp(optarg, "every") == 0) {
+          config.wal_sync = WAL_SYNC_EVERY;
+        } else {
+          fprintf(stderr, "Invalid sync policy: %s\n", optarg);
+          return 1;
         }
+        break;
 
-        case '4': {
-          int session_id;
-          unsigned int event_id;
-          size_t num_seats;
-
-          if (read(req_pipe, &session_id, sizeof(int)) == -1 || read(req_pipe, &event_id, sizeof(unsigned int)) == -1 ||
-              read(req_pipe, &num_seats, sizeof(size_t)) == -1) {
-            fprintf(stderr, "Error reading from request pipe (ems_reserve)\n");
-          }
-
-          size_t xs[num_seats];
-          size_t ys[num_seats];
-
-          if (read(req_pipe, &xs, sizeof(size_t) * num_seats) == -1 ||
-              read(req_pipe, &ys, sizeof(size_t) * num_seats) == -1) {
-            fprintf(stderr, "Error reading reservation seat coordinates from request pipe (ems_reserve)\n");
-          }
-
-          printf("REQUEST FOR EMS_RESERVE RECEIVED\n");
-
-          int return_status = ems_reserve(event_id, num_seats, xs, ys);
-
-          if (write(resp_pipe, &return_status, sizeof(int)) == -1) {
-            fprintf(stderr, "Error writing return status to response pipe (ems_reserve)\n");
-          }
-
-          break;
+      case 'i': {
+        char* end;
+        unsigned long int interval = strtoul(optarg, &end, 10);
+        if (*optarg == '\0' || *end != '\0' || interval > UINT_MAX) {
+          fprintf(stderr, "Invalid sync interval: %s\n", optarg);
+          return 1;
         }
+        config.wal_interval_us = (unsigned int)interval;
+        break;
+      }
 
-        case '5': {
-          int session_id;
-          unsigned int event_id;
-
-          if (read(req_pipe, &session_id, sizeof(int)) == -1 || read(req_pipe, &event_id, sizeof(unsigned int)) == -1) {
-            fprintf(stderr, "Error reading from request pipe (ems_show)\n");
-          }
-
-          printf("REQUEST FOR EMS_SHOW RECEIVED\n");
-          ems_show(resp_pipe, event_id);
+      case 'c':
+        config.checkpoint_path = optarg;
+        break;
 
-          break;
+      case 'p': {
+        char* end;
+        unsigned long int period = strtoul(optarg, &end, 10);
+        if (*optarg == '\0' || *end != '\0' || period > UINT_MAX) {
+          fprintf(stderr, "Invalid checkpoint period: %s\n", optarg);
+          return 1;
         }
+        config.checkpoint_interval_s = (unsigned int)period;
+        break;
+      }
 
-        case '6': {
-          int session_id;
-
-          if (read(req_pipe, &session_id, sizeof(int)) == -1) {
-            fprintf(stderr, "Error when reading session_id from request pipe (ems_list_events)\n");
-          }
+      case 'n': {
+        char* end;
+        unsigned long int shards = strtoul(optarg, &end, 10);
+        if (*optarg == '\0' || *end != '\0' || shards > MAX_SHARD_COUNT) {
+          fprintf(stderr, "Invalid number of shards: %s\n", optarg);
+          return 1;
+        }
+        num_shards = (size_t)shards;
+        break;
+      }
 
-          printf("REQUEST FOR EMS_LIST_EVENTS RECEIVED\n");
-          ems_list_events(resp_pipe);
-          break;
+      case 'e': {
+        char* end;
+        unsigned long int loops = strtoul(optarg, &end, 10);
+        if (*optarg == '\0' || *end != '\0' || loops > MAX_LOOP_COUNT) {
+          fprintf(stderr, "Invalid number of event loops: %s\n", optarg);
+          return 1;
         }
+        num_loops = (size_t)loops;
+        break;
+      }
 
-        default: {
-          break;
+      case 't':
+        if (strcmp(optarg, "fifo") == 0) {
+          transport = TRANSPORT_FIFO;
+        } else if (strcmp(optarg, "socket") == 0) {
+          transport = TRANSPORT_SOCKET;
+        } else if (strcmp(optarg, "shm") == 0) {
+          transport = TRANSPORT_SHM;
+        } else {
+          fprintf(stderr, "Invalid transport: %s\n", optarg);
+          return 1;
         }
+        break;
 
-      }
+      default:
+        fprintf(stderr, "Usage: %s [-r mutex|cas] [-w wal_path] [-s none|interval|every] [-i interval_us] [-c checkpoint_path] [-p period_s] [-n shards] [-e loops] [-t fifo|socket|shm] <pipe_path> [delay]\n", argv[0]);
+        return 1;
     }
   }
-}
-
-
 
-int main(int argc, char* argv[]) {
-  if (argc < 2 || argc > 3) {
-    fprintf(stderr, "Usage: %s\n <pipe_path> [delay]\n", argv[0]);
+  if (argc - optind < 1 || argc - optind > 2) {
+    fprintf(stderr, "Usage: %s [-r mutex|cas] [-w wal_path] [-s none|interval|every] [-i interval_us] [-c checkpoint_path] [-p period_s] [-n shards] [-e loops] [-t fifo|socket|shm] <pipe_path> [delay]\n", argv[0]);
     return 1;
   }
 
+  char* pipe_path = argv[optind];
+
   char* endptr;
-  unsigned int state_access_delay_us = STATE_ACCESS_DELAY_US;
-  if (argc == 3) {
-    unsigned long int delay = strtoul(argv[2], &endptr, 10);
+  if (argc - optind == 2) {
+    unsigned long int delay = strtoul(argv[optind + 1], &endptr, 10);
 
     if (*endptr != '\0' ||  delay > UINT_MAX) {
       fprintf(stderr, "Invalid delay value or value too large\n");
       return 1;
     }
 
-    state_access_delay_us = (unsigned int)delay;
+    config.delay_us = (unsigned int)delay;
+  }
+
+  // A client that goes away mid-response only fails the write, instead of stopping the server
+  signal(SIGPIPE, SIG_IGN);
+
+  // Both without SA_RESTART, so a blocked read of the server pipe returns and the loop sees the signal
+  sigemptyset(&blocked_signals);
+  struct sigaction sigusr1_action = {.sa_handler = handle_function};
+  sigemptyset(&sigusr1_action.sa_mask);
+  sigaction(SIGUSR1, &sigusr1_action, NULL);
+  sigaddset(&blocked_signals, SIGUSR1);
+
+  struct sigaction sigterm_action = {.sa_handler = handle_sigterm};
+  sigemptyset(&sigterm_action.sa_mask);
+  sigaction(SIGTERM, &sigterm_action, NULL);
+  sigaddset(&blocked_signals, SIGTERM);
+
+  // Threads started from here on inherit the mask, only the main thread handles the signals
+  pthread_sigmask(SIG_BLOCK, &blocked_signals, NULL);
+
+  // Shared-memory sessions are waited on with futexes, which an event loop cannot poll
+  if (transport == TRANSPORT_SHM && num_loops > 0) {
+    fprintf(stderr, "Shared-memory sessions need a thread each, -e cannot be used with -t shm\n");
+    return 1;
   }
 
-  if (ems_init(state_access_delay_us)) {
+  // Shards own their events outright, so the reservation mode chosen with -r does not apply
+  if (num_shards > 0) config.reserve_mode = RESERVE_MODE_OWNER;
+
+  if (ems_init(&config)) {
     fprintf(stderr, "Failed to initialize EMS\n");
     return 1;
   }
 
-  sigemptyset(&blocked_signals);
-  signal(SIGUSR1, handle_function);
-  sigaddset(&blocked_signals, SIGUSR1);
+  // Each session thread, or each worker of the event loops, hands requests to the shards over its own queues
+  if (shard_init(num_shards, num_loops > 0 ? REACTOR_WORKERS : MAX_SESSION_COUNT)) {
+    fprintf(stderr, "Failed to start shards\n");
+    return 1;
+  }
 
   //Initializes clients mutex and condition variable
   pthread_mutex_init(&clients_mutex, NULL);
   pthread_cond_init(&clients_cond, NULL);
+  sem_init(&free_clients, 0, MAX_PENDING_SESSIONS);
 
   pthread_t thread_array[MAX_SESSION_COUNT];
   thread_args  args_array[MAX_SESSION_COUNT];
 
-  for(int i=0; i<MAX_SESSION_COUNT; i++){
-    // Assigns session id to thread id
-    args_array[i].client_session_id = i+1;
-    pthread_create(&thread_array[i], NULL, thread_function, &args_array[i]);
+  // In event-loop mode the loops serve every session, and no session thread is started
+  if (num_loops > 0) {
+    if (reactor_start(num_loops)) {
+      fprintf(stderr, "Failed to start event loops\n");
+      return 1;
+    }
+  } else {
+    for(int i=0; i<MAX_SESSION_COUNT; i++){
+      // Assigns session id to thread id
+      args_array[i].client_session_id = i+1;
+      pthread_create(&thread_array[i], NULL, thread_function, &args_array[i]);
+    }
+  }
+
+  if (transport == TRANSPORT_SOCKET) {
+    // Listens on a socket with the name from command line, replacing the one a previous run left behind
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(pipe_path) >= sizeof(address.sun_path)) {
+      fprintf(stderr, "Server socket path too long\n");
+      return 1;
+    }
+    strcpy(address.sun_path, pipe_path);
+    unlink(pipe_path);
+
+    if ((server_pipe = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1 ||
+        bind(server_pipe, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(server_pipe, SOMAXCONN) == -1) {
+      perror("Failed to create server socket");
+      return 1;
+    }
   }
 
   // Creates server pipe with name from command line
-  if (mkfifo(argv[1], 0777) == -1){
+  if (transport != TRANSPORT_SOCKET && mkfifo(pipe_path, 0777) == -1){
     if (errno != EEXIST){
       fprintf(stderr, "Failed to create server pipe\n");
       return 1;
     }
   }
 
-  // Opens server pipe for reading
-  if ((server_pipe = open(argv[1], O_RDONLY) )== -1){
+  // Opens server pipe for reading, without waiting for a client to open it for writing
+  if (transport != TRANSPORT_SOCKET && (server_pipe = open(pipe_path, O_RDONLY | O_NONBLOCK) )== -1){
+    fprintf(stderr, "Failed to open server pipe\n");
+    return 1;
+  }
+
+  // Keeps a writer on server pipe, so reading it blocks between clients instead of returning end of file at once
+  int server_pipe_writer = -1;
+  if (transport != TRANSPORT_SOCKET && ((server_pipe_writer = open(pipe_path, O_WRONLY)) == -1 ||
+                                        fcntl(server_pipe, F_SETFL, 0) == -1)) {
     fprintf(stderr, "Failed to open server pipe\n");
     return 1;
   }
 
+  pthread_sigmask(SIG_UNBLOCK, &blocked_signals, NULL);
+
   printf("Server is now running...\n");
   printf("\n");
 
   // Registration while loop
-  while(1){
-    char OP_CODE = '0';
-    char req_pipe_path[MAX_PIPE_NAME];
-    char resp_pipe_path[MAX_PIPE_NAME];
-    Client client;
-    ssize_t bytes_read;
+  while(!sigterm_flag){
+    Client client = {.socket = -1};
 
     if(sigusr1_flag){
       sigusr1_flag = 0;
       ems_print_info(STDOUT_FILENO);
     }
 
-    // Reads from server pipe to initialize a new session
-    if ((bytes_read = read(server_pipe, &OP_CODE, sizeof(char))) == -1){
-      fprintf(stderr, "Failed to read from request pipe\n");
-      return 1;
-    } else if(bytes_read == 0){
-      continue;
-    }
+    if (transport == TRANSPORT_SOCKET) {
+      // A connection is the whole registration, there are no pipes to learn of
+      if ((client.socket = accept(server_pipe, NULL, NULL)) == -1) {
+        if (errno != EINTR) perror("Failed to accept connection");
+        continue;
+      }
+    } else {
+      char registration[1 + 2 * MAX_PIPE_NAME];
+      ssize_t bytes_read;
 
-    if(OP_CODE != '1'){
-      continue;
-    }
+      // Reads a whole registration from server pipe to initialize a new session, clients write each one at once
+      if ((bytes_read = read(server_pipe, registration, sizeof(registration))) == -1){
+        if (errno == EINTR) continue;
+        fprintf(stderr, "Failed to read from request pipe\n");
+        return 1;
+      }
 
-    if (read(server_pipe, req_pipe_path, MAX_PIPE_NAME) == -1){
-      fprintf(stderr, "Failed to read from request pipe\n");
-      return 1;
+      if (bytes_read != (ssize_t)sizeof(registration) || registration[0] != '1'){
+        continue;
+      }
+
+      memcpy(client.req_pipe_path, registration + 1, MAX_PIPE_NAME);
+      memcpy(client.resp_pipe_path, registration + 1 + MAX_PIPE_NAME, MAX_PIPE_NAME);
     }
 
-    if (read(server_pipe, resp_pipe_path, MAX_PIPE_NAME) == -1){
-      fprintf(stderr, "Failed to read from request pipe\n");
-      return 1;
+    if (num_loops > 0) {
+      if (client.socket != -1) {
+        reactor_accept(client.socket);
+      } else {
+        reactor_add(client.req_pipe_path, client.resp_pipe_path);
+      }
+      continue;
     }
 
-    client.req_pipe_path = req_pipe_path;
-    client.resp_pipe_path = resp_pipe_path;
+    // Waits for a free slot, leaving further clients blocked on the server pipe until a thread takes one
+    while (sem_wait(&free_clients) == -1 && !sigterm_flag);
+    if (sigterm_flag) break;
 
     pthread_mutex_lock(&clients_mutex);
 
-    // Adds new client to the array of clients
-    clients[client_count] = client;
+    // Adds new client to the end of the queue of clients
+    clients[(client_head + client_count) % MAX_PENDING_SESSIONS] = client;
     client_count++;
 
     // Signals the threads that are waiting to acquire a client and execute its requests
@@ -317,4 +457,22 @@ int main(int argc, char* argv[]) {
 
   }
 
+  printf("SIGTERM received, shutting down...\n");
+
+  // Sessions only stop between requests, so the state is left consistent for the last checkpoint
+  if (num_loops > 0) {
+    reactor_stop();
+  } else {
+    for(int i=0; i<MAX_SESSION_COUNT; i++){
+      pthread_cancel(thread_array[i]);
+    }
+    for(int i=0; i<MAX_SESSION_COUNT; i++){
+      pthread_join(thread_array[i], NULL);
+    }
+  }
+
+  close(server_pipe);
+  if (server_pipe_writer != -1) close(server_pipe_writer);
+  shard_terminate();
+  return ems_terminate();
 }
\ No newline at end of file
@@ -1,26 +1,119 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "common/constants.h"
+#include "checkpoint.h"
 #include "common/io.h"
+#include "epoch.h"
 #include "eventlist.h"
+#include "operations.h"
+#include "reply.h"
+#include "wal.h"
+
+#define SNAPSHOT_RETRIES 16  // Optimistic copies of an event before snapshot_seats falls back to its mutex
+#define CATALOG_STRIPES 64    // Locks ordering the creates and deletes of the same id in the log (power of two)
+#define SEAT_MAP_HEADER_SIZE (2 * sizeof(size_t) + sizeof(unsigned char) + sizeof(size_t))  // See put_seat_map
+
+// Serialized LIST response, shared by every session while the set of events is unchanged
+struct ListResponse {
+  unsigned long version;  // Version of the event list the response was built from
+  unsigned int refs;      // One per session writing the response, plus one while it is cached
+  int status;             // Return value of ems_list_events
+  size_t size;            // Size of data
+  char data[];
+};
+
+// Types of the write-ahead log records
+enum WalRecord {
+  WAL_RECORD_CREATE = 1,  // struct WalCreate
+  WAL_RECORD_DELETE,      // struct WalDelete
+  WAL_RECORD_RESERVE,     // size_t number of parts, then per part a struct WalReservation and its seat indices
+  WAL_RECORD_CANCEL,      // struct WalReservation without seats
+};
+
+struct WalCreate {
+  size_t serial;
+  size_t rows;
+  size_t cols;
+  unsigned int id;
+};
+
+struct WalDelete {
+  size_t serial;
+  unsigned int id;
+};
+
+// Reservation of one event, always naming its serial so it never applies to a later event with the same id
+struct WalReservation {
+  size_t serial;
+  size_t num_seats;
+  unsigned int id;
+  unsigned int reservation_id;
+};
 
 static struct EventList* event_list = NULL;
+static struct ListResponse* list_cache = NULL;
 static unsigned int state_access_delay_us = 0;
+static enum ReserveMode reserve_mode = RESERVE_MODE_MUTEX;
+static int logging = 0;  // Whether changes are appended to the write-ahead log
+static pthread_mutex_t catalog_locks[CATALOG_STRIPES];
+
+static const char* checkpoint_path = NULL;
+static unsigned int checkpoint_interval_s = 0;
+static pthread_t checkpoint_thread;
+static int checkpoint_stop = 0;  // Set to end checkpoint_loop, protected by checkpoint_mutex
+static pthread_mutex_t checkpoint_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t checkpoint_cond = PTHREAD_COND_INITIALIZER;
+
+static _Thread_local uint64_t deferred_lsn = 0;  // Log sequence number left for ems_take_lsn
+static _Thread_local struct EmsBatch* current_batch = NULL;  // See ems_batch_enter
+
+/// Waits to simulate a real system accessing a costly memory resource.
+static void delay_state_access(void) {
+  struct timespec delay = {0, state_access_delay_us * 1000};
+  nanosleep(&delay, NULL);  // Should not be removed
+}
+
+/// Acknowledges a change once it is durable.
+/// @note In RESERVE_MODE_OWNER the wait is left to the caller of ems_take_lsn, so the owner of an event never
+/// blocks on the log.
+/// @param lsn Log sequence number returned by wal_append, 0 if nothing was logged.
+/// @return 0 if the change is durable or its wait deferred, 1 otherwise.
+static int acknowledge(uint64_t lsn) {
+  if (reserve_mode != RESERVE_MODE_OWNER) return wal_wait(lsn);
+
+  deferred_lsn = lsn;
+  return 0;
+}
+
+/// Records a lookup of an event in the batch of the calling thread.
+/// @return 1 if the batch already looked the event up, and so paid its access delay, 0 otherwise.
+static int batch_looked_up(unsigned int event_id) {
+  struct EmsBatch* batch = current_batch;
+  if (batch == NULL) return 0;
+
+  for (size_t i = 0; i < batch->num_events; i++) {
+    if (batch->event_ids[i] == event_id) return 1;
+  }
+  if (batch->num_events < BATCH_LOOKUPS) batch->event_ids[batch->num_events++] = event_id;
+  return 0;
+}
 
 /// Gets the event with the given ID from the state.
-/// @note Will wait to simulate a real system accessing a costly memory resource.
+/// @note Will wait to simulate a real system accessing a costly memory resource, once per batch, see ems_batch_enter.
+/// @note Must be called inside an epoch critical section, see get_event.
 /// @param event_id The ID of the event to get.
-/// @param from First node to be searched.
-/// @param to Last node to be searched.
 /// @return Pointer to the event if found, NULL otherwise.
-static struct Event* get_event_with_delay(unsigned int event_id, struct ListNode* from, struct ListNode* to) {
-  struct timespec delay = {0, state_access_delay_us * 1000};
-  nanosleep(&delay, NULL);  // Should not be removed
+static struct Event* get_event_with_delay(unsigned int event_id) {
+  if (!batch_looked_up(event_id)) delay_state_access();
 
-  return get_event(event_list, event_id, from, to);
+  return get_event(event_list, event_id);
 }
 
 /// Gets the index of a seat.
@@ -31,27 +124,426 @@ static struct Event* get_event_with_delay(unsigned int event_id, struct ListNode
 /// @return Index of the seat.
 static size_t seat_index(struct Event* event, size_t row, size_t col) { return (row - 1) * event->cols + col - 1; }
 
-size_t get_num_events(struct ListNode* head) {
-  size_t count = 0;
-  struct ListNode* current = head;
-  // Traverse the linked list
-  while (current != NULL) {
-    count++;
-    current = current->next;
+/// Checks the occupancy bitmap for a seat.
+/// @param event Event to check.
+/// @param index Index of the seat.
+/// @return 1 if the seat is taken, 0 otherwise.
+static int seat_taken(struct Event* event, size_t index) { return (int)((event->taken[index / 64] >> (index % 64)) & 1); }
+
+/// Marks a seat as taken in the occupancy bitmap.
+static void take_seat(struct Event* event, size_t index) { event->taken[index / 64] |= (uint64_t)1 << (index % 64); }
+
+/// Marks a row as changed since its longest free run was computed, see refresh_free_runs.
+static void mark_row_dirty(struct Event* event, size_t row) {
+  __atomic_fetch_or(&event->dirty_rows[row / 64], (uint64_t)1 << (row % 64), __ATOMIC_RELEASE);
+}
+
+/// Marks a seat as free in the occupancy bitmap.
+static void release_seat(struct Event* event, size_t index) {
+  event->taken[index / 64] &= ~((uint64_t)1 << (index % 64));
+  mark_row_dirty(event, index / event->cols);
+}
+
+/// Atomically marks a seat as taken in the occupancy bitmap.
+/// @return 1 if the seat was claimed, 0 if it was already taken.
+static int claim_seat_atomic(struct Event* event, size_t index) {
+  uint64_t bit = (uint64_t)1 << (index % 64);
+  return (__atomic_fetch_or(&event->taken[index / 64], bit, __ATOMIC_ACQ_REL) & bit) == 0;
+}
+
+/// Atomically marks a seat as free in the occupancy bitmap.
+static void release_seat_atomic(struct Event* event, size_t index) {
+  __atomic_fetch_and(&event->taken[index / 64], ~((uint64_t)1 << (index % 64)), __ATOMIC_RELEASE);
+  mark_row_dirty(event, index / event->cols);
+}
+
+/// Marks the start of a change to the seats of an event, see snapshot_seats.
+static void begin_seat_write(struct Event* event) { __atomic_add_fetch(&event->writers, 1, __ATOMIC_SEQ_CST); }
+
+/// Marks the end of a change to the seats of an event, see snapshot_seats.
+static void end_seat_write(struct Event* event) {
+  __atomic_add_fetch(&event->version, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch(&event->writers, 1, __ATOMIC_SEQ_CST);
+}
+
+/// Records a changed seat in the journal of an event.
+/// @note Must be called between begin_seat_write and end_seat_write.
+static void journal_seat(struct Event* event, size_t index) {
+  size_t slot = __atomic_fetch_add(&event->changes, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&event->journal[slot % event->journal_size], index, __ATOMIC_RELAXED);
+}
+
+/// Copies the seats of an event without blocking reservations.
+/// @note The copy is retried until no change was in progress and none completed while copying, so it never
+/// contains part of a reservation. After SNAPSHOT_RETRIES attempts in RESERVE_MODE_MUTEX, the event mutex is
+/// held for the copy instead.
+/// @param event Event to copy the seats from.
+/// @param seats Array of size rows * cols to copy the seats to.
+/// @return Number of seat changes the copy includes, see Event::changes.
+static size_t snapshot_seats(struct Event* event, unsigned int* seats) {
+  size_t num_seats = event->rows * event->cols;
+
+  for (unsigned int attempt = 0;; attempt++) {
+    if (attempt >= SNAPSHOT_RETRIES && reserve_mode == RESERVE_MODE_MUTEX) {
+      pthread_mutex_lock(&event->mutex);
+      memcpy(seats, event->data, num_seats * sizeof(unsigned int));
+      size_t changes = event->changes;
+      pthread_mutex_unlock(&event->mutex);
+      return changes;
+    }
+
+    unsigned int version = __atomic_load_n(&event->version, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&event->writers, __ATOMIC_SEQ_CST) != 0) {
+      sched_yield();
+      continue;
+    }
+
+    size_t changes = __atomic_load_n(&event->changes, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < num_seats; i++) {
+      seats[i] = __atomic_load_n(&event->data[i], __ATOMIC_RELAXED);
+    }
+
+    if (__atomic_load_n(&event->writers, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&event->version, __ATOMIC_SEQ_CST) == version) {
+      return changes;
+    }
+  }
+}
+
+/// Copies the seats of an event changed since a given number of changes, consistently like snapshot_seats.
+/// @param event Event to copy the seats from.
+/// @param since Number of changes the caller already has.
+/// @param indices Array of size journal_size to copy the indices of the changed seats to.
+/// @param seats Array of size journal_size to copy the changed seats to.
+/// @param changes Pointer to the variable to store the number of changes the copy includes in.
+/// @return Number of seats copied, possibly repeated, or -1 if the journal no longer holds every change.
+static long snapshot_delta(struct Event* event, size_t since, size_t* indices, unsigned int* seats, size_t* changes) {
+  for (unsigned int attempt = 0;; attempt++) {
+    int locked = attempt >= SNAPSHOT_RETRIES && reserve_mode == RESERVE_MODE_MUTEX;
+    unsigned int version = 0;
+
+    if (locked) {
+      pthread_mutex_lock(&event->mutex);
+    } else {
+      version = __atomic_load_n(&event->version, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&event->writers, __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+        continue;
+      }
+    }
+
+    *changes = __atomic_load_n(&event->changes, __ATOMIC_RELAXED);
+    long count = -1;
+
+    if (since <= *changes && *changes - since <= event->journal_size) {
+      count = (long)(*changes - since);
+      for (size_t i = 0; i < (size_t)count; i++) {
+        indices[i] = __atomic_load_n(&event->journal[(since + i) % event->journal_size], __ATOMIC_RELAXED);
+        seats[i] = __atomic_load_n(&event->data[indices[i]], __ATOMIC_RELAXED);
+      }
+    }
+
+    if (locked) {
+      pthread_mutex_unlock(&event->mutex);
+      return count;
+    }
+
+    if (__atomic_load_n(&event->writers, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&event->version, __ATOMIC_SEQ_CST) == version) {
+      return count;
+    }
+  }
+}
+
+/// Replays a WAL_RECORD_CREATE, keeping the serial the event had.
+static void replay_create(const char* payload, size_t size) {
+  struct WalCreate record;
+  if (size != sizeof(record)) return;
+  memcpy(&record, payload, sizeof(record));
+
+  struct Event* event = create_event(event_list, record.id, record.rows, record.cols);
+  if (event == NULL) return;
+
+  event->serial = record.serial;
+  if (event_list->next_serial <= record.serial) event_list->next_serial = record.serial + 1;
+
+  if (append_to_list(event_list, event) != 0) destroy_event(event_list, event);
+}
+
+/// Replays a WAL_RECORD_RESERVE, with the reservation ids it was made with.
+static void replay_reserve(const char* payload, size_t size) {
+  size_t num_parts;
+  if (size < sizeof(size_t)) return;
+  memcpy(&num_parts, payload, sizeof(size_t));
+  size_t offset = sizeof(size_t);
+
+  for (size_t p = 0; p < num_parts; p++) {
+    struct WalReservation record;
+    if (size - offset < sizeof(record)) return;
+    memcpy(&record, payload + offset, sizeof(record));
+    offset += sizeof(record);
+    if ((size - offset) / sizeof(size_t) < record.num_seats) return;
+
+    const char* indices = payload + offset;
+    offset += record.num_seats * sizeof(size_t);
+
+    // Parts of events deleted later in the log have nothing to apply to
+    struct Event* event = get_event(event_list, record.id);
+    if (event == NULL || event->serial != record.serial) continue;
+
+    struct ReservationSeats* seats = create_reservation_seats(event_list, record.num_seats);
+    if (seats == NULL) continue;
+    memcpy(seats->seats, indices, record.num_seats * sizeof(size_t));
+
+    for (size_t i = 0; i < record.num_seats; i++) {
+      if (seats->seats[i] >= event->rows * event->cols) continue;
+      event->data[seats->seats[i]] = record.reservation_id;
+      take_seat(event, seats->seats[i]);
+      mark_row_dirty(event, seats->seats[i] / event->cols);
+    }
+
+    if (event->reservations < record.reservation_id) event->reservations = record.reservation_id;
+    if (index_reservation(event_list, event, record.reservation_id, seats) != 0) {
+      free_reservation_seats(event_list, seats);
+    }
+  }
+}
+
+/// Replays a WAL_RECORD_CANCEL.
+static void replay_cancel(const char* payload, size_t size) {
+  struct WalReservation record;
+  if (size != sizeof(record)) return;
+  memcpy(&record, payload, sizeof(record));
+
+  struct Event* event = get_event(event_list, record.id);
+  if (event == NULL || event->serial != record.serial || index_restored_reservations(event_list, event) != 0) return;
+
+  struct ReservationSeats* seats = unindex_reservation(event, record.reservation_id);
+  if (seats == NULL) return;
+
+  for (size_t i = 0; i < seats->num_seats; i++) {
+    event->data[seats->seats[i]] = 0;
+    release_seat(event, seats->seats[i]);
+  }
+  free_reservation_seats(event_list, seats);
+}
+
+/// Applies a record of the write-ahead log to the state, used as the wal_replay callback.
+/// @note Records are applied in log order by a single thread, before any session starts.
+static void replay_record(void* context, unsigned char type, const char* payload, size_t size) {
+  (void)context;
+
+  switch (type) {
+    case WAL_RECORD_CREATE:
+      replay_create(payload, size);
+      break;
+
+    case WAL_RECORD_DELETE: {
+      struct WalDelete record;
+      if (size != sizeof(record)) break;
+      memcpy(&record, payload, sizeof(record));
+
+      // A checkpoint may already hold the event created with the same id after the delete
+      struct Event* event = get_event(event_list, record.id);
+      if (event != NULL && event->serial == record.serial) remove_from_list(event_list, record.id);
+      break;
+    }
+
+    case WAL_RECORD_RESERVE:
+      replay_reserve(payload, size);
+      break;
+
+    case WAL_RECORD_CANCEL:
+      replay_cancel(payload, size);
+      break;
+
+    default:
+      fprintf(stderr, "Unknown write-ahead log record %u\n", type);
+  }
+}
+
+/// Restores the events of a checkpoint, using its seat blocks in place.
+/// @return Write-ahead log offset the checkpoint covers, 0 if there is no checkpoint, UINT64_MAX on failure.
+static uint64_t restore_checkpoint(const char* path) {
+  struct Checkpoint checkpoint;
+  if (checkpoint_map(path, &checkpoint, seat_block_size) != 0) return UINT64_MAX;
+  if (checkpoint.image == NULL) return 0;
+
+  event_list->image = checkpoint.image;
+  event_list->image_size = checkpoint.size;
+  event_list->next_serial = checkpoint.header->next_serial;
+
+  for (size_t i = 0; i < checkpoint.header->num_events; i++) {
+    const struct CheckpointEvent* entry = &checkpoint.events[i];
+    struct Event* event =
+        restore_event(event_list, entry->id, entry->rows, entry->cols, checkpoint.image + entry->block_offset);
+    if (event == NULL) return UINT64_MAX;
+
+    // Reservations are only indexed when one of them is first cancelled
+    event->serial = entry->serial;
+    event->changes = entry->changes;
+    event->reservations = entry->reservations;
+    event->unindexed = entry->reservations;
+
+    if (restore_to_list(event_list, event) != 0) {
+      destroy_event(event_list, event);
+      return UINT64_MAX;
+    }
+  }
+
+  return checkpoint.header->wal_lsn;
+}
+
+/// Copies the seat block of an event for a checkpoint, consistently like snapshot_seats.
+/// @note The occupancy bitmap is rebuilt from the copied seats, since seats claimed by reservations still in
+/// progress have no reservation id yet, and every row is marked dirty so its free-run leaf is recomputed first.
+/// @param event Event to copy the seat block from.
+/// @param block Buffer of seat_block_size bytes to copy the block to.
+/// @param entry Entry of the event in the checkpoint to fill in.
+static void snapshot_block(struct Event* event, char* block, struct CheckpointEvent* entry) {
+  size_t num_seats = event->rows * event->cols;
+  unsigned int* data = (unsigned int*)block;
+  uint64_t* taken = (uint64_t*)(block + ((char*)event->taken - (char*)event->data));
+  size_t* journal = (size_t*)(block + ((char*)event->journal - (char*)event->data));
+  size_t* free_runs = (size_t*)(block + ((char*)event->free_runs - (char*)event->data));
+  uint64_t* dirty_rows = (uint64_t*)(block + ((char*)event->dirty_rows - (char*)event->data));
+
+  entry->changes = snapshot_seats(event, data);
+
+  // The journal is only used for the changes the copy includes, so it needs no consistency of its own
+  for (size_t i = 0; i < event->journal_size; i++) journal[i] = __atomic_load_n(&event->journal[i], __ATOMIC_RELAXED);
+
+  memset(taken, 0, (num_seats + 63) / 64 * sizeof(uint64_t));
+  for (size_t i = 0; i < num_seats; i++) {
+    if (data[i] != 0) taken[i / 64] |= (uint64_t)1 << (i % 64);
+  }
+
+  memset(free_runs, 0, 2 * event->free_run_leaves * sizeof(size_t));
+  memset(dirty_rows, 0, (event->rows + 63) / 64 * sizeof(uint64_t));
+  for (size_t i = 0; i < event->rows; i++) dirty_rows[i / 64] |= (uint64_t)1 << (i % 64);
+
+  // Read after the seats, so every reservation id in the copy is covered
+  entry->reservations = __atomic_load_n(&event->reservations, __ATOMIC_SEQ_CST);
+}
+
+/// Writes a checkpoint of every event while sessions keep running.
+/// @note Each event is copied consistently on its own. Changes logged after the returned position may or may not
+/// be part of the copy, and replaying them again reaches the same state.
+/// @return 0 if the checkpoint was written successfully, 1 otherwise.
+static int write_checkpoint(void) {
+  uint64_t lsn = wal_position();
+
+  // Every change logged before lsn is applied once the operations that logged it have returned
+  for (size_t i = 0; i < CATALOG_STRIPES; i++) {
+    pthread_mutex_lock(&catalog_locks[i]);
+    pthread_mutex_unlock(&catalog_locks[i]);
+  }
+  epoch_synchronize();
+
+  struct CheckpointWriter writer;
+  if (checkpoint_begin(&writer, checkpoint_path) != 0) return 1;
+
+  char* block = NULL;
+  size_t block_capacity = 0;
+  int result = 0;
+
+  epoch_enter();
+
+  for (struct ListNode* node = list_first(event_list); node != NULL && result == 0; node = list_next(node)) {
+    struct Event* event = node->event;
+    size_t size = seat_block_size(event->rows, event->cols);
+
+    if (size > block_capacity) {
+      char* grown = realloc(block, size);
+      if (grown == NULL) {
+        fprintf(stderr, "Error allocating memory for checkpoint\n");
+        result = 1;
+        break;
+      }
+      block = grown;
+      block_capacity = size;
+    }
+
+    struct CheckpointEvent entry = {.serial = event->serial, .rows = event->rows, .cols = event->cols, .id = event->id};
+    snapshot_block(event, block, &entry);
+    result = checkpoint_add(&writer, &entry, block, size);
   }
-  return count;
+
+  // Events created while copying have later serials than any copied one
+  uint64_t next_serial = __atomic_load_n(&event_list->next_serial, __ATOMIC_RELAXED);
+  epoch_exit();
+  free(block);
+
+  if (result != 0) {
+    checkpoint_abort(&writer);
+    return 1;
+  }
+  return checkpoint_commit(&writer, lsn, next_serial);
 }
 
-int ems_init(unsigned int delay_us) {
+/// Writes a checkpoint every checkpoint_interval_s seconds until checkpoint_stop is set.
+static void* checkpoint_loop(void* arg) {
+  (void)arg;
+  pthread_mutex_lock(&checkpoint_mutex);
+
+  while (!checkpoint_stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += checkpoint_interval_s;
+
+    if (pthread_cond_timedwait(&checkpoint_cond, &checkpoint_mutex, &deadline) == ETIMEDOUT && !checkpoint_stop) {
+      write_checkpoint();
+    }
+  }
+
+  pthread_mutex_unlock(&checkpoint_mutex);
+  return NULL;
+}
+
+int ems_init(const struct EmsConfig* config) {
   if (event_list != NULL) {
     fprintf(stderr, "EMS state has already been initialized\n");
     return 1;
   }
 
   event_list = create_list();
-  state_access_delay_us = delay_us;
+  state_access_delay_us = config->delay_us;
+  reserve_mode = config->reserve_mode;
+  checkpoint_path = config->checkpoint_path;
+  checkpoint_interval_s = config->checkpoint_interval_s;
+
+  if (event_list == NULL) return 1;
+
+  for (size_t i = 0; i < CATALOG_STRIPES; i++) pthread_mutex_init(&catalog_locks[i], NULL);
+
+  // The log is replayed from where the checkpoint left off
+  uint64_t lsn = checkpoint_path != NULL ? restore_checkpoint(checkpoint_path) : 0;
+  if (lsn == UINT64_MAX) {
+    fprintf(stderr, "Error restoring checkpoint\n");
+    return 1;
+  }
+
+  if (config->wal_path != NULL) {
+    epoch_enter();
+    int replay_status = wal_replay(config->wal_path, lsn, replay_record, NULL);
+    epoch_exit();
+
+    if (replay_status != 0 || wal_open(config->wal_path, config->wal_sync, config->wal_interval_us) != 0) {
+      fprintf(stderr, "Error recovering from write-ahead log\n");
+      return 1;
+    }
+    logging = 1;
+  }
 
-  return event_list == NULL;
+  if (checkpoint_path != NULL && checkpoint_interval_s > 0) {
+    checkpoint_stop = 0;
+    if (pthread_create(&checkpoint_thread, NULL, checkpoint_loop, NULL) != 0) {
+      fprintf(stderr, "Error starting checkpoint thread\n");
+      return 1;
+    }
+  }
+
+  return 0;
 }
 
 int ems_terminate() {
@@ -60,275 +552,1129 @@ int ems_terminate() {
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
-    return 1;
+  int result = 0;
+  if (checkpoint_path != NULL) {
+    if (checkpoint_interval_s > 0) {
+      pthread_mutex_lock(&checkpoint_mutex);
+      checkpoint_stop = 1;
+      pthread_cond_signal(&checkpoint_cond);
+      pthread_mutex_unlock(&checkpoint_mutex);
+      pthread_join(checkpoint_thread, NULL);
+    }
+
+    // Taken before the log is closed, so a restart replays nothing
+    result = write_checkpoint();
+    checkpoint_path = NULL;
+  }
+
+  if (logging) {
+    wal_close();
+    logging = 0;
   }
 
+  // Retired events live in the slabs of the list, so they are freed first
+  epoch_drain();
   free_list(event_list);
-  pthread_rwlock_unlock(&event_list->rwl);
-  return 0;
+  free(list_cache);
+  list_cache = NULL;
+  event_list = NULL;
+
+  for (size_t i = 0; i < CATALOG_STRIPES; i++) pthread_mutex_destroy(&catalog_locks[i]);
+  return result;
 }
 
+/// Gets the lock ordering the creates and deletes of an id in the log.
+static pthread_mutex_t* catalog_lock(unsigned int event_id) { return &catalog_locks[event_id & (CATALOG_STRIPES - 1)]; }
+
 int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
-    return 1;
-  }
+  epoch_enter();
+  int exists = get_event_with_delay(event_id) != NULL;
+  epoch_exit();
 
-  if (get_event_with_delay(event_id, event_list->head, event_list->tail) != NULL) {
+  if (exists) {
     fprintf(stderr, "Event already exists\n");
-    pthread_rwlock_unlock(&event_list->rwl);
     return 1;
   }
 
-  struct Event* event = malloc(sizeof(struct Event));
+  struct Event* event = create_event(event_list, event_id, num_rows, num_cols);
 
   if (event == NULL) {
     fprintf(stderr, "Error allocating memory for event\n");
-    pthread_rwlock_unlock(&event_list->rwl);
     return 1;
   }
 
-  event->id = event_id;
-  event->rows = num_rows;
-  event->cols = num_cols;
-  event->reservations = 0;
-  if (pthread_mutex_init(&event->mutex, NULL) != 0) {
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event);
+  // Creates and deletes of the same id are logged and applied in one order, so replay reaches the same state
+  pthread_mutex_t* lock = catalog_lock(event_id);
+  pthread_mutex_lock(lock);
+
+  epoch_enter();
+  int append_status = get_event(event_list, event_id) != NULL ? 2 : 0;
+  epoch_exit();
+
+  uint64_t lsn = 0;
+  if (append_status == 0 && logging) {
+    struct WalCreate record = {event->serial, num_rows, num_cols, event_id};
+    lsn = wal_append(WAL_RECORD_CREATE, &record, sizeof(record));
+
+    // An event whose record could not be logged is not added, so it is never acknowledged as durable
+    if (lsn == 0) append_status = 1;
+  }
+
+  if (append_status == 0) append_status = append_to_list(event_list, event);
+  pthread_mutex_unlock(lock);
+
+  if (append_status != 0) {
+    fprintf(stderr, append_status == 2 ? "Event already exists\n" : "Error appending event to list\n");
+    destroy_event(event_list, event);
     return 1;
   }
-  event->data = calloc(num_rows * num_cols, sizeof(unsigned int));
 
-  if (event->data == NULL) {
-    fprintf(stderr, "Error allocating memory for event data\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event);
+  return acknowledge(lsn);
+}
+
+/// Reservation of a transaction in one of its events.
+struct TransactionPart {
+  struct Event* event;
+  size_t num_seats;
+  size_t* xs;
+  size_t* ys;
+  struct ReservationSeats* seats;  // Set by commit_reservations
+  unsigned int reservation_id;     // Set by commit_reservations
+};
+
+/// Orders the parts of a transaction by event ID, the order their mutexes are locked in.
+/// @note The same ID may resolve to two events if it was deleted and re-created between lookups, so ties are
+/// broken by address to keep a single global order.
+static int compare_parts(const void* a, const void* b) {
+  const struct Event* x = ((const struct TransactionPart*)a)->event;
+  const struct Event* y = ((const struct TransactionPart*)b)->event;
+  if (x->id != y->id) return x->id < y->id ? -1 : 1;
+  if (x != y) return (uintptr_t)x < (uintptr_t)y ? -1 : 1;
+  return 0;
+}
+
+/// Claims a seat in the occupancy bitmap according to the reserve mode.
+/// @note In RESERVE_MODE_MUTEX the mutex of the event must be held, in RESERVE_MODE_OWNER the event owned.
+/// @return 1 if the seat was claimed, 0 if it was already taken.
+static int claim_seat(struct Event* event, size_t index) {
+  if (reserve_mode == RESERVE_MODE_CAS) return claim_seat_atomic(event, index);
+  if (seat_taken(event, index)) return 0;
+  take_seat(event, index);
+  return 1;
+}
+
+/// Releases a seat claimed with claim_seat.
+static void unclaim_seat(struct Event* event, size_t index) {
+  if (reserve_mode == RESERVE_MODE_CAS) {
+    release_seat_atomic(event, index);
+  } else {
+    release_seat(event, index);
+  }
+}
+
+/// Releases every seat of the parts of a reservation, claimed with claim_seat.
+static void unclaim_parts(struct TransactionPart* parts, size_t num_parts) {
+  for (size_t p = 0; p < num_parts; p++) {
+    for (size_t i = 0; i < parts[p].num_seats; i++) {
+      unclaim_seat(parts[p].event, seat_index(parts[p].event, parts[p].xs[i], parts[p].ys[i]));
+    }
+  }
+}
+
+/// Logs the reservations of the parts of a transaction as a single record, see replay_reserve.
+/// @param lsn Pointer to the variable to store the log sequence number to wait for in.
+/// @return 0 if the reservations were logged successfully, 1 otherwise.
+static int log_reservations(struct TransactionPart* parts, size_t num_parts, uint64_t* lsn) {
+  *lsn = 0;
+  if (!logging) return 0;
+
+  size_t size = sizeof(size_t);
+  for (size_t p = 0; p < num_parts; p++) {
+    size += sizeof(struct WalReservation) + parts[p].num_seats * sizeof(size_t);
+  }
+
+  char* record = malloc(size);
+  if (record == NULL) {
+    fprintf(stderr, "Error allocating memory for write-ahead log record\n");
     return 1;
   }
 
-  if (append_to_list(event_list, event) != 0) {
-    fprintf(stderr, "Error appending event to list\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event->data);
-    free(event);
+  char* current = record;
+  memcpy(current, &num_parts, sizeof(size_t));
+  current += sizeof(size_t);
+  for (size_t p = 0; p < num_parts; p++) {
+    struct WalReservation header = {parts[p].event->serial, parts[p].num_seats, parts[p].event->id,
+                                    parts[p].reservation_id};
+    memcpy(current, &header, sizeof(header));
+    current += sizeof(header);
+    memcpy(current, parts[p].seats->seats, parts[p].num_seats * sizeof(size_t));
+    current += parts[p].num_seats * sizeof(size_t);
+  }
+
+  *lsn = wal_append(WAL_RECORD_RESERVE, record, size);
+  free(record);
+  return *lsn == 0;
+}
+
+/// Writes a reservation to its seats, already claimed in the occupancy bitmap, and indexes it.
+static void write_reservation(struct TransactionPart* part) {
+  struct Event* event = part->event;
+
+  begin_seat_write(event);
+
+  for (size_t i = 0; i < part->num_seats; i++) {
+    size_t index = part->seats->seats[i];
+    __atomic_store_n(&event->data[index], part->reservation_id, __ATOMIC_RELAXED);
+    journal_seat(event, index);
+
+    if (i == 0 || part->xs[i] != part->xs[i - 1]) mark_row_dirty(event, part->xs[i] - 1);
+  }
+
+  end_seat_write(event);
+
+  // The reservation stands even if it cannot be indexed, it just cannot be cancelled
+  if (index_reservation(event_list, event, part->reservation_id, part->seats) != 0) {
+    fprintf(stderr, "Error allocating memory for reservation index\n");
+    free_reservation_seats(event_list, part->seats);
+  }
+  part->seats = NULL;
+}
+
+/// Commits reservations to seats already claimed in the occupancy bitmap.
+/// @note Every reservation is logged in one record before any seat is written, so a crash never replays only
+/// part of a transaction.
+/// @param parts Reservations to commit, one per part.
+/// @param num_parts Number of parts.
+/// @param lsn Pointer to the variable to store the log sequence number to wait for in.
+/// @return 0 if the reservations were committed successfully, 1 otherwise with the seats still claimed.
+static int commit_reservations(struct TransactionPart* parts, size_t num_parts, uint64_t* lsn) {
+  for (size_t p = 0; p < num_parts; p++) {
+    parts[p].seats = create_reservation_seats(event_list, parts[p].num_seats);
+    if (parts[p].seats == NULL) {
+      fprintf(stderr, "Error allocating memory for reservation index\n");
+      while (p-- > 0) free_reservation_seats(event_list, parts[p].seats);
+      return 1;
+    }
+
+    for (size_t i = 0; i < parts[p].num_seats; i++) {
+      parts[p].seats->seats[i] = seat_index(parts[p].event, parts[p].xs[i], parts[p].ys[i]);
+    }
+    parts[p].reservation_id = __atomic_add_fetch(&parts[p].event->reservations, 1, __ATOMIC_RELAXED);
+  }
+
+  if (log_reservations(parts, num_parts, lsn) != 0) {
+    for (size_t p = 0; p < num_parts; p++) free_reservation_seats(event_list, parts[p].seats);
     return 1;
   }
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  for (size_t p = 0; p < num_parts; p++) write_reservation(&parts[p]);
   return 0;
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
-  if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
+/// Reserves seats by claiming them one by one in the occupancy bitmap with atomic operations.
+/// @note The seats must be in bounds. If any seat is already taken the seats claimed so far are released.
+/// @param event Event to reserve the seats in.
+/// @param num_seats Number of seats to reserve.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @param lsn Pointer to the variable to store the log sequence number to wait for in.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+static int reserve_lock_free(struct Event* event, size_t num_seats, size_t* xs, size_t* ys, uint64_t* lsn) {
+  for (size_t i = 0; i < num_seats; i++) {
+    if (!claim_seat_atomic(event, seat_index(event, xs[i], ys[i]))) {
+      fprintf(stderr, "Seat already reserved\n");
+      while (i-- > 0) release_seat_atomic(event, seat_index(event, xs[i], ys[i]));
+      return 1;
+    }
+  }
+
+  struct TransactionPart part = {.event = event, .num_seats = num_seats, .xs = xs, .ys = ys};
+  if (commit_reservations(&part, 1, lsn) != 0) {
+    unclaim_parts(&part, 1);
     return 1;
   }
+  return 0;
+}
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+/// Reserves seats while holding the event mutex, or owning the event in RESERVE_MODE_OWNER.
+/// @param event Event to reserve the seats in.
+/// @param num_seats Number of seats to reserve.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @param lsn Pointer to the variable to store the log sequence number to wait for in.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+static int reserve_locked(struct Event* event, size_t num_seats, size_t* xs, size_t* ys, uint64_t* lsn) {
+  int locked = reserve_mode == RESERVE_MODE_MUTEX;
+  if (locked && pthread_mutex_lock(&event->mutex) != 0) {
+    fprintf(stderr, "Error locking mutex\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id, event_list->head, event_list->tail);
+  if (event->deleted) {
+    fprintf(stderr, "Event not found\n");
+    if (locked) pthread_mutex_unlock(&event->mutex);
+    return 1;
+  }
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  // Claims the seats in the bitmap, so a seat listed twice in the request is caught by the same test
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t index = seat_index(event, xs[i], ys[i]);
 
-  if (event == NULL) {
-    fprintf(stderr, "Event not found\n");
+    if (seat_taken(event, index)) {
+      fprintf(stderr, event->data[index] != 0 ? "Seat already reserved\n" : "Seat repeated in reservation\n");
+      while (i-- > 0) release_seat(event, seat_index(event, xs[i], ys[i]));
+      if (locked) pthread_mutex_unlock(&event->mutex);
+      return 1;
+    }
+
+    take_seat(event, index);
+  }
+
+  struct TransactionPart part = {.event = event, .num_seats = num_seats, .xs = xs, .ys = ys};
+  int result = commit_reservations(&part, 1, lsn);
+  if (result != 0) unclaim_parts(&part, 1);
+
+  if (locked) pthread_mutex_unlock(&event->mutex);
+  return result;
+}
+
+int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_mutex_lock(&event->mutex) != 0) {
-    fprintf(stderr, "Error locking mutex\n");
+  epoch_enter();
+
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    epoch_exit();
     return 1;
   }
 
   for (size_t i = 0; i < num_seats; i++) {
     if (xs[i] <= 0 || xs[i] > event->rows || ys[i] <= 0 || ys[i] > event->cols) {
       fprintf(stderr, "Seat out of bounds\n");
-      pthread_mutex_unlock(&event->mutex);
+      epoch_exit();
       return 1;
     }
   }
 
-  for (size_t i = 0; i < event->rows * event->cols; i++) {
-    for (size_t j = 0; j < num_seats; j++) {
-      if (seat_index(event, xs[j], ys[j]) != i) {
+  uint64_t lsn = 0;
+  int result = reserve_mode == RESERVE_MODE_CAS ? reserve_lock_free(event, num_seats, xs, ys, &lsn)
+                                                : reserve_locked(event, num_seats, xs, ys, &lsn);
+
+  epoch_exit();
+
+  // Acknowledged only once durable, while other sessions keep going
+  return result != 0 || acknowledge(lsn) != 0;
+}
+
+/// Reads 64 seats of the occupancy bitmap starting at a seat, the bits past the last seat are 0.
+static uint64_t taken_bits(struct Event* event, size_t index) {
+  size_t word = index / 64, shift = index % 64;
+  uint64_t bits = __atomic_load_n(&event->taken[word], __ATOMIC_RELAXED) >> shift;
+  if (shift != 0 && (word + 1) * 64 < event->rows * event->cols) {
+    bits |= __atomic_load_n(&event->taken[word + 1], __ATOMIC_RELAXED) << (64 - shift);
+  }
+  return bits;
+}
+
+/// Scans a row of the occupancy bitmap for runs of free seats, 64 seats at a time.
+/// @param event Event to scan.
+/// @param row Row to scan, starting at 0.
+/// @param num_seats Length of the run to find, SIZE_MAX to scan the whole row.
+/// @param longest Pointer to the variable to store the longest run scanned in.
+/// @return Column of the first run of at least num_seats free seats, starting at 0, SIZE_MAX if there is none.
+static size_t scan_row(struct Event* event, size_t row, size_t num_seats, size_t* longest) {
+  size_t run = 0;
+  *longest = 0;
+
+  for (size_t col = 0; col < event->cols; col += 64) {
+    size_t width = event->cols - col < 64 ? event->cols - col : 64;
+    uint64_t bits = taken_bits(event, row * event->cols + col);
+    if (width < 64) bits |= ~(uint64_t)0 << width;  // Seats past the row count as taken
+
+    for (size_t bit = 0; bit < width;) {
+      uint64_t rest = bits >> bit;
+      if (rest & 1) {
+        run = 0;
+        bit += ~rest == 0 ? 64 : (size_t)__builtin_ctzll(~rest);
         continue;
       }
 
-      if (event->data[i] != 0) {
-        fprintf(stderr, "Seat already reserved\n");
-        pthread_mutex_unlock(&event->mutex);
-        return 1;
-      }
+      size_t free_seats = rest == 0 ? 64 - bit : (size_t)__builtin_ctzll(rest);
+      run += free_seats;
+      bit += free_seats;
+      if (run > *longest) *longest = run;
+      if (run >= num_seats) return col + bit - run;
+    }
+  }
 
-      break;
+  return SIZE_MAX;
+}
+
+/// Recomputes the longest free run of a row and its ancestors in the free-run tree.
+/// @note The mutex of the event must be held, or the event owned in RESERVE_MODE_OWNER.
+static void update_free_run(struct Event* event, size_t row) {
+  size_t node = event->free_run_leaves + row;
+  scan_row(event, row, SIZE_MAX, &event->free_runs[node]);
+
+  for (node /= 2; node > 0; node /= 2) {
+    size_t left = event->free_runs[2 * node], right = event->free_runs[2 * node + 1];
+    event->free_runs[node] = left > right ? left : right;
+  }
+}
+
+/// Recomputes the longest free run of every row marked dirty.
+/// @note The mutex of the event must be held, or the event owned. A row is unmarked before it is scanned, so a
+/// change racing with the scan leaves it marked for the next refresh.
+static void refresh_free_runs(struct Event* event) {
+  for (size_t word = 0; word < (event->rows + 63) / 64; word++) {
+    if (__atomic_load_n(&event->dirty_rows[word], __ATOMIC_RELAXED) == 0) continue;
+
+    uint64_t rows = __atomic_exchange_n(&event->dirty_rows[word], 0, __ATOMIC_ACQUIRE);
+    for (; rows != 0; rows &= rows - 1) {
+      update_free_run(event, word * 64 + (size_t)__builtin_ctzll(rows));
+    }
+  }
+}
+
+/// Finds the first row of a range with a free run long enough by descending the free-run tree.
+/// @param node Node of the tree to search, covering rows node_lo to node_hi - 1.
+/// @param lo First row of the range, starting at 0.
+/// @param hi Row past the last of the range.
+/// @param num_seats Length of the free run.
+/// @return First row found, SIZE_MAX if there is none.
+static size_t find_free_row(struct Event* event, size_t node, size_t node_lo, size_t node_hi, size_t lo, size_t hi,
+                            size_t num_seats) {
+  if (node_hi <= lo || hi <= node_lo || event->free_runs[node] < num_seats) return SIZE_MAX;
+  if (node >= event->free_run_leaves) return node_lo;
+
+  size_t mid = node_lo + (node_hi - node_lo) / 2;
+  size_t row = find_free_row(event, 2 * node, node_lo, mid, lo, hi, num_seats);
+  if (row == SIZE_MAX) row = find_free_row(event, 2 * node + 1, mid, node_hi, lo, hi, num_seats);
+  return row;
+}
+
+int ems_reserve_best(unsigned int event_id, size_t num_seats, size_t min_row, size_t max_row, size_t* row,
+                     size_t* col) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  epoch_enter();
+
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    epoch_exit();
+    return 1;
+  }
+
+  if (max_row == 0) max_row = event->rows;
+  if (min_row == 0) min_row = 1;
+  if (num_seats == 0 || num_seats > event->cols || num_seats > MAX_RESERVATION_SIZE || min_row > max_row ||
+      max_row > event->rows) {
+    fprintf(stderr, "Invalid seat request\n");
+    epoch_exit();
+    return 1;
+  }
+
+  // The free-run tree is only touched under the mutex or by the owner, plain reservations just mark their rows dirty
+  int locked = reserve_mode != RESERVE_MODE_OWNER;
+  if (locked) pthread_mutex_lock(&event->mutex);
+
+  if (event->deleted) {
+    fprintf(stderr, "Event not found\n");
+    if (locked) pthread_mutex_unlock(&event->mutex);
+    epoch_exit();
+    return 1;
+  }
+
+  refresh_free_runs(event);
+
+  // A row can only be stale in RESERVE_MODE_CAS, and is rescanned before it is searched again
+  size_t found_row, found_col;
+  while (1) {
+    found_row = find_free_row(event, 1, 0, event->free_run_leaves, min_row - 1, max_row, num_seats);
+    if (found_row == SIZE_MAX) break;
+
+    size_t longest;
+    found_col = scan_row(event, found_row, num_seats, &longest);
+
+    size_t claimed = 0;
+    if (found_col != SIZE_MAX) {
+      size_t first = found_row * event->cols + found_col;
+      while (claimed < num_seats && claim_seat(event, first + claimed)) claimed++;
+      if (claimed == num_seats) break;
+      while (claimed-- > 0) unclaim_seat(event, first + claimed);
     }
+
+    update_free_run(event, found_row);
   }
 
-  unsigned int reservation_id = ++event->reservations;
+  if (found_row == SIZE_MAX) {
+    fprintf(stderr, "No adjacent seats available\n");
+    if (locked) pthread_mutex_unlock(&event->mutex);
+    epoch_exit();
+    return 1;
+  }
 
+  size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
   for (size_t i = 0; i < num_seats; i++) {
-    event->data[seat_index(event, xs[i], ys[i])] = reservation_id;
+    xs[i] = found_row + 1;
+    ys[i] = found_col + 1 + i;
   }
 
-  pthread_mutex_unlock(&event->mutex);
+  uint64_t lsn = 0;
+  struct TransactionPart part = {.event = event, .num_seats = num_seats, .xs = xs, .ys = ys};
+  int result = commit_reservations(&part, 1, &lsn);
+  if (result != 0) unclaim_parts(&part, 1);
+  update_free_run(event, found_row);
+
+  if (locked) pthread_mutex_unlock(&event->mutex);
+  epoch_exit();
+
+  *row = found_row + 1;
+  *col = found_col + 1;
+  return result != 0 || acknowledge(lsn) != 0;
+}
+
+/// Claims the seats of every part of a transaction, releasing all of them if any is already taken.
+/// @note In RESERVE_MODE_MUTEX the mutexes of every event must be held, in RESERVE_MODE_OWNER every event owned.
+/// @return 0 if every seat was claimed, 1 otherwise.
+static int claim_transaction(struct TransactionPart* parts, size_t num_parts) {
+  for (size_t p = 0; p < num_parts; p++) {
+    for (size_t i = 0; i < parts[p].num_seats; i++) {
+      if (claim_seat(parts[p].event, seat_index(parts[p].event, parts[p].xs[i], parts[p].ys[i]))) continue;
+
+      fprintf(stderr, "Seat already reserved\n");
+      // Unwinds the current part from i and then every earlier part whole
+      for (size_t q = p + 1; q-- > 0;) {
+        size_t claimed = q == p ? i : parts[q].num_seats;
+        while (claimed-- > 0) {
+          unclaim_seat(parts[q].event, seat_index(parts[q].event, parts[q].xs[claimed], parts[q].ys[claimed]));
+        }
+      }
+      return 1;
+    }
+  }
   return 0;
 }
 
-int ems_show(int out_fd, unsigned int event_id) {
+/// Locks the mutexes of the events of a transaction in the order of compare_parts.
+/// @return 0 if every event was locked and none is deleted, 1 otherwise with none locked.
+static int lock_transaction(struct TransactionPart* parts, size_t num_parts) {
+  for (size_t p = 0; p < num_parts; p++) {
+    if (p > 0 && parts[p].event == parts[p - 1].event) continue;
+    pthread_mutex_lock(&parts[p].event->mutex);
+
+    if (parts[p].event->deleted) {
+      fprintf(stderr, "Event not found\n");
+      for (size_t q = p + 1; q-- > 0;) {
+        if (q == 0 || parts[q].event != parts[q - 1].event) pthread_mutex_unlock(&parts[q].event->mutex);
+      }
+      return 1;
+    }
+  }
+  return 0;
+}
 
-  char error_buffer[sizeof(int)];
-  int error_ret_val = 1;
-  memcpy(error_buffer, &error_ret_val, sizeof(int));
+/// Unlocks the mutexes locked by lock_transaction.
+static void unlock_transaction(struct TransactionPart* parts, size_t num_parts) {
+  for (size_t p = num_parts; p-- > 0;) {
+    if (p == 0 || parts[p].event != parts[p - 1].event) pthread_mutex_unlock(&parts[p].event->mutex);
+  }
+}
 
+int ems_transaction(size_t num_events, unsigned int* event_ids, size_t* num_seats, size_t* xs, size_t* ys) {
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
-    write(out_fd, error_buffer, sizeof(error_buffer));
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
-    write(out_fd, error_buffer, sizeof(error_buffer));
+  if (num_events == 0 || num_events > MAX_TRANSACTION_EVENTS) {
+    fprintf(stderr, "Invalid number of events in transaction\n");
+    return 1;
+  }
+
+  struct TransactionPart parts[MAX_TRANSACTION_EVENTS];
+
+  epoch_enter();
+
+  // The whole transaction pays for a single access to the state, none if its batch already looked up every event
+  int looked_up = 1;
+  for (size_t p = 0; p < num_events; p++) {
+    if (!batch_looked_up(event_ids[p])) looked_up = 0;
+  }
+  if (!looked_up) delay_state_access();
+
+  size_t offset = 0;
+  for (size_t p = 0; p < num_events; p++) {
+    parts[p].event = get_event(event_list, event_ids[p]);
+    parts[p].num_seats = num_seats[p];
+    parts[p].xs = xs + offset;
+    parts[p].ys = ys + offset;
+    offset += num_seats[p];
+
+    if (parts[p].event == NULL) {
+      fprintf(stderr, "Event not found\n");
+      epoch_exit();
+      return 1;
+    }
+
+    for (size_t i = 0; i < parts[p].num_seats; i++) {
+      if (parts[p].xs[i] <= 0 || parts[p].xs[i] > parts[p].event->rows || parts[p].ys[i] <= 0 ||
+          parts[p].ys[i] > parts[p].event->cols) {
+        fprintf(stderr, "Seat out of bounds\n");
+        epoch_exit();
+        return 1;
+      }
+    }
+  }
+
+  qsort(parts, num_events, sizeof(struct TransactionPart), compare_parts);
+
+  // In RESERVE_MODE_CAS the bitmap claims alone make the transaction all or nothing
+  int locked = reserve_mode == RESERVE_MODE_MUTEX;
+  if (locked && lock_transaction(parts, num_events) != 0) {
+    epoch_exit();
+    return 1;
+  }
+
+  uint64_t lsn = 0;
+  int result = claim_transaction(parts, num_events);
+  if (result == 0 && commit_reservations(parts, num_events, &lsn) != 0) {
+    unclaim_parts(parts, num_events);
+    result = 1;
+  }
+
+  if (locked) unlock_transaction(parts, num_events);
+
+  epoch_exit();
+  return result != 0 || acknowledge(lsn) != 0;
+}
+
+int ems_cancel(unsigned int event_id, unsigned int reservation_id) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id, event_list->head, event_list->tail);
+  epoch_enter();
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  struct Event* event = get_event_with_delay(event_id);
 
   if (event == NULL) {
     fprintf(stderr, "Event not found\n");
-    write(out_fd, error_buffer, sizeof(error_buffer));
+    epoch_exit();
     return 1;
   }
 
-  if (pthread_mutex_lock(&event->mutex) != 0) {
-    fprintf(stderr, "Error locking mutex\n");
-    write(out_fd, error_buffer, sizeof(error_buffer));
+  if (index_restored_reservations(event_list, event) != 0) {
+    fprintf(stderr, "Error allocating memory for reservation index\n");
+    epoch_exit();
     return 1;
   }
 
+  // Only RESERVE_MODE_CAS lets other threads change the event meanwhile
+  int locked = reserve_mode == RESERVE_MODE_MUTEX;
+  int exclusive = reserve_mode != RESERVE_MODE_CAS;
+  if (locked) pthread_mutex_lock(&event->mutex);
+
+  // Taking the seats out of the index makes a concurrent cancel of the same reservation fail
+  struct ReservationSeats* seats = exclusive && event->deleted ? NULL : unindex_reservation(event, reservation_id);
+  if (seats == NULL) {
+    fprintf(stderr, "Reservation not found\n");
+    if (locked) pthread_mutex_unlock(&event->mutex);
+    epoch_exit();
+    return 1;
+  }
 
-  int success_ret_val = 0;
+  // Logged before the seats are freed, so it precedes any reservation of them in the log
+  uint64_t lsn = 0;
+  if (logging) {
+    struct WalReservation record = {event->serial, 0, event->id, reservation_id};
+    lsn = wal_append(WAL_RECORD_CANCEL, &record, sizeof(record));
+  }
+
+  // Without a log record the seats stay reserved and the reservation goes back into the index
+  if (logging && lsn == 0) {
+    if (index_reservation(event_list, event, reservation_id, seats) != 0) free_reservation_seats(event_list, seats);
+    if (locked) pthread_mutex_unlock(&event->mutex);
+    epoch_exit();
+    return 1;
+  }
+
+  begin_seat_write(event);
+  for (size_t i = 0; i < seats->num_seats; i++) {
+    __atomic_store_n(&event->data[seats->seats[i]], 0, __ATOMIC_RELAXED);
+    journal_seat(event, seats->seats[i]);
+  }
+  end_seat_write(event);
+
+  // Seats are only freed once cleared, so a reservation claiming them again is never overwritten
+  for (size_t i = 0; i < seats->num_seats; i++) unclaim_seat(event, seats->seats[i]);
+
+  // Without exclusive access the freed rows stay marked dirty until the next RESERVE_BEST rescans them
+  if (exclusive) refresh_free_runs(event);
+  if (locked) pthread_mutex_unlock(&event->mutex);
+  epoch_exit();
+
+  free_reservation_seats(event_list, seats);
+  return acknowledge(lsn);
+}
+
+int ems_delete(unsigned int event_id) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  epoch_enter();
+  int exists = get_event_with_delay(event_id) != NULL;
+  epoch_exit();
+
+  pthread_mutex_t* lock = catalog_lock(event_id);
+  pthread_mutex_lock(lock);
+
+  // Looked up again under the lock, since the id may have been deleted and re-created meanwhile
+  uint64_t lsn = 0;
+  if (exists && logging) {
+    epoch_enter();
+    struct Event* event = get_event(event_list, event_id);
+    struct WalDelete record = {event != NULL ? event->serial : 0, event_id};
+    epoch_exit();
 
-  if(write(out_fd, &success_ret_val, sizeof(int)) == -1 ||
-   write(out_fd, &event->rows, sizeof(size_t)) == -1 ||
-   write(out_fd, &event->cols, sizeof(size_t)) == -1){
-      fprintf(stderr, "Error writing to response pipe (ems_show)\n");
+    exists = event != NULL;
+    if (exists) lsn = wal_append(WAL_RECORD_DELETE, &record, sizeof(record));
+
+    // An event whose delete could not be logged is kept
+    if (exists && lsn == 0) {
+      pthread_mutex_unlock(lock);
       return 1;
+    }
   }
 
-  unsigned int seats[event->rows*event->cols];
-  for (size_t i = 1; i <= event->rows; i++) {
-    for (size_t j = 1; j <= event->cols; j++) {
-      seats[seat_index(event, i, j)] = event->data[seat_index(event, i,j)];
+  if (!exists || remove_from_list(event_list, event_id) != 0) {
+    pthread_mutex_unlock(lock);
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  pthread_mutex_unlock(lock);
+  return acknowledge(lsn);
+}
+
+/// Counts the runs of equal seats of a seat map, with runs never crossing a row.
+/// @param seats Array of size rows * cols with the seats.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+/// @return Number of runs.
+static size_t count_runs(const unsigned int* seats, size_t rows, size_t cols) {
+  size_t runs = 0;
+  for (size_t i = 0; i < rows; i++) {
+    for (size_t j = 0; j < cols; j++) {
+      if (j == 0 || seats[i * cols + j] != seats[i * cols + j - 1]) runs++;
     }
   }
+  return runs;
+}
 
+/// Encodes a seat map as SHOW_ENCODING_RLE.
+/// @param seats Array of size rows * cols with the seats.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+/// @param out Buffer with room for count_runs(seats, rows, cols) runs.
+static void encode_runs(const unsigned int* seats, size_t rows, size_t cols, char* out) {
+  for (size_t i = 0; i < rows; i++) {
+    size_t j = 0;
+    while (j < cols) {
+      unsigned int id = seats[i * cols + j];
+      size_t start = j;
+      while (j < cols && seats[i * cols + j] == id) j++;
+
+      unsigned int length = (unsigned int)(j - start);
+      memcpy(out, &length, sizeof(unsigned int));
+      memcpy(out + sizeof(unsigned int), &id, sizeof(unsigned int));
+      out += 2 * sizeof(unsigned int);
+    }
+  }
+}
 
-  // Writes the array of seats to response pipe
-  write(out_fd, &seats, sizeof(unsigned int)* event->rows * event->cols);
+/// Chooses the encoding of a seat map.
+/// @note SHOW_ENCODING_RLE is only chosen when the client accepts it and it is smaller.
+/// @param seats Seat map of size rows * cols.
+/// @param encodings Bitmask of the SHOW_ENCODING_* the client accepts.
+/// @param payload_size Pointer to the variable to store the size of the encoded seat map in.
+/// @return Chosen SHOW_ENCODING_*.
+static unsigned char choose_encoding(const unsigned int* seats, size_t rows, size_t cols, unsigned char encodings,
+                                     size_t* payload_size) {
+  *payload_size = rows * cols * sizeof(unsigned int);
+  if (encodings & (1u << SHOW_ENCODING_RLE)) {
+    size_t rle_size = count_runs(seats, rows, cols) * 2 * sizeof(unsigned int);
+    if (rle_size < *payload_size) {
+      *payload_size = rle_size;
+      return SHOW_ENCODING_RLE;
+    }
+  }
+  return SHOW_ENCODING_RAW;
+}
 
-  pthread_mutex_unlock(&event->mutex);
-  return 0;
+/// Writes a seat map as the dimensions, the encoding, the size of the seat map and the encoded seat map.
+/// @param out Buffer with room for the seat map, see SEAT_MAP_HEADER_SIZE.
+/// @return Pointer past the written seat map.
+static char* put_seat_map(char* out, const unsigned int* seats, size_t rows, size_t cols, unsigned char encoding,
+                          size_t payload_size) {
+  memcpy(out, &rows, sizeof(size_t));
+  out += sizeof(size_t);
+  memcpy(out, &cols, sizeof(size_t));
+  out += sizeof(size_t);
+  memcpy(out, &encoding, sizeof(unsigned char));
+  out += sizeof(unsigned char);
+  memcpy(out, &payload_size, sizeof(size_t));
+  out += sizeof(size_t);
+
+  if (encoding == SHOW_ENCODING_RLE) {
+    encode_runs(seats, rows, cols, out);
+  } else {
+    memcpy(out, seats, payload_size);
+  }
+  return out + payload_size;
 }
 
-int ems_list_events(int out_fd) {
+/// Builds the SHOW response of an event from a snapshot of its seats.
+/// @note The response is the status followed by the seat map, see put_seat_map.
+/// @param event Event to show.
+/// @param encodings Bitmask of the SHOW_ENCODING_* the client accepts.
+/// @param reply Where the response is built, see reply_claim.
+/// @param size Pointer to the variable to store the size of the response in.
+/// @return Response to send with reply_send, NULL on failure.
+static char* build_show_response(struct Event* event, unsigned char encodings, struct Reply* reply, size_t* size) {
+  unsigned int* seats = malloc(event->rows * event->cols * sizeof(unsigned int));
+  if (seats == NULL) {
+    fprintf(stderr, "Error allocating memory for seats snapshot\n");
+    return NULL;
+  }
+  snapshot_seats(event, seats);
 
-  // Buffer sent when something goes wrong
-  char error1_buffer[sizeof(int)];
-  int error1_ret_val = 1;
-  memcpy(error1_buffer, &error1_ret_val, sizeof(int));
+  size_t payload_size;
+  unsigned char encoding = choose_encoding(seats, event->rows, event->cols, encodings, &payload_size);
+
+  char* response = reply_claim(reply, sizeof(int) + SEAT_MAP_HEADER_SIZE + payload_size);
+  if (response == NULL) {
+    fprintf(stderr, "Error allocating memory for show response\n");
+    free(seats);
+    return NULL;
+  }
+
+  int success_ret_val = 0;
+  memcpy(response, &success_ret_val, sizeof(int));
+  char* end = put_seat_map(response + sizeof(int), seats, event->rows, event->cols, encoding, payload_size);
+
+  free(seats);
+  *size = (size_t)(end - response);
+  return response;
+}
 
-  // Buffer sent when there are no events
-  char error2_buffer[sizeof(int)];
-  int error2_ret_val = 2;
-  memcpy(error2_buffer, &error2_ret_val, sizeof(int));
+/// Builds the SHOW_SINCE response of an event, only with the seats changed since the version the client has.
+/// @note The response is the status, the serial and version of the event and the kind of update. A
+/// SHOW_SINCE_DELTA is followed by the number of changed seats, their indices and their reservation ids, a
+/// SHOW_SINCE_FULL by the seat map, see put_seat_map. The full seat map is sent when the client has another
+/// instance of the event, the journal no longer holds every change or the delta would be larger than it.
+/// @param event Event to show.
+/// @param encodings Bitmask of the SHOW_ENCODING_* the client accepts for a full seat map.
+/// @param serial Serial of the event the client has, 0 if none.
+/// @param since Version of the event the client has.
+/// @param reply Where the response is built, see reply_claim.
+/// @param size Pointer to the variable to store the size of the response in.
+/// @return Response to send with reply_send, NULL on failure.
+static char* build_show_since_response(struct Event* event, unsigned char encodings, size_t serial, size_t since,
+                                       struct Reply* reply, size_t* size) {
+  size_t num_seats = event->rows * event->cols;
+  size_t header_size = sizeof(int) + 2 * sizeof(size_t) + sizeof(unsigned char);
+  size_t changes;
+  long count = -1;
+
+  size_t* indices = NULL;
+  unsigned int* seats = malloc(num_seats * sizeof(unsigned int));
+  if (seats == NULL) {
+    fprintf(stderr, "Error allocating memory for seats snapshot\n");
+    return NULL;
+  }
+
+  if (serial == event->serial) {
+    indices = malloc(event->journal_size * sizeof(size_t));
+    if (indices == NULL) {
+      fprintf(stderr, "Error allocating memory for seats snapshot\n");
+      free(seats);
+      return NULL;
+    }
+    count = snapshot_delta(event, since, indices, seats, &changes);
+  }
+
+  unsigned char kind = SHOW_SINCE_DELTA;
+  unsigned char encoding = SHOW_ENCODING_RAW;
+  size_t payload_size = 0;
+  if (count >= 0) {
+    payload_size = sizeof(size_t) + (size_t)count * (sizeof(size_t) + sizeof(unsigned int));
+  }
+
+  if (count < 0 || payload_size >= num_seats * sizeof(unsigned int)) {
+    kind = SHOW_SINCE_FULL;
+    changes = snapshot_seats(event, seats);
+    encoding = choose_encoding(seats, event->rows, event->cols, encodings, &payload_size);
+    payload_size += SEAT_MAP_HEADER_SIZE;
+  }
+
+  char* response = reply_claim(reply, header_size + payload_size);
+  if (response == NULL) {
+    fprintf(stderr, "Error allocating memory for show response\n");
+    free(indices);
+    free(seats);
+    return NULL;
+  }
+
+  int success_ret_val = 0;
+  char* current = response;
+  memcpy(current, &success_ret_val, sizeof(int));
+  current += sizeof(int);
+  memcpy(current, &event->serial, sizeof(size_t));
+  current += sizeof(size_t);
+  memcpy(current, &changes, sizeof(size_t));
+  current += sizeof(size_t);
+  memcpy(current, &kind, sizeof(unsigned char));
+  current += sizeof(unsigned char);
+
+  if (kind == SHOW_SINCE_FULL) {
+    put_seat_map(current, seats, event->rows, event->cols, encoding, payload_size - SEAT_MAP_HEADER_SIZE);
+  } else {
+    size_t num_changed = (size_t)count;
+    memcpy(current, &num_changed, sizeof(size_t));
+    current += sizeof(size_t);
+    memcpy(current, indices, num_changed * sizeof(size_t));
+    current += num_changed * sizeof(size_t);
+    memcpy(current, seats, num_changed * sizeof(unsigned int));
+  }
+
+  free(indices);
+  free(seats);
+  *size = header_size + payload_size;
+  return response;
+}
 
+/// Sends the SHOW or SHOW_SINCE response of an event.
+/// @param delta Whether to send the SHOW_SINCE response, see build_show_since_response.
+/// @return 0 if the event was sent successfully, 1 otherwise.
+static int send_show(struct Reply* reply, unsigned int event_id, unsigned char encodings, int delta, size_t serial,
+                     size_t since) {
+
+  char error_buffer[sizeof(int)];
+  int error_ret_val = 1;
+  memcpy(error_buffer, &error_ret_val, sizeof(int));
 
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
-    write(out_fd, error1_buffer, sizeof(error1_buffer));
+    reply_write(reply, error_buffer, sizeof(error_buffer));
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
-    write(out_fd, error1_buffer, sizeof(error1_buffer));
+  epoch_enter();
+
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    reply_write(reply, error_buffer, sizeof(error_buffer));
+    epoch_exit();
     return 1;
   }
 
-  struct ListNode* to = event_list->tail;
-  struct ListNode* current = event_list->head;
+  size_t response_size;
+  char* response = delta ? build_show_since_response(event, encodings, serial, since, reply, &response_size)
+                         : build_show_response(event, encodings, reply, &response_size);
 
-  if (current == NULL) {
-    // writes "No events" on Client's file
-    write(out_fd, error2_buffer, sizeof(error2_buffer));
-    pthread_rwlock_unlock(&event_list->rwl);
-    return 2;
-  }
+  epoch_exit();
 
-  size_t num_events = get_num_events(current);
+  if (response == NULL) {
+    reply_write(reply, error_buffer, sizeof(error_buffer));
+    return 1;
+  }
 
-  char success_buffer[sizeof(int) + sizeof(size_t) + sizeof(unsigned int)* num_events ];
-  int success_ret_val = 0;
-  memcpy(success_buffer, &success_ret_val, sizeof(int));
-  memcpy(success_buffer + sizeof(int), &num_events, sizeof(size_t));
+  // Nothing is held while writing, so a slow reader never delays reservations
+  if (reply_send(reply, response, response_size) != 0) {
+    fprintf(stderr, "Error writing to response pipe (ems_show)\n");
+    return 1;
+  }
 
-  size_t j = 0;
+  return 0;
+}
 
-  while (1) {
+int ems_show(struct Reply* reply, unsigned int event_id, unsigned char encodings) {
+  return send_show(reply, event_id, encodings, 0, 0, 0);
+}
 
-    // Copies event IDs to success_buffer
-    memcpy(success_buffer + sizeof(int) + sizeof(size_t) + j*sizeof(unsigned int), &(current->event)->id, sizeof(unsigned int));
+int ems_show_since(struct Reply* reply, unsigned int event_id, unsigned char encodings, size_t serial,
+                   size_t since) {
+  return send_show(reply, event_id, encodings, 1, serial, since);
+}
 
-    if (current == to) {
-      break;
+/// Builds the LIST response from a traversal of the event list.
+/// @note Must be called inside an epoch critical section.
+/// @param version Version of the event list read before the traversal.
+/// @return Newly allocated response with two references, NULL on failure.
+static struct ListResponse* build_list_response(unsigned long version) {
+  size_t header_size = sizeof(int) + sizeof(size_t);
+  size_t capacity = 64;
+  size_t num_events = 0;
+  struct ListResponse* response = malloc(sizeof(struct ListResponse) + header_size + capacity * sizeof(unsigned int));
+
+  // The list may grow while it is traversed, so the ids are collected in a single pass
+  for (struct ListNode* current = list_first(event_list); current != NULL && response != NULL;
+       current = list_next(current)) {
+    if (num_events == capacity) {
+      capacity *= 2;
+      struct ListResponse* grown =
+          realloc(response, sizeof(struct ListResponse) + header_size + capacity * sizeof(unsigned int));
+      if (grown == NULL) {
+        free(response);
+        return NULL;
+      }
+      response = grown;
     }
 
-    current = current->next;
-    ++j;
+    // Copies event IDs to the response
+    memcpy(response->data + header_size + num_events * sizeof(unsigned int), &(current->event)->id,
+           sizeof(unsigned int));
+    ++num_events;
   }
 
-  write(out_fd, success_buffer, sizeof(success_buffer)) ;
+  if (response == NULL) return NULL;
 
-  pthread_rwlock_unlock(&event_list->rwl);
-  return 0;
+  response->version = version;
+  response->refs = 2;
+
+  if (num_events == 0) {
+    // Sends "No events" to the Client
+    response->status = 2;
+    response->size = sizeof(int);
+  } else {
+    response->status = 0;
+    response->size = header_size + num_events * sizeof(unsigned int);
+    memcpy(response->data + sizeof(int), &num_events, sizeof(size_t));
+  }
+  memcpy(response->data, &response->status, sizeof(int));
+
+  return response;
 }
 
-int ems_print_info(int out_fd) {
+/// Drops a reference to a LIST response, freeing it with the last one.
+static void release_list_response(struct ListResponse* response) {
+  if (__atomic_sub_fetch(&response->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(response);
+  }
+}
+
+/// Drops the reference of the cache to a replaced LIST response, used as the epoch_retire callback.
+static void uncache_list_response(void* context, void* ptr) {
+  (void)context;
+  release_list_response((struct ListResponse*)ptr);
+}
+
+int ems_list_events(struct Reply* reply) {
+
+  // Buffer sent when something goes wrong
+  char error1_buffer[sizeof(int)];
+  int error1_ret_val = 1;
+  memcpy(error1_buffer, &error1_ret_val, sizeof(int));
+
+
   if (event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
+    reply_write(reply, error1_buffer, sizeof(error1_buffer));
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  epoch_enter();
+
+  unsigned long version = list_version(event_list);
+  struct ListResponse* response = __atomic_load_n(&list_cache, __ATOMIC_ACQUIRE);
+
+  if (response != NULL && response->version == version) {
+    __atomic_add_fetch(&response->refs, 1, __ATOMIC_RELAXED);
+  } else {
+    // The list changed since the cached response was built
+    struct ListResponse* fresh = build_list_response(version);
+
+    if (fresh == NULL) {
+      epoch_exit();
+      fprintf(stderr, "Error allocating memory for event list\n");
+      reply_write(reply, error1_buffer, sizeof(error1_buffer));
+      return 1;
+    }
+
+    if (__atomic_compare_exchange_n(&list_cache, &response, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      // Sessions still writing the replaced response keep their own references
+      if (response != NULL) epoch_retire(response, uncache_list_response, NULL);
+    } else {
+      // Another session cached a response first, this one is only used here
+      fresh->refs = 1;
+    }
+
+    response = fresh;
+  }
+
+  epoch_exit();
+
+  int status = response->status;
+  if (reply_write(reply, response->data, response->size) != 0) {
+    fprintf(stderr, "Error writing to response pipe (ems_list_events)\n");
+    status = 1;
+  }
+
+  release_list_response(response);
+  return status;
+}
+
+void ems_batch_enter(struct EmsBatch* batch) { current_batch = batch; }
+
+struct EmsBatch* ems_batch_current(void) { return current_batch; }
+
+uint64_t ems_take_lsn(void) {
+  uint64_t lsn = deferred_lsn;
+  deferred_lsn = 0;
+  return lsn;
+}
+
+int ems_print_info(int out_fd) {
+  if (event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  struct ListNode* to = event_list->tail;
-  struct ListNode* current = event_list->head;
+  epoch_enter();
+
+  struct ListNode* current = list_first(event_list);
 
   if (current == NULL) {
     char buff[] = "No events\n";
     if (print_str(out_fd, buff)) {
       perror("Error writing to file descriptor");
-      pthread_rwlock_unlock(&event_list->rwl);
+      epoch_exit();
       return 1;
     }
 
-    pthread_rwlock_unlock(&event_list->rwl);
+    epoch_exit();
     return 0;
   }
 
@@ -336,7 +1682,7 @@ int ems_print_info(int out_fd) {
     char buff[] = "Event: ";
     if (print_str(out_fd, buff)) {
       perror("Error writing to file descriptor");
-      pthread_rwlock_unlock(&event_list->rwl);
+      epoch_exit();
       return 1;
     }
 
@@ -344,25 +1690,37 @@ int ems_print_info(int out_fd) {
     sprintf(id, "%u\n", (current->event)->id);
     if (print_str(out_fd, id)) {
       perror("Error writing to file descriptor");
-      pthread_rwlock_unlock(&event_list->rwl);
+      epoch_exit();
       return 1;
     }
 
-    for (size_t i = 1; i <= (current->event)->rows; i++) {
-      for (size_t j = 1; j <= (current->event)->cols; j++) {
+    struct Event* event = current->event;
+    unsigned int* seats = malloc(event->rows * event->cols * sizeof(unsigned int));
+    if (seats == NULL) {
+      fprintf(stderr, "Error allocating memory for seats snapshot\n");
+      epoch_exit();
+      return 1;
+    }
+
+    snapshot_seats(event, seats);
+
+    for (size_t i = 1; i <= event->rows; i++) {
+      for (size_t j = 1; j <= event->cols; j++) {
         char buffer[16];
-        sprintf(buffer, "%u", (current->event)->data[seat_index((current->event), i, j)]);
+        sprintf(buffer, "%u", seats[seat_index(event, i, j)]);
 
         if (print_str(out_fd, buffer)) {
           perror("Error writing to file descriptor");
-          pthread_mutex_unlock(&(current->event)->mutex);
+          free(seats);
+          epoch_exit();
           return 1;
         }
 
-        if (j < (current->event)->cols) {
+        if (j < event->cols) {
           if (print_str(out_fd, " ")) {
             perror("Error writing to file descriptor");
-            pthread_mutex_unlock(&(current->event)->mutex);
+            free(seats);
+            epoch_exit();
             return 1;
           }
         }
@@ -370,18 +1728,20 @@ int ems_print_info(int out_fd) {
 
       if (print_str(out_fd, "\n")) {
         perror("Error writing to file descriptor");
-        pthread_mutex_unlock(&(current->event)->mutex);
+        free(seats);
+        epoch_exit();
         return 1;
       }
     }
 
-    if (current == to) {
+    free(seats);
+
+    current = list_next(current);
+    if (current == NULL) {
       break;
     }
-
-    current = current->next;
   }
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  epoch_exit();
   return 0;
 }
\ No newline at end of file
@@ -2,13 +2,45 @@
 #define SERVER_OPERATIONS_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "wal.h"
+
+struct Reply;
+
+/// How concurrent reservations of the same event are serialized.
+enum ReserveMode {
+  RESERVE_MODE_MUTEX,  // Reservations hold the event mutex.
+  RESERVE_MODE_CAS,    // Seats are claimed with atomic operations and released again if any is taken.
+  RESERVE_MODE_OWNER,  // Each event is only changed by the one thread owning it, so nothing is locked, see shard.h.
+};
+
+/// Startup options of the EMS state.
+struct EmsConfig {
+  unsigned int delay_us;               // Delay in microseconds.
+  enum ReserveMode reserve_mode;       // How reservations are serialized.
+  const char* wal_path;                // Write-ahead log replayed on start and appended to, NULL to keep no log.
+  enum WalSync wal_sync;               // When logged changes are made durable, and so acknowledged.
+  unsigned int wal_interval_us;        // Interval between syncs in microseconds, for WAL_SYNC_INTERVAL.
+  const char* checkpoint_path;         // Checkpoint restored on start and written on terminate, NULL to keep none.
+  unsigned int checkpoint_interval_s;  // Interval between checkpoints in seconds, 0 to only write one on terminate.
+};
+
+#define BATCH_LOOKUPS 256  // Distinct events a batch remembers looking up, later ones pay their delay every time
+
+/// Events looked up by a batch of requests, each paying the access delay only on its first lookup.
+struct EmsBatch {
+  unsigned int event_ids[BATCH_LOOKUPS];
+  size_t num_events;
+};
 
 /// Initializes the EMS state.
-/// @param delay_us Delay in microseconds.
+/// @param config Startup options.
 /// @return 0 if the EMS state was initialized successfully, 1 otherwise.
-int ems_init(unsigned int delay_us);
+int ems_init(const struct EmsConfig* config);
 
-/// Destroys the EMS state.
+/// Destroys the EMS state, writing a last checkpoint first.
+/// @note No other operation may be in progress or start afterwards.
 int ems_terminate();
 
 /// Creates a new event with the given id and dimensions.
@@ -26,16 +58,76 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 /// @return 0 if the reservation was created successfully, 1 otherwise.
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
 
+/// Reserves the first run of adjacent free seats in a row of the given event.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of adjacent seats to reserve.
+/// @param min_row First row the seats may be in, 0 for the first row of the event.
+/// @param max_row Last row the seats may be in, 0 for the last row of the event.
+/// @param row Pointer to the variable to store the row of the seats in.
+/// @param col Pointer to the variable to store the column of the first seat in.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+int ems_reserve_best(unsigned int event_id, size_t num_seats, size_t min_row, size_t max_row, size_t *row,
+                     size_t *col);
+
+/// Reserves seats in several events as a single transaction, either every reservation is made or none.
+/// @note The seats of each event follow those of the previous one in xs and ys.
+/// @param num_events Number of events, at most MAX_TRANSACTION_EVENTS.
+/// @param event_ids Array of IDs of the events to reserve seats in.
+/// @param num_seats Array of numbers of seats to reserve in each event.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @return 0 if every reservation was made successfully, 1 otherwise.
+int ems_transaction(size_t num_events, unsigned int *event_ids, size_t *num_seats, size_t *xs, size_t *ys);
+
+/// Cancels a reservation, freeing its seats.
+/// @param event_id Id of the event of the reservation.
+/// @param reservation_id Id of the reservation to cancel.
+/// @return 0 if the reservation was cancelled successfully, 1 otherwise.
+int ems_cancel(unsigned int event_id, unsigned int reservation_id);
+
+/// Deletes the given event.
+/// @note Requests already holding the event finish against it before it is freed.
+/// @param event_id Id of the event to be deleted.
+/// @return 0 if the event was deleted successfully, 1 otherwise.
+int ems_delete(unsigned int event_id);
+
 /// Prints the given event.
-/// @param out_fd File descriptor to print the event to.
+/// @param reply Where the event is sent.
 /// @param event_id Id of the event to print.
+/// @param encodings Bitmask of the SHOW_ENCODING_* the client accepts, the smallest one is used.
 /// @return 0 if the event was printed successfully, 1 otherwise.
-int ems_show(int out_fd, unsigned int event_id);
+int ems_show(struct Reply* reply, unsigned int event_id, unsigned char encodings);
+
+/// Prints the seats of the given event changed since the version the client has.
+/// @note Falls back to the whole event when the client has another instance of it or the changes since its
+/// version are no longer journaled.
+/// @param reply Where the changes are sent.
+/// @param event_id Id of the event to print.
+/// @param encodings Bitmask of the SHOW_ENCODING_* the client accepts for the whole event.
+/// @param serial Serial of the instance of the event the client has, 0 if none.
+/// @param since Version of the event the client has.
+/// @return 0 if the changes were printed successfully, 1 otherwise.
+int ems_show_since(struct Reply* reply, unsigned int event_id, unsigned char encodings, size_t serial, size_t since);
 
 /// Prints all the events.
-/// @param out_fd File descriptor to print the events to.
+/// @param reply Where the events are sent.
 /// @return 0 if the events were printed successfully, 1 otherwise.
-int ems_list_events(int out_fd);
+int ems_list_events(struct Reply* reply);
+
+/// Makes the lookups of the calling thread count against a batch, until it is called again.
+/// @note A batch must only be used by one thread at a time.
+/// @param batch Batch whose requests the thread executes, NULL once it is done.
+void ems_batch_enter(struct EmsBatch* batch);
+
+/// Gets the batch the lookups of the calling thread count against.
+/// @return Pointer to the batch, NULL if there is none, see ems_batch_enter.
+struct EmsBatch* ems_batch_current(void);
+
+/// Takes the log sequence number the last change made by the calling thread has to wait for.
+/// @note In RESERVE_MODE_OWNER changes return before they are durable, and whoever asked for one waits for it
+/// with wal_wait.
+/// @return Log sequence number, 0 if there is nothing to wait for.
+uint64_t ems_take_lsn(void);
 
 // Prints info when SIGUSR1 is received by the main thread
 int ems_print_info(int out_fd);
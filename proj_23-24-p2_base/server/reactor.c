@@ -0,0 +1,433 @@
+#include "reactor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "common/io.h"
+#include "request.h"
+
+#define REACTOR_EVENTS 64                    // Ready sessions taken from epoll at a time
+#define REACTOR_OUTPUT_LIMIT (1024 * 1024)  // Responses a session may have queued before its requests are left unread
+
+struct Loop;
+
+struct Session {
+  int id;
+  int req_fd;   // Non-blocking
+  int resp_fd;  // Non-blocking once the session id is written, responses are queued in reply until it takes them
+  int socket;   // Whether req_fd and resp_fd are the same connected socket, read a message at a time
+  int busy;     // Whether a worker is executing its requests, which owns requests and reply until it hands it back
+  int ending;   // Whether it quit or its client left, so it is closed once its responses are written
+  int closed;   // Whether it was ended, so events still pending for it are ignored
+  struct RequestBuffer requests;
+  struct Reply reply;  // Queues responses for resp_fd
+  struct Loop* loop;
+  struct Session* prev;  // Sessions of the same loop
+  struct Session* next;
+  struct Session* next_work;  // Sessions waiting for a worker, or handed back to the loop
+};
+
+struct Loop {
+  pthread_t thread;
+  int epoll_fd;
+  int stop_fd;            // Event file descriptor written by reactor_stop
+  int wake_fd;            // Event file descriptor written by the workers when they hand a session back
+  pthread_mutex_t mutex;  // Protects sessions, added by the registering thread and removed by the loop, and done
+  struct Session* sessions;
+  struct Session* done;   // Sessions handed back by the workers
+  struct Session* ended;  // Sessions ended while handling the current events, only freed after them
+};
+
+// Workers execute the requests of sessions, so a request waiting on the access delay or the log never holds a loop
+static struct {
+  pthread_t* threads;
+  size_t count;
+  pthread_mutex_t mutex;  // Protects the queue and stop
+  pthread_cond_t ready;   // Signaled when a session is queued or the workers must stop
+  struct Session* head;   // Sessions with requests to execute, in order
+  struct Session* tail;
+  int stop;
+} workers = {.mutex = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER};
+
+static struct Loop* loops = NULL;
+static size_t loop_count = 0;
+static size_t next_loop = 0;  // Loop the next session is handed to
+static int next_session_id = 1;
+
+/// Closes a session and frees it.
+/// @note The session must already be out of the list of its loop.
+static void close_session(struct Session* session) {
+  close(session->req_fd);
+  if (!session->socket) close(session->resp_fd);
+  request_free(&session->requests);
+  reply_free(&session->reply);
+  free(session);
+}
+
+/// Takes a session out of the list of its loop and out of its epoll instance.
+static void unlink_session(struct Loop* loop, struct Session* session) {
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, session->req_fd, NULL);
+  if (!session->socket) epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, session->resp_fd, NULL);
+
+  pthread_mutex_lock(&loop->mutex);
+  if (session->prev != NULL) session->prev->next = session->next;
+  if (session->next != NULL) session->next->prev = session->prev;
+  if (loop->sessions == session) loop->sessions = session->next;
+  pthread_mutex_unlock(&loop->mutex);
+}
+
+/// Ends a session, which is closed once the loop handled the events it already got.
+/// @note Both pipes of a session may be ready in the same batch of events, so it cannot be freed right away.
+static void end_session(struct Loop* loop, struct Session* session) {
+  unlink_session(loop, session);
+  session->closed = 1;
+  session->next = loop->ended;
+  loop->ended = session;
+}
+
+/// Rearms a file descriptor of a session for one more event.
+/// @return 0 if it was rearmed successfully, 1 otherwise.
+static int arm(struct Loop* loop, int fd, uint32_t events, struct Session* session) {
+  struct epoll_event event = {.events = events | EPOLLONESHOT, .data.ptr = session};
+  return epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &event) != 0;
+}
+
+/// Waits for what a session needs next: requests while it is under its output limit, room for its queued
+/// responses, or nothing once it is ending and they were all written, in which case it is ended.
+/// @note File descriptors are armed one event at a time, so a session is never served by the loop and a worker at
+/// once, and a pipe with nothing to wait for cannot report its hangup over and over.
+static void update(struct Loop* loop, struct Session* session) {
+  if (session->busy) return;
+
+  size_t pending = reply_pending(&session->reply);
+  if (session->ending && pending == 0) {
+    end_session(loop, session);
+    return;
+  }
+
+  uint32_t in = !session->ending && pending < REACTOR_OUTPUT_LIMIT ? EPOLLIN : 0;
+  uint32_t out = pending > 0 ? EPOLLOUT : 0;
+  int failed = 0;
+  if (session->socket) {
+    failed = arm(loop, session->req_fd, in | out, session);
+  } else {
+    if (in != 0) failed |= arm(loop, session->req_fd, in, session);
+    if (out != 0) failed |= arm(loop, session->resp_fd, out, session);
+  }
+
+  if (failed) {
+    perror("Error waiting for session");
+    end_session(loop, session);
+  }
+}
+
+/// Queues a session for the workers, which own it until they hand it back.
+static void submit(struct Session* session) {
+  session->busy = 1;
+  session->next_work = NULL;
+
+  pthread_mutex_lock(&workers.mutex);
+  if (workers.tail != NULL) {
+    workers.tail->next_work = session;
+  } else {
+    workers.head = session;
+  }
+  workers.tail = session;
+  pthread_cond_signal(&workers.ready);
+  pthread_mutex_unlock(&workers.mutex);
+}
+
+/// Writes the queued responses of a session. Its client left if they cannot be written, so they are dropped.
+static void flush(struct Session* session) {
+  if (reply_flush(&session->reply) == 0) return;
+  session->ending = 1;
+  reply_free(&session->reply);
+}
+
+/// Writes what a ready session can take and reads what it sent, handing it to the workers once it sent a request.
+/// @note Only one read is made, so a busy session cannot starve the others of the loop. Nothing is read while the
+/// session has too many responses queued, so a client that does not read them cannot make the server hold more.
+/// A socket is ready with a whole message, so receiving it never blocks.
+static void serve(struct Loop* loop, struct Session* session, uint32_t events) {
+  if (session->closed || session->busy) return;
+
+  if (events & EPOLLOUT) flush(session);
+
+  // An error is the response pipe reporting it has no reader, the request pipe reads nothing until the client opens it
+  if ((events & (EPOLLIN | EPOLLHUP)) && !session->ending && reply_pending(&session->reply) < REACTOR_OUTPUT_LIMIT) {
+    ssize_t bytes_read = session->socket ? request_receive(&session->requests, session->req_fd)
+                                          : request_read(&session->requests, session->req_fd);
+
+    if (bytes_read == -1 && (errno == EAGAIN || errno == EINTR)) {
+      // Woken up for the other pipe, or for nothing
+    } else if (bytes_read <= 0) {
+      // The client closed its end
+      if (bytes_read == -1) perror("Error reading from request pipe");
+      session->ending = 1;
+    } else if (request_ready(&session->requests)) {
+      submit(session);
+      return;
+    }
+  }
+
+  update(loop, session);
+}
+
+/// Takes back the sessions the workers are done with and sends their responses.
+static void take_done(struct Loop* loop) {
+  uint64_t count;
+  if (read(loop->wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) perror("Error reading wake event");
+
+  pthread_mutex_lock(&loop->mutex);
+  struct Session* session = loop->done;
+  loop->done = NULL;
+  pthread_mutex_unlock(&loop->mutex);
+
+  while (session != NULL) {
+    struct Session* next = session->next_work;
+    session->busy = 0;
+    flush(session);
+    update(loop, session);
+    session = next;
+  }
+}
+
+/// Executes the requests of the sessions the loops hand over until reactor_stop.
+/// @param arg Index of the worker, its id among the producers of the shards.
+static void* worker_function(void* arg) {
+  size_t index = (size_t)arg;
+
+  pthread_mutex_lock(&workers.mutex);
+  while (1) {
+    while (!workers.stop && workers.head == NULL) pthread_cond_wait(&workers.ready, &workers.mutex);
+    if (workers.stop) break;
+
+    struct Session* session = workers.head;
+    workers.head = session->next_work;
+    if (workers.head == NULL) workers.tail = NULL;
+    pthread_mutex_unlock(&workers.mutex);
+
+    // Quit or sent a malformed request
+    if (request_execute(&session->requests, index, &session->reply) != 0) session->ending = 1;
+
+    struct Loop* loop = session->loop;
+    pthread_mutex_lock(&loop->mutex);
+    session->next_work = loop->done;
+    loop->done = session;
+    pthread_mutex_unlock(&loop->mutex);
+
+    uint64_t one = 1;
+    if (write(loop->wake_fd, &one, sizeof(one)) != (ssize_t)sizeof(one)) perror("Error waking event loop");
+
+    pthread_mutex_lock(&workers.mutex);
+  }
+  pthread_mutex_unlock(&workers.mutex);
+  return NULL;
+}
+
+/// Serves the sessions of a loop until reactor_stop.
+static void* loop_function(void* arg) {
+  struct Loop* loop = arg;
+  struct epoll_event events[REACTOR_EVENTS];
+  int stop = 0;
+
+  while (!stop) {
+    int ready = epoll_wait(loop->epoll_fd, events, REACTOR_EVENTS, -1);
+    if (ready == -1) {
+      if (errno == EINTR) continue;
+      perror("Error waiting for sessions");
+      break;
+    }
+
+    for (int i = 0; i < ready; i++) {
+      if (events[i].data.ptr == NULL) {
+        stop = 1;
+      } else if (events[i].data.ptr == loop) {
+        take_done(loop);
+      } else {
+        serve(loop, events[i].data.ptr, events[i].events);
+      }
+    }
+
+    while (loop->ended != NULL) {
+      struct Session* session = loop->ended;
+      loop->ended = session->next;
+      close_session(session);
+    }
+  }
+
+  // The workers were stopped first, so no session is still being executed
+  pthread_mutex_lock(&loop->mutex);
+  while (loop->sessions != NULL) {
+    struct Session* session = loop->sessions;
+    loop->sessions = session->next;
+    close_session(session);
+  }
+  pthread_mutex_unlock(&loop->mutex);
+  return NULL;
+}
+
+int reactor_start(size_t num_loops) {
+  loops = calloc(num_loops, sizeof(struct Loop));
+  workers.threads = calloc(REACTOR_WORKERS, sizeof(pthread_t));
+  if (loops == NULL || workers.threads == NULL) {
+    fprintf(stderr, "Error allocating memory for event loops\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < num_loops; i++) {
+    struct Loop* loop = &loops[i];
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->stop_fd = eventfd(0, EFD_CLOEXEC);
+    loop->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    struct epoll_event stop_event = {.events = EPOLLIN, .data.ptr = NULL};
+    struct epoll_event wake_event = {.events = EPOLLIN, .data.ptr = loop};
+    if (loop->epoll_fd == -1 || loop->stop_fd == -1 || loop->wake_fd == -1 ||
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->stop_fd, &stop_event) != 0 ||
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &wake_event) != 0 ||
+        pthread_mutex_init(&loop->mutex, NULL) != 0 || pthread_create(&loop->thread, NULL, loop_function, loop) != 0) {
+      perror("Error starting event loop");
+      return 1;
+    }
+    loop_count++;
+  }
+
+  for (size_t i = 0; i < REACTOR_WORKERS; i++) {
+    if (pthread_create(&workers.threads[i], NULL, worker_function, (void*)i) != 0) {
+      perror("Error starting worker");
+      return 1;
+    }
+    workers.count++;
+  }
+
+  return 0;
+}
+
+/// Sends a new session its id and hands it to the next loop in turn.
+/// @note The session is closed if it cannot be added.
+/// @return 0 if the session was added successfully, 1 otherwise.
+static int add_session(struct Session* session) {
+  session->id = next_session_id++;
+  if (write_all(session->resp_fd, &session->id, sizeof(int)) != 0) {
+    fprintf(stderr, "Failed to write session_id to response pipe\n");
+    close_session(session);
+    return 1;
+  }
+
+  // Responses are queued from then on, and written as the client takes them
+  session->reply = (struct Reply){.fd = session->resp_fd, .queued = 1};
+  int flags = fcntl(session->resp_fd, F_GETFL);
+  if (flags == -1 || fcntl(session->resp_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    perror("Error setting up response pipe");
+    close_session(session);
+    return 1;
+  }
+
+  struct Loop* loop = &loops[next_loop];
+  next_loop = (next_loop + 1) % loop_count;
+  session->loop = loop;
+
+  pthread_mutex_lock(&loop->mutex);
+  session->next = loop->sessions;
+  if (loop->sessions != NULL) loop->sessions->prev = session;
+  loop->sessions = session;
+  pthread_mutex_unlock(&loop->mutex);
+
+  // The response pipe is only armed once responses are queued, until then it can only report once that the client
+  // has not opened it yet. Once the request pipe is registered the session belongs to the loop, which may end it at
+  // any time
+  int session_id = session->id;
+  struct epoll_event resp_event = {.events = EPOLLONESHOT, .data.ptr = session};
+  struct epoll_event req_event = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = session};
+  if ((!session->socket && epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, session->resp_fd, &resp_event) != 0) ||
+      epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, session->req_fd, &req_event) != 0) {
+    perror("Error registering session");
+    unlink_session(loop, session);
+    close_session(session);
+    return 1;
+  }
+
+  printf("A Client connected to the server with session ID: %d!\n", session_id);
+  return 0;
+}
+
+int reactor_add(const char* req_pipe_path, const char* resp_pipe_path) {
+  struct Session* session = calloc(1, sizeof(struct Session));
+  if (session == NULL) {
+    fprintf(stderr, "Error allocating memory for session\n");
+    return 1;
+  }
+
+  // Opening the response pipe for reading first lets it be opened for writing before the client opens it, and
+  // keeps the session id buffered in it until the client does
+  session->req_fd = open(req_pipe_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  int placeholder = open(resp_pipe_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  session->resp_fd = placeholder == -1 ? -1 : open(resp_pipe_path, O_WRONLY | O_CLOEXEC);
+
+  if (session->req_fd == -1 || session->resp_fd == -1) {
+    perror("Error opening Client's pipes");
+    if (session->req_fd != -1) close(session->req_fd);
+    if (session->resp_fd != -1) close(session->resp_fd);
+    if (placeholder != -1) close(placeholder);
+    free(session);
+    return 1;
+  }
+
+  int added = add_session(session);
+  close(placeholder);
+  return added;
+}
+
+int reactor_accept(int socket_fd) {
+  struct Session* session = calloc(1, sizeof(struct Session));
+  if (session == NULL) {
+    fprintf(stderr, "Error allocating memory for session\n");
+    close(socket_fd);
+    return 1;
+  }
+
+  session->req_fd = socket_fd;
+  session->resp_fd = socket_fd;
+  session->socket = 1;
+  return add_session(session);
+}
+
+void reactor_stop(void) {
+  pthread_mutex_lock(&workers.mutex);
+  workers.stop = 1;
+  pthread_cond_broadcast(&workers.ready);
+  pthread_mutex_unlock(&workers.mutex);
+
+  for (size_t i = 0; i < workers.count; i++) pthread_join(workers.threads[i], NULL);
+  free(workers.threads);
+  workers.threads = NULL;
+  workers.count = 0;
+  workers.head = NULL;
+  workers.tail = NULL;
+  workers.stop = 0;
+
+  for (size_t i = 0; i < loop_count; i++) {
+    uint64_t one = 1;
+    if (write(loops[i].stop_fd, &one, sizeof(one)) != (ssize_t)sizeof(one)) perror("Error stopping event loop");
+  }
+
+  for (size_t i = 0; i < loop_count; i++) {
+    pthread_join(loops[i].thread, NULL);
+    close(loops[i].epoll_fd);
+    close(loops[i].stop_fd);
+    close(loops[i].wake_fd);
+    pthread_mutex_destroy(&loops[i].mutex);
+  }
+
+  free(loops);
+  loops = NULL;
+  loop_count = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef SERVER_REACTOR_H
+#define SERVER_REACTOR_H
+
+#include <stddef.h>
+
+#include "common/constants.h"
+
+// Event-loop mode: the pipes or socket of every session are registered in the epoll instance of one of a few loop
+// threads, which read requests as their bytes arrive and write responses as the client takes them. Complete
+// requests are executed by a pool of workers, so the access delay and the log never block a loop. An idle or slow
+// session costs its file descriptors and its queued responses, never a thread.
+
+#define REACTOR_WORKERS MAX_SESSION_COUNT  // Threads executing requests, each a producer of the shards, see shard_init
+
+/// Starts the loop threads and the workers.
+/// @param num_loops Number of loop threads.
+/// @return 0 if the loops were started successfully, 1 otherwise.
+int reactor_start(size_t num_loops);
+
+/// Opens the pipes of a new session, sends it its id and hands it to the next loop in turn.
+/// @note Never blocks on the client, the pipes may be opened before or after the client opens its ends.
+/// @param req_pipe_path Path of the request pipe of the session.
+/// @param resp_pipe_path Path of the response pipe of the session.
+/// @return 0 if the session was added successfully, 1 otherwise.
+int reactor_add(const char* req_pipe_path, const char* resp_pipe_path);
+
+/// Sends the session of a connected socket its id and hands it to the next loop in turn.
+/// @param socket_fd Socket accepted on the server socket, owned by the reactor from then on.
+/// @return 0 if the session was added successfully, 1 otherwise.
+int reactor_accept(int socket_fd);
+
+/// Stops the workers once their current requests end, then the loop threads, and closes every session.
+void reactor_stop(void);
+
+#endif  // SERVER_REACTOR_H
@@ -0,0 +1,123 @@
+#include "reply.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/io.h"
+
+void reply_begin(struct Reply* reply, unsigned int request_id) {
+  reply->request_id = request_id;
+  reply->id_pending = 1;
+}
+
+/// Gets how many bytes go ahead of the next part of a response.
+static size_t header_size(const struct Reply* reply) { return reply->id_pending ? sizeof(unsigned int) : 0; }
+
+/// Appends bytes to the queue of a reply, moving what is left of it to the start or growing it as needed.
+/// @return 0 if the bytes were queued successfully, 1 otherwise.
+static int enqueue(struct Reply* reply, const void* data, size_t size) {
+  if (reply->queue_capacity - reply->queue_size < size && reply->queue_offset > 0) {
+    reply->queue_size -= reply->queue_offset;
+    memmove(reply->queue, reply->queue + reply->queue_offset, reply->queue_size);
+    reply->queue_offset = 0;
+  }
+
+  if (reply->queue_capacity - reply->queue_size < size) {
+    size_t capacity = reply->queue_capacity == 0 ? REPLY_FLUSH_SIZE : reply->queue_capacity;
+    while (capacity - reply->queue_size < size) {
+      if (capacity > SIZE_MAX / 2) return 1;
+      capacity *= 2;
+    }
+
+    char* grown = realloc(reply->queue, capacity);
+    if (grown == NULL) return 1;
+    reply->queue = grown;
+    reply->queue_capacity = capacity;
+  }
+
+  memcpy(reply->queue + reply->queue_size, data, size);
+  reply->queue_size += size;
+  return 0;
+}
+
+int reply_write(struct Reply* reply, const void* data, size_t size) {
+  struct iovec parts[2] = {{&reply->request_id, header_size(reply)}, {(void*)data, size}};
+  reply->id_pending = 0;
+
+  if (reply->queued) {
+    return enqueue(reply, parts[0].iov_base, parts[0].iov_len) != 0 || enqueue(reply, data, size) != 0;
+  }
+  if (reply->ring == NULL) {
+    // Written REPLY_FLUSH_SIZE bytes at a time, the id with the first ones
+    size_t first = size < REPLY_FLUSH_SIZE - parts[0].iov_len ? size : REPLY_FLUSH_SIZE - parts[0].iov_len;
+    parts[1].iov_len = first;
+    if (writev_all(reply->fd, parts, 2) != 0) return 1;
+
+    for (size_t offset = first; offset < size; offset += REPLY_FLUSH_SIZE) {
+      size_t chunk = size - offset < REPLY_FLUSH_SIZE ? size - offset : REPLY_FLUSH_SIZE;
+      if (write_all(reply->fd, (const char*)data + offset, chunk) != 0) return 1;
+    }
+    return 0;
+  }
+
+  if (ring_write(reply->ring, parts[0].iov_base, parts[0].iov_len) != 0 || ring_write(reply->ring, data, size) != 0) {
+    return 1;
+  }
+  ring_flush(reply->ring);
+  return 0;
+}
+
+void* reply_claim(struct Reply* reply, size_t size) {
+  size_t header = header_size(reply);
+  char* room = reply->ring != NULL ? ring_claim(reply->ring, header + size) : NULL;
+  reply->in_ring = room != NULL;
+  if (room == NULL) room = malloc(header + size);
+  if (room == NULL) return NULL;
+
+  memcpy(room, &reply->request_id, header);
+  return room + header;
+}
+
+int reply_send(struct Reply* reply, void* response, size_t size) {
+  // The id was put ahead of the response by reply_claim
+  size_t header = header_size(reply);
+  char* start = (char*)response - header;
+  reply->id_pending = 0;
+
+  if (reply->in_ring) {
+    reply->in_ring = 0;
+    ring_publish(reply->ring, header + size);
+    return 0;
+  }
+
+  int failed = reply_write(reply, start, header + size);
+  free(start);
+  return failed;
+}
+
+int reply_flush(struct Reply* reply) {
+  while (reply_pending(reply) > 0) {
+    size_t size = reply_pending(reply) < REPLY_FLUSH_SIZE ? reply_pending(reply) : REPLY_FLUSH_SIZE;
+    ssize_t written = write(reply->fd, reply->queue + reply->queue_offset, size);
+    if (written == -1 && errno == EINTR) continue;
+    if (written == -1) return errno != EAGAIN;
+    reply->queue_offset += (size_t)written;
+  }
+
+  // An idle session holds no memory
+  reply_free(reply);
+  return 0;
+}
+
+size_t reply_pending(const struct Reply* reply) { return reply->queue_size - reply->queue_offset; }
+
+void reply_free(struct Reply* reply) {
+  free(reply->queue);
+  reply->queue = NULL;
+  reply->queue_size = 0;
+  reply->queue_capacity = 0;
+  reply->queue_offset = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef SERVER_REPLY_H
+#define SERVER_REPLY_H
+
+#include <stddef.h>
+
+#include "common/constants.h"
+#include "common/ring.h"
+
+#define REPLY_FLUSH_SIZE MAX_SOCKET_MESSAGE  // Most bytes written at a time, so each socket message fits the client's
+
+/// Where the responses of a session are written.
+struct Reply {
+  int fd;             // Response pipe or socket, unless ring is set
+  struct Ring* ring;  // Response ring of a shared-memory session, NULL otherwise
+  int in_ring;        // Whether the response got with reply_claim is in the ring
+  unsigned int request_id;  // Id of the request being answered
+  int id_pending;           // Whether request_id still has to be sent ahead of the response
+  int queued;               // Whether responses are queued for reply_flush instead of written to fd
+  char* queue;              // Responses not written yet, NULL while empty
+  size_t queue_size;
+  size_t queue_capacity;
+  size_t queue_offset;  // Bytes at the start of queue already written
+};
+
+/// Starts the response to a request, so its id is sent ahead of it.
+/// @note The id goes out with the first part of the response, written or claimed.
+void reply_begin(struct Reply* reply, unsigned int request_id);
+
+/// Writes a response, or part of one, or queues it if the reply is queued.
+/// @return 0 if the response was written successfully, 1 otherwise.
+int reply_write(struct Reply* reply, const void* data, size_t size);
+
+/// Gets room for a response so it can be built in place, straight in the ring when it has room.
+/// @param size Size of the response.
+/// @return Room for the response, NULL on failure.
+void* reply_claim(struct Reply* reply, size_t size);
+
+/// Sends a response built in the room got with reply_claim.
+/// @return 0 if the response was sent successfully, 1 otherwise.
+int reply_send(struct Reply* reply, void* response, size_t size);
+
+/// Writes what a queued reply holds to its non-blocking fd, as much as it takes.
+/// @return 0 unless the write failed, a full fd is not a failure.
+int reply_flush(struct Reply* reply);
+
+/// Gets how many bytes a queued reply holds.
+size_t reply_pending(const struct Reply* reply);
+
+/// Releases the queue of a reply, dropping the responses in it.
+void reply_free(struct Reply* reply);
+
+#endif  // SERVER_REPLY_H
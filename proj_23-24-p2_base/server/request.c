@@ -0,0 +1,431 @@
+#include "request.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common/constants.h"
+#include "operations.h"
+#include "reply.h"
+#include "shard.h"
+
+#define REQUEST_READ_SIZE 4096  // Free space a buffer is grown to before each read
+
+// Largest request, a TRANSACTION with as many seats as it may reserve
+#define REQUEST_MAX_SIZE                                                                   \
+  (1 + sizeof(int) + sizeof(unsigned int) + sizeof(size_t) +                               \
+   MAX_TRANSACTION_EVENTS * (sizeof(unsigned int) + sizeof(size_t)) +                      \
+   2 * MAX_TRANSACTION_EVENTS * MAX_RESERVATION_SIZE * sizeof(size_t))
+
+_Static_assert(1 + sizeof(int) + sizeof(unsigned int) + sizeof(size_t) + MAX_BATCH_SIZE <= REQUEST_MAX_SIZE,
+               "a whole BATCH must fit in the largest request");
+
+/// Checks whether a command may be part of a BATCH, those answered with a status alone.
+static int batchable(char op_code) {
+  return op_code == '3' || op_code == '4' || op_code == '7' || op_code == '9' || op_code == 'B';
+}
+
+/// Gets the size of the fields of a command, which follow its OP_CODE in a request or a BATCH.
+/// @param op_code OP_CODE of the command.
+/// @param fields Fields of the command.
+/// @param size Number of bytes from the fields to the end of the frame.
+/// @return Size of the fields, SIZE_MAX if the frame is too short for the fields they name.
+static size_t command_size(char op_code, const char* fields, size_t size) {
+  size_t needed = 0;
+  switch (op_code) {
+    case '2':
+    case '6':
+      break;
+    case '3':
+      needed += sizeof(unsigned int) + 2 * sizeof(size_t);
+      break;
+    case '4': {
+      needed += sizeof(unsigned int) + sizeof(size_t);
+      if (size < needed) return SIZE_MAX;
+
+      size_t num_seats;
+      memcpy(&num_seats, fields + needed - sizeof(size_t), sizeof(size_t));
+      if (num_seats > MAX_RESERVATION_SIZE) return SIZE_MAX;
+      needed += 2 * num_seats * sizeof(size_t);
+      break;
+    }
+    case '5':
+      needed += sizeof(unsigned int) + sizeof(unsigned char);
+      break;
+    case '7':
+      needed += sizeof(unsigned int);
+      break;
+    case '8':
+      needed += sizeof(unsigned int) + sizeof(unsigned char) + 2 * sizeof(size_t);
+      break;
+    case '9': {
+      needed += sizeof(size_t);
+      if (size < needed) return SIZE_MAX;
+
+      size_t num_events;
+      memcpy(&num_events, fields + needed - sizeof(size_t), sizeof(size_t));
+      if (num_events > MAX_TRANSACTION_EVENTS) return SIZE_MAX;
+      needed += num_events * (sizeof(unsigned int) + sizeof(size_t));
+      if (size < needed) return SIZE_MAX;
+
+      size_t total_seats = 0;
+      for (size_t i = 0; i < num_events; i++) {
+        size_t num_seats;
+        memcpy(&num_seats, fields + needed - (num_events - i) * sizeof(size_t), sizeof(size_t));
+        if (num_seats > MAX_TRANSACTION_EVENTS * MAX_RESERVATION_SIZE) return SIZE_MAX;
+        total_seats += num_seats;
+      }
+      if (total_seats > MAX_TRANSACTION_EVENTS * MAX_RESERVATION_SIZE) return SIZE_MAX;
+      needed += 2 * total_seats * sizeof(size_t);
+      break;
+    }
+    case 'A':
+      needed += sizeof(unsigned int) + 3 * sizeof(size_t);
+      break;
+    case 'B':
+      needed += 2 * sizeof(unsigned int);
+      break;
+    case 'C': {
+      needed += sizeof(size_t);
+      if (size < needed) return SIZE_MAX;
+
+      size_t num_commands;
+      memcpy(&num_commands, fields, sizeof(size_t));
+      if (num_commands == 0 || num_commands > MAX_BATCH_COMMANDS) return SIZE_MAX;
+
+      for (size_t i = 0; i < num_commands; i++) {
+        if (size - needed < 1 || !batchable(fields[needed])) return SIZE_MAX;
+        size_t batched = command_size(fields[needed], fields + needed + 1, size - needed - 1);
+        if (batched == SIZE_MAX) return SIZE_MAX;
+        needed += 1 + batched;
+      }
+      if (needed - sizeof(size_t) > MAX_BATCH_SIZE) return SIZE_MAX;
+      break;
+    }
+    default:
+      return size;  // Unknown OP_CODEs are skipped, whatever their fields
+  }
+
+  return size < needed ? SIZE_MAX : needed;
+}
+
+/// Gets the size a request should have from its fields.
+/// @param data Request, starting with its OP_CODE.
+/// @param size Size of the frame of the request.
+/// @return Size of the request, SIZE_MAX if its frame is too short for the fields it names.
+static size_t fields_size(const char* data, size_t size) {
+  size_t header = 1 + sizeof(int) + sizeof(unsigned int);  // OP_CODE, session id and request id
+  if (size < header) return SIZE_MAX;
+
+  size_t fields = command_size(data[0], data + header, size - header);
+  return fields == SIZE_MAX ? SIZE_MAX : header + fields;
+}
+
+/// Gets the size of the frame at the start of a buffer.
+/// @param data Bytes of the buffer, starting with the size of the request in the frame.
+/// @param size Number of bytes in the buffer.
+/// @return Size of the frame, 0 if more bytes are needed, SIZE_MAX if the request in it is malformed.
+static size_t frame_size(const char* data, size_t size) {
+  unsigned int request_size;
+  if (size < sizeof(unsigned int)) return 0;
+  memcpy(&request_size, data, sizeof(unsigned int));
+
+  // Checked before the request is whole, so a bogus size cannot make the buffer grow without bound
+  if (request_size == 0 || request_size > REQUEST_MAX_SIZE) return SIZE_MAX;
+  if (size - sizeof(unsigned int) < request_size) return 0;
+
+  // The fields must fill the frame exactly
+  if (fields_size(data + sizeof(unsigned int), request_size) != request_size) return SIZE_MAX;
+  return sizeof(unsigned int) + request_size;
+}
+
+/// Copies a field out of a request and advances past it.
+static const char* take(const char* cursor, void* field, size_t size) {
+  memcpy(field, cursor, size);
+  return cursor + size;
+}
+
+/// Writes the return status of a request to its session.
+static void write_status(struct Reply* reply, int return_status, const char* name) {
+  if (reply_write(reply, &return_status, sizeof(int)) != 0) {
+    fprintf(stderr, "Error writing return status to response pipe (%s)\n", name);
+  }
+}
+
+/// Runs a command answered with a status alone, see batchable.
+/// @param op_code OP_CODE of the command.
+/// @param fields Fields of the command, see command_size.
+/// @param producer Id of the calling thread among the producers of the shards.
+/// @param name Where the name of the command is stored, for error messages.
+/// @return Status of the command.
+static int run_command(char op_code, const char* fields, size_t producer, const char** name) {
+  const char* cursor = fields;
+
+  switch (op_code) {
+    case '3': {
+      unsigned int event_id;
+      size_t num_rows, num_cols;
+      cursor = take(cursor, &event_id, sizeof(unsigned int));
+      cursor = take(cursor, &num_rows, sizeof(size_t));
+      take(cursor, &num_cols, sizeof(size_t));
+
+      printf("REQUEST FOR EMS_CREATE RECEIVED\n");
+      *name = "ems_create";
+      return shard_create(producer, event_id, num_rows, num_cols);
+    }
+
+    case '4': {
+      unsigned int event_id;
+      size_t num_seats;
+      size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+      cursor = take(cursor, &event_id, sizeof(unsigned int));
+      cursor = take(cursor, &num_seats, sizeof(size_t));
+      cursor = take(cursor, xs, num_seats * sizeof(size_t));
+      take(cursor, ys, num_seats * sizeof(size_t));
+
+      printf("REQUEST FOR EMS_RESERVE RECEIVED\n");
+      *name = "ems_reserve";
+      return shard_reserve(producer, event_id, num_seats, xs, ys);
+    }
+
+    case '7': {
+      unsigned int event_id;
+      take(cursor, &event_id, sizeof(unsigned int));
+
+      printf("REQUEST FOR EMS_DELETE RECEIVED\n");
+      *name = "ems_delete";
+      return shard_delete(producer, event_id);
+    }
+
+    case '9': {
+      size_t num_events, total_seats = 0;
+      unsigned int event_ids[MAX_TRANSACTION_EVENTS];
+      size_t num_seats[MAX_TRANSACTION_EVENTS];
+      size_t xs[MAX_TRANSACTION_EVENTS * MAX_RESERVATION_SIZE];
+      size_t ys[MAX_TRANSACTION_EVENTS * MAX_RESERVATION_SIZE];
+      cursor = take(cursor, &num_events, sizeof(size_t));
+      cursor = take(cursor, event_ids, num_events * sizeof(unsigned int));
+      cursor = take(cursor, num_seats, num_events * sizeof(size_t));
+      for (size_t i = 0; i < num_events; i++) total_seats += num_seats[i];
+      cursor = take(cursor, xs, total_seats * sizeof(size_t));
+      take(cursor, ys, total_seats * sizeof(size_t));
+
+      printf("REQUEST FOR EMS_TRANSACTION RECEIVED\n");
+      *name = "ems_transaction";
+      return shard_transaction(producer, num_events, event_ids, num_seats, xs, ys);
+    }
+
+    default: {  // 'B', the last one left
+      unsigned int event_id, reservation_id;
+      cursor = take(cursor, &event_id, sizeof(unsigned int));
+      take(cursor, &reservation_id, sizeof(unsigned int));
+
+      printf("REQUEST FOR EMS_CANCEL RECEIVED\n");
+      *name = "ems_cancel";
+      return shard_cancel(producer, event_id, reservation_id);
+    }
+  }
+}
+
+/// Runs the commands of a BATCH in order and writes their statuses to its session, one byte each.
+/// @note Each event is only looked up once by the whole batch, see ems_batch_enter.
+static void run_batch(const char* fields, size_t producer, struct Reply* reply) {
+  size_t num_commands;
+  const char* cursor = take(fields, &num_commands, sizeof(size_t));
+  printf("REQUEST FOR EMS_BATCH RECEIVED\n");
+
+  unsigned char statuses[MAX_BATCH_COMMANDS];
+  struct EmsBatch batch = {.num_events = 0};
+  ems_batch_enter(&batch);
+
+  for (size_t i = 0; i < num_commands; i++) {
+    const char* name;
+    statuses[i] = (unsigned char)run_command(cursor[0], cursor + 1, producer, &name);
+    cursor += 1 + command_size(cursor[0], cursor + 1, SIZE_MAX);  // Checked whole before the batch ran
+  }
+
+  ems_batch_enter(NULL);
+  if (reply_write(reply, statuses, num_commands) != 0) {
+    fprintf(stderr, "Error writing statuses to response pipe (ems_batch)\n");
+  }
+}
+
+/// Executes a complete request, see fields_size.
+/// @return 0 while the session goes on, 1 once it quit.
+static int execute(const char* request, size_t producer, struct Reply* reply) {
+  int session_id;
+  unsigned int request_id;
+  const char* cursor = take(request + 1, &session_id, sizeof(int));
+  cursor = take(cursor, &request_id, sizeof(unsigned int));
+
+  // Every response but that of EMS_QUIT, which has none, starts with the id of its request
+  reply_begin(reply, request_id);
+
+  switch (request[0]) {
+    case '2':
+      printf("REQUEST FOR EMS_QUIT RECEIVED\n");
+      printf("Client with session ID %d disconnected from server!\n", session_id);
+      return 1;
+
+    case '3':
+    case '4':
+    case '7':
+    case '9':
+    case 'B': {
+      const char* name;
+      int return_status = run_command(request[0], cursor, producer, &name);
+      write_status(reply, return_status, name);
+      break;
+    }
+
+    case '5': {
+      unsigned int event_id;
+      unsigned char encodings;
+      cursor = take(cursor, &event_id, sizeof(unsigned int));
+      take(cursor, &encodings, sizeof(unsigned char));
+
+      printf("REQUEST FOR EMS_SHOW RECEIVED\n");
+      ems_show(reply, event_id, encodings);
+      break;
+    }
+
+    case '6':
+      printf("REQUEST FOR EMS_LIST_EVENTS RECEIVED\n");
+      ems_list_events(reply);
+      break;
+
+    case '8': {
+      unsigned int event_id;
+      unsigned char encodings;
+      size_t serial, since;
+      cursor = take(cursor, &event_id, sizeof(unsigned int));
+      cursor = take(cursor, &encodings, sizeof(unsigned char));
+      cursor = take(cursor, &serial, sizeof(size_t));
+      take(cursor, &since, sizeof(size_t));
+
+      printf("REQUEST FOR EMS_SHOW_SINCE RECEIVED\n");
+      ems_show_since(reply, event_id, encodings, serial, since);
+      break;
+    }
+
+    case 'A': {
+      unsigned int event_id;
+      size_t num_seats, min_row, max_row;
+      cursor = take(cursor, &event_id, sizeof(unsigned int));
+      cursor = take(cursor, &num_seats, sizeof(size_t));
+      cursor = take(cursor, &min_row, sizeof(size_t));
+      take(cursor, &max_row, sizeof(size_t));
+
+      printf("REQUEST FOR EMS_RESERVE_BEST RECEIVED\n");
+
+      size_t seats[2] = {0, 0};
+      int return_status = shard_reserve_best(producer, event_id, num_seats, min_row, max_row, &seats[0], &seats[1]);
+      write_status(reply, return_status, "ems_reserve_best");
+      if (return_status == 0 && reply_write(reply, seats, sizeof(seats)) != 0) {
+        fprintf(stderr, "Error writing seats to response pipe (ems_reserve_best)\n");
+      }
+      break;
+    }
+
+    case 'C':
+      run_batch(cursor, producer, reply);
+      break;
+
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+/// Grows a buffer until it has room for a number of bytes after the ones it holds.
+/// @return 0 if the buffer has room, 1 if it could not be grown.
+static int reserve_space(struct RequestBuffer* buffer, size_t space) {
+  if (buffer->capacity - buffer->size >= space) return 0;
+
+  size_t capacity = buffer->capacity == 0 ? REQUEST_READ_SIZE : 2 * buffer->capacity;
+  while (capacity - buffer->size < space) capacity *= 2;
+
+  char* grown = realloc(buffer->data, capacity);
+  if (grown == NULL) return 1;
+  buffer->data = grown;
+  buffer->capacity = capacity;
+  return 0;
+}
+
+ssize_t request_read(struct RequestBuffer* buffer, int fd) {
+  if (reserve_space(buffer, REQUEST_READ_SIZE) != 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  ssize_t bytes_read = read(fd, buffer->data + buffer->size, buffer->capacity - buffer->size);
+  if (bytes_read > 0) buffer->size += (size_t)bytes_read;
+  return bytes_read;
+}
+
+ssize_t request_receive(struct RequestBuffer* buffer, int fd) {
+  // A message is cut short if it does not fit, so its size is learned first without taking it
+  ssize_t message_size = recv(fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+  if (message_size <= 0) return message_size;
+
+  if (reserve_space(buffer, (size_t)message_size) != 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  ssize_t bytes_read = recv(fd, buffer->data + buffer->size, buffer->capacity - buffer->size, 0);
+  if (bytes_read > 0) buffer->size += (size_t)bytes_read;
+  return bytes_read;
+}
+
+int request_ready(const struct RequestBuffer* buffer) {
+  return buffer->size > 0 && frame_size(buffer->data, buffer->size) != 0;
+}
+
+int request_execute(struct RequestBuffer* buffer, size_t producer, struct Reply* reply) {
+  if (buffer->size == 0) return 0;
+
+  size_t offset = 0;
+  int ended = 0;
+
+  while (!ended) {
+    size_t size = frame_size(buffer->data + offset, buffer->size - offset);
+    if (size == 0) break;
+    if (size == SIZE_MAX) {
+      fprintf(stderr, "Malformed request, ending session\n");
+      return 1;
+    }
+
+    ended = execute(buffer->data + offset + sizeof(unsigned int), producer, reply);
+    offset += size;
+  }
+
+  buffer->size -= offset;
+  if (buffer->size == 0) {
+    request_free(buffer);
+  } else if (offset > 0) {
+    memmove(buffer->data, buffer->data + offset, buffer->size);
+  }
+  return ended;
+}
+
+ssize_t request_read_ring(struct RequestBuffer* buffer, struct Ring* ring) {
+  if (reserve_space(buffer, REQUEST_READ_SIZE) != 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  size_t bytes_read = ring_read(ring, buffer->data + buffer->size, buffer->capacity - buffer->size);
+  buffer->size += bytes_read;
+  return (ssize_t)bytes_read;
+}
+
+void request_free(struct RequestBuffer* buffer) {
+  free(buffer->data);
+  *buffer = (struct RequestBuffer){0};
+}
@@ -0,0 +1,51 @@
+#ifndef SERVER_REQUEST_H
+#define SERVER_REQUEST_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "common/ring.h"
+#include "reply.h"
+
+// Bytes read from the request pipe of a session and not executed yet
+struct RequestBuffer {
+  char* data;  // NULL while empty, so an idle session holds no memory
+  size_t size;
+  size_t capacity;
+};
+
+/// Reads the bytes available in a request pipe into a buffer.
+/// @param buffer Buffer to append the bytes to.
+/// @param fd Request pipe of the session.
+/// @return Number of bytes read, 0 at end of file, -1 on error with errno set.
+ssize_t request_read(struct RequestBuffer* buffer, int fd);
+
+/// Receives the next message of a SOCK_SEQPACKET socket into a buffer, whatever its size.
+/// @note The socket must only be read by the calling thread, or the message received may not be the one sized.
+/// @param buffer Buffer to append the message to.
+/// @param fd Connected socket of the session.
+/// @return Number of bytes received, 0 once the peer closed the connection, -1 on error with errno set.
+ssize_t request_receive(struct RequestBuffer* buffer, int fd);
+
+/// Reads the bytes published in the request ring of a shared-memory session into a buffer.
+/// @param buffer Buffer to append the bytes to.
+/// @param ring Request ring of the session.
+/// @return Number of bytes read, 0 once the session ended, -1 on error with errno set.
+ssize_t request_read_ring(struct RequestBuffer* buffer, struct Ring* ring);
+
+/// Checks whether a buffer holds a frame to execute, complete or malformed.
+/// @return 1 if request_execute would execute a request or end the session, 0 if it needs more bytes.
+int request_ready(const struct RequestBuffer* buffer);
+
+/// Executes the request of every complete frame of a buffer in order, keeping the bytes of the incomplete one that
+/// follows. A frame is the size of its request, as an unsigned int, then the request.
+/// @param buffer Buffer of the session.
+/// @param producer Id of the calling thread among the producers of the shards, see shard_init.
+/// @param reply Where the responses of the session are written.
+/// @return 0 while the session goes on, 1 once it quit or sent a malformed request.
+int request_execute(struct RequestBuffer* buffer, size_t producer, struct Reply* reply);
+
+/// Releases the memory of a buffer.
+void request_free(struct RequestBuffer* buffer);
+
+#endif  // SERVER_REQUEST_H
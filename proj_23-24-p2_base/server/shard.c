@@ -0,0 +1,431 @@
+#define _GNU_SOURCE  // pthread_attr_setaffinity_np
+#include "shard.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/constants.h"
+#include "operations.h"
+#include "wal.h"
+
+#define CACHE_LINE_SIZE 64
+#define SHARD_QUEUE_SIZE 64  // Requests a session can have queued on one shard (power of two)
+#define SHARD_SPINS 64       // Checks a waiting thread makes, yielding in between, before it blocks
+
+enum ShardOp {
+  SHARD_OP_CREATE,
+  SHARD_OP_RESERVE,
+  SHARD_OP_RESERVE_BEST,
+  SHARD_OP_TRANSACTION,
+  SHARD_OP_CANCEL,
+  SHARD_OP_DELETE,
+  SHARD_OP_PARK,  // Leaves the events of the shard to the session until it clears Shard::parked
+};
+
+// Lets a thread block until another one makes a condition true, see wait_until and wake
+struct Waiter {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int sleeping;  // Set while the thread may be blocked on cond
+};
+
+// Request handed to a shard, with the arguments of the ems_* function it runs
+struct ShardRequest {
+  enum ShardOp op;
+  unsigned int event_id;
+  unsigned int reservation_id;
+  unsigned int* event_ids;
+  size_t num_rows;
+  size_t num_cols;
+  size_t num_events;
+  size_t num_seats;
+  size_t* event_seats;  // Number of seats in each event of a transaction
+  size_t* xs;
+  size_t* ys;
+  size_t min_row;
+  size_t max_row;
+  size_t* row;
+  size_t* col;
+  int result;
+  uint64_t lsn;            // Log sequence number the session waits for, see ems_take_lsn
+  struct EmsBatch* batch;  // Batch of the session, whose lookups the request counts against
+  int done;                // Set by the shard once result is set, the request is not touched afterwards
+  struct Waiter* waiter;   // Waiter of the session, woken once done is set
+};
+
+// Single-producer single-consumer ring of requests, from one session to one shard
+struct ShardQueue {
+  _Alignas(CACHE_LINE_SIZE) size_t head;  // Next slot to be read, only written by the shard
+  _Alignas(CACHE_LINE_SIZE) size_t tail;  // Next slot to be written, only written by the session
+  struct ShardRequest* slots[SHARD_QUEUE_SIZE];
+};
+
+struct Shard {
+  pthread_t thread;
+  struct ShardQueue* queues;  // One per session
+  struct Waiter waiter;       // Woken when a request is queued, the shard is unparked or stopped
+  int parked;                 // Set while a session has the events of the shard, see SHARD_OP_PARK
+  int stop;
+};
+
+static struct Shard* shards = NULL;
+static size_t shard_count = 0;
+static size_t session_count = 0;
+static struct Waiter* session_waiters = NULL;
+
+/// Initializes a waiter.
+/// @return 0 if the waiter was initialized successfully, 1 otherwise.
+static int init_waiter(struct Waiter* waiter) {
+  waiter->sleeping = 0;
+  if (pthread_mutex_init(&waiter->mutex, NULL) != 0) return 1;
+  if (pthread_cond_init(&waiter->cond, NULL) != 0) {
+    pthread_mutex_destroy(&waiter->mutex);
+    return 1;
+  }
+  return 0;
+}
+
+/// Destroys a waiter.
+static void destroy_waiter(struct Waiter* waiter) {
+  pthread_cond_destroy(&waiter->cond);
+  pthread_mutex_destroy(&waiter->mutex);
+}
+
+/// Waits until a condition holds, yielding a few times before blocking so a quick answer costs no system call.
+/// @note The condition must be made true with a sequentially consistent store followed by wake.
+/// @param waiter Waiter of the calling thread.
+/// @param ready Function checking the condition with sequentially consistent loads.
+/// @param arg Argument of ready.
+static void wait_until(struct Waiter* waiter, int (*ready)(void*), void* arg) {
+  for (unsigned int spin = 0; spin < SHARD_SPINS; spin++) {
+    if (ready(arg)) return;
+    sched_yield();
+  }
+
+  // Either wake sees sleeping set, or ready sees the condition it was called for
+  pthread_mutex_lock(&waiter->mutex);
+  __atomic_store_n(&waiter->sleeping, 1, __ATOMIC_SEQ_CST);
+  while (!ready(arg)) pthread_cond_wait(&waiter->cond, &waiter->mutex);
+  __atomic_store_n(&waiter->sleeping, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&waiter->mutex);
+}
+
+/// Wakes the thread of a waiter if it is blocked in wait_until.
+static void wake(struct Waiter* waiter) {
+  if (!__atomic_load_n(&waiter->sleeping, __ATOMIC_SEQ_CST)) return;
+
+  pthread_mutex_lock(&waiter->mutex);
+  pthread_cond_signal(&waiter->cond);
+  pthread_mutex_unlock(&waiter->mutex);
+}
+
+/// Adds a request to a queue.
+/// @return 0 if the request was added, 1 if the queue is full.
+static int queue_push(struct ShardQueue* queue, struct ShardRequest* request) {
+  size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+  if (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == SHARD_QUEUE_SIZE) return 1;
+
+  queue->slots[tail % SHARD_QUEUE_SIZE] = request;
+  __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+/// Takes the oldest request out of a queue.
+/// @return Pointer to the request, NULL if the queue is empty.
+static struct ShardRequest* queue_pop(struct ShardQueue* queue) {
+  size_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+  if (head == __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST)) return NULL;
+
+  struct ShardRequest* request = queue->slots[head % SHARD_QUEUE_SIZE];
+  __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+  return request;
+}
+
+/// Gets the shard owning an event (Fibonacci hashing, reduced to the number of shards).
+static struct Shard* owner(unsigned int event_id) {
+  uint64_t hash = (uint32_t)(event_id * 2654435761u);
+  return &shards[(hash * shard_count) >> 32];
+}
+
+/// Checks whether a shard has a request queued or was stopped.
+static int shard_ready(void* arg) {
+  struct Shard* shard = arg;
+  if (__atomic_load_n(&shard->stop, __ATOMIC_SEQ_CST)) return 1;
+
+  for (size_t session = 0; session < session_count; session++) {
+    struct ShardQueue* queue = &shard->queues[session];
+    if (__atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST) != __atomic_load_n(&queue->head, __ATOMIC_RELAXED)) return 1;
+  }
+  return 0;
+}
+
+/// Checks whether a shard was unparked.
+static int shard_unparked(void* arg) {
+  struct Shard* shard = arg;
+  return !__atomic_load_n(&shard->parked, __ATOMIC_SEQ_CST);
+}
+
+/// Checks whether a request is done.
+static int request_done(void* arg) {
+  struct ShardRequest* request = arg;
+  return __atomic_load_n(&request->done, __ATOMIC_SEQ_CST);
+}
+
+/// Runs a request on the shard owning its events and hands the result back to its session.
+static void execute(struct Shard* shard, struct ShardRequest* request) {
+  ems_batch_enter(request->batch);
+
+  switch (request->op) {
+    case SHARD_OP_CREATE:
+      request->result = ems_create(request->event_id, request->num_rows, request->num_cols);
+      break;
+    case SHARD_OP_RESERVE:
+      request->result = ems_reserve(request->event_id, request->num_seats, request->xs, request->ys);
+      break;
+    case SHARD_OP_RESERVE_BEST:
+      request->result = ems_reserve_best(request->event_id, request->num_seats, request->min_row, request->max_row,
+                                         request->row, request->col);
+      break;
+    case SHARD_OP_TRANSACTION:
+      request->result = ems_transaction(request->num_events, request->event_ids, request->event_seats,
+                                        request->xs, request->ys);
+      break;
+    case SHARD_OP_CANCEL:
+      request->result = ems_cancel(request->event_id, request->reservation_id);
+      break;
+    case SHARD_OP_DELETE:
+      request->result = ems_delete(request->event_id);
+      break;
+    case SHARD_OP_PARK:
+      __atomic_store_n(&shard->parked, 1, __ATOMIC_RELAXED);
+      request->result = 0;
+      break;
+  }
+
+  ems_batch_enter(NULL);
+
+  // The session waits for the change to be durable, so the shard moves on to its next request meanwhile
+  request->lsn = ems_take_lsn();
+
+  // The session may release the request as soon as done is set
+  struct Waiter* waiter = request->waiter;
+  __atomic_store_n(&request->done, 1, __ATOMIC_SEQ_CST);
+  wake(waiter);
+
+  if (__atomic_load_n(&shard->parked, __ATOMIC_RELAXED)) wait_until(&shard->waiter, shard_unparked, shard);
+}
+
+/// Runs the requests queued on a shard until it is stopped.
+static void* shard_loop(void* arg) {
+  struct Shard* shard = arg;
+
+  while (1) {
+    int idle = 1;
+
+    for (size_t session = 0; session < session_count; session++) {
+      struct ShardRequest* request;
+      while ((request = queue_pop(&shard->queues[session])) != NULL) {
+        execute(shard, request);
+        idle = 0;
+      }
+    }
+
+    if (!idle) continue;
+    if (__atomic_load_n(&shard->stop, __ATOMIC_SEQ_CST)) break;
+    wait_until(&shard->waiter, shard_ready, shard);
+  }
+
+  return NULL;
+}
+
+/// Queues a request on a shard without waiting for it.
+static void send(struct Shard* shard, size_t session, struct ShardRequest* request) {
+  request->waiter = &session_waiters[session];
+  request->batch = ems_batch_current();
+  request->done = 0;
+
+  while (queue_push(&shard->queues[session], request) != 0) sched_yield();
+  wake(&shard->waiter);
+}
+
+/// Runs a request on a shard and waits for its result.
+/// @return Result of the request, once its change is durable.
+static int run(struct Shard* shard, size_t session, struct ShardRequest* request) {
+  send(shard, session, request);
+  wait_until(&session_waiters[session], request_done, request);
+  return request->result != 0 || wal_wait(request->lsn) != 0;
+}
+
+int shard_init(size_t num_shards, size_t num_sessions) {
+  if (num_shards == 0) return 0;
+
+  shards = calloc(num_shards, sizeof(struct Shard));
+  session_waiters = calloc(num_sessions, sizeof(struct Waiter));
+  if (shards == NULL || session_waiters == NULL) {
+    fprintf(stderr, "Error allocating memory for shards\n");
+    free(shards);
+    free(session_waiters);
+    shards = NULL;
+    session_waiters = NULL;
+    return 1;
+  }
+
+  for (size_t session = 0; session < num_sessions; session++) {
+    if (init_waiter(&session_waiters[session]) != 0) {
+      fprintf(stderr, "Error initializing session waiter\n");
+      return 1;
+    }
+  }
+  session_count = num_sessions;
+
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_cpus < 1) num_cpus = 1;
+
+  for (size_t i = 0; i < num_shards; i++) {
+    struct Shard* shard = &shards[i];
+    shard->queues = aligned_alloc(CACHE_LINE_SIZE, num_sessions * sizeof(struct ShardQueue));
+    if (shard->queues == NULL || init_waiter(&shard->waiter) != 0) {
+      fprintf(stderr, "Error allocating memory for shards\n");
+      return 1;
+    }
+    memset(shard->queues, 0, num_sessions * sizeof(struct ShardQueue));
+
+    // Pinning is only a hint, a shard left unpinned still owns its events
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(i % (size_t)num_cpus, &cpus);
+    pthread_attr_init(&attr);
+    if (pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus) != 0) {
+      fprintf(stderr, "Error pinning shard %zu\n", i);
+    }
+
+    int status = pthread_create(&shard->thread, &attr, shard_loop, shard);
+    pthread_attr_destroy(&attr);
+    if (status != 0) {
+      fprintf(stderr, "Error starting shard thread\n");
+      return 1;
+    }
+    shard_count++;
+  }
+
+  return 0;
+}
+
+void shard_terminate(void) {
+  for (size_t i = 0; i < shard_count; i++) {
+    __atomic_store_n(&shards[i].stop, 1, __ATOMIC_SEQ_CST);
+    wake(&shards[i].waiter);
+  }
+
+  for (size_t i = 0; i < shard_count; i++) {
+    pthread_join(shards[i].thread, NULL);
+    destroy_waiter(&shards[i].waiter);
+    free(shards[i].queues);
+  }
+
+  for (size_t session = 0; session < session_count; session++) destroy_waiter(&session_waiters[session]);
+
+  free(shards);
+  free(session_waiters);
+  shards = NULL;
+  session_waiters = NULL;
+  shard_count = 0;
+  session_count = 0;
+}
+
+int shard_create(size_t session, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  if (shard_count == 0) return ems_create(event_id, num_rows, num_cols);
+
+  struct ShardRequest request = {
+      .op = SHARD_OP_CREATE, .event_id = event_id, .num_rows = num_rows, .num_cols = num_cols};
+  return run(owner(event_id), session, &request);
+}
+
+int shard_reserve(size_t session, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  if (shard_count == 0) return ems_reserve(event_id, num_seats, xs, ys);
+
+  struct ShardRequest request = {
+      .op = SHARD_OP_RESERVE, .event_id = event_id, .num_seats = num_seats, .xs = xs, .ys = ys};
+  return run(owner(event_id), session, &request);
+}
+
+int shard_reserve_best(size_t session, unsigned int event_id, size_t num_seats, size_t min_row, size_t max_row,
+                       size_t* row, size_t* col) {
+  if (shard_count == 0) return ems_reserve_best(event_id, num_seats, min_row, max_row, row, col);
+
+  struct ShardRequest request = {.op = SHARD_OP_RESERVE_BEST,
+                                 .event_id = event_id,
+                                 .num_seats = num_seats,
+                                 .min_row = min_row,
+                                 .max_row = max_row,
+                                 .row = row,
+                                 .col = col};
+  return run(owner(event_id), session, &request);
+}
+
+int shard_transaction(size_t session, size_t num_events, unsigned int* event_ids, size_t* num_seats, size_t* xs,
+                      size_t* ys) {
+  // An invalid transaction is rejected before any event is looked up
+  if (shard_count == 0 || num_events == 0 || num_events > MAX_TRANSACTION_EVENTS) {
+    return ems_transaction(num_events, event_ids, num_seats, xs, ys);
+  }
+
+  // Distinct owners of the events in ascending order, the order they are parked in
+  struct Shard* owners[MAX_TRANSACTION_EVENTS];
+  size_t num_owners = 0;
+  for (size_t p = 0; p < num_events; p++) {
+    struct Shard* shard = owner(event_ids[p]);
+    size_t i = 0;
+    while (i < num_owners && owners[i] < shard) i++;
+    if (i < num_owners && owners[i] == shard) continue;
+
+    memmove(&owners[i + 1], &owners[i], (num_owners - i) * sizeof(struct Shard*));
+    owners[i] = shard;
+    num_owners++;
+  }
+
+  if (num_owners == 1) {
+    struct ShardRequest request = {.op = SHARD_OP_TRANSACTION,
+                                   .num_events = num_events,
+                                   .event_ids = event_ids,
+                                   .event_seats = num_seats,
+                                   .xs = xs,
+                                   .ys = ys};
+    return run(owners[0], session, &request);
+  }
+
+  // With every owner parked no other thread changes the events, so the session owns them for the transaction
+  for (size_t i = 0; i < num_owners; i++) {
+    struct ShardRequest request = {.op = SHARD_OP_PARK};
+    run(owners[i], session, &request);
+  }
+
+  int result = ems_transaction(num_events, event_ids, num_seats, xs, ys);
+  uint64_t lsn = ems_take_lsn();
+
+  for (size_t i = 0; i < num_owners; i++) {
+    __atomic_store_n(&owners[i]->parked, 0, __ATOMIC_SEQ_CST);
+    wake(&owners[i]->waiter);
+  }
+  return result != 0 || wal_wait(lsn) != 0;
+}
+
+int shard_cancel(size_t session, unsigned int event_id, unsigned int reservation_id) {
+  if (shard_count == 0) return ems_cancel(event_id, reservation_id);
+
+  struct ShardRequest request = {.op = SHARD_OP_CANCEL, .event_id = event_id, .reservation_id = reservation_id};
+  return run(owner(event_id), session, &request);
+}
+
+int shard_delete(size_t session, unsigned int event_id) {
+  if (shard_count == 0) return ems_delete(event_id);
+
+  struct ShardRequest request = {.op = SHARD_OP_DELETE, .event_id = event_id};
+  return run(owner(event_id), session, &request);
+}
@@ -0,0 +1,50 @@
+#ifndef SERVER_SHARD_H
+#define SERVER_SHARD_H
+
+#include <stddef.h>
+
+// Share-nothing execution: events are partitioned by id across shard threads, and only the shard owning an event
+// ever changes it, so the EMS state runs in RESERVE_MODE_OWNER. Sessions hand their requests to the owning shard
+// over one single-producer single-consumer queue per session and shard, and wait for the result. Without shards
+// every function below calls the matching ems_* function directly.
+
+/// Starts the shard threads, each pinned to a core.
+/// @note The EMS state must have been initialized in RESERVE_MODE_OWNER.
+/// @param num_shards Number of shard threads, 0 to run every request on its session thread.
+/// @param num_sessions Number of session threads, each with its own id below num_sessions.
+/// @return 0 if the shards were started successfully, 1 otherwise.
+int shard_init(size_t num_shards, size_t num_sessions);
+
+/// Stops the shard threads once their queues are empty.
+/// @note No request may be in progress or start afterwards.
+void shard_terminate(void);
+
+/// Runs ems_create on the shard owning the event.
+/// @param session Id of the calling session thread.
+int shard_create(size_t session, unsigned int event_id, size_t num_rows, size_t num_cols);
+
+/// Runs ems_reserve on the shard owning the event.
+/// @param session Id of the calling session thread.
+int shard_reserve(size_t session, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys);
+
+/// Runs ems_reserve_best on the shard owning the event.
+/// @param session Id of the calling session thread.
+int shard_reserve_best(size_t session, unsigned int event_id, size_t num_seats, size_t min_row, size_t max_row,
+                       size_t* row, size_t* col);
+
+/// Runs ems_transaction on the shard owning its events.
+/// @note Events owned by several shards are reserved by the session itself while every one of those shards is
+/// parked, the shards being parked in ascending order so two sessions never wait on each other.
+/// @param session Id of the calling session thread.
+int shard_transaction(size_t session, size_t num_events, unsigned int* event_ids, size_t* num_seats, size_t* xs,
+                      size_t* ys);
+
+/// Runs ems_cancel on the shard owning the event.
+/// @param session Id of the calling session thread.
+int shard_cancel(size_t session, unsigned int event_id, unsigned int reservation_id);
+
+/// Runs ems_delete on the shard owning the event.
+/// @param session Id of the calling session thread.
+int shard_delete(size_t session, unsigned int event_id);
+
+#endif  // SERVER_SHARD_H
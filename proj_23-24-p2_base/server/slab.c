@@ -0,0 +1,198 @@
+#include "slab.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct SlabChunk {
+  struct SlabChunk* next;
+  size_t next_object;  // Index of the next never used object, past objects_per_chunk once the chunk is used up
+};
+
+struct LargeBlock {
+  struct LargeBlock* prev;
+  struct LargeBlock* next;
+};
+
+/// Rounds a size up to the maximum fundamental alignment.
+static size_t align_up(size_t size) {
+  return (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+}
+
+/// Gets the object with the given index in a chunk.
+static void* chunk_object(struct Slab* slab, struct SlabChunk* chunk, size_t index) {
+  return (char*)chunk + align_up(sizeof(struct SlabChunk)) + index * slab->object_size;
+}
+
+int slab_init(struct Slab* slab, size_t object_size) {
+  slab->object_size = align_up(object_size < sizeof(void*) ? sizeof(void*) : object_size);
+  slab->objects_per_chunk = (SLAB_CHUNK_SIZE - align_up(sizeof(struct SlabChunk))) / slab->object_size;
+  if (slab->objects_per_chunk == 0) slab->objects_per_chunk = 1;
+  slab->free_objects = (struct SlabFreeList){NULL, 0};
+  slab->chunks = NULL;
+
+  return pthread_mutex_init(&slab->mutex, NULL) != 0;
+}
+
+/// Takes the last freed object of a slab.
+/// @return Pointer to the object, NULL if none is free.
+static void* pop_free(struct Slab* slab) {
+  struct SlabFreeList old, new;
+
+  // The halves may be read from different lists, which only makes the exchange fail
+  old.tag = __atomic_load_n(&slab->free_objects.tag, __ATOMIC_ACQUIRE);
+  old.head = __atomic_load_n(&slab->free_objects.head, __ATOMIC_ACQUIRE);
+  do {
+    if (old.head == NULL) return NULL;
+
+    // Objects are never returned to the system, so the word is readable even if another thread took the object,
+    // and the tag then makes the exchange fail
+    new.head = __atomic_load_n((void**)old.head, __ATOMIC_RELAXED);
+    new.tag = old.tag;
+  } while (!__atomic_compare_exchange(&slab->free_objects, &old, &new, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+  return old.head;
+}
+
+/// Carves a never used object out of the first chunk of a slab, adding a chunk once it is used up.
+/// @return Pointer to the object, NULL on failure.
+static void* carve(struct Slab* slab) {
+  while (1) {
+    struct SlabChunk* chunk = __atomic_load_n(&slab->chunks, __ATOMIC_ACQUIRE);
+    if (chunk != NULL) {
+      size_t index = __atomic_fetch_add(&chunk->next_object, 1, __ATOMIC_RELAXED);
+      if (index < slab->objects_per_chunk) return chunk_object(slab, chunk, index);
+    }
+
+    // Only the first thread to find the chunk used up adds the next one
+    pthread_mutex_lock(&slab->mutex);
+    if (slab->chunks == chunk) {
+      size_t size = align_up(sizeof(struct SlabChunk)) + slab->objects_per_chunk * slab->object_size;
+      struct SlabChunk* added = malloc(size);
+      if (added == NULL) {
+        pthread_mutex_unlock(&slab->mutex);
+        return NULL;
+      }
+
+      added->next = chunk;
+      added->next_object = 0;
+      __atomic_store_n(&slab->chunks, added, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&slab->mutex);
+  }
+}
+
+void* slab_alloc(struct Slab* slab) {
+  void* object = pop_free(slab);
+  return object != NULL ? object : carve(slab);
+}
+
+void slab_free(struct Slab* slab, void* object) {
+  struct SlabFreeList old, new = {object, 0};
+
+  old.tag = __atomic_load_n(&slab->free_objects.tag, __ATOMIC_RELAXED);
+  old.head = __atomic_load_n(&slab->free_objects.head, __ATOMIC_RELAXED);
+  do {
+    __atomic_store_n((void**)object, old.head, __ATOMIC_RELAXED);
+    new.tag = old.tag + 1;
+  } while (!__atomic_compare_exchange(&slab->free_objects, &old, &new, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void slab_destroy(struct Slab* slab) {
+  while (slab->chunks) {
+    struct SlabChunk* temp = slab->chunks;
+    slab->chunks = temp->next;
+    free(temp);
+  }
+
+  slab->free_objects = (struct SlabFreeList){NULL, 0};
+  pthread_mutex_destroy(&slab->mutex);
+}
+
+/// Gets the size class of a seat block.
+/// @param size Size of the block in bytes.
+/// @return Index of the class, SEAT_CLASSES if the block is too large for every class.
+static size_t seat_class(size_t size) {
+  size_t class = 0;
+  while (class < SEAT_CLASSES && ((size_t)1 << (class + SEAT_CLASS_MIN_SHIFT)) < size) {
+    class++;
+  }
+  return class;
+}
+
+int seat_pool_init(struct SeatPool* pool) {
+  for (size_t i = 0; i < SEAT_CLASSES; i++) {
+    if (slab_init(&pool->classes[i], (size_t)1 << (i + SEAT_CLASS_MIN_SHIFT)) != 0) {
+      while (i-- > 0) slab_destroy(&pool->classes[i]);
+      return 1;
+    }
+  }
+
+  pool->large = NULL;
+  if (pthread_mutex_init(&pool->large_mutex, NULL) != 0) {
+    for (size_t i = 0; i < SEAT_CLASSES; i++) slab_destroy(&pool->classes[i]);
+    return 1;
+  }
+
+  return 0;
+}
+
+void* seat_alloc(struct SeatPool* pool, size_t size) {
+  size_t class = seat_class(size);
+
+  if (class < SEAT_CLASSES) {
+    void* block = slab_alloc(&pool->classes[class]);
+    if (block != NULL) memset(block, 0, size);
+    return block;
+  }
+
+  struct LargeBlock* large = calloc(1, align_up(sizeof(struct LargeBlock)) + size);
+  if (large == NULL) return NULL;
+
+  pthread_mutex_lock(&pool->large_mutex);
+  large->prev = NULL;
+  large->next = pool->large;
+  if (pool->large != NULL) pool->large->prev = large;
+  pool->large = large;
+  pthread_mutex_unlock(&pool->large_mutex);
+
+  return (char*)large + align_up(sizeof(struct LargeBlock));
+}
+
+void seat_free(struct SeatPool* pool, void* block, size_t size) {
+  if (block == NULL) return;
+
+  size_t class = seat_class(size);
+
+  if (class < SEAT_CLASSES) {
+    slab_free(&pool->classes[class], block);
+    return;
+  }
+
+  struct LargeBlock* large = (struct LargeBlock*)((char*)block - align_up(sizeof(struct LargeBlock)));
+
+  pthread_mutex_lock(&pool->large_mutex);
+  if (large->prev != NULL) {
+    large->prev->next = large->next;
+  } else {
+    pool->large = large->next;
+  }
+  if (large->next != NULL) large->next->prev = large->prev;
+  pthread_mutex_unlock(&pool->large_mutex);
+
+  free(large);
+}
+
+void seat_pool_destroy(struct SeatPool* pool) {
+  for (size_t i = 0; i < SEAT_CLASSES; i++) {
+    slab_destroy(&pool->classes[i]);
+  }
+
+  while (pool->large) {
+    struct LargeBlock* temp = pool->large;
+    pool->large = temp->next;
+    free(temp);
+  }
+
+  pthread_mutex_destroy(&pool->large_mutex);
+}
@@ -0,0 +1,81 @@
+#ifndef SERVER_SLAB_H
+#define SERVER_SLAB_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define SLAB_CHUNK_SIZE (1u << 20)  // Bytes requested from malloc per chunk
+#define SEAT_CLASS_MIN_SHIFT 6       // Smallest seat block is 64 bytes
+#define SEAT_CLASSES 15              // Largest pooled seat block is 1 MiB
+
+struct SlabChunk;
+struct LargeBlock;
+
+// Free list of a slab, replaced whole with a double-word compare-and-swap. The tag changes on every push, so a
+// pop that read an object which was taken and freed again in the meantime fails instead of corrupting the list.
+struct SlabFreeList {
+  void* head;  // Last freed object, its first word holds the one freed before it
+  size_t tag;
+} __attribute__((aligned(2 * sizeof(void*))));
+
+// Allocator of fixed-size objects carved out of large chunks. Freed objects are kept for reuse and the
+// chunks are only returned to the system by slab_destroy. Allocating and freeing take no lock, only adding a chunk
+// does, once every SLAB_CHUNK_SIZE bytes.
+struct Slab {
+  size_t object_size;                // Size of each object, rounded up to the maximum alignment
+  size_t objects_per_chunk;          // Number of objects carved out of each chunk
+  struct SlabFreeList free_objects;  // Free list threaded through the freed objects
+  struct SlabChunk* chunks;          // Every chunk allocated by the slab, the one objects are carved from first
+  pthread_mutex_t mutex;             // Mutex to serialize adding chunks
+};
+
+// Allocator of zeroed seat blocks, served by one slab per power-of-two size class. Blocks larger than the
+// largest class are allocated individually.
+struct SeatPool {
+  struct Slab classes[SEAT_CLASSES];
+  struct LargeBlock* large;     // Blocks larger than the largest class
+  pthread_mutex_t large_mutex;  // Mutex to protect large
+};
+
+/// Initializes a slab.
+/// @param slab Slab to be initialized.
+/// @param object_size Size of the objects.
+/// @return 0 if the slab was initialized successfully, 1 otherwise.
+int slab_init(struct Slab* slab, size_t object_size);
+
+/// Allocates an object from a slab.
+/// @param slab Slab to allocate from.
+/// @return Pointer to the object, NULL on failure.
+void* slab_alloc(struct Slab* slab);
+
+/// Returns an object to its slab.
+/// @param slab Slab the object was allocated from.
+/// @param object Object to be freed.
+void slab_free(struct Slab* slab, void* object);
+
+/// Frees every chunk of a slab at once, including objects still in use.
+/// @param slab Slab to be destroyed.
+void slab_destroy(struct Slab* slab);
+
+/// Initializes a seat pool.
+/// @param pool Pool to be initialized.
+/// @return 0 if the pool was initialized successfully, 1 otherwise.
+int seat_pool_init(struct SeatPool* pool);
+
+/// Allocates a zeroed seat block.
+/// @param pool Pool to allocate from.
+/// @param size Size of the block in bytes.
+/// @return Pointer to the block, NULL on failure.
+void* seat_alloc(struct SeatPool* pool, size_t size);
+
+/// Returns a seat block to its pool.
+/// @param pool Pool the block was allocated from.
+/// @param block Block to be freed.
+/// @param size Size the block was allocated with.
+void seat_free(struct SeatPool* pool, void* block, size_t size);
+
+/// Frees every block of a pool at once, including blocks still in use.
+/// @param pool Pool to be destroyed.
+void seat_pool_destroy(struct SeatPool* pool);
+
+#endif  // SERVER_SLAB_H
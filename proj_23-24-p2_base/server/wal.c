@@ -0,0 +1,263 @@
+#include "wal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/io.h"
+
+#define WAL_HEADER_SIZE 9           // uint32_t payload size, unsigned char type, uint32_t checksum
+#define WAL_BATCH_SIZE (1u << 20)  // Pending bytes that end a WAL_SYNC_INTERVAL batch early
+
+// Appended records are copied to buffer, which the flusher swaps with spare before writing it out
+static struct {
+  int fd;
+  enum WalSync sync;
+  unsigned int interval_us;
+  pthread_t flusher;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t pending;  // Signaled when the flusher has records to write
+  pthread_cond_t durable;  // Signaled when a batch is durable
+  char* buffer;
+  size_t size;
+  size_t records;  // Records in buffer
+  size_t capacity;
+  char* spare;
+  size_t spare_capacity;
+  uint64_t appended_lsn;  // Offset past the last appended record
+  uint64_t durable_lsn;   // Offset past the last durable record
+  struct timespec batch_start;  // When the last batch was taken to be written
+  int failed;                   // Set once a batch could not be written
+  int stop;
+} wal = {.fd = -1, .mutex = PTHREAD_MUTEX_INITIALIZER, .pending = PTHREAD_COND_INITIALIZER,
+         .durable = PTHREAD_COND_INITIALIZER};
+
+/// Computes the checksum of a record, a 32-bit FNV-1a hash of its type and payload.
+static uint32_t record_checksum(unsigned char type, const char* payload, size_t size) {
+  uint32_t hash = 2166136261u;
+  hash = (hash ^ type) * 16777619u;
+  for (size_t i = 0; i < size; i++) hash = (hash ^ (unsigned char)payload[i]) * 16777619u;
+  return hash;
+}
+
+int wal_replay(const char* path, uint64_t start, wal_apply_fn apply, void* context) {
+  int fd = open(path, O_RDWR);
+  if (fd == -1) return errno == ENOENT && start == 0 ? 0 : 1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < start) {
+    fprintf(stderr, "Write-ahead log is shorter than the checkpoint\n");
+    close(fd);
+    return 1;
+  }
+
+  // Only the records after start are read, the ones before are covered by the checkpoint
+  size_t length = (size_t)((uint64_t)st.st_size - start);
+  char* log = malloc(length + 1);
+  if (log == NULL || lseek(fd, (off_t)start, SEEK_SET) == -1 || read_all(fd, log, length) != 0) {
+    fprintf(stderr, "Error reading write-ahead log\n");
+    free(log);
+    close(fd);
+    return 1;
+  }
+
+  size_t offset = 0;
+  while (length - offset >= WAL_HEADER_SIZE) {
+    uint32_t size, checksum;
+    unsigned char type = (unsigned char)log[offset + sizeof(uint32_t)];
+    memcpy(&size, log + offset, sizeof(uint32_t));
+    memcpy(&checksum, log + offset + sizeof(uint32_t) + 1, sizeof(uint32_t));
+
+    const char* payload = log + offset + WAL_HEADER_SIZE;
+    if (length - offset - WAL_HEADER_SIZE < size || record_checksum(type, payload, size) != checksum) break;
+
+    apply(context, type, payload, size);
+    offset += WAL_HEADER_SIZE + size;
+  }
+
+  // Records after a torn one were never acknowledged, so they are dropped for good
+  int result = 0;
+  if (offset < length) {
+    fprintf(stderr, "Truncating write-ahead log after %llu bytes\n", (unsigned long long)(start + offset));
+    result = ftruncate(fd, (off_t)(start + offset)) != 0;
+  }
+
+  free(log);
+  close(fd);
+  return result;
+}
+
+/// Writes out batches of appended records until the log is closed.
+static void* flush_loop(void* arg) {
+  (void)arg;
+  pthread_mutex_lock(&wal.mutex);
+
+  while (1) {
+    if (wal.size == 0) {
+      if (wal.stop) break;
+      pthread_cond_wait(&wal.pending, &wal.mutex);
+      continue;
+    }
+
+    // Once a second session appends, the batch fills until an interval after the previous one, so they share a
+    // sync. A lone record is written at once, and a batch whose previous sync took the interval is not held back.
+    if (wal.sync != WAL_SYNC_EVERY && wal.records > 1) {
+      struct timespec deadline = wal.batch_start;
+      deadline.tv_nsec += (long)wal.interval_us * 1000;
+      deadline.tv_sec += deadline.tv_nsec / 1000000000;
+      deadline.tv_nsec %= 1000000000;
+
+      while (!wal.stop && wal.size < WAL_BATCH_SIZE &&
+             pthread_cond_timedwait(&wal.pending, &wal.mutex, &deadline) != ETIMEDOUT)
+        ;
+    }
+
+    char* batch = wal.buffer;
+    size_t batch_size = wal.size;
+    size_t batch_capacity = wal.capacity;
+    uint64_t batch_lsn = wal.appended_lsn;
+    wal.buffer = wal.spare;
+    wal.capacity = wal.spare_capacity;
+    wal.size = 0;
+    wal.records = 0;
+    clock_gettime(CLOCK_REALTIME, &wal.batch_start);
+    pthread_mutex_unlock(&wal.mutex);
+
+    int failed = write_all(wal.fd, batch, batch_size) != 0 || (wal.sync != WAL_SYNC_NONE && fdatasync(wal.fd) != 0);
+
+    pthread_mutex_lock(&wal.mutex);
+    wal.spare = batch;
+    wal.spare_capacity = batch_capacity;
+    if (failed) {
+      fprintf(stderr, "Error writing write-ahead log\n");
+      wal.failed = 1;
+    }
+    wal.durable_lsn = batch_lsn;
+    pthread_cond_broadcast(&wal.durable);
+  }
+
+  pthread_mutex_unlock(&wal.mutex);
+  return NULL;
+}
+
+int wal_open(const char* path, enum WalSync sync, unsigned int interval_us) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+  if (fd == -1) {
+    fprintf(stderr, "Error opening write-ahead log\n");
+    return 1;
+  }
+
+  off_t end = lseek(fd, 0, SEEK_END);
+  if (end == -1) {
+    close(fd);
+    return 1;
+  }
+
+  wal.fd = fd;
+  wal.sync = sync;
+  wal.interval_us = interval_us;
+  wal.appended_lsn = (uint64_t)end;
+  wal.durable_lsn = (uint64_t)end;
+  wal.failed = 0;
+  wal.stop = 0;
+
+  if (pthread_create(&wal.flusher, NULL, flush_loop, NULL) != 0) {
+    close(fd);
+    wal.fd = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+uint64_t wal_append(unsigned char type, const void* payload, size_t size) {
+  if (wal.fd == -1) return 0;
+
+  uint32_t size32 = (uint32_t)size;
+  uint32_t checksum = record_checksum(type, payload, size);
+
+  pthread_mutex_lock(&wal.mutex);
+
+  if (wal.size + WAL_HEADER_SIZE + size > wal.capacity) {
+    size_t capacity = wal.capacity == 0 ? 4096 : wal.capacity;
+    while (wal.size + WAL_HEADER_SIZE + size > capacity) capacity *= 2;
+
+    char* grown = realloc(wal.buffer, capacity);
+    if (grown == NULL) {
+      pthread_mutex_unlock(&wal.mutex);
+      fprintf(stderr, "Error allocating memory for write-ahead log\n");
+      return 0;
+    }
+    wal.buffer = grown;
+    wal.capacity = capacity;
+  }
+
+  char* record = wal.buffer + wal.size;
+  memcpy(record, &size32, sizeof(uint32_t));
+  record[sizeof(uint32_t)] = (char)type;
+  memcpy(record + sizeof(uint32_t) + 1, &checksum, sizeof(uint32_t));
+  memcpy(record + WAL_HEADER_SIZE, payload, size);
+
+  // The flusher only waits for a signal when it had nothing to write, or to end a full batch early
+  if (wal.size == 0 || wal.sync == WAL_SYNC_EVERY || wal.size + WAL_HEADER_SIZE + size >= WAL_BATCH_SIZE) {
+    pthread_cond_signal(&wal.pending);
+  }
+
+  wal.size += WAL_HEADER_SIZE + size;
+  wal.records++;
+  wal.appended_lsn += WAL_HEADER_SIZE + size;
+  uint64_t lsn = wal.appended_lsn;
+
+  pthread_mutex_unlock(&wal.mutex);
+  return lsn;
+}
+
+uint64_t wal_position(void) {
+  if (wal.fd == -1) return 0;
+
+  pthread_mutex_lock(&wal.mutex);
+  uint64_t lsn = wal.appended_lsn;
+  pthread_mutex_unlock(&wal.mutex);
+  return lsn;
+}
+
+int wal_wait(uint64_t lsn) {
+  if (wal.fd == -1 || wal.sync == WAL_SYNC_NONE || lsn == 0) return 0;
+
+  pthread_mutex_lock(&wal.mutex);
+  while (wal.durable_lsn < lsn) pthread_cond_wait(&wal.durable, &wal.mutex);
+  int failed = wal.failed;
+  pthread_mutex_unlock(&wal.mutex);
+
+  return failed;
+}
+
+void wal_close(void) {
+  if (wal.fd == -1) return;
+
+  pthread_mutex_lock(&wal.mutex);
+  wal.stop = 1;
+  pthread_cond_signal(&wal.pending);
+  pthread_mutex_unlock(&wal.mutex);
+
+  pthread_join(wal.flusher, NULL);
+  if (wal.sync != WAL_SYNC_NONE) fdatasync(wal.fd);
+  close(wal.fd);
+  wal.fd = -1;
+
+  free(wal.buffer);
+  free(wal.spare);
+  wal.buffer = NULL;
+  wal.spare = NULL;
+  wal.size = 0;
+  wal.records = 0;
+  wal.capacity = 0;
+  wal.spare_capacity = 0;
+}
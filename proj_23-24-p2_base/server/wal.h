@@ -0,0 +1,58 @@
+#ifndef SERVER_WAL_H
+#define SERVER_WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// When appended records are made durable.
+enum WalSync {
+  WAL_SYNC_NONE,      // Records are written in the background and never synced, appends are not waited for.
+  WAL_SYNC_INTERVAL,  // Records are written and synced at once, in a batch at most every interval once they queue.
+  WAL_SYNC_EVERY,     // Records are written and synced as soon as the previous batch is durable.
+};
+
+/// Applies a replayed record, see wal_replay.
+/// @param context Context given to wal_replay.
+/// @param type Type of the record.
+/// @param payload Payload of the record.
+/// @param size Size of the payload.
+typedef void (*wal_apply_fn)(void* context, unsigned char type, const char* payload, size_t size);
+
+/// Replays every complete record of a log from a given offset, in order.
+/// @note A torn or corrupt record ends the log, and is cut off with everything after it.
+/// @param path Path of the log. A missing log has no records.
+/// @param start Offset of the first record to replay, a log sequence number or 0.
+/// @param apply Function called for each record.
+/// @param context First argument of apply.
+/// @return 0 if the log was replayed successfully, 1 otherwise.
+int wal_replay(const char* path, uint64_t start, wal_apply_fn apply, void* context);
+
+/// Opens a log for appending and starts its flusher thread.
+/// @param path Path of the log, created if missing.
+/// @param sync When appended records are made durable.
+/// @param interval_us Interval between batches in microseconds, for WAL_SYNC_INTERVAL.
+/// @return 0 if the log was opened successfully, 1 otherwise.
+int wal_open(const char* path, enum WalSync sync, unsigned int interval_us);
+
+/// Appends a record to the log.
+/// @note Records are written in the order they are appended, so appending inside the critical section of a
+/// change orders the log like the changes themselves.
+/// @param type Type of the record.
+/// @param payload Payload of the record.
+/// @param size Size of the payload.
+/// @return Log sequence number to wait for with wal_wait, 0 if the log is not open.
+uint64_t wal_append(unsigned char type, const void* payload, size_t size);
+
+/// Gets the position of the log, the sequence number of the last appended record.
+/// @return Offset past the last appended record, 0 if the log is not open.
+uint64_t wal_position(void);
+
+/// Waits until a record is durable according to the sync policy.
+/// @param lsn Log sequence number returned by wal_append.
+/// @return 0 if the record is durable, 1 if the log could not be written.
+int wal_wait(uint64_t lsn);
+
+/// Writes every appended record, stops the flusher thread and closes the log.
+void wal_close(void);
+
+#endif  // SERVER_WAL_H
@@ -0,0 +1,294 @@
+// Test of pipelining and batching: runs the same .jobs file with the client waiting for each response and with
+// requests pipelined 8 deep and batched, each against a fresh server, and checks that the two print the same .out
+// file and report the same outcome for every command. The file has commands that fail inside batches, SHOWs and
+// LISTs between them, and a SHOW of a missing event that ends the session, after which every request fails to be
+// sent, a BATCH included.
+// Usage: tests/pipeline [fifo|socket|shm]
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/io.h"
+
+#define TEST_DEADLINE_S 30  // Time both runs have to finish
+#define GRID_ROWS 20        // Rows of the event most reservations are made in
+#define GRID_COLS 20
+#define GRID_RESERVATIONS 300  // Reservations made in it, more than a BATCH carries
+#define RETRY_EVERY 7          // Reservations that retry the seat of the one before, and fail, one in this many
+
+static char server_path[64];
+static char req_path[64];
+static char resp_path[64];
+static char jobs_path[64];
+static char out_path[64];
+static char stdout_path[64];
+static char stderr_path[64];
+static pid_t server_pid = -1;
+
+static void on_deadline(int signal) {
+  (void)signal;
+  const char message[] = "FAIL: the client did not finish in time\n";
+  if (write(STDERR_FILENO, message, sizeof(message) - 1) == -1) _exit(1);
+  if (server_pid != -1) kill(server_pid, SIGKILL);
+  _exit(1);
+}
+
+/// Writes the .jobs file both runs use.
+/// @return 0 if the file was written successfully, 1 otherwise.
+static int write_jobs(void) {
+  FILE *file = fopen(jobs_path, "w");
+  if (file == NULL) return 1;
+
+  // Commands of every kind, failing and not, so a BATCH is answered with statuses of both
+  fprintf(file,
+          "# Setup\n"
+          "CREATE 1 4 6\n"
+          "CREATE 2 3 3\n"
+          "CREATE 1 5 5\n"
+          "RESERVE 1 [(1,1) (1,2)]\n"
+          "RESERVE 1 [(1,2) (1,3)]\n"
+          "RESERVE 3 [(1,1)]\n"
+          "RESERVE 2 [(2,2)]\n"
+          "SHOW 1\n"
+          "RESERVE_BEST 1 3\n"
+          "RESERVE_BEST 2 4\n"
+          "TRANSACTION 1 [(2,1)] 2 [(1,1)]\n"
+          "TRANSACTION 1 [(2,2)] 2 [(1,1)]\n"
+          "SHOW 2\n"
+          "LIST\n"
+          "CANCEL 1 1\n"
+          "CANCEL 1 99\n"
+          "SHOW 1\n"
+          "DELETE 2\n"
+          "DELETE 2\n"
+          "LIST\n");
+
+  // More reservations than a BATCH carries, with SHOWs keeping several requests in flight
+  fprintf(file, "CREATE 10 %d %d\n", GRID_ROWS, GRID_COLS);
+  for (int i = 0, seat = 0; i < GRID_RESERVATIONS; i++) {
+    int retry = i % RETRY_EVERY == RETRY_EVERY - 1;
+    if (!retry) seat++;
+    fprintf(file, "RESERVE 10 [(%d,%d)]\n", (seat - 1) / GRID_COLS + 1, (seat - 1) % GRID_COLS + 1);
+    if (i % 50 == 49) fprintf(file, "SHOW 10\n");
+  }
+  fprintf(file, "RESERVE_BEST 10 5\nSHOW 10\nLIST\n");
+
+  // The failed SHOW ends the session, with more requests after it than are in flight, then a batch of commands
+  fprintf(file, "SHOW 9\n");
+  for (int i = 0; i < 10; i++) fprintf(file, "SHOW 1\n");
+  fprintf(file, "LIST\nCREATE 5 1 1\nRESERVE 1 [(4,4)]\nDELETE 1\n");
+
+  return fclose(file) != 0;
+}
+
+/// Starts the server with session threads and waits for its pipe, socket or segment name to appear.
+/// @return 0 if the server was started successfully, 1 otherwise.
+static int start_server(const char *transport_name) {
+  unlink(server_path);
+  server_pid = fork();
+  if (server_pid == -1) return 1;
+
+  if (server_pid == 0) {
+    // What the server logs of every request, and of the commands that fail, is dropped
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd != -1) {
+      dup2(null_fd, STDOUT_FILENO);
+      dup2(null_fd, STDERR_FILENO);
+    }
+    execl("server/ems", "ems", "-t", transport_name, server_path, "0", (char *)NULL);
+    perror("Error starting server/ems");
+    _exit(1);
+  }
+
+  struct timespec pause = {0, 10 * 1000 * 1000};
+  for (int i = 0; i < 500; i++) {
+    if (access(server_path, F_OK) == 0) return 0;
+    nanosleep(&pause, NULL);
+  }
+  return 1;
+}
+
+/// Reads a whole file.
+/// @return Contents of the file, NUL-terminated, to be freed, NULL on failure.
+static char *read_file(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return NULL;
+
+  struct stat st;
+  char *contents = NULL;
+  if (fstat(fd, &st) == 0 && (contents = malloc((size_t)st.st_size + 1)) != NULL) {
+    if (read_all(fd, contents, (size_t)st.st_size) != 0) {
+      free(contents);
+      contents = NULL;
+    } else {
+      contents[st.st_size] = '\0';
+    }
+  }
+
+  close(fd);
+  return contents;
+}
+
+/// Keeps the lines of a text that start with a prefix, dropping the rest in place.
+static void keep_lines(char *text, const char *prefix) {
+  size_t length = strlen(prefix);
+  char *kept = text;
+  for (char *line = text; *line != '\0';) {
+    char *end = strchr(line, '\n');
+    end = end != NULL ? end + 1 : line + strlen(line);
+    if (strncmp(line, prefix, length) == 0) {
+      memmove(kept, line, (size_t)(end - line));
+      kept += end - line;
+    }
+    line = end;
+  }
+  *kept = '\0';
+}
+
+/// What a run of the client printed.
+struct Run {
+  char *out;       // The .out file
+  char *reserved;  // Seats chosen by RESERVE_BEST, from stdout
+  char *failed;    // The commands reported failed, from stderr
+  char *errors;    // Everything on stderr
+};
+
+static void free_run(struct Run *run) {
+  free(run->out);
+  free(run->reserved);
+  free(run->failed);
+  free(run->errors);
+}
+
+/// Runs the client on the .jobs file against a fresh server.
+/// @param options Options of the client after the transport, for the pipeline and batching.
+/// @param run Set to what the client printed.
+/// @return 0 if the client ran the file, 1 otherwise.
+static int run_client(const char *transport_name, char *const options[], struct Run *run) {
+  *run = (struct Run){NULL};
+  if (start_server(transport_name) != 0) {
+    fprintf(stderr, "FAIL: the server did not start\n");
+    return 1;
+  }
+
+  pid_t client_pid = fork();
+  if (client_pid == 0) {
+    int stdout_fd = open(stdout_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int stderr_fd = open(stderr_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (stdout_fd == -1 || stderr_fd == -1 || dup2(stdout_fd, STDOUT_FILENO) == -1 ||
+        dup2(stderr_fd, STDERR_FILENO) == -1) {
+      _exit(1);
+    }
+
+    char *argv[16] = {"client", "-t", (char *)transport_name};
+    int argc = 3;
+    for (int i = 0; options[i] != NULL; i++) argv[argc++] = options[i];
+    argv[argc++] = req_path;
+    argv[argc++] = resp_path;
+    argv[argc++] = server_path;
+    argv[argc++] = jobs_path;
+    argv[argc] = NULL;
+    execv("client/client", argv);
+    _exit(1);
+  }
+
+  int status;
+  int failed = client_pid == -1 || waitpid(client_pid, &status, 0) == -1 || !WIFEXITED(status) ||
+               WEXITSTATUS(status) != 0;
+
+  kill(server_pid, SIGTERM);
+  waitpid(server_pid, NULL, 0);
+  server_pid = -1;
+  unlink(server_path);
+
+  if (!failed) {
+    run->out = read_file(out_path);
+    run->reserved = read_file(stdout_path);
+    run->errors = read_file(stderr_path);
+    run->failed = run->errors != NULL ? strdup(run->errors) : NULL;
+    failed = run->out == NULL || run->reserved == NULL || run->errors == NULL || run->failed == NULL;
+  }
+  if (!failed) {
+    keep_lines(run->reserved, "Reserved ");
+    keep_lines(run->failed, "Failed to ");
+  }
+
+  unlink(out_path);
+  unlink(stdout_path);
+  unlink(stderr_path);
+  return failed;
+}
+
+/// Checks that a part of what the two runs printed is the same.
+/// @return 0 if it is, 1 otherwise.
+static int check_same(const char *name, const char *expected, const char *actual) {
+  if (strcmp(expected, actual) == 0) return 0;
+
+  size_t i = 0;
+  while (expected[i] == actual[i]) i++;
+  fprintf(stderr, "FAIL: the %s differ from byte %zu, waiting for each response:\n%.200s\npipelined:\n%.200s\n", name,
+          i, expected + i, actual + i);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  const char *transport_name = argc > 1 ? argv[1] : "fifo";
+  if (strcmp(transport_name, "fifo") != 0 && strcmp(transport_name, "socket") != 0 &&
+      strcmp(transport_name, "shm") != 0) {
+    fprintf(stderr, "Usage: %s [fifo|socket|shm]\n", argv[0]);
+    return 1;
+  }
+
+  snprintf(server_path, sizeof(server_path), "/tmp/ems-test-%d", getpid());
+  snprintf(req_path, sizeof(req_path), "/tmp/ems-test-req-%d", getpid());
+  snprintf(resp_path, sizeof(resp_path), "/tmp/ems-test-resp-%d", getpid());
+  snprintf(jobs_path, sizeof(jobs_path), "/tmp/ems-test-%d.jobs", getpid());
+  snprintf(out_path, sizeof(out_path), "/tmp/ems-test-%d.out", getpid());
+  snprintf(stdout_path, sizeof(stdout_path), "/tmp/ems-test-%d.stdout", getpid());
+  snprintf(stderr_path, sizeof(stderr_path), "/tmp/ems-test-%d.stderr", getpid());
+
+  signal(SIGALRM, on_deadline);
+  alarm(TEST_DEADLINE_S);
+
+  if (write_jobs() != 0) {
+    fprintf(stderr, "FAIL: the .jobs file could not be written\n");
+    return 1;
+  }
+
+  char *waiting_options[] = {"-p", "1", NULL};
+  char *pipelined_options[] = {"-p", "8", "-b", NULL};
+  struct Run waiting = {NULL}, pipelined = {NULL};
+  int failed = run_client(transport_name, waiting_options, &waiting) ||
+               run_client(transport_name, pipelined_options, &pipelined);
+  alarm(0);
+  unlink(jobs_path);
+
+  if (failed) {
+    fprintf(stderr, "FAIL: the client did not run the .jobs file\n");
+  } else {
+    failed = check_same(".out files", waiting.out, pipelined.out) ||
+             check_same("seats reserved", waiting.reserved, pipelined.reserved) ||
+             check_same("commands failed", waiting.failed, pipelined.failed);
+  }
+
+  // Requests sent after the session ended must have failed on their own, and the pipelined BATCH with them
+  if (!failed && (strstr(waiting.errors, "Error writing to request pipe (ems_show)") == NULL ||
+                  strstr(pipelined.errors, "Error writing to request pipe (ems_batch)") == NULL)) {
+    fprintf(stderr, "FAIL: no request was sent after the session ended\n");
+    failed = 1;
+  }
+
+  if (!failed) {
+    printf("PASS: pipeline %s, the same .out and outcomes with -p 1 and with -p 8 -b\n", transport_name);
+  }
+  free_run(&waiting);
+  free_run(&pipelined);
+  return failed;
+}
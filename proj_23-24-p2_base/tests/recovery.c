@@ -0,0 +1,310 @@
+// Test of recovery: changes events through a server keeping a write-ahead log and a checkpoint, and checks that what
+// SHOW and LIST print is the same after a restart from a SIGTERM, after a SIGKILL that leaves changes only in the
+// log, and after a record torn at the end of the log. Checkpoints that were corrupted must keep the server from
+// starting.
+// Usage: tests/recovery
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client/api.h"
+#include "common/io.h"
+#include "server/checkpoint.h"
+
+#define TEST_DEADLINE_S 30  // Time the whole test has to finish
+
+static char server_path[64];
+static char req_path[64];
+static char resp_path[64];
+static char wal_path[64];
+static char checkpoint_path[64];
+static char output_path[64];
+static pid_t server_pid = -1;
+static unsigned int num_events;  // Events are numbered from 1 up to this id, a failed SHOW ends the session
+
+static void on_deadline(int signal) {
+  (void)signal;
+  const char message[] = "FAIL: recovery did not finish in time\n";
+  if (write(STDERR_FILENO, message, sizeof(message) - 1) == -1) _exit(1);
+  if (server_pid != -1) kill(server_pid, SIGKILL);
+  _exit(1);
+}
+
+/// Starts the server with the log and the checkpoint, and waits for its pipe to appear or for it to exit.
+/// @param quiet Whether what the server prints on stderr is dropped, for starts expected to complain.
+/// @return 0 if the server was started successfully, 1 otherwise, with server_pid reset if it exited.
+static int start_server(int quiet) {
+  unlink(server_path);
+  server_pid = fork();
+  if (server_pid == -1) return 1;
+
+  if (server_pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (quiet && null_fd != -1) dup2(null_fd, STDERR_FILENO);
+    execl("server/ems", "ems", "-w", wal_path, "-s", "every", "-c", checkpoint_path, "-p", "0", server_path, "0",
+          (char *)NULL);
+    perror("Error starting server/ems");
+    _exit(1);
+  }
+
+  struct timespec pause = {0, 10 * 1000 * 1000};
+  for (int i = 0; i < 500; i++) {
+    if (access(server_path, F_OK) == 0) return 0;
+    if (waitpid(server_pid, NULL, WNOHANG) == server_pid) {
+      server_pid = -1;
+      return 1;
+    }
+    nanosleep(&pause, NULL);
+  }
+  return 1;
+}
+
+/// Stops the server with a signal and waits for it to exit.
+static void stop_server(int signal) {
+  kill(server_pid, signal);
+  waitpid(server_pid, NULL, 0);
+  server_pid = -1;
+  unlink(server_path);
+}
+
+/// Makes a round of changes of every kind the log records, in a session of its own.
+/// @param round Round of changes, 0 or 1.
+/// @return 0 if every change was made successfully, 1 otherwise.
+static int make_changes(int round) {
+  if (ems_setup(req_path, resp_path, server_path, TRANSPORT_FIFO) != 0) return 1;
+
+  int failed = 0;
+  if (round == 0) {
+    size_t xs[] = {1, 1, 2, 3, 3, 4}, ys[] = {1, 2, 2, 1, 2, 3};
+    unsigned int event_ids[] = {1, 3};
+    size_t num_seats[] = {2, 1};
+    failed = ems_create(1, 10, 10) || ems_create(2, 5, 20) || ems_create(3, 30, 3) || ems_create(4, 2, 2) ||
+             ems_reserve(1, 2, xs, ys) || ems_reserve(2, 3, xs + 2, ys + 2) || ems_reserve(4, 1, xs, ys) ||
+             ems_transaction(2, event_ids, num_seats, xs + 3, ys + 3) || ems_reserve_best(3, 3, 5, 0, NULL, NULL) ||
+             ems_cancel(1, 1) || ems_delete(4);
+    num_events = 3;
+  } else {
+    size_t xs[] = {5, 5, 5, 2}, ys[] = {5, 6, 7, 2};
+    failed = ems_create(5, 7, 9) || ems_reserve(1, 3, xs, ys) || ems_reserve(5, 1, xs + 3, ys + 3) ||
+             ems_reserve_best(2, 4, 0, 0, NULL, NULL) || ems_cancel(2, 1) || ems_create(4, 3, 3);
+    num_events = 5;
+  }
+
+  return ems_quit() != 0 || failed;
+}
+
+/// Prints the LIST and the SHOW of every event, in a session of its own, and reads back what was printed.
+/// @param size Set to the size of the output.
+/// @return Output, to be freed, NULL on failure.
+static char *capture(size_t *size) {
+  int out_fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (out_fd == -1 || ems_setup(req_path, resp_path, server_path, TRANSPORT_FIFO) != 0) {
+    if (out_fd != -1) close(out_fd);
+    return NULL;
+  }
+
+  int failed = ems_list_events(out_fd);
+  for (unsigned int event_id = 1; event_id <= num_events && !failed; event_id++) failed = ems_show(out_fd, event_id);
+  failed |= ems_quit() != 0;
+
+  char *output = NULL;
+  off_t end = lseek(out_fd, 0, SEEK_END);
+  if (!failed && end > 0 && (output = malloc((size_t)end)) != NULL) {
+    *size = (size_t)end;
+    if (lseek(out_fd, 0, SEEK_SET) == -1 || read_all(out_fd, output, *size) != 0) {
+      free(output);
+      output = NULL;
+    }
+  }
+
+  close(out_fd);
+  unlink(output_path);
+  return output;
+}
+
+/// Restarts the server and checks that it prints the same as before.
+/// @param name Name of the case.
+/// @param expected Output before the restart.
+/// @param expected_size Size of expected.
+/// @param quiet Whether the server is expected to complain on stderr.
+/// @return 0 if the output matches, 1 otherwise.
+static int check_restart(const char *name, const char *expected, size_t expected_size, int quiet) {
+  if (start_server(quiet) != 0) {
+    fprintf(stderr, "FAIL: %s, the server did not restart\n", name);
+    return 1;
+  }
+
+  size_t size = 0;
+  char *output = capture(&size);
+  int failed = output == NULL || size != expected_size || memcmp(output, expected, size) != 0;
+  if (failed) fprintf(stderr, "FAIL: %s, SHOW and LIST differ after the restart\n", name);
+  free(output);
+  return failed;
+}
+
+/// Gets the size of a file, 0 if it is missing.
+static off_t file_size(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+/// Writes a whole file.
+/// @return 0 if the file was written successfully, 1 otherwise.
+static int write_file(const char *path, const char *data, size_t size) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd == -1) return 1;
+  int failed = write_all(fd, data, size) != 0;
+  return close(fd) != 0 || failed;
+}
+
+/// Checks that the server refuses each corruption of a valid checkpoint, and still starts from the valid one.
+/// @param expected Output the valid checkpoint restores.
+/// @param expected_size Size of expected.
+/// @return 0 if every corruption was rejected, 1 otherwise.
+static int check_corrupt_checkpoints(const char *expected, size_t expected_size) {
+  size_t size = (size_t)file_size(checkpoint_path);
+  char *valid = malloc(size), *corrupt = malloc(size);
+  int fd = open(checkpoint_path, O_RDONLY);
+  int failed = valid == NULL || corrupt == NULL || size < sizeof(struct CheckpointHeader) || fd == -1 ||
+               read_all(fd, valid, size) != 0;
+  if (fd != -1) close(fd);
+  if (failed) {
+    fprintf(stderr, "FAIL: the checkpoint could not be read\n");
+    free(valid);
+    free(corrupt);
+    return 1;
+  }
+
+  struct CheckpointHeader header;
+  memcpy(&header, valid, sizeof(header));
+  struct CheckpointEvent first;
+  if (header.num_events == 0 || header.table_offset + sizeof(first) > size) {
+    fprintf(stderr, "FAIL: the checkpoint has no event table\n");
+    free(valid);
+    free(corrupt);
+    return 1;
+  }
+
+  const char *names[] = {"bad magic", "truncated event table", "seat block past the table",
+                         "rows times cols wrapping around"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]) && !failed; i++) {
+    size_t corrupt_size = size;
+    memcpy(corrupt, valid, size);
+    memcpy(&first, corrupt + header.table_offset, sizeof(first));
+
+    if (i == 0) {
+      corrupt[0] ^= 0x20;
+    } else if (i == 1) {
+      corrupt_size -= sizeof(uint64_t);
+    } else if (i == 2) {
+      first.block_offset = header.table_offset;
+    } else {
+      first.rows = 64;
+      first.cols = (uint64_t)1 << 58;
+    }
+    memcpy(corrupt + header.table_offset, &first, sizeof(first));
+
+    if (write_file(checkpoint_path, corrupt, corrupt_size) != 0) {
+      fprintf(stderr, "FAIL: the checkpoint could not be written\n");
+      failed = 1;
+    } else if (start_server(1) == 0) {
+      fprintf(stderr, "FAIL: a checkpoint with %s was restored\n", names[i]);
+      stop_server(SIGKILL);
+      failed = 1;
+    } else if (server_pid != -1) {
+      fprintf(stderr, "FAIL: a checkpoint with %s left the server hanging\n", names[i]);
+      stop_server(SIGKILL);
+      failed = 1;
+    }
+  }
+
+  if (!failed && write_file(checkpoint_path, valid, size) != 0) failed = 1;
+  if (!failed) {
+    failed = check_restart("valid checkpoint written back", expected, expected_size, 0);
+    if (server_pid != -1) stop_server(SIGTERM);
+  }
+
+  free(valid);
+  free(corrupt);
+  return failed;
+}
+
+int main(void) {
+  snprintf(server_path, sizeof(server_path), "/tmp/ems-test-%d", getpid());
+  snprintf(req_path, sizeof(req_path), "/tmp/ems-recovery-req-%d", getpid());
+  snprintf(resp_path, sizeof(resp_path), "/tmp/ems-recovery-resp-%d", getpid());
+  snprintf(wal_path, sizeof(wal_path), "/tmp/ems-recovery-%d.wal", getpid());
+  snprintf(checkpoint_path, sizeof(checkpoint_path), "/tmp/ems-recovery-%d.ckpt", getpid());
+  snprintf(output_path, sizeof(output_path), "/tmp/ems-recovery-%d.out", getpid());
+
+  // The client API reports every request on stdout, only the outcome of the test is printed
+  int report_fd = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (report_fd == -1 || null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1) {
+    perror("Error redirecting stdout");
+    return 1;
+  }
+  close(null_fd);
+
+  signal(SIGALRM, on_deadline);
+  alarm(TEST_DEADLINE_S);
+
+  size_t size = 0;
+  char *before = NULL;
+  int failed = start_server(0) != 0 || make_changes(0) != 0 || (before = capture(&size)) == NULL;
+  if (failed) fprintf(stderr, "FAIL: the first changes were not made\n");
+
+  // SIGTERM writes a checkpoint covering the whole log
+  if (!failed) {
+    stop_server(SIGTERM);
+    failed = check_restart("SIGTERM", before, size, 0);
+  }
+
+  // SIGKILL leaves the second changes only in the log, replayed on top of the checkpoint
+  if (!failed) {
+    free(before);
+    before = NULL;
+    failed = make_changes(1) != 0 || (before = capture(&size)) == NULL;
+    if (failed) fprintf(stderr, "FAIL: the second changes were not made\n");
+  }
+  if (!failed) {
+    stop_server(SIGKILL);
+    failed = check_restart("SIGKILL", before, size, 0);
+  }
+
+  // A record cut short by a crash is dropped, and the log truncated back to the records before it
+  off_t log_size = file_size(wal_path);
+  if (!failed) {
+    stop_server(SIGKILL);
+    char torn[16] = {64};
+    int fd = open(wal_path, O_WRONLY | O_APPEND);
+    failed = fd == -1 || write_all(fd, torn, sizeof(torn)) != 0;
+    if (fd != -1) close(fd);
+    failed = failed || check_restart("torn log record", before, size, 1);
+    if (!failed && file_size(wal_path) != log_size) {
+      fprintf(stderr, "FAIL: the torn log record was not truncated\n");
+      failed = 1;
+    }
+  }
+
+  if (!failed) {
+    stop_server(SIGTERM);
+    failed = check_corrupt_checkpoints(before, size);
+  }
+  alarm(0);
+
+  if (server_pid != -1) stop_server(SIGKILL);
+  free(before);
+  unlink(wal_path);
+  unlink(checkpoint_path);
+
+  if (!failed) dprintf(report_fd, "PASS: recovery, SIGTERM, SIGKILL, torn log and corrupt checkpoints\n");
+  return failed;
+}
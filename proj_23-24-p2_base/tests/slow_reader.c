@@ -0,0 +1,219 @@
+// Test of event-loop mode with a client that never reads its responses: it asks for SHOWs of a large event until
+// the server holds as many responses for it as it will, while other clients keep creating, reserving and showing
+// events of their own, which must all be answered before the deadline.
+// Usage: tests/slow_reader [fifo|socket] [loops]
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client/api.h"
+#include "common/io.h"
+
+#define TEST_DEADLINE_S 10  // Time the other clients have to finish
+#define SLOW_ROWS 200       // Rows of the event the slow client shows, 160 KB a SHOW, which a socket message fits
+#define SLOW_COLS 200
+#define SLOW_SHOWS 64    // SHOWs the slow client sends and never reads
+#define FAST_CLIENTS 4   // Clients that keep reading
+#define FAST_ROUNDS 20   // Reservations each of them makes and shows
+
+static char server_path[64];
+static int transport;
+static pid_t server_pid = -1;
+
+static void on_deadline(int signal) {
+  (void)signal;
+  const char message[] = "FAIL: the other clients were not answered in time\n";
+  if (write(STDERR_FILENO, message, sizeof(message) - 1) == -1) _exit(1);
+  if (server_pid != -1) kill(server_pid, SIGKILL);
+  _exit(1);
+}
+
+/// Sends a request frame the way the client API does, with the slow session as its sender.
+/// @return 0 if the frame was written successfully, 1 otherwise.
+static int send_frame(int fd, char op_code, int session_id, unsigned int request_id, const void *fields,
+                      size_t size) {
+  unsigned int request_size = (unsigned int)(sizeof(char) + sizeof(int) + sizeof(unsigned int) + size);
+  struct iovec parts[5] = {{&request_size, sizeof(unsigned int)},
+                           {&op_code, sizeof(char)},
+                           {&session_id, sizeof(int)},
+                           {&request_id, sizeof(unsigned int)},
+                           {(void *)fields, size}};
+  return writev_all(fd, parts, 5);
+}
+
+/// Connects the slow client, creates its event and sends its SHOWs, leaving every response unread.
+/// @param req_fd Set to the file descriptor requests are sent over.
+/// @param resp_fd Set to the file descriptor responses would be read from.
+/// @return 0 if the requests were sent successfully, 1 otherwise.
+static int start_slow_client(int *req_fd, int *resp_fd) {
+  *req_fd = *resp_fd = -1;
+
+  if (transport == TRANSPORT_SOCKET) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    strcpy(address.sun_path, server_path);
+    *req_fd = *resp_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (*req_fd == -1 || connect(*req_fd, (struct sockaddr *)&address, sizeof(address)) == -1) return 1;
+  } else {
+    char registration[1 + 2 * MAX_PIPE_NAME] = {'1'};
+    snprintf(registration + 1, MAX_PIPE_NAME, "/tmp/ems-slow-req-%d", getpid());
+    snprintf(registration + 1 + MAX_PIPE_NAME, MAX_PIPE_NAME, "/tmp/ems-slow-resp-%d", getpid());
+    unlink(registration + 1);
+    unlink(registration + 1 + MAX_PIPE_NAME);
+    if (mkfifo(registration + 1, 0777) == -1 || mkfifo(registration + 1 + MAX_PIPE_NAME, 0777) == -1) return 1;
+
+    int server_pipe = open(server_path, O_WRONLY);
+    if (server_pipe == -1) return 1;
+    int failed = write_all(server_pipe, registration, sizeof(registration));
+    close(server_pipe);
+
+    if (failed || (*req_fd = open(registration + 1, O_WRONLY)) == -1 ||
+        (*resp_fd = open(registration + 1 + MAX_PIPE_NAME, O_RDONLY)) == -1) {
+      return 1;
+    }
+    unlink(registration + 1);
+    unlink(registration + 1 + MAX_PIPE_NAME);
+  }
+
+  int session_id;
+  if (read_all(*resp_fd, &session_id, sizeof(int)) != 0) return 1;
+
+  char create[sizeof(unsigned int) + 2 * sizeof(size_t)];
+  unsigned int event_id = 1;
+  size_t rows = SLOW_ROWS, cols = SLOW_COLS;
+  memcpy(create, &event_id, sizeof(unsigned int));
+  memcpy(create + sizeof(unsigned int), &rows, sizeof(size_t));
+  memcpy(create + sizeof(unsigned int) + sizeof(size_t), &cols, sizeof(size_t));
+  if (send_frame(*req_fd, '3', session_id, 1, create, sizeof(create)) != 0) return 1;
+
+  // Only the raw encoding is accepted, so each response is as large as the seat map
+  char show[sizeof(unsigned int) + sizeof(unsigned char)];
+  unsigned char encodings = 1u << SHOW_ENCODING_RAW;
+  memcpy(show, &event_id, sizeof(unsigned int));
+  memcpy(show + sizeof(unsigned int), &encodings, sizeof(unsigned char));
+  for (unsigned int i = 0; i < SLOW_SHOWS; i++) {
+    if (send_frame(*req_fd, '5', session_id, 2 + i, show, sizeof(show)) != 0) return 1;
+  }
+
+  return 0;
+}
+
+/// Runs a client that reads its responses, on an event of its own.
+/// @param arg Index of the client.
+/// @return NULL if every request was answered successfully, non-NULL otherwise.
+static void *fast_client(void *arg) {
+  size_t index = (size_t)arg;
+  unsigned int event_id = 2 + (unsigned int)index;
+  char req_path[MAX_PIPE_NAME], resp_path[MAX_PIPE_NAME];
+  snprintf(req_path, sizeof(req_path), "/tmp/ems-fast-req-%d-%zu", getpid(), index);
+  snprintf(resp_path, sizeof(resp_path), "/tmp/ems-fast-resp-%d-%zu", getpid(), index);
+
+  int out_fd = open("/dev/null", O_WRONLY);
+  int failed = out_fd == -1 || ems_setup(req_path, resp_path, server_path, transport) != 0;
+  if (!failed) {
+    failed = ems_create(event_id, FAST_ROUNDS, FAST_ROUNDS) != 0;
+    for (size_t i = 1; i <= FAST_ROUNDS && !failed; i++) {
+      failed = ems_reserve(event_id, 1, &i, &i) != 0 || ems_show(out_fd, event_id) != 0;
+    }
+    failed |= ems_quit() != 0;
+  }
+
+  if (out_fd != -1) close(out_fd);
+  unlink(req_path);
+  unlink(resp_path);
+  return failed ? (void *)1 : NULL;
+}
+
+/// Starts the server in event-loop mode and waits for its pipe or socket to appear.
+/// @return 0 if the server was started successfully, 1 otherwise.
+static int start_server(const char *transport_name, const char *loops) {
+  unlink(server_path);
+  server_pid = fork();
+  if (server_pid == -1) return 1;
+
+  if (server_pid == 0) {
+    execl("server/ems", "ems", "-e", loops, "-t", transport_name, server_path, "0", (char *)NULL);
+    perror("Error starting server/ems");
+    _exit(1);
+  }
+
+  struct timespec pause = {0, 10 * 1000 * 1000};
+  for (int i = 0; i < 500; i++) {
+    if (access(server_path, F_OK) == 0) return 0;
+    nanosleep(&pause, NULL);
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  const char *transport_name = argc > 1 ? argv[1] : "fifo";
+  const char *loops = argc > 2 ? argv[2] : "1";
+  if (strcmp(transport_name, "fifo") != 0 && strcmp(transport_name, "socket") != 0) {
+    fprintf(stderr, "Usage: %s [fifo|socket] [loops]\n", argv[0]);
+    return 1;
+  }
+  transport = strcmp(transport_name, "socket") == 0 ? TRANSPORT_SOCKET : TRANSPORT_FIFO;
+  snprintf(server_path, sizeof(server_path), "/tmp/ems-test-%d", getpid());
+
+  // The client API reports every request on stdout, only the outcome of the test is printed
+  int report_fd = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (report_fd == -1 || null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1) {
+    perror("Error redirecting stdout");
+    return 1;
+  }
+  close(null_fd);
+
+  signal(SIGALRM, on_deadline);
+  alarm(TEST_DEADLINE_S);
+
+  if (start_server(transport_name, loops) != 0) {
+    fprintf(stderr, "FAIL: the server did not start\n");
+    if (server_pid > 0) kill(server_pid, SIGKILL);
+    return 1;
+  }
+
+  int slow_req, slow_resp;
+  int failed = start_slow_client(&slow_req, &slow_resp);
+  if (failed) fprintf(stderr, "FAIL: the slow client could not send its requests\n");
+
+  // Gives the server time to fill the response pipe or socket of the slow client
+  struct timespec pause = {0, 200 * 1000 * 1000};
+  nanosleep(&pause, NULL);
+
+  pthread_t threads[FAST_CLIENTS];
+  size_t started = 0;
+  for (; started < FAST_CLIENTS && !failed; started++) {
+    failed = pthread_create(&threads[started], NULL, fast_client, (void *)started) != 0;
+  }
+  for (size_t i = 0; i < started; i++) {
+    void *result;
+    pthread_join(threads[i], &result);
+    if (result != NULL) {
+      fprintf(stderr, "FAIL: client %zu was not answered\n", i);
+      failed = 1;
+    }
+  }
+  alarm(0);
+
+  kill(server_pid, SIGTERM);
+  waitpid(server_pid, NULL, 0);
+  if (slow_req != -1) close(slow_req);
+  if (slow_resp != -1 && slow_resp != slow_req) close(slow_resp);
+  unlink(server_path);
+
+  if (!failed) {
+    dprintf(report_fd, "PASS: slow_reader %s, %d clients answered while one never read\n", transport_name,
+            FAST_CLIENTS);
+  }
+  return failed;
+}